@@ -3,12 +3,68 @@
 # ----------------------------------------------------------------------------
 #  Build and Run script (bnr.sh)
 # ----------------------------------------------------------------------------
+#  0) Fuzz the kernel library routines on the host (scripts/libtest.sh).
 #  1) Assemble the boot, loader, and kernel code into bin files.
 #  2) Create a blank 1.44MB disk image (boot.img).
 #  3) Write the boot/loader/kernel binaries into the disk image.
 #  4) Launch QEMU with the disk image.
+#
+#  Usage: scripts/bnr.sh [--headless] [--tcg] [--irqbench] [--schedbench]
+#                        [--profile] [--debug]
+#    --headless  Run QEMU without a display and connect COM1 to stdio. The
+#                serial output is also saved to build/serial.log so it can
+#                be diffed between runs. Ctrl-C stops QEMU.
+#    --tcg       Use QEMU's software emulation instead of KVM.
+#    --irqbench  Build a kernel that runs the interrupt latency benchmark
+#                at boot and powers QEMU off afterwards (implies
+#                --headless). See scripts/irqbench.sh.
+#    --schedbench  Same for the thread switch latency and throughput
+#                  benchmark (src/kernel/schedbench.h).
+#    --profile   Sample every CPU with the profiler (src/kernel/profile.h)
+#                through the benchmark given with it, or for a while of
+#                idling without one, dump the samples on COM1 and power
+#                QEMU off (implies --headless). Then run tools/profile on
+#                build/kernel.elf and build/serial.log.
+#    --debug     Build with lock statistics (LOCK_STATS), printed at the
+#                end of boot.
 # ----------------------------------------------------------------------------
 
+HEADLESS=0
+ACCEL="kvm"
+IRQBENCH=0
+SCHEDBENCH=0
+PROFILE=0
+DEBUG=0
+for arg in "$@"; do
+    case "$arg" in
+        --headless) HEADLESS=1 ;;
+        --tcg)      ACCEL="tcg" ;;
+        --irqbench) IRQBENCH=1; HEADLESS=1 ;;
+        --schedbench) SCHEDBENCH=1; HEADLESS=1 ;;
+        --profile)  PROFILE=1; HEADLESS=1 ;;
+        --debug)    DEBUG=1 ;;
+        *)          echo "Unknown option: $arg" >&2; exit 1 ;;
+    esac
+done
+
+# Extra defines for main.c (what KMain runs)
+MAIN_DEFINES=""
+if [ "$IRQBENCH" -eq 1 ]; then
+    MAIN_DEFINES="-DIRQBENCH"
+fi
+if [ "$SCHEDBENCH" -eq 1 ]; then
+    MAIN_DEFINES="$MAIN_DEFINES -DSCHEDBENCH"
+fi
+if [ "$PROFILE" -eq 1 ]; then
+    MAIN_DEFINES="$MAIN_DEFINES -DPROFILE"
+fi
+
+# Extra defines for every C file (lock structures change size with them)
+DEBUG_DEFINES=""
+if [ "$DEBUG" -eq 1 ]; then
+    DEBUG_DEFINES="-DLOCK_STATS"
+fi
+
 # Directories
 BUILD_DIR="build"
 SRC_DIR="src"
@@ -19,6 +75,7 @@ BOOT_SRC="$SRC_DIR/boot/boot.asm"
 LOADER_SRC="$SRC_DIR/loader/loader.asm"
 KERNEL_ASM_SRC="$SRC_DIR/kernel/kernel.asm"
 TRAP_ASM_SRC="$SRC_DIR/kernel/trap.asm"
+SMP_ASM_SRC="$SRC_DIR/kernel/smp.asm"
 LIB_ASM_SRC="$SRC_DIR/lib/lib.asm"
 
 MAIN_C_SRC="$SRC_DIR/kernel/main.c"
@@ -26,6 +83,29 @@ TRAP_C_SRC="$SRC_DIR/kernel/trap.c"
 LIB_C_SRC="$SRC_DIR/lib/lib.c"
 PRINT_C_SRC="$SRC_DIR/lib/print.c"
 DEBUG_C_SRC="$SRC_DIR/lib/debug.c"
+CPU_C_SRC="$SRC_DIR/kernel/cpu.c"
+LOG_C_SRC="$SRC_DIR/lib/log.c"
+CONSOLE_C_SRC="$SRC_DIR/lib/console.c"
+SERIAL_C_SRC="$SRC_DIR/lib/serial.c"
+TRACE_C_SRC="$SRC_DIR/kernel/trace.c"
+PROFILE_C_SRC="$SRC_DIR/kernel/profile.c"
+APIC_C_SRC="$SRC_DIR/kernel/apic.c"
+TIME_C_SRC="$SRC_DIR/kernel/time.c"
+TIMER_C_SRC="$SRC_DIR/kernel/timer.c"
+IRQBENCH_C_SRC="$SRC_DIR/kernel/irqbench.c"
+BENCH_C_SRC="$SRC_DIR/kernel/bench.c"
+HISTOGRAM_C_SRC="$SRC_DIR/lib/histogram.c"
+MEMMAP_C_SRC="$SRC_DIR/kernel/memmap.c"
+PAGE_ALLOC_C_SRC="$SRC_DIR/kernel/page_alloc.c"
+SLAB_C_SRC="$SRC_DIR/kernel/slab.c"
+PAGING_C_SRC="$SRC_DIR/kernel/paging.c"
+VM_C_SRC="$SRC_DIR/kernel/vm.c"
+SMP_C_SRC="$SRC_DIR/kernel/smp.c"
+SCHED_C_SRC="$SRC_DIR/kernel/sched.c"
+SCHEDBENCH_C_SRC="$SRC_DIR/kernel/schedbench.c"
+SPINLOCK_C_SRC="$SRC_DIR/lib/spinlock.c"
+SOFTIRQ_C_SRC="$SRC_DIR/kernel/softirq.c"
+FPU_C_SRC="$SRC_DIR/kernel/fpu.c"
 
 # Output files
 BOOT_BIN="$BUILD_DIR/boot.bin"
@@ -33,6 +113,7 @@ LOADER_BIN="$BUILD_DIR/loader.bin"
 
 KERNEL_ASM_OBJ="$BUILD_DIR/kernel_asm.o"
 TRAP_ASM_OBJ="$BUILD_DIR/trap_asm.o"
+SMP_ASM_OBJ="$BUILD_DIR/smp_asm.o"
 LIB_ASM_OBJ="$BUILD_DIR/lib_asm.o"
 
 MAIN_C_OBJ="$BUILD_DIR/main.o"
@@ -40,12 +121,43 @@ TRAP_C_OBJ="$BUILD_DIR/trap.o"
 LIB_C_OBJ="$BUILD_DIR/lib.o"
 PRINT_C_OBJ="$BUILD_DIR/print.o"
 DEBUG_C_OBJ="$BUILD_DIR/debug.o"
+CPU_C_OBJ="$BUILD_DIR/cpu.o"
+LOG_C_OBJ="$BUILD_DIR/log.o"
+CONSOLE_C_OBJ="$BUILD_DIR/console.o"
+SERIAL_C_OBJ="$BUILD_DIR/serial.o"
+TRACE_C_OBJ="$BUILD_DIR/trace.o"
+PROFILE_C_OBJ="$BUILD_DIR/profile.o"
+APIC_C_OBJ="$BUILD_DIR/apic.o"
+TIME_C_OBJ="$BUILD_DIR/time.o"
+TIMER_C_OBJ="$BUILD_DIR/timer.o"
+IRQBENCH_C_OBJ="$BUILD_DIR/irqbench.o"
+BENCH_C_OBJ="$BUILD_DIR/bench.o"
+HISTOGRAM_C_OBJ="$BUILD_DIR/histogram.o"
+MEMMAP_C_OBJ="$BUILD_DIR/memmap.o"
+PAGE_ALLOC_C_OBJ="$BUILD_DIR/page_alloc.o"
+SLAB_C_OBJ="$BUILD_DIR/slab.o"
+PAGING_C_OBJ="$BUILD_DIR/paging.o"
+VM_C_OBJ="$BUILD_DIR/vm.o"
+SMP_C_OBJ="$BUILD_DIR/smp.o"
+SCHED_C_OBJ="$BUILD_DIR/sched.o"
+SCHEDBENCH_C_OBJ="$BUILD_DIR/schedbench.o"
+SPINLOCK_C_OBJ="$BUILD_DIR/spinlock.o"
+SOFTIRQ_C_OBJ="$BUILD_DIR/softirq.o"
+FPU_C_OBJ="$BUILD_DIR/fpu.o"
 
 KERNEL_ELF="$BUILD_DIR/kernel.elf"
 KERNEL_BIN="$BUILD_DIR/kernel.bin"
+SERIAL_LOG="$BUILD_DIR/serial.log"
 
 DISK_IMG="$BUILD_DIR/boot.img"
 
+# 0) Catch broken library routines before building an image
+echo -e "\e[1;3;34mChecking library routines on the host:\e[0m"
+scripts/libtest.sh --fuzz > "$BUILD_DIR/libtest.jsonl" || {
+    echo -e "\e[31mlibtest failed, see $BUILD_DIR/libtest.jsonl\e[0m"
+    exit 1
+}
+
 # 1) Assemble/compile all components
 mkdir -p "$BUILD_DIR"
 
@@ -63,6 +175,9 @@ nasm -f elf64 -o "$KERNEL_ASM_OBJ" "$KERNEL_ASM_SRC"
 echo -e "\e[36mCompiling trap assembly (trap.asm) to 64-bit object...\e[0m"
 nasm -f elf64 -o "$TRAP_ASM_OBJ" "$TRAP_ASM_SRC"
 
+echo -e "\e[36mCompiling AP trampoline (smp.asm) to 64-bit object...\e[0m"
+nasm -f elf64 -o "$SMP_ASM_OBJ" "$SMP_ASM_SRC"
+
 echo -e "\e[36mCompiling lib assembly (lib.asm) to 64-bit object...\e[0m"
 nasm -f elf64 -o "$LIB_ASM_OBJ" "$LIB_ASM_SRC"
 
@@ -73,31 +188,225 @@ echo -e "\e[33mCompiling main.c to 64-bit object...\e[0m"
 # -ffreestanding : no standard lib assumptions
 # -fno-stack-protector, -mno-red-zone : typical for kernel
 # -m64 : ensures 64-bit code generation
-gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -c "$MAIN_C_SRC" -o "$MAIN_C_OBJ"
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES $MAIN_DEFINES -c "$MAIN_C_SRC" -o "$MAIN_C_OBJ"
 
 echo -e "\e[33mCompiling trap.c to 64-bit object...\e[0m"
 # -ffreestanding : no standard lib assumptions
 # -fno-stack-protector, -mno-red-zone : typical for kernel
 # -m64 : ensures 64-bit code generation
-gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -c "$TRAP_C_SRC" -o "$TRAP_C_OBJ"
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$TRAP_C_SRC" -o "$TRAP_C_OBJ"
 
 echo -e "\e[33mCompiling lib.c to 64-bit object...\e[0m"
 # -ffreestanding : no standard lib assumptions
 # -fno-stack-protector, -mno-red-zone : typical for kernel
 # -m64 : ensures 64-bit code generation
-gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -c "$LIB_C_SRC" -o "$LIB_C_OBJ"
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$LIB_C_SRC" -o "$LIB_C_OBJ"
 
 echo -e "\e[33mCompiling print.c to 64-bit object...\e[0m"
 # -ffreestanding : no standard lib assumptions
 # -fno-stack-protector, -mno-red-zone : typical for kernel
 # -m64 : ensures 64-bit code generation
-gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -c "$PRINT_C_SRC" -o "$PRINT_C_OBJ"
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$PRINT_C_SRC" -o "$PRINT_C_OBJ"
 
 echo -e "\e[33mCompiling debug.c to 64-bit object...\e[0m"
 # -ffreestanding : no standard lib assumptions
 # -fno-stack-protector, -mno-red-zone : typical for kernel
 # -m64 : ensures 64-bit code generation
-gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -c "$DEBUG_C_SRC" -o "$DEBUG_C_OBJ"
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$DEBUG_C_SRC" -o "$DEBUG_C_OBJ"
+
+echo -e "\e[33mCompiling cpu.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$CPU_C_SRC" -o "$CPU_C_OBJ"
+
+echo -e "\e[33mCompiling log.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$LOG_C_SRC" -o "$LOG_C_OBJ"
+
+echo -e "\e[33mCompiling console.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$CONSOLE_C_SRC" -o "$CONSOLE_C_OBJ"
+
+echo -e "\e[33mCompiling serial.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SERIAL_C_SRC" -o "$SERIAL_C_OBJ"
+
+echo -e "\e[33mCompiling trace.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$TRACE_C_SRC" -o "$TRACE_C_OBJ"
+
+echo -e "\e[33mCompiling profile.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$PROFILE_C_SRC" -o "$PROFILE_C_OBJ"
+
+echo -e "\e[33mCompiling apic.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$APIC_C_SRC" -o "$APIC_C_OBJ"
+
+echo -e "\e[33mCompiling time.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$TIME_C_SRC" -o "$TIME_C_OBJ"
+
+echo -e "\e[33mCompiling timer.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$TIMER_C_SRC" -o "$TIMER_C_OBJ"
+
+echo -e "\e[33mCompiling irqbench.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$IRQBENCH_C_SRC" -o "$IRQBENCH_C_OBJ"
+
+echo -e "\e[33mCompiling bench.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$BENCH_C_SRC" -o "$BENCH_C_OBJ"
+
+echo -e "\e[33mCompiling histogram.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$HISTOGRAM_C_SRC" -o "$HISTOGRAM_C_OBJ"
+
+echo -e "\e[33mCompiling memmap.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$MEMMAP_C_SRC" -o "$MEMMAP_C_OBJ"
+
+echo -e "\e[33mCompiling page_alloc.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$PAGE_ALLOC_C_SRC" -o "$PAGE_ALLOC_C_OBJ"
+
+echo -e "\e[33mCompiling slab.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SLAB_C_SRC" -o "$SLAB_C_OBJ"
+
+echo -e "\e[33mCompiling paging.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$PAGING_C_SRC" -o "$PAGING_C_OBJ"
+
+echo -e "\e[33mCompiling vm.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$VM_C_SRC" -o "$VM_C_OBJ"
+
+echo -e "\e[33mCompiling smp.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SMP_C_SRC" -o "$SMP_C_OBJ"
+
+echo -e "\e[33mCompiling sched.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SCHED_C_SRC" -o "$SCHED_C_OBJ"
+
+echo -e "\e[33mCompiling schedbench.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SCHEDBENCH_C_SRC" -o "$SCHEDBENCH_C_OBJ"
+
+echo -e "\e[33mCompiling spinlock.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SPINLOCK_C_SRC" -o "$SPINLOCK_C_OBJ"
+
+echo -e "\e[33mCompiling softirq.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$SOFTIRQ_C_SRC" -o "$SOFTIRQ_C_OBJ"
+
+echo -e "\e[33mCompiling fpu.c to 64-bit object...\e[0m"
+# -ffreestanding : no standard lib assumptions
+# -fno-stack-protector, -mno-red-zone : typical for kernel
+# -m64 : ensures 64-bit code generation
+# -mgeneral-regs-only : no compiler-generated FPU/SIMD code (see fpu.c)
+# -Wformat : checks printk-style format strings against their arguments
+gcc -std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat $DEBUG_DEFINES -c "$FPU_C_SRC" -o "$FPU_C_OBJ"
 
 echo
 echo -e "\e[1;3;38;2;150;50;150mHandling kernel.elf:\e[0m"
@@ -111,10 +420,34 @@ ld -nostdlib -z max-page-size=0x1000 -T "$LINKER_SCRIPT" -o "$KERNEL_ELF" \
    "$MAIN_C_OBJ" \
    "$TRAP_ASM_OBJ" \
    "$TRAP_C_OBJ"  \
+   "$SMP_ASM_OBJ" \
    "$LIB_ASM_OBJ" \
    "$LIB_C_OBJ" \
    "$PRINT_C_OBJ" \
-   "$DEBUG_C_OBJ"
+   "$DEBUG_C_OBJ" \
+   "$CPU_C_OBJ" \
+   "$LOG_C_OBJ" \
+   "$CONSOLE_C_OBJ" \
+   "$SERIAL_C_OBJ" \
+   "$TRACE_C_OBJ" \
+   "$PROFILE_C_OBJ" \
+   "$APIC_C_OBJ" \
+   "$TIME_C_OBJ" \
+   "$TIMER_C_OBJ" \
+   "$IRQBENCH_C_OBJ" \
+   "$BENCH_C_OBJ" \
+   "$HISTOGRAM_C_OBJ" \
+   "$MEMMAP_C_OBJ" \
+   "$PAGE_ALLOC_C_OBJ" \
+   "$SLAB_C_OBJ" \
+   "$PAGING_C_OBJ" \
+   "$VM_C_OBJ" \
+   "$SMP_C_OBJ" \
+   "$SCHED_C_OBJ" \
+   "$SCHEDBENCH_C_OBJ" \
+   "$SPINLOCK_C_OBJ" \
+   "$SOFTIRQ_C_OBJ" \
+   "$FPU_C_OBJ"
 
 echo -e "\e[1;3;38;2;180;60;180mConverting kernel.elf => kernel.bin (raw binary)...\e[0m"
 objcopy -O binary "$KERNEL_ELF" "$KERNEL_BIN"
@@ -134,23 +467,46 @@ dd if="$BOOT_BIN" of="$DISK_IMG" bs=512 count=1 conv=notrunc 2>/dev/null
 echo -e "\e[38;2;180;170;60mWriting loader (loader.bin) starting at sector 1...\e[0m"
 dd if="$LOADER_BIN" of="$DISK_IMG" bs=512 count=5 seek=1 conv=notrunc 2>/dev/null
 
-# Write kernel after loader
+# Write kernel after loader, whole: the loader takes its size from the
+# kernel header. A larger kernel grows the image (sync pads the last sector)
 echo -e "\e[38;2;180;170;60mWriting kernel (kernel.bin) starting at sector 6...\e[0m"
-dd if="$KERNEL_BIN" of="$DISK_IMG" bs=512 count=100 seek=6 conv=notrunc 2>/dev/null
+dd if="$KERNEL_BIN" of="$DISK_IMG" bs=512 seek=6 conv=notrunc,sync 2>/dev/null
 
 # 4) Run the disk image in QEMU
 echo
 echo -e "\e[1;3;38;2;40;200;100mLaunching QEMU with $DISK_IMG...\e[0m"
-qemu-system-x86_64 \
-  -m 1024 \
-  -drive format=raw,file="$DISK_IMG",if=ide,index=0 \
-  -boot c \
-  -enable-kvm \
-  -cpu host \
-  -smp 1 \
-  -vga std \
-  -rtc base=localtime \
-  -no-reboot \
-  -serial null \
-  -parallel none \
-  -monitor stdio
+QEMU_ARGS=(
+  -m 1024
+  -drive format=raw,file="$DISK_IMG",if=ide,index=0
+  -boot c
+  -smp 4
+  -rtc base=localtime
+  -no-reboot
+  -parallel none
+)
+
+if [ "$ACCEL" == "kvm" ]; then
+  QEMU_ARGS+=(-enable-kvm -cpu host)
+else
+  QEMU_ARGS+=(-accel tcg -cpu max)
+fi
+
+if [ "$IRQBENCH" -eq 1 ] || [ "$SCHEDBENCH" -eq 1 ] || [ "$PROFILE" -eq 1 ]; then
+  # Lets the kernel power QEMU off when the benchmark or profile is done
+  QEMU_ARGS+=(-device isa-debug-exit,iobase=0xf4,iosize=0x04)
+fi
+
+if [ "$HEADLESS" -eq 1 ]; then
+  # Kernel log on stdout (via COM1) and in $SERIAL_LOG
+  qemu-system-x86_64 "${QEMU_ARGS[@]}" \
+    -display none \
+    -vga std \
+    -chardev stdio,id=com1,signal=on,logfile="$SERIAL_LOG" \
+    -serial chardev:com1 \
+    -monitor none
+else
+  qemu-system-x86_64 "${QEMU_ARGS[@]}" \
+    -vga std \
+    -serial file:"$SERIAL_LOG" \
+    -monitor stdio
+fi
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+# ----------------------------------------------------------------------------
+#  Interrupt latency benchmark script (irqbench.sh)
+# ----------------------------------------------------------------------------
+#  1) Build and boot a benchmark kernel headless (scripts/bnr.sh --irqbench).
+#     It measures interrupt entry and return latency, prints the results on
+#     COM1 and powers QEMU off.
+#  2) Copy the result block from build/serial.log to build/irqbench.txt.
+#  3) With --baseline, compare every p50/p99/p999 against a previous
+#     irqbench.txt and flag the ones more than 10% (and 100 ns) slower.
+#
+#  Usage: scripts/irqbench.sh [--tcg] [--baseline FILE]
+#  The exit status is non-zero if the benchmark produced no results or a
+#  percentile regressed. Keep baselines per accelerator and host: TCG and
+#  KVM numbers differ by an order of magnitude.
+# ----------------------------------------------------------------------------
+
+BUILD_DIR="build"
+SERIAL_LOG="$BUILD_DIR/serial.log"
+RESULTS="$BUILD_DIR/irqbench.txt"
+
+BNR_ARGS=(--irqbench)
+BASELINE=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --tcg)      BNR_ARGS+=(--tcg) ;;
+        --baseline) BASELINE="$2"; shift ;;
+        *)          echo "Unknown option: $1" >&2; exit 1 ;;
+    esac
+    shift
+done
+
+# 1) Run the benchmark kernel; QEMU exits through isa-debug-exit
+scripts/bnr.sh "${BNR_ARGS[@]}" < /dev/null > /dev/null
+
+# 2) Keep the last complete result block
+awk '/^# irqbench begin/ { block = ""; inside = 1 }
+     inside { block = block $0 "\n" }
+     /^# irqbench end/ && inside { last = block; inside = 0 }
+     END { printf "%s", last }' "$SERIAL_LOG" | tr -d '\r' > "$RESULTS"
+
+if [ ! -s "$RESULTS" ]; then
+    echo -e "\e[31mNo irqbench results in $SERIAL_LOG\e[0m" >&2
+    exit 1
+fi
+cat "$RESULTS"
+
+# 3) Compare with the baseline
+if [ -n "$BASELINE" ]; then
+    awk '
+        # key = "<source> <vector> <phase>"
+        FNR == NR && /^L / {
+            for (i = 5; i <= NF; i++) { split($i, kv, "="); base[$2 " " $3 " " $4, kv[1]] = kv[2] }
+            next
+        }
+        /^L / {
+            for (i = 5; i <= NF; i++) {
+                split($i, kv, "=")
+                if (kv[1] != "p50" && kv[1] != "p99" && kv[1] != "p999") continue
+                old = base[$2 " " $3 " " $4, kv[1]]
+                if (old == "") continue
+                if (kv[2] > old * 1.10 && kv[2] - old > 100) {
+                    printf "REGRESSION %s %s %s %s: %d ns -> %d ns\n", $2, $3, $4, kv[1], old, kv[2]
+                    bad = 1
+                }
+            }
+        }
+        END { exit bad }' "$BASELINE" "$RESULTS" || exit 1
+fi
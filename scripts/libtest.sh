@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# ----------------------------------------------------------------------------
+#  Library test script (libtest.sh)
+# ----------------------------------------------------------------------------
+#  1) Build lib.asm, lib.c, print.c, log.c and histogram.c with the same
+#     flags bnr.sh uses.
+#  2) Prefix every symbol in them with "k_" so they can be linked next to
+#     glibc.
+#  3) Build tools/libtest/libtest.c against those objects and run it.
+#
+#  Usage: scripts/libtest.sh [--fuzz] [--bench [--baseline FILE]]
+#  Results are written to stdout as JSON lines; the exit status is non-zero
+#  on any fuzz failure or benchmark regression.
+# ----------------------------------------------------------------------------
+
+# Directories
+BUILD_DIR="build/libtest"
+SRC_DIR="src"
+TOOL_DIR="tools/libtest"
+
+# Same code generation flags as the kernel build in bnr.sh
+KERNEL_CFLAGS="-std=c99 -m64 -ffreestanding -fno-stack-protector -mno-red-zone -mgeneral-regs-only -Wformat"
+
+mkdir -p "$BUILD_DIR"
+
+echo -e "\e[36mBuilding kernel library objects for the host...\e[0m" >&2
+# HOSTED: no per-CPU area (GS) to find the trap depth in
+nasm -f elf64 -DHOSTED -o "$BUILD_DIR/lib_asm.o" "$SRC_DIR/lib/lib.asm" || exit 1
+gcc $KERNEL_CFLAGS -c "$SRC_DIR/lib/lib.c" -o "$BUILD_DIR/lib.o" || exit 1
+gcc $KERNEL_CFLAGS -c "$SRC_DIR/lib/print.c" -o "$BUILD_DIR/print.o" || exit 1
+gcc $KERNEL_CFLAGS -c "$SRC_DIR/lib/log.c" -o "$BUILD_DIR/log.o" || exit 1
+gcc $KERNEL_CFLAGS -c "$SRC_DIR/lib/histogram.c" -o "$BUILD_DIR/histogram.o" || exit 1
+
+# Rename the kernel symbols (memcpy => k_memcpy, ...)
+objcopy --prefix-symbols=k_ "$BUILD_DIR/lib_asm.o" "$BUILD_DIR/k_lib_asm.o" || exit 1
+objcopy --prefix-symbols=k_ "$BUILD_DIR/lib.o" "$BUILD_DIR/k_lib.o" || exit 1
+objcopy --prefix-symbols=k_ "$BUILD_DIR/print.o" "$BUILD_DIR/k_print.o" || exit 1
+objcopy --prefix-symbols=k_ "$BUILD_DIR/log.o" "$BUILD_DIR/k_log.o" || exit 1
+objcopy --prefix-symbols=k_ "$BUILD_DIR/histogram.o" "$BUILD_DIR/k_histogram.o" || exit 1
+
+echo -e "\e[36mBuilding libtest...\e[0m" >&2
+gcc -O2 -no-pie -z noexecstack -o "$BUILD_DIR/libtest" "$TOOL_DIR/libtest.c" \
+    "$BUILD_DIR/k_lib_asm.o" \
+    "$BUILD_DIR/k_lib.o" \
+    "$BUILD_DIR/k_print.o" \
+    "$BUILD_DIR/k_log.o" \
+    "$BUILD_DIR/k_histogram.o" || exit 1
+
+"$BUILD_DIR/libtest" "$@"
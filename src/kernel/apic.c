@@ -0,0 +1,473 @@
+#include "apic.h"
+#include "trap.h"
+#include "../lib/io.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  apic.c
+// ----------------------------------------------------------------------------
+//  Local APIC and IOAPIC support.
+//
+//  The local APIC is used in x2APIC mode when the CPU supports it: every
+//  register is an MSR, and an EOI is a single WRMSR. Otherwise it is used
+//  through its MMIO page (xAPIC). eoi() in trap.asm is patched with the
+//  same preference (ALTERNATIVE), so it must stay in step with init_apic().
+//
+//  The 8259 stays programmed by kernel.asm but is masked once the APIC is
+//  up. Legacy IRQs go through the IOAPIC instead, keeping their vectors
+//  (32 + IRQ), so handlers registered with register_irq_handler() don't
+//  change. Wiring and CPU list come from the ACPI MADT.
+//
+//  The MMIO windows (0xFEC00000, 0xFEE00000) lie in the fourth gigabyte,
+//  which the direct map (paging.c) maps uncached.
+// ----------------------------------------------------------------------------
+
+#define MSR_APIC_BASE           0x1B
+#define APIC_BASE_ENABLE        (1 << 11)
+#define APIC_BASE_X2APIC        (1 << 10)
+#define APIC_BASE_ADDR_MASK     0xFFFFFF000ULL
+#define MSR_X2APIC_BASE         0x800
+
+#define SVR_ENABLE              (1 << 8)
+#define LVT_NMI                 (4 << 8)
+
+// IOAPIC registers
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WINDOW           0x10
+#define IOAPIC_REG_VERSION      0x01
+#define IOAPIC_REG_REDIR        0x10
+
+#define REDIR_POLARITY_LOW      (1 << 13)
+#define REDIR_LEVEL             (1 << 15)
+#define REDIR_MASKED            (1 << 16)
+
+// MPS INTI flags in MADT interrupt source overrides
+#define INTI_POLARITY_MASK      0x3
+#define INTI_POLARITY_LOW       0x3
+#define INTI_TRIGGER_MASK       0xC
+#define INTI_TRIGGER_LEVEL      0xC
+
+#define PIC1_DATA               0x21
+#define PIC2_DATA               0xA1
+
+#define IOAPIC_DEFAULT_BASE     0xFEC00000
+
+/**
+ * ACPI table header, common to the RSDT, XSDT and MADT.
+ */
+struct AcpiHeader {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+/**
+ * Root System Description Pointer (ACPI 2.0 layout).
+ */
+struct AcpiRsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+/**
+ * MADT entry types.
+ */
+enum {
+    MADT_LAPIC = 0,
+    MADT_IOAPIC = 1,
+    MADT_OVERRIDE = 2,
+    MADT_LAPIC_ADDRESS = 5,
+    MADT_X2APIC = 9,
+};
+
+struct ApicInfo apic_info;
+
+/**
+ * Address of the xAPIC EOI register, used by xapic_eoi (trap.asm).
+ * Initialized data, so it is valid before init_apic() runs.
+ */
+uint64_t lapic_eoi_register = LAPIC_DEFAULT_BASE + LAPIC_EOI;
+
+// ----------------------------------------------------------------------------
+//  ACPI
+// ----------------------------------------------------------------------------
+
+/**
+ * Only tables in the identity-mapped first gigabyte can be read.
+ */
+static int acpi_mapped(uint64_t address, uint64_t length) {
+    return address + length <= 0x40000000ULL;
+}
+
+static int acpi_checksum(const void *table, uint32_t length) {
+    const uint8_t *bytes = table;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/**
+ * Scan a memory range for the RSDP signature on 16-byte boundaries.
+ */
+static const struct AcpiRsdp *scan_rsdp(uint64_t start, uint64_t length) {
+    for (uint64_t addr = start; addr + 20 <= start + length; addr += 16) {
+        const struct AcpiRsdp *rsdp = (const struct AcpiRsdp *)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the RSDP in the first KB of the EBDA or in the BIOS ROM area.
+ */
+static const struct AcpiRsdp *find_rsdp(void) {
+    uint64_t ebda = (uint64_t)(*(volatile uint16_t *)0x40E) << 4;
+    const struct AcpiRsdp *rsdp = NULL;
+
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = scan_rsdp(ebda, 1024);
+    }
+    if (rsdp == NULL) {
+        rsdp = scan_rsdp(0xE0000, 0x20000);
+    }
+    return rsdp;
+}
+
+/**
+ * Find an ACPI table by signature through the XSDT (ACPI 2.0+) or RSDT.
+ */
+static const struct AcpiHeader *find_acpi_table(const char *signature) {
+    const struct AcpiRsdp *rsdp = find_rsdp();
+    if (rsdp == NULL) {
+        return NULL;
+    }
+
+    int wide = rsdp->revision >= 2 && rsdp->xsdt_address != 0;
+    uint64_t root = wide ? rsdp->xsdt_address : rsdp->rsdt_address;
+    if (!acpi_mapped(root, sizeof(struct AcpiHeader))) {
+        return NULL;
+    }
+
+    const struct AcpiHeader *sdt = (const struct AcpiHeader *)root;
+    uint32_t entry_size = wide ? 8 : 4;
+    uint32_t count = (sdt->length - sizeof(*sdt)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)(sdt + 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t address = wide ? *(const uint64_t *)(entries + i * 8)
+                                : *(const uint32_t *)(entries + i * 4);
+        const struct AcpiHeader *table = (const struct AcpiHeader *)address;
+
+        if (acpi_mapped(address, sizeof(*table)) &&
+            memcmp(table->signature, signature, 4) == 0 &&
+            acpi_mapped(address, table->length) && acpi_checksum(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add a CPU from a MADT entry. Only enabled CPUs are used.
+ */
+static void add_cpu(uint32_t apic_id, uint32_t flags) {
+    if ((flags & 1) && apic_info.cpu_count < MAX_CPUS) {
+        apic_info.cpu_apic_ids[apic_info.cpu_count++] = apic_id;
+    }
+}
+
+/**
+ * Fill apic_info from the MADT.
+ * @return 0 if there is no MADT.
+ */
+static int parse_madt(void) {
+    const struct AcpiHeader *madt = find_acpi_table("APIC");
+    if (madt == NULL) {
+        return 0;
+    }
+
+    const uint8_t *p = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->length;
+
+    apic_info.lapic_base = *(const uint32_t *)p;
+    p += 8;                                 // Local APIC address, flags
+
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+            case MADT_LAPIC:
+                add_cpu(p[3], *(const uint32_t *)(p + 4));
+                break;
+
+            case MADT_X2APIC:
+                add_cpu(*(const uint32_t *)(p + 4), *(const uint32_t *)(p + 8));
+                break;
+
+            case MADT_IOAPIC:
+                if (apic_info.ioapic_count < IOAPIC_MAX) {
+                    struct IoApic *io = &apic_info.ioapics[apic_info.ioapic_count++];
+                    io->id = p[2];
+                    io->address = *(const uint32_t *)(p + 4);
+                    io->gsi_base = *(const uint32_t *)(p + 8);
+                }
+                break;
+
+            case MADT_OVERRIDE:
+                // Bus 0 is ISA
+                if (p[2] == 0 && p[3] < ISA_IRQ_COUNT) {
+                    apic_info.isa_gsi[p[3]] = *(const uint32_t *)(p + 4);
+                    apic_info.isa_flags[p[3]] = *(const uint16_t *)(p + 8);
+                }
+                break;
+
+            case MADT_LAPIC_ADDRESS:
+                apic_info.lapic_base = *(const uint64_t *)(p + 4);
+                break;
+        }
+        p += p[1];
+    }
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+//  Local APIC
+// ----------------------------------------------------------------------------
+
+/**
+ * Read a local APIC register.
+ */
+uint32_t lapic_read(uint32_t reg) {
+    if (apic_info.mode == APIC_MODE_X2APIC) {
+        return (uint32_t)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return *(volatile uint32_t *)(apic_info.lapic_base + reg);
+}
+
+/**
+ * Write a local APIC register.
+ */
+void lapic_write(uint32_t reg, uint32_t value) {
+    if (apic_info.mode == APIC_MODE_X2APIC) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    *(volatile uint32_t *)(apic_info.lapic_base + reg) = value;
+}
+
+/**
+ * Return the local APIC id of the calling CPU.
+ */
+uint32_t lapic_id(void) {
+    uint32_t id = lapic_read(LAPIC_ID);
+    return apic_info.mode == APIC_MODE_X2APIC ? id : id >> 24;
+}
+
+/**
+ * Enable the local APIC of the calling CPU.
+ */
+void lapic_init_cpu(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+
+    // xAPIC must be enabled before x2APIC mode can be entered
+    wrmsr(MSR_APIC_BASE, base);
+    if (apic_info.mode == APIC_MODE_X2APIC) {
+        wrmsr(MSR_APIC_BASE, base | APIC_BASE_X2APIC);
+    }
+
+    // Accept every priority, keep the local sources quiet and leave NMI on
+    // LINT1 (virtual wire). ExtINT on LINT0 is masked with the 8259.
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+
+    // The ESR is cleared by a write before it is read
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    // Drop anything left in service from before
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * Send an IPI to one CPU.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    if (apic_info.mode == APIC_MODE_X2APIC) {
+        // One 64-bit ICR. WRMSR to it isn't serializing, so earlier stores
+        // (what the target is about to read) are fenced first.
+        __asm__ volatile ("mfence" : : : "memory");
+        wrmsr(MSR_X2APIC_BASE + (LAPIC_ICR_LOW >> 4), ((uint64_t)apic_id << 32) | icr);
+        return;
+    }
+
+    // The write to the low half sends
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/**
+ * Spurious interrupt from the local APIC. It sets no in-service bit, so
+ * there is nothing to acknowledge.
+ */
+static void apic_spurious_interrupt(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+}
+
+// ----------------------------------------------------------------------------
+//  IOAPIC
+// ----------------------------------------------------------------------------
+
+static uint32_t ioapic_read(const struct IoApic *io, uint32_t reg) {
+    volatile uint32_t *mmio = (volatile uint32_t *)(uint64_t)io->address;
+    mmio[IOAPIC_REGSEL / 4] = reg;
+    return mmio[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(const struct IoApic *io, uint32_t reg, uint32_t value) {
+    volatile uint32_t *mmio = (volatile uint32_t *)(uint64_t)io->address;
+    mmio[IOAPIC_REGSEL / 4] = reg;
+    mmio[IOAPIC_WINDOW / 4] = value;
+}
+
+/**
+ * Route an ISA IRQ through the IOAPIC that handles its GSI.
+ */
+int ioapic_route_irq(int irq, uint8_t vector, int enabled) {
+    if (irq < 0 || irq >= ISA_IRQ_COUNT) {
+        return -1;
+    }
+
+    uint32_t gsi = apic_info.isa_gsi[irq];
+    uint16_t flags = apic_info.isa_flags[irq];
+
+    for (uint32_t i = 0; i < apic_info.ioapic_count; i++) {
+        const struct IoApic *io = &apic_info.ioapics[i];
+        if (gsi < io->gsi_base || gsi >= io->gsi_base + io->pins) {
+            continue;
+        }
+
+        // ISA defaults are edge triggered, active high; overrides may change both
+        uint32_t low = vector;
+        if ((flags & INTI_POLARITY_MASK) == INTI_POLARITY_LOW) {
+            low |= REDIR_POLARITY_LOW;
+        }
+        if ((flags & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL) {
+            low |= REDIR_LEVEL;
+        }
+        if (!enabled) {
+            low |= REDIR_MASKED;
+        }
+
+        // Fixed delivery, physical destination: the boot CPU
+        uint32_t reg = IOAPIC_REG_REDIR + 2 * (gsi - io->gsi_base);
+        ioapic_write(io, reg, REDIR_MASKED);
+        ioapic_write(io, reg + 1, apic_info.cpu_apic_ids[0] << 24);
+        ioapic_write(io, reg, low);
+        return 0;
+    }
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+//  Setup
+// ----------------------------------------------------------------------------
+
+/**
+ * Initialize the local APIC and IOAPICs and retire the 8259.
+ */
+void init_apic(void) {
+    memset(&apic_info, 0, sizeof(apic_info));
+    apic_info.mode = APIC_MODE_PIC;
+
+    if (!cpu_has(X86_FEATURE_APIC)) {
+        return;
+    }
+
+    // Identity ISA wiring unless the MADT says otherwise
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        apic_info.isa_gsi[irq] = (uint32_t)irq;
+    }
+
+    if (!parse_madt()) {
+        apic_info.ioapic_count = 1;
+        apic_info.ioapics[0].address = IOAPIC_DEFAULT_BASE;
+    }
+    if (apic_info.lapic_base == 0) {
+        apic_info.lapic_base = rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDR_MASK;
+    }
+    lapic_eoi_register = apic_info.lapic_base + LAPIC_EOI;
+
+    // Must match the eoi() alternatives in trap.asm
+    apic_info.mode = cpu_has(X86_FEATURE_X2APIC) ? APIC_MODE_X2APIC : APIC_MODE_XAPIC;
+
+    register_irq_handler(APIC_SPURIOUS_VECTOR, apic_spurious_interrupt, NULL);
+    lapic_init_cpu();
+
+    // Without a MADT the boot CPU is the only one known
+    if (apic_info.cpu_count == 0) {
+        apic_info.cpu_apic_ids[0] = lapic_id();
+        apic_info.cpu_count = 1;
+    }
+
+    // Remember which IRQs drivers enabled on the 8259, then mask it for good
+    uint16_t enabled = (uint16_t)~(inb(PIC1_DATA) | (inb(PIC2_DATA) << 8));
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+
+    // Mask every IOAPIC pin, then carry the enabled IRQs over
+    for (uint32_t i = 0; i < apic_info.ioapic_count; i++) {
+        struct IoApic *io = &apic_info.ioapics[i];
+        io->pins = ((ioapic_read(io, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        for (uint32_t pin = 0; pin < io->pins; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDIR + 2 * pin, REDIR_MASKED);
+        }
+    }
+
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        // IRQ2 is only the cascade input of the 8259
+        if (irq != 2 && (enabled & (1 << irq))) {
+            ioapic_route_irq(irq, (uint8_t)(IRQ_BASE_VECTOR + irq), 1);
+        }
+    }
+}
+
+/**
+ * Print the interrupt controller setup.
+ */
+void print_apic_info(void) {
+    static const char *modes[] = { "8259 PIC", "xAPIC", "x2APIC" };
+
+    printk("Interrupts: %s", modes[apic_info.mode]);
+    if (apic_info.mode != APIC_MODE_PIC) {
+        printk(", local APIC id %u, %u CPU(s), %u IOAPIC(s)", lapic_id(),
+               apic_info.cpu_count, apic_info.ioapic_count);
+    }
+    printk("\n");
+}
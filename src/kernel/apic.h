@@ -0,0 +1,132 @@
+#ifndef _APIC_H_
+#define _APIC_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+/**
+ * Fixed addresses and vectors.
+ * APIC_SPURIOUS_VECTOR: Delivered by the local APIC for a spurious
+ *                       interrupt; its low four bits must be set.
+ * IRQ_BASE_VECTOR: Vector of ISA IRQ 0 (same offset the 8259 was remapped to).
+ */
+#define LAPIC_DEFAULT_BASE      0xFEE00000
+#define APIC_SPURIOUS_VECTOR    0xFF
+#define IRQ_BASE_VECTOR         32
+#define IOAPIC_MAX              4
+#define ISA_IRQ_COUNT           16
+
+/**
+ * Local APIC registers (xAPIC MMIO offsets; see lapic_read()).
+ */
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ESR               0x280
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INITIAL     0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+#define LVT_MASKED              (1 << 16)
+#define LVT_TIMER_TSC_DEADLINE  (2 << 17)
+#define ICR_INIT                (5 << 8)    // Delivery mode: INIT
+#define ICR_STARTUP             (6 << 8)    // Delivery mode: start-up (SIPI)
+#define ICR_PENDING             (1 << 12)   // xAPIC only: not yet accepted
+#define ICR_ASSERT              (1 << 14)
+#define ICR_LEVEL               (1 << 15)
+#define ICR_DEST_SELF           (1 << 18)   // Destination shorthand: self
+
+/**
+ * Interrupt controller in use, set by init_apic().
+ */
+enum ApicMode {
+    APIC_MODE_PIC,       // No local APIC; the 8259 still delivers interrupts
+    APIC_MODE_XAPIC,     // Local APIC through its MMIO page
+    APIC_MODE_X2APIC,    // Local APIC through MSRs
+};
+
+/**
+ * One IOAPIC from the MADT.
+ */
+struct IoApic {
+    uint8_t id;
+    uint32_t address;    // Physical (= virtual) MMIO base
+    uint32_t gsi_base;   // First global system interrupt it handles
+    uint32_t pins;       // Number of redirection entries
+};
+
+/**
+ * Interrupt topology found in the ACPI MADT. Without a MADT it describes
+ * one CPU and one IOAPIC at the default address.
+ */
+struct ApicInfo {
+    enum ApicMode mode;
+    uint64_t lapic_base;                     // xAPIC MMIO base
+    uint32_t cpu_count;                      // Usable CPUs (at most MAX_CPUS)
+    uint32_t cpu_apic_ids[MAX_CPUS];         // Local APIC id of each CPU
+    uint32_t ioapic_count;
+    struct IoApic ioapics[IOAPIC_MAX];
+    uint32_t isa_gsi[ISA_IRQ_COUNT];         // GSI each ISA IRQ is wired to
+    uint16_t isa_flags[ISA_IRQ_COUNT];       // MPS INTI polarity/trigger flags
+};
+
+extern struct ApicInfo apic_info;
+
+/**
+ * Initialize the interrupt controllers.
+ * Reads the MADT, enables this CPU's local APIC (x2APIC when the CPU has
+ * it), masks the 8259 and moves every ISA IRQ that was unmasked on the
+ * 8259 to the IOAPIC with the same vector. Does nothing without a local
+ * APIC. Call after init_idt() and with interrupts disabled.
+ */
+void init_apic(void);
+
+/**
+ * Enable the local APIC of the calling CPU.
+ * init_apic() does this for the boot CPU; other CPUs call it as they start.
+ */
+void lapic_init_cpu(void);
+
+/**
+ * Return the local APIC id of the calling CPU.
+ */
+uint32_t lapic_id(void);
+
+/**
+ * Read or write a local APIC register.
+ * @param reg xAPIC register offset (e.g. 0x0B0 for EOI); x2APIC mode maps
+ *            it to MSR 0x800 + reg / 16.
+ */
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+
+/**
+ * Send an inter-processor interrupt.
+ * @param apic_id Local APIC id of the target CPU.
+ * @param icr Low half of the ICR: vector, delivery mode and flags.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+/**
+ * Route an ISA IRQ through the IOAPIC.
+ * @param irq ISA IRQ number (0-15); interrupt source overrides are applied.
+ * @param vector Vector to deliver to the boot CPU.
+ * @param enabled Non-zero to unmask the entry.
+ * @return 0 on success, -1 if no IOAPIC handles the IRQ.
+ */
+int ioapic_route_irq(int irq, uint8_t vector, int enabled);
+
+/**
+ * Print the interrupt controller setup.
+ */
+void print_apic_info(void);
+
+#endif  // _APIC_H_
@@ -0,0 +1,35 @@
+#include "bench.h"
+#include "time.h"
+#include "../lib/log.h"
+#include "../lib/serial.h"
+
+// ----------------------------------------------------------------------------
+//  bench.c
+// ----------------------------------------------------------------------------
+//  Report helpers shared by the boot-time benchmarks (irqbench.c,
+//  schedbench.c), so their "L" lines share one format that scripts such
+//  as scripts/irqbench.sh can compare across runs.
+// ----------------------------------------------------------------------------
+
+/**
+ * Flush the log before a benchmark starts writing to COM1.
+ */
+void bench_begin(void) {
+    log_flush();
+}
+
+/**
+ * Write one histogram as an "L" line.
+ */
+void bench_report_hist(const char *label, const struct Histogram *h) {
+    if (h->count == 0) {
+        return;
+    }
+
+    serial_printk("L %s count=%lu min=%lu p50=%lu p99=%lu p999=%lu max=%lu mean=%lu\n",
+                  label, h->count, clock_cycles_to_ns(h->min),
+                  clock_cycles_to_ns(hist_percentile(h, 5000)),
+                  clock_cycles_to_ns(hist_percentile(h, 9900)),
+                  clock_cycles_to_ns(hist_percentile(h, 9990)),
+                  clock_cycles_to_ns(h->max), clock_cycles_to_ns(h->sum / h->count));
+}
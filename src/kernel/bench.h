@@ -0,0 +1,23 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "../lib/histogram.h"
+
+/**
+ * Get COM1 ready for a benchmark's report: flush the log so none of its
+ * lines end up between the benchmark's own.
+ */
+void bench_begin(void);
+
+/**
+ * Write a histogram of TSC cycle counts to COM1 as one line, in
+ * nanoseconds:
+ *
+ *   L <label> count=<n> min=<ns> p50=<ns> p99=<ns> p999=<ns> max=<ns>
+ *     mean=<ns>                                     (one line)
+ *
+ * Writes nothing for an empty histogram.
+ */
+void bench_report_hist(const char *label, const struct Histogram *h);
+
+#endif  // _BENCH_H_
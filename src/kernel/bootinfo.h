@@ -0,0 +1,58 @@
+#ifndef _BOOTINFO_H_
+#define _BOOTINFO_H_
+
+#include <stdint.h>
+
+/**
+ * Values shared with loader.asm.
+ * BOOTINFO_MAGIC: "BOOT", checked before the structure is trusted.
+ * KERNEL_MAGIC: "KRNL", first bytes of the kernel image.
+ * E820_MAX: Most entries the loader stores.
+ */
+#define BOOTINFO_MAGIC      0x544F4F42
+#define KERNEL_MAGIC        0x4C4E524B
+#define E820_MAX            128
+
+/**
+ * E820 range types.
+ */
+#define E820_USABLE         1
+#define E820_RESERVED       2
+#define E820_ACPI           3    // ACPI tables; reclaimable once parsed
+#define E820_NVS            4    // ACPI non-volatile storage
+#define E820_BAD            5
+
+/**
+ * One BIOS E820 entry (20 bytes, as INT 15h/E820 writes it).
+ */
+struct E820Entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed));
+
+/**
+ * Handed to KMain by the loader (in rdi, through kernel.asm).
+ * Lives in loader memory below 1 MB; copy what is needed.
+ */
+struct BootInfo {
+    uint32_t magic;                  // BOOTINFO_MAGIC
+    uint32_t e820_count;             // Entries at e820_map
+    uint64_t e820_map;               // Physical address of the entries
+} __attribute__((packed));
+
+/**
+ * Start of the kernel image, at KERNEL_BASE (kernel.asm, linker.lds).
+ * The loader reads the first sector for it, streams the image from disk
+ * to load_address, clears image_end..bss_end and jumps to entry.
+ */
+struct KernelHeader {
+    uint32_t magic;                  // KERNEL_MAGIC
+    uint32_t header_size;
+    uint64_t load_address;           // Link address of the image
+    uint64_t image_end;              // End of what kernel.bin holds; .bss starts here
+    uint64_t bss_end;                // End of .bss (__kernel_end)
+    uint64_t entry;                  // start, in kernel.asm
+} __attribute__((packed));
+
+#endif  // _BOOTINFO_H_
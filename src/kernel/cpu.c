@@ -0,0 +1,188 @@
+#include "cpu.h"
+#include "../lib/print.h"
+
+/**
+ * CPU information filled by init_cpu().
+ */
+struct CpuInfo cpu_info;
+
+/**
+ * Alternative entry as emitted by the ALTERNATIVE macro (cpu.inc).
+ */
+struct AltEntry {
+    uint64_t site;       // Address of a 5-byte jmp near (E9 rel32)
+    uint64_t target;     // Replacement jump target
+    uint64_t feature;    // X86_FEATURE_* that must be present
+};
+
+/**
+ * Bounds of the .altinstr table (linker.lds).
+ */
+extern struct AltEntry __alt_start[];
+extern struct AltEntry __alt_end[];
+
+/**
+ * Feature names for print_cpu_info(), indexed by X86_FEATURE_*.
+ */
+static const char *feature_names[X86_FEATURE_COUNT] = {
+    "tsc", "msr", "apic", "fxsr", "sse2", "pcid", "x2apic", "tsc_deadline",
+    "xsave", "osxsave", "avx", "hypervisor", "avx2", "erms", "invpcid", "fsrm",
+    "xsaveopt", "nx", "pdpe1gb", "rdtscp", "lm", "invariant_tsc",
+};
+
+/**
+ * Set a feature bit if the given CPUID register bit is set.
+ */
+static void set_feature(int feature, uint32_t reg, int bit) {
+    if (reg & (1u << bit)) {
+        cpu_info.features |= 1ULL << feature;
+    }
+}
+
+/**
+ * Initialize cpu_info from CPUID.
+ */
+void init_cpu(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpu_info.features = 0;
+
+    // Leaf 0: highest leaf and vendor string (EBX, EDX, ECX order)
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    cpu_info.max_leaf = eax;
+    *(uint32_t *)&cpu_info.vendor[0] = ebx;
+    *(uint32_t *)&cpu_info.vendor[4] = edx;
+    *(uint32_t *)&cpu_info.vendor[8] = ecx;
+    cpu_info.vendor[12] = '\0';
+
+    // Leaf 1: signature and basic features
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    cpu_info.stepping = eax & 0xF;
+    cpu_info.model = (eax >> 4) & 0xF;
+    cpu_info.family = (eax >> 8) & 0xF;
+    if (cpu_info.family == 0xF) {
+        cpu_info.family += (eax >> 20) & 0xFF;
+    }
+    if (cpu_info.family >= 0x6) {
+        cpu_info.model |= ((eax >> 16) & 0xF) << 4;
+    }
+
+    set_feature(X86_FEATURE_TSC, edx, 4);
+    set_feature(X86_FEATURE_MSR, edx, 5);
+    set_feature(X86_FEATURE_APIC, edx, 9);
+    set_feature(X86_FEATURE_FXSR, edx, 24);
+    set_feature(X86_FEATURE_SSE2, edx, 26);
+    set_feature(X86_FEATURE_PCID, ecx, 17);
+    set_feature(X86_FEATURE_X2APIC, ecx, 21);
+    set_feature(X86_FEATURE_TSC_DEADLINE, ecx, 24);
+    set_feature(X86_FEATURE_XSAVE, ecx, 26);
+    set_feature(X86_FEATURE_HYPERVISOR, ecx, 31);
+
+    // Leaf 7: structured extended features
+    if (cpu_info.max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        set_feature(X86_FEATURE_ERMS, ebx, 9);
+        set_feature(X86_FEATURE_INVPCID, ebx, 10);
+        set_feature(X86_FEATURE_FSRM, edx, 4);
+    }
+
+    // Leaf 0xD subleaf 1: XSAVE extensions
+    if (cpu_info.max_leaf >= 0xD && cpu_has(X86_FEATURE_XSAVE)) {
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        set_feature(X86_FEATURE_XSAVEOPT, eax, 0);
+    }
+
+    // Extended leaves
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    cpu_info.max_ext_leaf = eax;
+
+    if (cpu_info.max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        set_feature(X86_FEATURE_NX, edx, 20);
+        set_feature(X86_FEATURE_PDPE1GB, edx, 26);
+        set_feature(X86_FEATURE_RDTSCP, edx, 27);
+        set_feature(X86_FEATURE_LM, edx, 29);
+    }
+
+    if (cpu_info.max_ext_leaf >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        set_feature(X86_FEATURE_INVARIANT_TSC, edx, 8);
+    }
+
+    refresh_cpu_features();
+}
+
+/**
+ * Recompute the features gated by CR4.OSXSAVE and XCR0.
+ */
+void refresh_cpu_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpu_info.features &= ~((1ULL << X86_FEATURE_OSXSAVE) |
+                           (1ULL << X86_FEATURE_AVX) |
+                           (1ULL << X86_FEATURE_AVX2));
+
+    // OSXSAVE mirrors CR4.OSXSAVE; without it XGETBV is undefined
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    set_feature(X86_FEATURE_OSXSAVE, ecx, 27);
+    if (!cpu_has(X86_FEATURE_OSXSAVE)) {
+        return;
+    }
+
+    // AVX/AVX2 only count as present once XCR0 enables SSE and YMM state
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return;
+    }
+
+    set_feature(X86_FEATURE_AVX, ecx, 28);
+    if (cpu_info.max_leaf >= 7 && cpu_has(X86_FEATURE_AVX)) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        set_feature(X86_FEATURE_AVX2, ebx, 5);
+    }
+}
+
+/**
+ * Patch every ALTERNATIVE site for the running CPU.
+ */
+void apply_alternatives(void) {
+    for (struct AltEntry *alt = __alt_start; alt < __alt_end; alt++) {
+        // Entries for one site are in priority order; only the first
+        // match may patch it.
+        int patched = 0;
+        for (struct AltEntry *prev = __alt_start; prev < alt; prev++) {
+            if (prev->site == alt->site && cpu_has((int)prev->feature)) {
+                patched = 1;
+                break;
+            }
+        }
+        if (patched || !cpu_has((int)alt->feature)) {
+            continue;
+        }
+
+        // Rewrite the rel32 of the jmp near at the site
+        uint8_t *site = (uint8_t *)alt->site;
+        int32_t rel = (int32_t)(alt->target - (alt->site + 5));
+        *(volatile int32_t *)(site + 1) = rel;
+    }
+
+    // Serialize so no stale decoded copy of a patched jump is executed
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+}
+
+/**
+ * Print the CPU identification and detected features.
+ */
+void print_cpu_info(void) {
+    printk("CPU: %s family %u model %u stepping %u\n", cpu_info.vendor,
+           cpu_info.family, cpu_info.model, cpu_info.stepping);
+    printk("CPU features:");
+    for (int i = 0; i < X86_FEATURE_COUNT; i++) {
+        if (cpu_has(i)) {
+            printk(" %s", feature_names[i]);
+        }
+    }
+    printk("\n");
+}
@@ -0,0 +1,211 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <stdint.h>
+
+/**
+ * CPU feature bits
+ * Index into CpuInfo.features. Keep in sync with cpu.inc, which the
+ * assembly files use to name features in their ALTERNATIVE entries.
+ */
+#define X86_FEATURE_TSC            0    // CPUID.1:EDX[4]
+#define X86_FEATURE_MSR            1    // CPUID.1:EDX[5]
+#define X86_FEATURE_APIC           2    // CPUID.1:EDX[9]
+#define X86_FEATURE_FXSR           3    // CPUID.1:EDX[24]
+#define X86_FEATURE_SSE2           4    // CPUID.1:EDX[26]
+#define X86_FEATURE_PCID           5    // CPUID.1:ECX[17]
+#define X86_FEATURE_X2APIC         6    // CPUID.1:ECX[21]
+#define X86_FEATURE_TSC_DEADLINE   7    // CPUID.1:ECX[24]
+#define X86_FEATURE_XSAVE          8    // CPUID.1:ECX[26]
+#define X86_FEATURE_OSXSAVE        9    // CPUID.1:ECX[27]
+#define X86_FEATURE_AVX            10   // CPUID.1:ECX[28], only if YMM state is enabled
+#define X86_FEATURE_HYPERVISOR     11   // CPUID.1:ECX[31]
+#define X86_FEATURE_AVX2           12   // CPUID.7.0:EBX[5], only if YMM state is enabled
+#define X86_FEATURE_ERMS           13   // CPUID.7.0:EBX[9]
+#define X86_FEATURE_INVPCID        14   // CPUID.7.0:EBX[10]
+#define X86_FEATURE_FSRM           15   // CPUID.7.0:EDX[4]
+#define X86_FEATURE_XSAVEOPT       16   // CPUID.0xD.1:EAX[0]
+#define X86_FEATURE_NX             17   // CPUID.0x80000001:EDX[20]
+#define X86_FEATURE_PDPE1GB        18   // CPUID.0x80000001:EDX[26]
+#define X86_FEATURE_RDTSCP         19   // CPUID.0x80000001:EDX[27]
+#define X86_FEATURE_LM             20   // CPUID.0x80000001:EDX[29]
+#define X86_FEATURE_INVARIANT_TSC  21   // CPUID.0x80000007:EDX[8]
+#define X86_FEATURE_COUNT          22
+
+/**
+ * Maximum number of CPUs the kernel keeps per-CPU state for.
+ */
+#define MAX_CPUS                   8
+
+/**
+ * Model-specific registers
+ */
+#define MSR_EFER                   0xC0000080   // Long mode and NX enables
+#define MSR_GS_BASE                0xC0000101   // Per-CPU area (percpu.h)
+#define MSR_TSC_AUX                0xC0000103   // Value returned in ECX by RDTSCP
+
+#define EFER_LME                   (1 << 8)
+#define EFER_NXE                   (1 << 11)
+
+/**
+ * Control register bits
+ */
+#define CR0_MP                     (1ULL << 1)   // WAIT/FWAIT also honour TS
+#define CR0_EM                     (1ULL << 2)   // Emulate the FPU (#UD on every FPU/SIMD use)
+#define CR0_TS                     (1ULL << 3)   // Task switched: FPU/SIMD use raises #NM
+#define CR0_NE                     (1ULL << 5)   // Native x87 error reporting
+#define CR0_WP                     (1ULL << 16)  // Supervisor writes honour read-only pages
+#define CR4_PGE                    (1ULL << 7)   // Global pages
+#define CR4_OSFXSR                 (1ULL << 9)   // FXSAVE/FXRSTOR and SSE
+#define CR4_OSXMMEXCPT             (1ULL << 10)  // Unmasked SIMD exceptions raise #XM
+#define CR4_PCIDE                  (1ULL << 17)  // Process-context identifiers
+#define CR4_OSXSAVE                (1ULL << 18)  // XSAVE, XGETBV/XSETBV
+#define CR3_NOFLUSH                (1ULL << 63)  // Keep the new PCID's TLB entries
+
+/**
+ * CPU Information
+ * Filled once at boot by init_cpu().
+ */
+struct CpuInfo {
+    char vendor[13];         // "GenuineIntel", "AuthenticAMD", ...
+    uint32_t max_leaf;       // Highest basic CPUID leaf
+    uint32_t max_ext_leaf;   // Highest extended CPUID leaf (0x8000xxxx)
+    uint32_t family;         // Display family
+    uint32_t model;          // Display model
+    uint32_t stepping;
+    uint64_t features;       // Bit set of X86_FEATURE_*
+};
+
+extern struct CpuInfo cpu_info;
+
+/**
+ * Execute CPUID for a leaf/subleaf pair.
+ */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                      : "a" (leaf), "c" (subleaf));
+}
+
+/**
+ * Read a model-specific register.
+ */
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Write a model-specific register.
+ */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+/**
+ * Read / write control registers. CR2 holds the last page fault address.
+ */
+static inline uint64_t read_cr0(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+static inline uint64_t read_cr2(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr2, %0" : "=r" (value));
+    return value;
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr3(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+/**
+ * Read the time stamp counter.
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Offset of the CPU index in struct PerCpu (percpu.h), which GS_BASE
+ * points at on every CPU.
+ */
+#define PERCPU_CPU_OFFSET          8
+
+/**
+ * Offset of the trap nesting depth in struct PerCpu, tested by the vector
+ * memory routines (lib.asm, cpu.inc).
+ */
+#define PERCPU_TRAP_DEPTH_OFFSET   52
+
+/**
+ * Return this CPU's index (0 for the boot CPU) from its per-CPU area.
+ * Valid from init_percpu() on.
+ */
+static inline uint32_t cpu_id(void) {
+    uint32_t cpu;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r" (cpu) : "i" (PERCPU_CPU_OFFSET));
+    return cpu;
+}
+
+/**
+ * Check whether a feature is present (and, for AVX/AVX2, usable).
+ * @param feature One of the X86_FEATURE_* bits.
+ * @return Non-zero if the feature is available.
+ */
+static inline int cpu_has(int feature) {
+    return (cpu_info.features >> feature) & 1;
+}
+
+/**
+ * CPU Initialization
+ * Reads CPUID leaves 0, 1, 7, 0xD, 0x80000001 and 0x80000007 into cpu_info.
+ */
+void init_cpu(void);
+
+/**
+ * Re-read the features that depend on control register state (OSXSAVE,
+ * AVX, AVX2) after CR4/XCR0 have been changed.
+ */
+void refresh_cpu_features(void);
+
+/**
+ * Apply Alternatives
+ * Walks the .altinstr table and retargets every patchable jump to the
+ * first alternative whose feature is present. Must run after init_cpu()
+ * and before other CPUs are started.
+ */
+void apply_alternatives(void);
+
+/**
+ * Print the CPU vendor, signature and feature list.
+ */
+void print_cpu_info(void);
+
+#endif  // _CPU_H_
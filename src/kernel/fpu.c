@@ -0,0 +1,312 @@
+#include "fpu.h"
+#include "percpu.h"
+#include "sched.h"
+#include "slab.h"
+#include "trap.h"
+#include "smp.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  fpu.c
+// ----------------------------------------------------------------------------
+//  x87/SSE/AVX state, switched lazily between threads.
+//
+//  Each CPU's registers hold the state of at most one thread, its
+//  fpu_owner. CR0.TS is clear only while that thread runs; any other
+//  thread touching the FPU or a vector register raises #NM, and the
+//  handler loads that thread's state (or the initial one) and makes it the
+//  owner. A thread that never uses them therefore never has anything
+//  saved or loaded, and switching to it costs no more than setting TS,
+//  which stays set from one such thread to the next.
+//
+//  The owner's state is saved when it is switched out, so a thread can
+//  be stolen by another CPU right after the switch. The registers keep
+//  that state, though: if the thread comes back to this CPU and nobody
+//  used them in between (fpu_owner and Thread.fpu_cpu still agree), TS is
+//  cleared and nothing is loaded.
+//
+//  Interrupt and exception handlers run on the interrupted thread's
+//  registers, so they may not use them: the kernel is compiled with
+//  -mgeneral-regs-only, the memory routines fall back to scalar code
+//  under handler() (lib.asm), and anything else goes through
+//  kernel_fpu_begin/end.
+// ----------------------------------------------------------------------------
+
+// Initial control words (x87: all exceptions masked, double extended
+// precision; SSE: all exceptions masked, round to nearest)
+#define FCW_DEFAULT         0x037F
+#define MXCSR_DEFAULT       0x1F80
+#define FXSAVE_FCW          0           // Offsets in the legacy area
+#define FXSAVE_MXCSR        24
+#define FXSAVE_SIZE         512
+#define XSAVE_HEADER_END    576         // Legacy area + 64-byte XSAVE header
+
+enum FpuMethod {
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT,
+};
+
+static const char *method_names[] = { "fxsave", "xsave", "xsaveopt" };
+
+uint32_t fpu_state_size;
+static enum FpuMethod method;
+static uint64_t xcr0;                   // 0 without XSAVE
+
+// What a thread starts with. Its XSAVE header is zero: every component
+// is loaded in its initial configuration, except MXCSR, which is read
+static uint8_t init_state[FPU_STATE_MAX] __attribute__((aligned(FPU_STATE_ALIGN)));
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+    __asm__ volatile ("xsetbv" : : "c" (reg), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+/**
+ * Store the registers in a save area. TS must be clear.
+ */
+static void fpu_save(void *area) {
+    switch (method) {
+        case FPU_XSAVEOPT:
+            __asm__ volatile ("xsaveopt64 (%0)" : : "r" (area), "a" (0xFFFFFFFF), "d" (0xFFFFFFFF) : "memory");
+            break;
+        case FPU_XSAVE:
+            __asm__ volatile ("xsave64 (%0)" : : "r" (area), "a" (0xFFFFFFFF), "d" (0xFFFFFFFF) : "memory");
+            break;
+        default:
+            __asm__ volatile ("fxsave64 (%0)" : : "r" (area) : "memory");
+            break;
+    }
+}
+
+/**
+ * Load the registers from a save area. TS must be clear.
+ */
+static void fpu_restore(const void *area) {
+    if (method != FPU_FXSAVE) {
+        __asm__ volatile ("xrstor64 (%0)" : : "r" (area), "a" (0xFFFFFFFF), "d" (0xFFFFFFFF) : "memory");
+    } else {
+        __asm__ volatile ("fxrstor64 (%0)" : : "r" (area) : "memory");
+    }
+}
+
+/**
+ * Set or clear CR0.TS, skipping the (serializing) CR0 write when it is
+ * already as wanted.
+ */
+static void set_ts(uint32_t ts) {
+    if (this_cpu_read(fpu_ts) == ts) {
+        return;
+    }
+    if (ts) {
+        write_cr0(read_cr0() | CR0_TS);
+    } else {
+        __asm__ volatile ("clts" : : : "memory");
+    }
+    this_cpu_write(fpu_ts, ts);
+}
+
+/**
+ * Save the owner's registers into its area (TS clear, owner running or
+ * interrupted).
+ */
+static void save_owner(struct Thread *owner) {
+    fpu_save(owner->fpu);
+    owner->fpu_valid = 1;
+    this_cpu_inc(fpu_saves);
+}
+
+/**
+ * Device not available (#NM): a thread used the FPU with TS set. Load
+ * its state and make it the owner.
+ */
+static void device_not_available(struct TrapFrame *tf, void *ctx) {
+    struct Thread *thread = this_cpu_read(current);
+
+    (void)ctx;
+
+    // This trap is handler()'s first level; anything deeper is a handler
+    // or bottom half using the registers of the thread it interrupted.
+    // Loading a state now would clobber them: stop here
+    if (this_cpu_read(trap_depth) > 1 || this_cpu_read(fpu_kernel) != 0) {
+        log_message(LOG_PANIC, "fpu: FPU/SIMD use in interrupt context at %#lx\n", tf->rip);
+        trap_panic(tf);
+    }
+
+    set_ts(0);
+    if (thread == NULL) {
+        return;                         // Before the scheduler: no state to keep
+    }
+
+    fpu_restore(thread->fpu_valid ? thread->fpu : init_state);
+    this_cpu_write(fpu_owner, thread);
+    thread->fpu_cpu = cpu_id();
+    this_cpu_inc(fpu_restores);
+}
+
+/**
+ * Enable the FPU state on the boot CPU and size the save area.
+ */
+void init_fpu(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    method = FPU_FXSAVE;
+    xcr0 = 0;
+    fpu_state_size = FXSAVE_SIZE;
+
+    // Leaf 0xD subleaf 0, EAX: components XCR0 may enable
+    if (cpu_has(X86_FEATURE_XSAVE)) {
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        xcr0 = eax & (XSTATE_X87 | XSTATE_SSE | XSTATE_AVX);
+        method = cpu_has(X86_FEATURE_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+
+        // Area size: the legacy area and XSAVE header, up to the end of
+        // the AVX component (subleaf 2, EBX: offset, EAX: size)
+        fpu_state_size = XSAVE_HEADER_END;
+        if (xcr0 & XSTATE_AVX) {
+            cpuid(0xD, 2, &eax, &ebx, &ecx, &edx);
+            fpu_state_size = ebx + eax;
+        }
+
+        // The areas are FPU_STATE_MAX bytes: XRSTOR must not read past them
+        if (fpu_state_size > FPU_STATE_MAX) {
+            log_message(LOG_WARN, "fpu: %u-byte XSAVE area, at most %u supported; using FXSAVE\n",
+                        fpu_state_size, FPU_STATE_MAX);
+            xcr0 = 0;
+            method = FPU_FXSAVE;
+            fpu_state_size = FXSAVE_SIZE;
+        }
+    }
+
+    fpu_init_cpu();
+
+    // AVX and AVX2 only count as present now that XCR0 enables YMM state
+    refresh_cpu_features();
+
+    memset(init_state, 0, sizeof(init_state));
+    *(uint16_t *)&init_state[FXSAVE_FCW] = FCW_DEFAULT;
+    *(uint32_t *)&init_state[FXSAVE_MXCSR] = MXCSR_DEFAULT;
+}
+
+/**
+ * Enable the FPU state on the calling CPU. Leaves TS clear, which is
+ * what PerCpu.fpu_ts starts as.
+ */
+void fpu_init_cpu(void) {
+    uint32_t mxcsr = MXCSR_DEFAULT;
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (xcr0 != 0) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+    if (xcr0 != 0) {
+        xsetbv(0, xcr0);
+    }
+
+    __asm__ volatile ("fninit; ldmxcsr %0" : : "m" (mxcsr));
+}
+
+/**
+ * Install the #NM handler.
+ */
+void init_fpu_switching(void) {
+    register_irq_handler(NM_VECTOR, device_not_available, NULL);
+}
+
+/**
+ * Allocate a zeroed save area.
+ */
+void *fpu_alloc_state(void) {
+    void *state = kmalloc(fpu_state_size);
+
+    if (state != NULL) {
+        memset(state, 0, fpu_state_size);
+    }
+    return state;
+}
+
+/**
+ * Make `thread` the owner of this CPU's registers.
+ */
+void fpu_adopt(struct Thread *thread) {
+    uint64_t flags = irq_save();
+
+    set_ts(0);
+    this_cpu_write(fpu_owner, thread);
+    thread->fpu_cpu = cpu_id();
+    irq_restore(flags);
+}
+
+/**
+ * Switch the FPU from `prev` to `next`.
+ */
+void fpu_switch(struct Thread *prev, struct Thread *next) {
+    struct Thread *owner = this_cpu_read(fpu_owner);
+
+    // TS is only clear while the owner runs
+    if (owner == prev && !this_cpu_read(fpu_ts)) {
+        if (prev->state == THREAD_DEAD) {
+            owner = NULL;
+            this_cpu_write(fpu_owner, NULL);
+        } else {
+            save_owner(prev);
+        }
+    }
+
+    set_ts(!(owner == next && next->fpu_cpu == cpu_id()));
+}
+
+/**
+ * Take the registers for kernel code.
+ */
+uint64_t kernel_fpu_begin(void) {
+    uint64_t flags = irq_save();
+
+    if (this_cpu_read(fpu_kernel) == 0) {
+        struct Thread *owner = this_cpu_read(fpu_owner);
+
+        // A switched-out owner was saved then; a running (or interrupted)
+        // one may have changed its registers since
+        if (owner != NULL && !this_cpu_read(fpu_ts)) {
+            save_owner(owner);
+        }
+        this_cpu_write(fpu_owner, NULL);
+        set_ts(0);
+    }
+    this_cpu_inc(fpu_kernel);
+    return flags;
+}
+
+/**
+ * Give the registers back: the next thread to use them loads its own
+ * state through #NM.
+ */
+void kernel_fpu_end(uint64_t flags) {
+    this_cpu_dec(fpu_kernel);
+    if (this_cpu_read(fpu_kernel) == 0) {
+        set_ts(1);
+    }
+    irq_restore(flags);
+}
+
+/**
+ * Print the save method, area size and XCR0.
+ */
+void print_fpu_info(void) {
+    printk("FPU: %s, %u-byte state, XCR0 %#lx\n", method_names[method], fpu_state_size, xcr0);
+}
+
+/**
+ * Print the per-CPU lazy restore and save counters.
+ */
+void fpu_dump_stats(void) {
+    printk("FPU: lazy restores / saves on switch-out\n");
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        printk("  CPU %u: %lu restores, %lu saves\n", cpu, per_cpu[cpu].fpu_restores, per_cpu[cpu].fpu_saves);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef _FPU_H_
+#define _FPU_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+struct Thread;
+
+/**
+ * FPU state.
+ * FPU_STATE_MAX: Largest save area supported. XCR0 only enables x87, SSE
+ *                and AVX state, which XSAVE stores in 832 bytes; a CPU
+ *                laying them out larger is left on FXSAVE, without AVX.
+ * FPU_STATE_ALIGN: XSAVE/FXSAVE area alignment.
+ * FPU_NO_CPU: Thread.fpu_cpu of a thread whose state is in no CPU's
+ *             registers.
+ * NM_VECTOR: Device-not-available exception (#NM), raised by the first
+ *            FPU/SIMD instruction while CR0.TS is set.
+ */
+#define FPU_STATE_MAX       1024
+#define FPU_STATE_ALIGN     64
+#define FPU_NO_CPU          0xFFFFFFFF
+#define NM_VECTOR           7
+
+/**
+ * XCR0 state components.
+ */
+#define XSTATE_X87          (1 << 0)
+#define XSTATE_SSE          (1 << 1)
+#define XSTATE_AVX          (1 << 2)
+
+/**
+ * Size of a thread's save area (from CPUID leaf 0xD with XSAVE, the
+ * 512-byte FXSAVE area otherwise). Set by init_fpu().
+ */
+extern uint32_t fpu_state_size;
+
+/**
+ * Enable the x87 FPU, SSE and, with XSAVE, AVX on the boot CPU and size
+ * the save area. Call after init_cpu() and before apply_alternatives(),
+ * which may pick AVX routines once XCR0 enables them.
+ */
+void init_fpu(void);
+
+/**
+ * Enable the same state on another CPU. First thing an AP does: the
+ * patched memory routines may already use AVX.
+ */
+void fpu_init_cpu(void);
+
+/**
+ * Start lazy switching: install the #NM handler. Call after init_idt().
+ */
+void init_fpu_switching(void);
+
+/**
+ * Allocate a thread's save area (fpu_state_size bytes, from kmalloc(),
+ * freed with kfree()), zeroed: XSAVE never writes most of the XSAVE
+ * header, and XRSTOR faults unless those bytes are zero.
+ * @return The area, or NULL if out of memory.
+ */
+void *fpu_alloc_state(void);
+
+/**
+ * Make `thread` the owner of this CPU's registers as they are now; the
+ * boot context becoming the idle thread keeps its state this way.
+ */
+void fpu_adopt(struct Thread *thread);
+
+/**
+ * Switch the FPU from `prev` to `next` (interrupts off, from the
+ * scheduler). Only a thread that used the registers since it was last
+ * switched in has its state saved, with XSAVEOPT where available. `next`
+ * gets the registers back only when it touches them (#NM), unless they
+ * still hold its state.
+ */
+void fpu_switch(struct Thread *prev, struct Thread *next);
+
+/**
+ * Bracket kernel code that uses FPU/SIMD registers outside a thread's own
+ * context: interrupt handlers and bottom halves, or anything that must
+ * not go through #NM. begin saves the state of the thread owning the
+ * registers and disables interrupts; end returns the registers to their
+ * owner lazily and restores the interrupt flag.
+ *
+ * Thread code (outside handler()) may use SIMD without them: its state
+ * is switched with it. Sections may nest; keep them short, and never
+ * use them from exception or NMI handlers, which may arrive inside one.
+ */
+uint64_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint64_t flags);
+
+/**
+ * Print the save method, area size and XCR0.
+ */
+void print_fpu_info(void);
+
+/**
+ * Print the per-CPU lazy restore and save counters.
+ */
+void fpu_dump_stats(void);
+
+#endif  // _FPU_H_
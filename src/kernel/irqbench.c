@@ -0,0 +1,198 @@
+#include "irqbench.h"
+#include "apic.h"
+#include "bench.h"
+#include "cpu.h"
+#include "time.h"
+#include "timer.h"
+#include "trap.h"
+#include "../lib/irqflags.h"
+#include "../lib/print.h"
+#include "../lib/serial.h"
+
+// ----------------------------------------------------------------------------
+//  irqbench.c
+// ----------------------------------------------------------------------------
+//  Interrupt latency and jitter benchmark.
+//
+//  Each sample raises one interrupt whose time is known in TSC cycles in
+//  advance (a timer's deadline) or at the instant it is requested (a
+//  self-IPI), then spins until it has been handled. handler() stamps its
+//  entry TSC (irq_entry_tsc()), the interrupt's callback copies it out,
+//  and the spinning loop reads the TSC again as soon as iretq lands back
+//  in it. The differences go into log-linear histograms, so the tail
+//  (p99.9, max) is kept at the same relative precision as the median.
+//
+//  With the TSC-deadline clock event the timer deadline is exact. The
+//  one-shot LAPIC and PIT fallbacks convert it to a count when armed, so
+//  their entry numbers also contain that rounding (up to ~1 us on the PIT).
+//  The spinning loop never halts, so no wakeup-from-idle time is included.
+// ----------------------------------------------------------------------------
+
+/**
+ * One interrupt source and its results.
+ */
+struct BenchSource {
+    const char *name;
+    int vector;
+    uint64_t lost;                  // Interrupts that never arrived
+    struct Histogram entry;         // Deadline -> handler() entry, cycles
+    struct Histogram ret;           // handler() entry -> back in the loop, cycles
+};
+
+static struct BenchSource sources[2];
+static struct Timer bench_timer;
+
+// Written by the interrupt, read by the spinning loop
+static volatile int bench_fired;
+static volatile uint64_t bench_entry;
+
+/**
+ * Timer callback and self-IPI handler: report the handler() entry time.
+ */
+static void bench_timer_fn(void *ctx) {
+    (void)ctx;
+    bench_entry = irq_entry_tsc();
+    bench_fired = 1;
+}
+
+static void bench_ipi(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    bench_entry = irq_entry_tsc();
+    bench_fired = 1;
+    eoi();
+}
+
+/**
+ * Spin until the interrupt has been handled.
+ * @return TSC on return to the loop, or 0 after IRQBENCH_TIMEOUT_US.
+ */
+static uint64_t wait_fired(uint64_t deadline) {
+    uint64_t timeout = deadline + IRQBENCH_TIMEOUT_US * tsc_khz / 1000;
+
+    for (;;) {
+        uint64_t now = rdtsc();
+        if (bench_fired) {
+            return now;
+        }
+        if (now > timeout) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * Record one sample; warm-up samples are dropped.
+ */
+static void record(struct BenchSource *src, uint32_t i, uint64_t deadline, uint64_t back) {
+    if (i < IRQBENCH_WARMUP) {
+        return;
+    }
+    if (back == 0) {
+        src->lost++;
+        return;
+    }
+
+    // A one-shot fallback can fire a little early; count that as 0
+    hist_record(&src->entry, bench_entry > deadline ? bench_entry - deadline : 0);
+    hist_record(&src->ret, back - bench_entry);
+}
+
+/**
+ * Timer source: arm a timer IRQBENCH_LEAD_US ahead and wait for it.
+ */
+static void run_timer(struct BenchSource *src, uint32_t samples) {
+    timer_init(&bench_timer, bench_timer_fn, NULL);
+
+    for (uint32_t i = 0; i < samples + IRQBENCH_WARMUP; i++) {
+        uint64_t expires = clock_us() + IRQBENCH_LEAD_US;
+        uint64_t deadline = us_to_tsc(expires);
+
+        bench_fired = 0;
+        timer_add(&bench_timer, expires);
+
+        uint64_t back = wait_fired(deadline);
+        if (back == 0) {
+            timer_cancel(&bench_timer);
+        }
+        record(src, i, deadline, back);
+    }
+}
+
+/**
+ * IPI source: send a fixed self-IPI and wait for it.
+ */
+static void run_ipi(struct BenchSource *src, uint32_t samples) {
+    register_irq_handler(IRQBENCH_VECTOR, bench_ipi, NULL);
+
+    for (uint32_t i = 0; i < samples + IRQBENCH_WARMUP; i++) {
+        bench_fired = 0;
+
+        uint64_t deadline = rdtsc();
+        lapic_write(LAPIC_ICR_LOW, ICR_DEST_SELF | IRQBENCH_VECTOR);
+
+        record(src, i, deadline, wait_fired(deadline));
+    }
+
+    register_irq_handler(IRQBENCH_VECTOR, NULL, NULL);
+}
+
+/**
+ * Write one histogram as an "L" line.
+ */
+static void report(const struct BenchSource *src, const char *phase, const struct Histogram *h) {
+    char label[64];
+
+    snprintk(label, sizeof(label), "%s %d %s", src->name, src->vector, phase);
+    bench_report_hist(label, h);
+}
+
+/**
+ * Measure interrupt latency and report it on COM1.
+ */
+void irqbench_run(uint32_t samples) {
+    int nsources = 0;
+
+    if (samples == 0) {
+        samples = IRQBENCH_SAMPLES;
+    }
+
+    bench_begin();
+
+    sources[nsources].name = "timer";
+    sources[nsources].vector = apic_info.mode == APIC_MODE_PIC ? IRQ_BASE_VECTOR : LAPIC_TIMER_VECTOR;
+    nsources++;
+    if (apic_info.mode != APIC_MODE_PIC) {
+        sources[nsources].name = "ipi";
+        sources[nsources].vector = IRQBENCH_VECTOR;
+        nsources++;
+    }
+
+    for (int s = 0; s < nsources; s++) {
+        sources[s].lost = 0;
+        hist_reset(&sources[s].entry);
+        hist_reset(&sources[s].ret);
+    }
+
+    uint64_t flags = irq_save();
+    irq_enable();
+
+    run_timer(&sources[0], samples);
+    if (nsources > 1) {
+        run_ipi(&sources[1], samples);
+    }
+
+    irq_disable();
+    irq_restore(flags);
+
+    serial_printk("# irqbench begin samples=%u tsc_khz=%lu clockevent=%s\n",
+                  samples, tsc_khz, clockevent_name());
+    for (int s = 0; s < nsources; s++) {
+        report(&sources[s], "entry", &sources[s].entry);
+        report(&sources[s], "return", &sources[s].ret);
+        if (sources[s].lost != 0) {
+            serial_printk("# irqbench lost source=%s count=%lu\n", sources[s].name, sources[s].lost);
+        }
+    }
+    serial_printk("# irqbench end\n");
+}
@@ -0,0 +1,47 @@
+#ifndef _IRQBENCH_H_
+#define _IRQBENCH_H_
+
+#include <stdint.h>
+
+/**
+ * Vector of the benchmark's self-IPI.
+ */
+#define IRQBENCH_VECTOR         0xF1
+
+/**
+ * IRQBENCH_SAMPLES: Default number of measured interrupts per source.
+ * IRQBENCH_WARMUP: Interrupts taken and discarded before measuring, so
+ *                  cold caches and TLBs don't show up as tail latency.
+ * IRQBENCH_LEAD_US: How far ahead of now each benchmark timer is armed.
+ * IRQBENCH_TIMEOUT_US: Wait for one interrupt before counting it lost.
+ */
+#define IRQBENCH_SAMPLES        10000
+#define IRQBENCH_WARMUP         100
+#define IRQBENCH_LEAD_US        50
+#define IRQBENCH_TIMEOUT_US     100000
+
+/**
+ * Measure interrupt latency on the calling CPU and report it on COM1.
+ *
+ * Each source raises `samples` interrupts at a known TSC time while the
+ * CPU spins with interrupts enabled:
+ *   - timer: a timer-wheel timer, delivered by the clock event device;
+ *   - ipi:   a self-IPI on IRQBENCH_VECTOR (local APIC only).
+ * For every interrupt two delays go into log-linear histograms:
+ *   - entry:  from the deadline to handler() entry (hardware delivery and
+ *             the trap.asm entry path);
+ *   - return: from handler() entry until the interrupted code runs again
+ *             (dispatch, the handler, the exit path and iretq).
+ *
+ * Needs init_time() and init_timers(). Interrupts are enabled only for
+ * the duration of the run. Output, in nanoseconds:
+ *
+ *   # irqbench begin samples=<n> tsc_khz=<khz> clockevent=<device>
+ *   L <source> <vector> <entry|return> count=<n> min=<ns> p50=<ns>
+ *     p99=<ns> p999=<ns> max=<ns> mean=<ns>          (one line)
+ *   # irqbench lost source=<source> count=<n>
+ *   # irqbench end
+ */
+void irqbench_run(uint32_t samples);
+
+#endif  // _IRQBENCH_H_
@@ -2,16 +2,46 @@
 ;  KERNEL.ASM (64-bit)
 ; ----------------------------------------------------------------------------
 ;  Responsibilities:
-;   1) Define a 64-bit GDT, TSS, and their descriptors.
+;   0) Start the image with the header the loader reads (struct
+;      KernelHeader in bootinfo.h).
+;   1) Define a 64-bit GDT, TSS, and their descriptors. They only last
+;      until init_percpu() (smp.c) gives the boot CPU its own.
 ;   2) Load the GDT, set up the TSS selector.
-;   3) Initialize PIT & PIC for basic interrupt handling.
-;   4) Perform a far jump into the kernel entry point (KernelEntry).
-;   5) From KernelEntry, call the main C function (KMain).
+;   3) Enable SSE (CR0/CR4) so the vector mem* routines can run; init_fpu()
+;      (fpu.c) enables the rest of the FPU state.
+;   4) Remap the PIC (the timer is set up later, in C).
+;   5) Perform a far jump into the kernel entry point (KernelEntry).
+;   6) From KernelEntry, call the main C function (KMain).
 ;
 ;  Extern:
 ;    - KMain: Defined in main.c (compiled to an object file).
 ; ----------------------------------------------------------------------------
 
+; ----------------------------------------------------------------------------
+;  Kernel Header
+; ----------------------------------------------------------------------------
+;  First bytes of kernel.bin (linker.lds puts .header at KERNEL_BASE). The
+;  loader reads the image up to ImageEnd to LoadAddress, clears .bss up to
+;  BssEnd, and jumps to Entry.
+; ----------------------------------------------------------------------------
+
+KERNEL_MAGIC equ 0x4C4E524B            ; "KRNL"
+
+extern __kernel_start
+extern __bss_start
+extern __kernel_end
+
+section .header
+
+KernelHeader:
+    dd KERNEL_MAGIC                    ; Magic
+    dd KernelHeaderLen                 ; Header size
+    dq __kernel_start                  ; LoadAddress: link address of the image
+    dq __bss_start                     ; ImageEnd: end of what is on disk
+    dq __kernel_end                    ; BssEnd: end of .bss (page aligned)
+    dq start                           ; Entry
+KernelHeaderLen: equ $ - KernelHeader
+
 section .data
 
 ; ----------------------------------------------------------------------------
@@ -48,7 +78,7 @@ Gdt64Ptr:
 ; ----------------------------------------------------------------------------
 Tss:
     dd 0                ; Reserved
-    dq 0x150000         ; RSP0 = top of kernel stack (example address)
+    dq 0x200000         ; RSP0 = top of the boot stack (KERNEL_BASE)
     times 88 db 0       ; Rest of TSS fields
     dd  TssLen
 
@@ -64,6 +94,8 @@ global start
 ;  start: Primary entry point after the bootloader jumps here
 ; ----------------------------------------------------------------------------
 start:
+    mov   r15, rdi         ; Boot info from the loader, for KMain
+
     ; ------------------------------------------------------------------------
     ; 1) Load the 64-bit GDT
     ; ------------------------------------------------------------------------
@@ -86,18 +118,18 @@ SetTss:
     mov   ax, 0x20
     ltr   ax
 
-InitPIT:
+EnableSSE:
     ; ------------------------------------------------------------------------
-    ; 3) Initialize PIT (Programmable Interval Timer)
-    ;    - Channel 0, Mode 3, ~100 Hz
+    ; 3) Enable SSE: clear CR0.EM, set CR0.MP, then set CR4.OSFXSR and
+    ;    CR4.OSXMMEXCPT so SSE instructions no longer raise #UD.
     ; ------------------------------------------------------------------------
-    mov   al, (1 << 2) | (3 << 4)   ; channel=0, access=lo/hi, mode=3
-    out   0x43, al
-
-    mov   ax, 11931                 ; reload value for ~100Hz
-    out   0x40, al
-    mov   al, ah
-    out   0x40, al
+    mov   rax, cr0
+    and   rax, ~(1 << 2)          ; EM = 0 (no x87 emulation)
+    or    rax, (1 << 1)           ; MP = 1
+    mov   cr0, rax
+    mov   rax, cr4
+    or    rax, (1 << 9) | (1 << 10) ; OSFXSR | OSXMMEXCPT
+    mov   cr4, rax
 
 InitPIC:
     ; ------------------------------------------------------------------------
@@ -145,8 +177,9 @@ KernelEntry:
     ; Set a stack pointer for the kernel
     mov   rsp, 0x200000
 
-    ; Call KMain (defined in main.c)
-    call  KMain
+    ; Call KMain (defined in main.c) with the loader's boot info
+    mov   rdi, r15
+    call  KMain           ; Ends in the idle loop; doesn't return
 
 End:
     hlt
@@ -1,7 +1,52 @@
 #include "trap.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "trace.h"
+#include "apic.h"
+#include "time.h"
+#include "timer.h"
+#include "irqbench.h"
+#include "bootinfo.h"
+#include "memmap.h"
+#include "paging.h"
+#include "page_alloc.h"
+#include "slab.h"
+#include "vm.h"
+#include "smp.h"
+#include "sched.h"
+#include "softirq.h"
+#include "schedbench.h"
+#include "profile.h"
 #include "../lib/print.h"
 #include "../lib/lib.h"
 #include "../lib/debug.h"
+#include "../lib/log.h"
+#include "../lib/console.h"
+#include "../lib/serial.h"
+#include "../lib/io.h"
+#include "../lib/irqflags.h"
+#include "../lib/spinlock.h"
+
+/**
+ * QEMU isa-debug-exit port (added by scripts/bnr.sh --irqbench,
+ * --schedbench and --profile). Writing to it powers QEMU off; without
+ * the device the write is ignored.
+ */
+#define QEMU_EXIT_PORT  0xF4
+
+#if defined(IRQBENCH) || defined(SCHEDBENCH) || defined(PROFILE)
+/**
+ * End of a headless run: dump the profile if one is being taken, let
+ * COM1 drain and power QEMU off.
+ */
+static void headless_exit(void) {
+#ifdef PROFILE
+    profile_dump();
+#endif
+    serial_drain();
+    outb(QEMU_EXIT_PORT, 0);
+}
+#endif
 
 /**
  * Displays a welcome message for AlecOS with ASCII art.
@@ -28,21 +73,122 @@ static void welcome_message() {
 
 /**
  * Kernel entry point.
- * This function initializes the system and displays a welcome message.
+ * This function initializes the system and displays a welcome message,
+ * then becomes the boot CPU's idle thread.
+ *
+ * @param boot_info Memory map and other data from the loader.
  */
-void KMain(void) {
+void KMain(struct BootInfo *boot_info) {
     char *string = "Hello and Welcome to AlecOS!";
     int64_t value = 0x123456789ABCD;
 
-    // Initialize the Interrupt Descriptor Table (IDT)
+    // Give the boot CPU its per-CPU area, GDT and TSS; cpu_id() reads it
+    init_percpu();
+
+    // Set up the kernel log before anything prints; the VGA console and
+    // COM1 are its sinks
+    init_log();
+    init_vga_console();
+    init_serial_console();
+
+    // Detect CPU features, enable the FPU/SSE/AVX state, and patch the hot
+    // routines for this CPU
+    init_cpu();
+    init_fpu();
+    apply_alternatives();
+
+    // Find usable RAM, map all of it and put it under the page allocator
+    init_memmap(boot_info);
+    init_paging();
+    init_page_alloc();
+    init_kmem();
+
+    // Start the per-CPU binary trace rings (needs the RDTSCP feature bit)
+    init_trace();
+
+    // Initialize the Interrupt Descriptor Table (IDT); FPU state is
+    // switched lazily through #NM, and kernel TLB flushes reach the other
+    // CPUs through a shootdown IPI, from here on
     init_idt();
+    init_fpu_switching();
+    init_tlb_shootdown();
+
+    // Move interrupt delivery from the 8259 to the local APIC and IOAPIC
+    init_apic();
+
+    // Calibrate the TSC clock and arm the timer wheel (no periodic tick)
+    init_time();
+    init_timers();
+
+    // Back the kernel virtual area on demand (needs the IDT and timers)
+    init_vm();
+
+    // Make KMain the boot CPU's idle thread and clear the bottom half
+    // queues, then wake the other CPUs; they idle until there are threads
+    // for them
+    init_sched();
+    init_softirq();
+    init_smp();
 
     // Display the welcome message
     welcome_message();
 
+    print_cpu_info();
+    print_fpu_info();
+    print_apic_info();
+    print_smp_info();
+    print_time_info();
+    print_memmap();
+    print_paging_info();
+    print_page_alloc_info();
+    kmem_dump_stats();
+    vm_dump_stats();
+    sched_dump_stats();
+    softirq_dump_stats();
+    fpu_dump_stats();
+    lock_stats_dump();
+
     // Print a sample string and hexadecimal value
     printk("%s\n", string);
-    printk("This value is equal to %x\n", value);
+    printk("This value is equal to 0x%lx\n", value);
 
     printk("System initialization complete.\n");
+
+    // Interrupts aren't enabled yet, so the deferred flush timer can't fire
+    log_flush();
+
+#ifdef PROFILE
+    // Sample every CPU from here on, through the benchmark if one is
+    // built in; the samples go to COM1 for tools/profile
+    profile_start(PROFILE_PERIOD_US, 1);
+#endif
+
+#ifdef IRQBENCH
+    // Headless latency run: report on COM1, then power QEMU off
+    irqbench_run(IRQBENCH_SAMPLES);
+    headless_exit();
+#endif
+
+#ifdef SCHEDBENCH
+    // Headless thread switch run, same as above
+    schedbench_run(SCHEDBENCH_SAMPLES);
+    sched_dump_stats();
+    lock_stats_dump();
+    log_flush();
+    headless_exit();
+#endif
+
+#ifdef PROFILE
+    // No benchmark: profile the system as it idles for PROFILE_RUN_US
+    uint64_t profile_end = clock_us() + PROFILE_RUN_US;
+    irq_enable();
+    while (clock_us() < profile_end) {
+        __asm__ volatile ("hlt");
+    }
+    irq_disable();
+    headless_exit();
+#endif
+
+    // Run threads from now on; never returns
+    sched_idle();
 }
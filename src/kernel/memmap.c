@@ -0,0 +1,214 @@
+#include "memmap.h"
+#include "../lib/debug.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  memmap.c
+// ----------------------------------------------------------------------------
+//  Physical memory layout from the BIOS E820 map.
+//
+//  The firmware list is unsorted and may overlap (a reserved hole inside a
+//  usable entry is common). Usable entries are shrunk to whole pages,
+//  sorted and merged; then every non-usable entry and every range the boot
+//  code still uses is cut out. What is left is plain RAM nobody owns, for
+//  the page allocator.
+// ----------------------------------------------------------------------------
+
+struct MemMap mem_map;
+
+/**
+ * Round down / up to a page boundary.
+ */
+static inline uint64_t page_floor(uint64_t addr) {
+    return addr & ~(PAGE_SIZE - 1);
+}
+
+static inline uint64_t page_ceil(uint64_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+/**
+ * Append a usable range; empty ones are ignored.
+ */
+static void add_range(uint64_t start, uint64_t end) {
+    if (start >= end) {
+        return;
+    }
+    if (mem_map.count == MEMMAP_MAX) {
+        log_message(LOG_WARN, "memmap: more than %d ranges, ignoring %#lx-%#lx\n",
+                    MEMMAP_MAX, start, end);
+        return;
+    }
+    mem_map.usable[mem_map.count].start = start;
+    mem_map.usable[mem_map.count].end = end;
+    mem_map.count++;
+}
+
+/**
+ * Sort the usable ranges by start and merge the ones that touch.
+ */
+static void sort_and_merge(void) {
+    struct MemRange *r = mem_map.usable;
+
+    // Insertion sort: the firmware gives a few dozen entries at most
+    for (uint32_t i = 1; i < mem_map.count; i++) {
+        struct MemRange key = r[i];
+        uint32_t j = i;
+        while (j > 0 && r[j - 1].start > key.start) {
+            r[j] = r[j - 1];
+            j--;
+        }
+        r[j] = key;
+    }
+
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        if (out > 0 && r[i].start <= r[out - 1].end) {
+            if (r[i].end > r[out - 1].end) {
+                r[out - 1].end = r[i].end;
+            }
+        } else {
+            r[out++] = r[i];
+        }
+    }
+    mem_map.count = out;
+}
+
+/**
+ * Remove [start, end) from the usable ranges, splitting one if needed.
+ * The list stays sorted.
+ */
+static void cut_range(uint64_t start, uint64_t end) {
+    start = page_floor(start);
+    end = page_ceil(end);
+
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        struct MemRange *r = &mem_map.usable[i];
+
+        if (end <= r->start || start >= r->end) {
+            continue;
+        }
+
+        if (start > r->start && end < r->end) {
+            // Hole in the middle: split in two
+            if (mem_map.count == MEMMAP_MAX) {
+                r->end = start;                  // Drop the upper part
+                continue;
+            }
+            memmove(r + 2, r + 1, (mem_map.count - i - 1) * sizeof(*r));
+            r[1].start = end;
+            r[1].end = r->end;
+            r->end = start;
+            mem_map.count++;
+            i++;
+        } else if (start <= r->start && end >= r->end) {
+            // Covers it all: remove
+            memmove(r, r + 1, (mem_map.count - i - 1) * sizeof(*r));
+            mem_map.count--;
+            i--;
+        } else if (start <= r->start) {
+            r->start = end;
+        } else {
+            r->end = start;
+        }
+    }
+}
+
+/**
+ * Recompute usable_bytes.
+ */
+static void count_usable(void) {
+    mem_map.usable_bytes = 0;
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        mem_map.usable_bytes += mem_map.usable[i].end - mem_map.usable[i].start;
+    }
+}
+
+/**
+ * Build the usable memory map from the loader's E820 entries.
+ */
+void init_memmap(const struct BootInfo *boot_info) {
+    memset(&mem_map, 0, sizeof(mem_map));
+
+    if (boot_info == NULL || boot_info->magic != BOOTINFO_MAGIC) {
+        log_message(LOG_ERROR, "memmap: no boot info from the loader\n");
+        return;
+    }
+
+    uint32_t count = boot_info->e820_count;
+    if (count > E820_MAX) {
+        count = E820_MAX;
+    }
+    memcpy(mem_map.e820, (const void *)boot_info->e820_map, count * sizeof(struct E820Entry));
+    mem_map.e820_count = count;
+
+    // Whole pages of every usable entry
+    for (uint32_t i = 0; i < count; i++) {
+        const struct E820Entry *e = &mem_map.e820[i];
+        if (e->type == E820_USABLE && e->length != 0) {
+            add_range(page_ceil(e->base), page_floor(e->base + e->length));
+        }
+    }
+    sort_and_merge();
+
+    // Anything the firmware also reports as something else isn't RAM we own
+    for (uint32_t i = 0; i < count; i++) {
+        const struct E820Entry *e = &mem_map.e820[i];
+        if (e->type != E820_USABLE && e->length != 0) {
+            cut_range(e->base, e->base + e->length);
+        }
+    }
+
+    // Ranges the boot code and the kernel live in
+    cut_range(0, LOW_MEMORY_END);
+    cut_range(KERNEL_STACK_BASE, KERNEL_BASE);
+    cut_range(KERNEL_BASE, (uint64_t)__kernel_end);
+
+    // Only what the direct map covers
+    while (mem_map.count > 0 && mem_map.usable[mem_map.count - 1].start >= PHYS_MAPPED_LIMIT) {
+        mem_map.count--;
+    }
+    if (mem_map.count > 0 && mem_map.usable[mem_map.count - 1].end > PHYS_MAPPED_LIMIT) {
+        mem_map.usable[mem_map.count - 1].end = PHYS_MAPPED_LIMIT;
+    }
+
+    count_usable();
+}
+
+/**
+ * Carve a boot-time table out of the usable ranges.
+ */
+uint64_t memmap_reserve(uint64_t size) {
+    size = page_ceil(size);
+
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        struct MemRange *r = &mem_map.usable[i];
+        if (r->end - r->start >= size) {
+            uint64_t addr = r->start;
+            cut_range(addr, addr + size);
+            count_usable();
+            return addr;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Print the firmware map and the usable ranges.
+ */
+void print_memmap(void) {
+    static const char *types[] = { "?", "usable", "reserved", "ACPI", "ACPI NVS", "bad" };
+
+    printk("E820 map (%u entries):\n", mem_map.e820_count);
+    for (uint32_t i = 0; i < mem_map.e820_count; i++) {
+        const struct E820Entry *e = &mem_map.e820[i];
+        printk("  %016lx-%016lx %s\n", e->base, e->base + e->length - 1,
+               e->type < 6 ? types[e->type] : types[0]);
+    }
+
+    printk("Usable RAM: %lu MB in %u ranges\n", mem_map.usable_bytes >> 20, mem_map.count);
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        printk("  %016lx-%016lx\n", mem_map.usable[i].start, mem_map.usable[i].end - 1);
+    }
+}
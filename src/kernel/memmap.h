@@ -0,0 +1,82 @@
+#ifndef _MEMMAP_H_
+#define _MEMMAP_H_
+
+#include <stdint.h>
+#include "bootinfo.h"
+
+/**
+ * Page geometry.
+ */
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1ULL << PAGE_SHIFT)
+
+/**
+ * Fixed parts of the physical layout.
+ * LOW_MEMORY_END: Everything below is left alone: IVT and BIOS data, the
+ *                 AP trampoline (0x7000, smp.h), the loader, the E820
+ *                 map, the boot page tables at 0x80000 and the VGA/BIOS
+ *                 ROM area.
+ * KERNEL_STACK_BASE: Bottom of the boot CPU's stack. kernel.asm starts
+ *                    KMain with rsp at KERNEL_BASE, growing down into
+ *                    this region; its TSS RSP0 is the same address.
+ * KERNEL_BASE: Load address of the kernel image (linker.lds).
+ * PHYS_MAPPED_LIMIT: End of the direct map (paging.c), which fills the
+ *                    first PML4 entry; memory above it isn't used.
+ */
+#define LOW_MEMORY_END      0x100000ULL
+#define KERNEL_STACK_BASE   0x100000ULL
+#define KERNEL_BASE         0x200000ULL
+#define PHYS_MAPPED_LIMIT   (1ULL << 39)
+
+/**
+ * MEMMAP_MAX: Most usable ranges kept after merging and splitting.
+ */
+#define MEMMAP_MAX          64
+
+/**
+ * Physical range [start, end).
+ */
+struct MemRange {
+    uint64_t start;
+    uint64_t end;
+};
+
+/**
+ * Physical memory layout, built by init_memmap().
+ */
+struct MemMap {
+    uint32_t e820_count;                     // Entries copied from the loader
+    struct E820Entry e820[E820_MAX];         // Firmware map, as reported
+    uint32_t count;                          // Usable ranges
+    struct MemRange usable[MEMMAP_MAX];      // Sorted, merged, page aligned
+    uint64_t usable_bytes;                   // Sum of usable[]
+};
+
+extern struct MemMap mem_map;
+
+/**
+ * End of the kernel image including .bss, page aligned (linker.lds).
+ */
+extern char __kernel_end[];
+
+/**
+ * Copy the loader's E820 map and work out the usable RAM: E820 usable
+ * entries, sorted and merged, minus every other E820 entry, low memory,
+ * the boot stacks and the kernel image, clipped to PHYS_MAPPED_LIMIT.
+ */
+void init_memmap(const struct BootInfo *boot_info);
+
+/**
+ * Take `size` bytes (rounded up to pages) out of the lowest usable range
+ * that can hold them, for boot-time tables the page allocator itself
+ * needs. Only valid before init_page_alloc().
+ * @return Physical address, or 0 if no range is large enough.
+ */
+uint64_t memmap_reserve(uint64_t size);
+
+/**
+ * Print the firmware map and the usable ranges.
+ */
+void print_memmap(void);
+
+#endif  // _MEMMAP_H_
@@ -0,0 +1,339 @@
+#include "page_alloc.h"
+#include "cpu.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+#include "../lib/spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  page_alloc.c
+// ----------------------------------------------------------------------------
+//  Physical page allocator: a binary buddy system over the usable ranges
+//  of mem_map, with a per-CPU cache of single pages in front of it.
+//
+//  A free block of 2^order pages is linked into free_lists[order] through
+//  a FreeBlock header stored in the block itself, and block_order[pfn] of
+//  its first page holds order + 1. Allocation takes the smallest non-empty
+//  order at or above the one asked for (one bit scan) and splits it down;
+//  freeing merges with the buddy (pfn ^ 2^order) for as long as it is a
+//  free block of the same order. Both are O(PAGE_MAX_ORDER).
+//
+//  The first page of a block handed out by alloc_pages() or alloc_page()
+//  holds PAGE_ALLOCATED | order instead, and every other page (inside a
+//  block, or sitting in a CPU's page cache) holds 0. A free has to find
+//  PAGE_ALLOCATED with the order it passes and clears it with one
+//  compare-exchange, so freeing a page twice, a cached page, or a page
+//  inside a block is caught without taking zone_lock, even when two CPUs
+//  race to do it.
+//
+//  The buddy lists are shared and take zone_lock, an MCS lock: every CPU
+//  refilling its page cache at once queues there. Most allocations are
+//  single pages, so each CPU keeps up to PCP_HIGH of them and only goes
+//  to the lists PCP_BATCH pages at a time.
+// ----------------------------------------------------------------------------
+
+/**
+ * Header at the start of every free block.
+ */
+struct FreeBlock {
+    struct FreeBlock *next;
+    struct FreeBlock *prev;
+};
+
+/**
+ * block_order[] tag for the first page of an allocated block.
+ */
+#define PAGE_ALLOCATED      0x80
+
+static struct FreeBlock free_lists[PAGE_MAX_ORDER + 1];    // Circular, sentinel heads
+static uint64_t free_blocks[PAGE_MAX_ORDER + 1];           // Blocks per order
+static uint32_t nonempty_orders;                           // Bit n: free_lists[n] has blocks
+static uint64_t buddy_free_pages;
+
+static uint8_t *block_order;                               // Indexed by pfn, see above
+static uint64_t max_pfn;
+
+static struct McsLock zone_lock;
+static struct PageCache page_caches[MAX_CPUS];
+
+static inline struct FreeBlock *pfn_to_block(uint64_t pfn) {
+    return (struct FreeBlock *)(pfn << PAGE_SHIFT);
+}
+
+static inline uint64_t block_to_pfn(const struct FreeBlock *block) {
+    return (uint64_t)block >> PAGE_SHIFT;
+}
+
+/**
+ * Link a free block into its list.
+ */
+static void list_add(uint64_t pfn, uint32_t order) {
+    struct FreeBlock *head = &free_lists[order];
+    struct FreeBlock *block = pfn_to_block(pfn);
+
+    block->next = head->next;
+    block->prev = head;
+    head->next->prev = block;
+    head->next = block;
+
+    block_order[pfn] = (uint8_t)(order + 1);
+    free_blocks[order]++;
+    nonempty_orders |= 1U << order;
+    buddy_free_pages += 1ULL << order;
+}
+
+/**
+ * Unlink a free block from its list.
+ */
+static void list_del(uint64_t pfn, uint32_t order) {
+    struct FreeBlock *block = pfn_to_block(pfn);
+
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+
+    block_order[pfn] = 0;
+    if (--free_blocks[order] == 0) {
+        nonempty_orders &= ~(1U << order);
+    }
+    buddy_free_pages -= 1ULL << order;
+}
+
+/**
+ * Take a block of 2^order pages from the lists. Called locked.
+ * @return First pfn, or 0 if nothing is free.
+ */
+static uint64_t buddy_alloc(uint32_t order) {
+    uint32_t avail = nonempty_orders & ~((1U << order) - 1);
+
+    if (avail == 0) {
+        return 0;
+    }
+
+    uint32_t found = (uint32_t)__builtin_ctz(avail);
+    uint64_t pfn = block_to_pfn(free_lists[found].next);
+    list_del(pfn, found);
+
+    // Give back the upper half at each step down
+    while (found > order) {
+        found--;
+        list_add(pfn + (1ULL << found), found);
+    }
+    return pfn;
+}
+
+/**
+ * Return a block to the lists, merging it with free buddies. Called locked.
+ */
+static void buddy_free(uint64_t pfn, uint32_t order) {
+    while (order < PAGE_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+
+        if (buddy >= max_pfn || block_order[buddy] != order + 1) {
+            break;
+        }
+        list_del(buddy, order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+    list_add(pfn, order);
+}
+
+/**
+ * Tag a block as handed out, so that exactly one free of it is accepted.
+ */
+static inline void mark_allocated(uint64_t pfn, uint32_t order) {
+    __atomic_store_n(&block_order[pfn], (uint8_t)(PAGE_ALLOCATED | order), __ATOMIC_RELAXED);
+}
+
+/**
+ * Check a block handed to free_pages() or free_page() and take its
+ * allocated tag, so a second free of it fails.
+ */
+static int claim_block(uint64_t addr, uint32_t order) {
+    uint64_t pfn = addr >> PAGE_SHIFT;
+
+    if (order > PAGE_MAX_ORDER || (pfn & ((1ULL << order) - 1)) != 0 ||
+        (addr & (PAGE_SIZE - 1)) != 0 || pfn + (1ULL << order) > max_pfn) {
+        log_message(LOG_ERROR, "page_alloc: bad free of %#lx order %u\n", addr, order);
+        return 0;
+    }
+
+    uint8_t expected = (uint8_t)(PAGE_ALLOCATED | order);
+    if (!__atomic_compare_exchange_n(&block_order[pfn], &expected, 0, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        if (expected & PAGE_ALLOCATED) {
+            log_message(LOG_ERROR, "page_alloc: free of %#lx as order %u, allocated as order %u\n",
+                        addr, order, expected & ~PAGE_ALLOCATED);
+        } else {
+            log_message(LOG_ERROR, "page_alloc: double free of %#lx (not allocated)\n", addr);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Build the free lists from mem_map.
+ */
+void init_page_alloc(void) {
+    for (uint32_t order = 0; order <= PAGE_MAX_ORDER; order++) {
+        free_lists[order].next = &free_lists[order];
+        free_lists[order].prev = &free_lists[order];
+        free_blocks[order] = 0;
+    }
+    nonempty_orders = 0;
+    buddy_free_pages = 0;
+    mcs_lock_init(&zone_lock, "zone");
+    memset(page_caches, 0, sizeof(page_caches));
+
+    max_pfn = mem_map.count ? mem_map.usable[mem_map.count - 1].end >> PAGE_SHIFT : 0;
+    block_order = (uint8_t *)memmap_reserve(max_pfn);
+    if (block_order == NULL) {
+        log_message(LOG_ERROR, "page_alloc: no room for the frame map\n");
+        max_pfn = 0;
+        return;
+    }
+    memset(block_order, 0, max_pfn);
+
+    // Each range as the largest aligned blocks that fit
+    for (uint32_t i = 0; i < mem_map.count; i++) {
+        uint64_t pfn = mem_map.usable[i].start >> PAGE_SHIFT;
+        uint64_t end = mem_map.usable[i].end >> PAGE_SHIFT;
+
+        while (pfn < end) {
+            uint32_t order = pfn ? (uint32_t)__builtin_ctzll(pfn) : PAGE_MAX_ORDER;
+            if (order > PAGE_MAX_ORDER) {
+                order = PAGE_MAX_ORDER;
+            }
+            while (pfn + (1ULL << order) > end) {
+                order--;
+            }
+            buddy_free(pfn, order);
+            pfn += 1ULL << order;
+        }
+    }
+}
+
+/**
+ * Allocate 2^order contiguous pages.
+ */
+uint64_t alloc_pages(uint32_t order) {
+    if (order == 0) {
+        return alloc_page();
+    }
+    if (order > PAGE_MAX_ORDER) {
+        return 0;
+    }
+
+    struct McsNode node;
+    uint64_t flags = mcs_lock_irqsave(&zone_lock, &node);
+    uint64_t pfn = buddy_alloc(order);
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
+
+    if (pfn != 0) {
+        mark_allocated(pfn, order);
+    }
+    return pfn << PAGE_SHIFT;
+}
+
+/**
+ * Free 2^order pages from alloc_pages().
+ */
+void free_pages(uint64_t addr, uint32_t order) {
+    if (order == 0) {
+        free_page(addr);
+        return;
+    }
+    if (!claim_block(addr, order)) {
+        return;
+    }
+
+    struct McsNode node;
+    uint64_t flags = mcs_lock_irqsave(&zone_lock, &node);
+    buddy_free(addr >> PAGE_SHIFT, order);
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
+}
+
+/**
+ * Allocate one page from this CPU's cache, refilling it when empty.
+ */
+uint64_t alloc_page(void) {
+    uint64_t flags = irq_save();
+    struct PageCache *pc = &page_caches[cpu_id() % MAX_CPUS];
+    uint64_t addr = 0;
+
+    if (pc->count == 0) {
+        struct McsNode node;
+
+        mcs_lock(&zone_lock, &node);
+        while (pc->count < PCP_BATCH) {
+            uint64_t pfn = buddy_alloc(0);
+            if (pfn == 0) {
+                break;
+            }
+            pc->pages[pc->count++] = pfn << PAGE_SHIFT;
+        }
+        mcs_unlock(&zone_lock, &node);
+    }
+
+    if (pc->count != 0) {
+        addr = pc->pages[--pc->count];
+        mark_allocated(addr >> PAGE_SHIFT, 0);
+    }
+
+    irq_restore(flags);
+    return addr;
+}
+
+/**
+ * Free one page into this CPU's cache, spilling a batch when it is full.
+ */
+void free_page(uint64_t addr) {
+    if (!claim_block(addr, 0)) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    struct PageCache *pc = &page_caches[cpu_id() % MAX_CPUS];
+
+    if (pc->count == PCP_HIGH) {
+        struct McsNode node;
+
+        mcs_lock(&zone_lock, &node);
+        for (int i = 0; i < PCP_BATCH; i++) {
+            buddy_free(pc->pages[--pc->count] >> PAGE_SHIFT, 0);
+        }
+        mcs_unlock(&zone_lock, &node);
+    }
+    pc->pages[pc->count++] = addr;
+
+    irq_restore(flags);
+}
+
+/**
+ * Count free pages, cached ones included.
+ */
+uint64_t free_page_count(void) {
+    uint64_t count = buddy_free_pages;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        count += page_caches[cpu].count;
+    }
+    return count;
+}
+
+/**
+ * Print the free blocks per order.
+ */
+void print_page_alloc_info(void) {
+    uint64_t free = free_page_count();
+
+    printk("Pages: %lu free (%lu MB), frame map %lu KB\n", free, free >> (20 - PAGE_SHIFT),
+           max_pfn >> 10);
+    printk("  order:");
+    for (uint32_t order = 0; order <= PAGE_MAX_ORDER; order++) {
+        printk(" %lu", free_blocks[order]);
+    }
+    printk("\n");
+}
@@ -0,0 +1,64 @@
+#ifndef _PAGE_ALLOC_H_
+#define _PAGE_ALLOC_H_
+
+#include <stdint.h>
+#include "memmap.h"
+
+/**
+ * Buddy allocator geometry.
+ * PAGE_MAX_ORDER: Largest block is 2^PAGE_MAX_ORDER pages (1 GB).
+ * PCP_HIGH: Pages a CPU's free-page cache holds before it gives some back.
+ * PCP_BATCH: Pages moved between a cache and the buddy lists at a time.
+ */
+#define PAGE_MAX_ORDER      18
+#define PCP_HIGH            64
+#define PCP_BATCH           16
+
+/**
+ * Per-CPU cache of free 4 KB pages. Only its own CPU touches it, with
+ * interrupts disabled, so the common alloc_page()/free_page() path takes
+ * no lock.
+ */
+struct PageCache {
+    uint32_t count;
+    uint64_t pages[PCP_HIGH];
+} __attribute__((aligned(64)));
+
+/**
+ * Hand every usable range of mem_map to the buddy allocator. Needs
+ * init_memmap().
+ */
+void init_page_alloc(void);
+
+/**
+ * Allocate 2^order physically contiguous pages, aligned to their size.
+ * O(log n) in the number of orders. Contents are not cleared.
+ * @return Physical address (identity mapped), or 0 if out of memory.
+ */
+uint64_t alloc_pages(uint32_t order);
+
+/**
+ * Free a block from alloc_pages() with the same order. A second free, a
+ * wrong order, or an address that was never allocated is logged and
+ * ignored.
+ */
+void free_pages(uint64_t addr, uint32_t order);
+
+/**
+ * Allocate / free one 4 KB page through this CPU's cache. free_page()
+ * checks its page like free_pages().
+ */
+uint64_t alloc_page(void);
+void free_page(uint64_t addr);
+
+/**
+ * Free pages in the buddy lists and all CPU caches.
+ */
+uint64_t free_page_count(void);
+
+/**
+ * Print the free blocks per order.
+ */
+void print_page_alloc_info(void);
+
+#endif  // _PAGE_ALLOC_H_
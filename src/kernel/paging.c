@@ -0,0 +1,752 @@
+#include "paging.h"
+#include "apic.h"
+#include "page_alloc.h"
+#include "slab.h"
+#include "smp.h"
+#include "trap.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+#include "../lib/spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  paging.c
+// ----------------------------------------------------------------------------
+//  Kernel page tables.
+//
+//  Virtual and physical addresses stay equal for the kernel: the first
+//  PML4 entry holds a direct (identity) map of physical memory, so the
+//  page allocator's addresses, the page tables themselves and the APIC
+//  windows are usable as they are. RAM is mapped write-back with the
+//  largest pages the CPU has; everything else in the map is uncached.
+//  Where RAM and a hole share a large page (the VGA and BIOS area below
+//  1 MB, the APIC windows next to RAM below 4 GB), it is split down to
+//  2 MB or 4 KB pages so the hole stays uncached.
+//  The kernel image is then mapped over it in 4 KB pages, so its text and
+//  read-only data can be write protected and its data kept from running.
+//
+//  All kernel mappings are global, so switching address spaces never
+//  drops them from the TLB, and every address space is tagged with a
+//  PCID, so switching back to one finds its own entries still cached.
+//
+//  map_pages() and unmap_pages() only flush the calling CPU's TLB. Adding
+//  a kernel mapping needs nothing more (demand faults fill in holes,
+//  which no TLB has cached); whoever removes one and reuses what it
+//  pointed to, like vm_release(), first calls flush_tlb_kernel_range(),
+//  which has every other CPU drop the range through a shootdown IPI and
+//  waits until all of them have.
+// ----------------------------------------------------------------------------
+
+/**
+ * Linker symbols (linker.lds): end of .text and the page-aligned start
+ * of the writable sections.
+ */
+extern char __text_end[];
+extern char __data_start[];
+
+/**
+ * LOADER_MAPPED_LIMIT: What the loader's tables cover (the first 1 GB);
+ * init_paging() must build the new tables inside it.
+ * DIRECT_MAP_MIN: The direct map reaches at least this far, to take in
+ * the APIC windows below 4 GB.
+ */
+#define LOADER_MAPPED_LIMIT 0x40000000ULL
+#define DIRECT_MAP_MIN      0x100000000ULL
+
+#define VIRT_LIMIT          (1ULL << 47)        // Lower canonical half
+#define TABLE_ENTRIES       512
+
+/**
+ * TLB_FLUSH_ALL_PAGES: Past this many pages a shootdown flushes the
+ * whole TLB instead of one INVLPG per page.
+ */
+#define TLB_FLUSH_ALL_PAGES 32
+
+/**
+ * Per-CPU PCID allocator.
+ */
+struct PcidState {
+    uint64_t generation;                        // Starts at 1
+    uint32_t next;                              // Next PCID to hand out
+} __attribute__((aligned(64)));
+
+/**
+ * The TLB shootdown in progress. One at a time, under shootdown_lock;
+ * each target clears its bit in `pending` once it has flushed.
+ */
+struct Shootdown {
+    uint64_t start;
+    uint64_t end;
+    uint32_t pending;                           // CPU mask
+    uint64_t sent;                              // Shootdowns started
+};
+
+struct AddressSpace kernel_space;
+
+static struct PcidState pcid_state[MAX_CPUS];
+static uint64_t pte_mask;                       // Flag bits the CPU accepts
+static uint64_t direct_map_end;
+static int have_1g_pages;
+static int have_pcid;
+static int paging_ready;
+static struct Spinlock shootdown_lock;
+static struct Shootdown shootdown;
+
+// Tables for init_paging(), taken before the page allocator exists
+static uint64_t boot_pool;
+static uint64_t boot_pool_end;
+
+/**
+ * Bytes mapped by one entry of a table at `level` (0: PT ... 3: PML4).
+ */
+static inline uint64_t level_size(int level) {
+    return 1ULL << (PAGE_SHIFT + 9 * level);
+}
+
+static inline uint32_t pt_index(uint64_t virt, int level) {
+    return (uint32_t)(virt >> (PAGE_SHIFT + 9 * level)) & (TABLE_ENTRIES - 1);
+}
+
+static inline uint64_t *entry_table(uint64_t entry) {
+    return (uint64_t *)(entry & PTE_ADDR_MASK);
+}
+
+static inline void invlpg(uint64_t virt) {
+    __asm__ volatile ("invlpg (%0)" : : "r" (virt) : "memory");
+}
+
+/**
+ * Get a zeroed page for a table: from the boot pool during init_paging(),
+ * from the page allocator afterwards.
+ */
+static uint64_t *alloc_table(void) {
+    uint64_t addr = 0;
+
+    if (boot_pool < boot_pool_end) {
+        addr = boot_pool;
+        boot_pool += PAGE_SIZE;
+    } else if (paging_ready) {
+        addr = alloc_page();
+    }
+
+    if (addr != 0) {
+        memset((void *)addr, 0, PAGE_SIZE);
+    }
+    return (uint64_t *)addr;
+}
+
+/**
+ * Drop a changed translation from the TLB.
+ *
+ * Kernel mappings are global, which INVLPG removes whatever PCID is
+ * loaded. A private mapping can also be cached under the address space's
+ * PCID on a CPU it isn't loaded on; forgetting those PCIDs makes the next
+ * switch to it start clean.
+ */
+static void flush_page(struct AddressSpace *as, uint64_t virt) {
+    if (as == &kernel_space || pt_index(virt, 3) < KERNEL_PML4_SLOTS) {
+        invlpg(virt);
+        return;
+    }
+
+    uint32_t cpu = cpu_id() % MAX_CPUS;
+    int loaded = (read_cr3() & PTE_ADDR_MASK) == (uint64_t)as->pml4;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i != cpu || !loaded) {
+            as->pcid_gen[i] = 0;
+        }
+    }
+    if (loaded) {
+        invlpg(virt);
+    }
+}
+
+/**
+ * Drop [start, end) from this CPU's TLB, global entries included.
+ */
+static void flush_local_range(uint64_t start, uint64_t end) {
+    if ((end - start) >> PAGE_SHIFT > TLB_FLUSH_ALL_PAGES) {
+        // Toggling CR4.PGE flushes every entry of every PCID
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 ^ CR4_PGE);
+        write_cr4(cr4);
+        return;
+    }
+    for (uint64_t virt = start; virt < end; virt += PAGE_SIZE) {
+        invlpg(virt);
+    }
+}
+
+/**
+ * Do this CPU's part of the shootdown in progress, if it has one.
+ */
+static void shootdown_answer(void) {
+    uint32_t bit = 1u << cpu_id();
+
+    if (__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE) & bit) {
+        flush_local_range(shootdown.start, shootdown.end);
+        __atomic_fetch_and(&shootdown.pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * TLB shootdown IPI.
+ */
+static void tlb_shootdown_ipi(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    shootdown_answer();
+    eoi();
+}
+
+/**
+ * Install the shootdown IPI handler.
+ */
+void init_tlb_shootdown(void) {
+    spin_lock_init(&shootdown_lock, "tlb shootdown");
+    memset(&shootdown, 0, sizeof(shootdown));
+    register_irq_handler(TLB_SHOOTDOWN_VECTOR, tlb_shootdown_ipi, NULL);
+}
+
+/**
+ * Flush a range of kernel mappings from every CPU's TLB.
+ */
+void flush_tlb_kernel_range(uint64_t start, uint64_t end) {
+    start &= ~(PAGE_SIZE - 1);
+    if (end <= start) {
+        return;
+    }
+
+    // Interrupts stay off to keep this on one CPU; while spinning, this
+    // CPU still answers the shootdowns of others, which may be waiting
+    // for it with theirs off too
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_id();
+    uint32_t targets = 0;
+
+    flush_local_range(start, end);
+
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (cpu != self && __atomic_load_n(&per_cpu[cpu].online, __ATOMIC_ACQUIRE)) {
+            targets |= 1u << cpu;
+        }
+    }
+    if (targets == 0) {
+        irq_restore(flags);
+        return;
+    }
+
+    while (!spin_trylock(&shootdown_lock)) {
+        shootdown_answer();
+        __asm__ volatile ("pause");
+    }
+    shootdown.start = start;
+    shootdown.end = end;
+    shootdown.sent++;
+    __atomic_store_n(&shootdown.pending, targets, __ATOMIC_RELEASE);
+
+    for (uint32_t mask = targets; mask != 0; mask &= mask - 1) {
+        lapic_send_ipi(per_cpu[__builtin_ctz(mask)].apic_id, TLB_SHOOTDOWN_VECTOR);
+    }
+    while (__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE) != 0) {
+        __asm__ volatile ("pause");
+    }
+
+    spin_unlock(&shootdown_lock);
+    irq_restore(flags);
+}
+
+/**
+ * Replace the huge page in `entry` (a table entry at `level`) by a table
+ * of the next level mapping the same memory with the same flags.
+ */
+static int split_huge(struct AddressSpace *as, uint64_t *entry, int level, uint64_t virt) {
+    uint64_t *table = alloc_table();
+
+    if (table == NULL) {
+        return -1;
+    }
+
+    uint64_t size = level_size(level - 1);
+    uint64_t phys = *entry & PTE_ADDR_MASK & ~(level_size(level) - 1);
+    uint64_t flags = *entry & ~PTE_ADDR_MASK;
+    if (level - 1 == 0) {
+        flags &= ~PTE_HUGE;                     // Bit 7 is PAT in a PTE
+    }
+
+    for (uint32_t i = 0; i < TABLE_ENTRIES; i++) {
+        table[i] = (phys + i * size) | flags;
+    }
+    *entry = (uint64_t)table | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+
+    // The translation is unchanged, but the old large TLB entry must go
+    flush_page(as, virt & ~(level_size(level) - 1));
+    return 0;
+}
+
+/**
+ * Find the entry for `virt` in the table at `level`, creating missing
+ * tables and splitting huge pages above it.
+ * @return The entry, or NULL when a table can't be allocated.
+ */
+static uint64_t *walk_create(struct AddressSpace *as, uint64_t virt, int level, uint64_t user) {
+    uint64_t *table = as->pml4;
+
+    for (int l = 3; l > level; l--) {
+        uint64_t *entry = &table[pt_index(virt, l)];
+
+        if (!(*entry & PTE_PRESENT)) {
+            uint64_t *next = alloc_table();
+            if (next == NULL) {
+                return NULL;
+            }
+            *entry = (uint64_t)next | PTE_PRESENT | PTE_WRITE;
+        } else if (*entry & PTE_HUGE) {
+            if (split_huge(as, entry, l, virt) != 0) {
+                return NULL;
+            }
+        }
+        *entry |= user;
+        table = entry_table(*entry);
+    }
+    return &table[pt_index(virt, level)];
+}
+
+/**
+ * Map a range with the largest pages its alignment allows.
+ */
+int map_pages(struct AddressSpace *as, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    if (((virt | phys | size) & (PAGE_SIZE - 1)) != 0 || virt + size > VIRT_LIMIT || virt + size < virt) {
+        log_message(LOG_ERROR, "paging: bad mapping %#lx -> %#lx size %#lx\n", virt, phys, size);
+        return -1;
+    }
+
+    // Kernel slots appear in every address space: keep them global
+    if (pt_index(virt, 3) < KERNEL_PML4_SLOTS) {
+        flags |= PTE_GLOBAL;
+    }
+    flags = (flags | PTE_PRESENT) & pte_mask & ~PTE_HUGE;
+
+    while (size != 0) {
+        int level = 0;
+        if (have_1g_pages && ((virt | phys) & (PAGE_SIZE_1G - 1)) == 0 && size >= PAGE_SIZE_1G) {
+            level = 2;
+        } else if (((virt | phys) & (PAGE_SIZE_2M - 1)) == 0 && size >= PAGE_SIZE_2M) {
+            level = 1;
+        }
+
+        uint64_t *entry;
+        for (;;) {
+            entry = walk_create(as, virt, level, flags & PTE_USER);
+            if (entry == NULL) {
+                log_message(LOG_ERROR, "paging: out of memory for page tables\n");
+                return -1;
+            }
+            // A table is already there: fill it in rather than drop it
+            if (level == 0 || !(*entry & PTE_PRESENT) || (*entry & PTE_HUGE)) {
+                break;
+            }
+            level--;
+        }
+
+        uint64_t was_present = *entry & PTE_PRESENT;
+        *entry = phys | flags | (level ? PTE_HUGE : 0);
+        if (was_present) {
+            flush_page(as, virt);
+        }
+
+        virt += level_size(level);
+        phys += level_size(level);
+        size -= level_size(level);
+    }
+    return 0;
+}
+
+/**
+ * Clear a range, splitting huge pages that reach outside it.
+ */
+int unmap_pages(struct AddressSpace *as, uint64_t virt, uint64_t size) {
+    if (((virt | size) & (PAGE_SIZE - 1)) != 0 || virt + size > VIRT_LIMIT || virt + size < virt) {
+        log_message(LOG_ERROR, "paging: bad unmap %#lx size %#lx\n", virt, size);
+        return -1;
+    }
+
+    uint64_t end = virt + size;
+
+    while (virt < end) {
+        uint64_t *table = as->pml4;
+
+        for (int level = 3;; level--) {
+            uint64_t *entry = &table[pt_index(virt, level)];
+            uint64_t span = level_size(level);
+            uint64_t next = (virt & ~(span - 1)) + span;
+
+            if (!(*entry & PTE_PRESENT)) {
+                virt = next;
+                break;
+            }
+            if (level == 0 || (*entry & PTE_HUGE)) {
+                if (level == 0 || ((virt & (span - 1)) == 0 && next <= end)) {
+                    *entry = 0;
+                    flush_page(as, virt);
+                    virt = next;
+                    break;
+                }
+                if (split_huge(as, entry, level, virt) != 0) {
+                    log_message(LOG_ERROR, "paging: out of memory for page tables\n");
+                    return -1;
+                }
+            }
+            table = entry_table(*entry);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Walk the tables for one address.
+ */
+uint64_t virt_to_phys(const struct AddressSpace *as, uint64_t virt) {
+    const uint64_t *table = as->pml4;
+
+    for (int level = 3; level >= 0; level--) {
+        uint64_t entry = table[pt_index(virt, level)];
+
+        if (!(entry & PTE_PRESENT)) {
+            return 0;
+        }
+        if (level == 0 || (entry & PTE_HUGE)) {
+            uint64_t span = level_size(level);
+            return (entry & PTE_ADDR_MASK & ~(span - 1)) | (virt & (span - 1));
+        }
+        table = entry_table(entry);
+    }
+    return 0;
+}
+
+/**
+ * How much of a physical range is RAM or ACPI tables in the E820 map.
+ */
+enum RamCover {
+    RAM_NONE,
+    RAM_PART,
+    RAM_ALL,
+};
+
+static inline int is_ram(const struct E820Entry *e) {
+    return e->type == E820_USABLE || e->type == E820_ACPI || e->type == E820_NVS;
+}
+
+static enum RamCover range_ram_cover(uint64_t start, uint64_t end) {
+    int overlap = 0;
+
+    for (uint32_t i = 0; i < mem_map.e820_count && !overlap; i++) {
+        const struct E820Entry *e = &mem_map.e820[i];
+        overlap = is_ram(e) && e->base < end && e->base + e->length > start;
+    }
+    if (!overlap) {
+        return RAM_NONE;
+    }
+
+    // Walk from start through the entries covering each point in turn
+    // (E820 entries may overlap or touch); a gap makes it partial
+    for (uint64_t pos = start; pos < end;) {
+        uint64_t next = pos;
+
+        for (uint32_t i = 0; i < mem_map.e820_count; i++) {
+            const struct E820Entry *e = &mem_map.e820[i];
+            if (is_ram(e) && e->base <= pos && e->base + e->length > next) {
+                next = e->base + e->length;
+            }
+        }
+        if (next == pos) {
+            return RAM_PART;
+        }
+        pos = next;
+    }
+    return RAM_ALL;
+}
+
+/**
+ * Page sizes map_direct() starts from: level 2 (1 GB) or 1 (2 MB).
+ */
+static inline int direct_map_level(void) {
+    return have_1g_pages ? 2 : 1;
+}
+
+/**
+ * Tables map_direct_range() adds to split chunks of [start, end) that are
+ * part RAM, part hole.
+ */
+static uint64_t direct_split_tables(uint64_t start, uint64_t end, int level) {
+    uint64_t size = level_size(level);
+    uint64_t tables = 0;
+
+    for (uint64_t addr = start; level > 0 && addr < end; addr += size) {
+        if (range_ram_cover(addr, addr + size) == RAM_PART) {
+            tables += 1 + direct_split_tables(addr, addr + size, level - 1);
+        }
+    }
+    return tables;
+}
+
+/**
+ * Map [start, end) at its own address in pages of `level`: RAM
+ * write-back, holes uncached. A page that would hold both is split into
+ * pages of the next level down; at 4 KB, one with any RAM is RAM.
+ */
+static int map_direct_range(uint64_t start, uint64_t end, int level) {
+    uint64_t size = level_size(level);
+
+    for (uint64_t addr = start; addr < end; addr += size) {
+        enum RamCover cover = range_ram_cover(addr, addr + size);
+
+        if (cover == RAM_PART && level > 0) {
+            if (map_direct_range(addr, addr + size, level - 1) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        uint64_t flags = cover != RAM_NONE ? PTE_WRITE : PAGE_KERNEL_MMIO;
+        if (map_pages(&kernel_space, addr, addr, size, flags) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Map physical memory at its own address: RAM write-back, holes uncached.
+ */
+static int map_direct(void) {
+    return map_direct_range(0, direct_map_end, direct_map_level());
+}
+
+/**
+ * Remap the kernel image in 4 KB pages: text executable and read-only,
+ * read-only data, then data and .bss not executable.
+ */
+static int map_kernel_image(void) {
+    uint64_t text_end = ((uint64_t)__text_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t data_start = (uint64_t)__data_start;
+    uint64_t image_end = (uint64_t)__kernel_end;
+
+    if (map_pages(&kernel_space, KERNEL_BASE, KERNEL_BASE, text_end - KERNEL_BASE, PAGE_KERNEL_RX) != 0 ||
+        map_pages(&kernel_space, text_end, text_end, data_start - text_end, PAGE_KERNEL_RO) != 0 ||
+        map_pages(&kernel_space, data_start, data_start, image_end - data_start, PAGE_KERNEL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Build the kernel tables and load them.
+ */
+void init_paging(void) {
+    have_1g_pages = cpu_has(X86_FEATURE_PDPE1GB);
+    have_pcid = cpu_has(X86_FEATURE_PCID);
+    paging_ready = 0;
+
+    pte_mask = ~PTE_ADDR_MASK;
+    if (cpu_has(X86_FEATURE_NX)) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    } else {
+        pte_mask &= ~PTE_NX;
+    }
+
+    memset(&kernel_space, 0, sizeof(kernel_space));
+    memset(pcid_state, 0, sizeof(pcid_state));
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        pcid_state[cpu].generation = 1;
+        pcid_state[cpu].next = 1;
+    }
+
+    direct_map_end = DIRECT_MAP_MIN;
+    for (uint32_t i = 0; i < mem_map.e820_count; i++) {
+        const struct E820Entry *e = &mem_map.e820[i];
+        if (e->type == E820_USABLE && e->base + e->length > direct_map_end) {
+            direct_map_end = e->base + e->length;
+        }
+    }
+    direct_map_end = (direct_map_end + PAGE_SIZE_1G - 1) & ~(PAGE_SIZE_1G - 1);
+    if (direct_map_end > PHYS_MAPPED_LIMIT) {
+        direct_map_end = PHYS_MAPPED_LIMIT;
+    }
+
+    // PML4, a PDPT per kernel slot, a PD per GB (one for the kernel's GB
+    // with 1 GB pages), the PTs under the kernel image and the tables
+    // splitting pages that hold both RAM and holes
+    uint64_t image_pts = (((uint64_t)__kernel_end + PAGE_SIZE_2M - 1) >> 21) - (KERNEL_BASE >> 21);
+    uint64_t tables = 1 + KERNEL_PML4_SLOTS + (have_1g_pages ? 1 : direct_map_end >> 30) + image_pts +
+                      direct_split_tables(0, direct_map_end, direct_map_level());
+
+    boot_pool = memmap_reserve(tables * PAGE_SIZE);
+    boot_pool_end = boot_pool + tables * PAGE_SIZE;
+    if (boot_pool == 0 || boot_pool_end > LOADER_MAPPED_LIMIT) {
+        log_message(LOG_PANIC, "paging: no room for %lu page tables below 1 GB\n", tables);
+        boot_pool = boot_pool_end = 0;
+        return;
+    }
+
+    // Every kernel slot gets its PDPT now, so address spaces created
+    // later share whatever is mapped under it
+    kernel_space.pml4 = alloc_table();
+    for (uint32_t i = 0; i < KERNEL_PML4_SLOTS; i++) {
+        kernel_space.pml4[i] = (uint64_t)alloc_table() | PTE_PRESENT | PTE_WRITE;
+    }
+    if (map_direct() != 0 || map_kernel_image() != 0) {
+        log_message(LOG_PANIC, "paging: can't build the kernel page tables\n");
+        return;
+    }
+
+    write_cr3((uint64_t)kernel_space.pml4);
+    paging_init_cpu();
+
+    boot_pool = boot_pool_end = 0;
+    paging_ready = 1;
+}
+
+/**
+ * Enable the paging features on the calling CPU.
+ */
+void paging_init_cpu(void) {
+    if (pte_mask & PTE_NX) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    }
+
+    // Global pages (every x86-64 CPU has them), then PCIDs, which need
+    // the CR3 PCID field to be 0 when turned on
+    write_cr4(read_cr4() | CR4_PGE);
+    if (have_pcid) {
+        write_cr4(read_cr4() | CR4_PCIDE);
+    }
+    write_cr0(read_cr0() | CR0_WP);
+}
+
+/**
+ * Free the tables under `table` (at `level`), then the table itself.
+ */
+static void free_table(uint64_t *table, int level) {
+    if (level > 0) {
+        for (uint32_t i = 0; i < TABLE_ENTRIES; i++) {
+            if ((table[i] & PTE_PRESENT) && !(table[i] & PTE_HUGE)) {
+                free_table(entry_table(table[i]), level - 1);
+            }
+        }
+    }
+    free_page((uint64_t)table);
+}
+
+/**
+ * New address space with the kernel slots of kernel_space.
+ */
+struct AddressSpace *address_space_create(void) {
+    struct AddressSpace *as = kmalloc(sizeof(*as));
+
+    if (as == NULL) {
+        return NULL;
+    }
+    memset(as, 0, sizeof(*as));
+
+    as->pml4 = alloc_table();
+    if (as->pml4 == NULL) {
+        kfree(as);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < KERNEL_PML4_SLOTS; i++) {
+        as->pml4[i] = kernel_space.pml4[i];
+    }
+    return as;
+}
+
+/**
+ * Free the private half of an address space.
+ */
+void address_space_destroy(struct AddressSpace *as) {
+    if (as == NULL || as == &kernel_space) {
+        return;
+    }
+
+    for (uint32_t i = KERNEL_PML4_SLOTS; i < TABLE_ENTRIES; i++) {
+        if (as->pml4[i] & PTE_PRESENT) {
+            free_table(entry_table(as->pml4[i]), 2);
+        }
+    }
+    free_page((uint64_t)as->pml4);
+    kfree(as);
+}
+
+/**
+ * Load an address space, reusing its PCID on this CPU when still valid.
+ */
+void switch_address_space(struct AddressSpace *as) {
+    uint64_t flags = irq_save();
+    uint64_t cr3 = (uint64_t)as->pml4;
+
+    if (have_pcid && as != &kernel_space) {
+        uint32_t cpu = cpu_id() % MAX_CPUS;
+        struct PcidState *ps = &pcid_state[cpu];
+
+        if (as->pcid_gen[cpu] == ps->generation) {
+            cr3 |= as->pcid[cpu] | CR3_NOFLUSH;
+        } else {
+            // New PCID: load without NOFLUSH to drop what an earlier
+            // owner of the same number left behind
+            if (ps->next > PCID_MAX) {
+                ps->generation++;
+                ps->next = 1;
+            }
+            as->pcid[cpu] = (uint16_t)ps->next++;
+            as->pcid_gen[cpu] = ps->generation;
+            cr3 |= as->pcid[cpu];
+        }
+    } else if (have_pcid) {
+        // PCID 0 only ever caches global kernel mappings
+        cr3 |= CR3_NOFLUSH;
+    }
+
+    write_cr3(cr3);
+    irq_restore(flags);
+}
+
+/**
+ * Count the leaf entries of each size under a table.
+ */
+static void count_pages(const uint64_t *table, int level, uint64_t counts[3]) {
+    for (uint32_t i = 0; i < TABLE_ENTRIES; i++) {
+        if (!(table[i] & PTE_PRESENT)) {
+            continue;
+        }
+        if (level == 0 || (table[i] & PTE_HUGE)) {
+            counts[level]++;
+        } else {
+            count_pages(entry_table(table[i]), level - 1, counts);
+        }
+    }
+}
+
+/**
+ * Print the kernel mappings by page size.
+ */
+void print_paging_info(void) {
+    uint64_t counts[3] = { 0, 0, 0 };
+
+    if (!paging_ready) {
+        printk("Paging: loader tables\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < KERNEL_PML4_SLOTS; i++) {
+        if (kernel_space.pml4[i] & PTE_PRESENT) {
+            count_pages(entry_table(kernel_space.pml4[i]), 2, counts);
+        }
+    }
+
+    printk("Paging: direct map %lu GB in %s pages, %lu x 1G, %lu x 2M, %lu x 4K\n",
+           direct_map_end >> 30, have_1g_pages ? "1 GB" : "2 MB", counts[2], counts[1], counts[0]);
+    printk("  global pages, PCID %s, NX %s, %lu TLB shootdowns\n", have_pcid ? "on" : "off",
+           (pte_mask & PTE_NX) ? "on" : "off", shootdown.sent);
+}
@@ -0,0 +1,163 @@
+#ifndef _PAGING_H_
+#define _PAGING_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "memmap.h"
+
+/**
+ * Page table entry bits.
+ * PTE_HUGE: In a PDPT entry a 1 GB page, in a PD entry a 2 MB page.
+ * PTE_NX: Only honoured once init_paging() has set EFER.NXE; map_pages()
+ *         drops it on CPUs without NX.
+ */
+#define PTE_PRESENT         (1ULL << 0)
+#define PTE_WRITE           (1ULL << 1)
+#define PTE_USER            (1ULL << 2)
+#define PTE_PWT             (1ULL << 3)
+#define PTE_PCD             (1ULL << 4)
+#define PTE_ACCESSED        (1ULL << 5)
+#define PTE_DIRTY           (1ULL << 6)
+#define PTE_HUGE            (1ULL << 7)
+#define PTE_GLOBAL          (1ULL << 8)
+#define PTE_NX              (1ULL << 63)
+#define PTE_ADDR_MASK       0x000FFFFFFFFFF000ULL
+
+/**
+ * Protections for map_pages().
+ * PAGE_KERNEL: Read/write data, shared by every address space.
+ * PAGE_KERNEL_RX: Kernel text.
+ * PAGE_KERNEL_RO: Read-only data.
+ * PAGE_KERNEL_MMIO: Device registers: uncached, never executed.
+ */
+#define PAGE_KERNEL         (PTE_WRITE | PTE_GLOBAL | PTE_NX)
+#define PAGE_KERNEL_RX      (PTE_GLOBAL)
+#define PAGE_KERNEL_RO      (PTE_GLOBAL | PTE_NX)
+#define PAGE_KERNEL_MMIO    (PTE_WRITE | PTE_GLOBAL | PTE_NX | PTE_PCD | PTE_PWT)
+
+/**
+ * TLB_SHOOTDOWN_VECTOR: IPI asking other CPUs to flush kernel mappings
+ * (flush_tlb_kernel_range()).
+ */
+#define TLB_SHOOTDOWN_VECTOR 0xF3
+
+/**
+ * Page sizes the tables can map.
+ */
+#define PAGE_SIZE_2M        (1ULL << 21)
+#define PAGE_SIZE_1G        (1ULL << 30)
+
+/**
+ * Address space layout.
+ * KERNEL_PML4_SLOTS: The first PML4 entries belong to the kernel and are
+ *                    shared by every address space; the rest of each
+ *                    PML4 is private to its owner. Slot 0 holds the
+ *                    direct map and the kernel image, slot 1 (from
+ *                    KERNEL_VIRT_BASE) kernel mappings of their own.
+ * PCID_MAX: Largest PCID the CPU can tag TLB entries with. PCID 0 is
+ *           the kernel address space's.
+ */
+#define KERNEL_PML4_SLOTS   2
+#define KERNEL_VIRT_BASE    (1ULL << 39)
+#define KERNEL_VIRT_END     (2ULL << 39)
+#define PCID_MAX            4095
+
+/**
+ * AddressSpace: a PML4 plus the PCID it is tagged with on each CPU.
+ *
+ * PCIDs are handed out per CPU as an address space is switched to. A
+ * PCID is only valid while pcid_gen matches its CPU's generation; once
+ * the CPU runs out and starts a new generation, the next switch picks a
+ * fresh PCID and flushes whatever the CPU still had cached for it.
+ */
+struct AddressSpace {
+    uint64_t *pml4;                         // Physical (identity mapped)
+    uint16_t pcid[MAX_CPUS];
+    uint64_t pcid_gen[MAX_CPUS];            // 0: no PCID on that CPU
+};
+
+extern struct AddressSpace kernel_space;
+
+/**
+ * Build the kernel page tables and switch to them: a direct map of
+ * physical memory from 0 to the end of RAM (at least 4 GB, so the APIC
+ * windows are covered) with 1 GB pages where the CPU has them and 2 MB
+ * pages otherwise (smaller where RAM and uncached holes meet), then the
+ * kernel image in 4 KB pages with its text read-only. Turns on global
+ * pages, PCIDs, NX and write protection as far as the CPU supports them.
+ * Call after init_memmap() and before init_page_alloc(): its tables come
+ * from memmap_reserve().
+ */
+void init_paging(void);
+
+/**
+ * Turn on NX, global pages, PCIDs and write protection on the calling
+ * CPU, as far as init_paging() found them. For the other CPUs, which
+ * load kernel_space.pml4 themselves as they start.
+ */
+void paging_init_cpu(void);
+
+/**
+ * Map [virt, virt + size) to [phys, phys + size) with `flags` (PTE_*
+ * bits, PTE_PRESENT implied). Addresses and size need only be 4 KB
+ * aligned; the largest page size alignment allows is used, and huge
+ * pages already in the way are split. Existing mappings are replaced.
+ * @return 0 on success, -1 on bad arguments or when a table can't be
+ *         allocated (the range is then partly mapped).
+ */
+int map_pages(struct AddressSpace *as, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+
+/**
+ * Remove the mappings of [virt, virt + size), splitting huge pages that
+ * straddle an end, and flush them from the TLB. Page tables stay.
+ * @return 0 on success, -1 on bad arguments or when a split fails.
+ */
+int unmap_pages(struct AddressSpace *as, uint64_t virt, uint64_t size);
+
+/**
+ * Translate a virtual address.
+ * @return Physical address, or 0 if it isn't mapped.
+ */
+uint64_t virt_to_phys(const struct AddressSpace *as, uint64_t virt);
+
+/**
+ * Create an address space that shares the kernel's mappings.
+ * @return The address space, or NULL if out of memory.
+ */
+struct AddressSpace *address_space_create(void);
+
+/**
+ * Free an address space and its private page tables. It must not be
+ * loaded on any CPU.
+ */
+void address_space_destroy(struct AddressSpace *as);
+
+/**
+ * Load an address space on this CPU. With PCIDs its TLB entries from
+ * earlier runs survive, so switching back costs no flush.
+ */
+void switch_address_space(struct AddressSpace *as);
+
+/**
+ * Install the TLB shootdown IPI handler. Call after init_idt() and
+ * before init_smp().
+ */
+void init_tlb_shootdown(void);
+
+/**
+ * Drop [start, end) of the kernel mappings from the TLB of every online
+ * CPU, and return once all of them have. Call it after unmapping kernel
+ * memory and before reusing the frames it mapped: until then other CPUs
+ * can still reach them through stale entries.
+ *
+ * May be called with interrupts off, but not holding a spinlock that
+ * other CPUs take with interrupts off: they would not answer the IPI.
+ */
+void flush_tlb_kernel_range(uint64_t start, uint64_t end);
+
+/**
+ * Print the page sizes in use and the CPU features paging relies on.
+ */
+void print_paging_info(void);
+
+#endif  // _PAGING_H_
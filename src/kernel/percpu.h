@@ -0,0 +1,116 @@
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+
+struct Thread;
+
+/**
+ * GDT layout, the same on every CPU (and in kernel.asm's boot GDT).
+ * 0x18 is a ring 3 data segment kept for user mode; the TSS descriptor
+ * takes two entries.
+ */
+#define KERNEL_CS           0x08
+#define KERNEL_DS           0x10
+#define TSS_SELECTOR        0x20
+#define GDT_ENTRIES         7
+
+/**
+ * Interrupt stack table slots (TSS.ist[n - 1]). These exceptions switch
+ * to a known good stack whatever the state of the current one, so a
+ * kernel stack overflow ends in a readable double fault report.
+ */
+#define IST_DOUBLE_FAULT    1
+#define IST_NMI             2
+#define IST_MACHINE_CHECK   3
+#define IST_COUNT           3
+
+/**
+ * Stack sizes. The boot CPU keeps its boot stack (below KERNEL_BASE);
+ * the other CPUs get theirs from vm_reserve(), with guard pages.
+ */
+#define KERNEL_STACK_SIZE   (16 * 1024)
+#define IST_STACK_SIZE      (8 * 1024)
+
+/**
+ * 64-bit task state segment. Only the stack pointers are used.
+ */
+struct Tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];                    // Stack for entry from ring 0-2
+    uint64_t reserved1;
+    uint64_t ist[7];                    // Interrupt stack table
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;                // No I/O bitmap: the TSS limit
+} __attribute__((packed));
+
+/**
+ * PerCpu: everything one CPU owns, found through its GS_BASE.
+ *
+ * Only the owning CPU writes its fields (other CPUs may read them), so
+ * counters are updated with plain read-modify-write instructions on
+ * %gs: one instruction can't be split by an interrupt, and no other CPU
+ * races with it. `self` and `cpu` must stay first: cpu_id() reads
+ * PERCPU_CPU_OFFSET directly, and lib.asm reads `trap_depth` at
+ * PERCPU_TRAP_DEPTH_OFFSET.
+ */
+struct PerCpu {
+    struct PerCpu *self;                // This structure, for this_cpu()
+    uint32_t cpu;                       // Index (0: boot CPU)
+    uint32_t apic_id;
+    uint64_t stack_top;                 // Idle stack, also TSS.rsp[0]
+    volatile uint32_t online;           // Set once the CPU is running
+    uint64_t idle_wakeups;              // Times the idle loop left HLT
+    struct Thread *current;             // Thread running here (sched.c)
+    uint32_t need_resched;              // Switch threads on interrupt exit
+    uint32_t trap_depth;                // handler() calls in progress
+    struct Thread *fpu_owner;           // Thread whose state the FPU registers hold
+    uint32_t fpu_ts;                    // CR0.TS as last written (fpu.c)
+    uint32_t fpu_kernel;                // kernel_fpu_begin() sections open
+    uint64_t fpu_restores;              // Lazy restores (#NM)
+    uint64_t fpu_saves;                 // States saved on switch-out
+    uint64_t gdt[GDT_ENTRIES];
+    struct Tss tss;
+} __attribute__((aligned(64)));
+
+extern struct PerCpu per_cpu[MAX_CPUS];
+
+/**
+ * Access a field of the calling CPU's PerCpu through %gs.
+ * The add/inc forms are single instructions and need no LOCK prefix:
+ * the field belongs to this CPU, and an interrupt lands either before or
+ * after the update.
+ */
+#define PERCPU_TYPE(field)  __typeof__(((struct PerCpu *)0)->field)
+
+#define this_cpu_read(field) ({                                         \
+    PERCPU_TYPE(field) val_;                                            \
+    __asm__ volatile ("mov %%gs:%c1, %0"                                \
+                      : "=r" (val_) : "i" (offsetof(struct PerCpu, field))); \
+    val_;                                                               \
+})
+
+#define this_cpu_write(field, val)                                      \
+    __asm__ volatile ("mov %1, %%gs:%c0"                                \
+                      : : "i" (offsetof(struct PerCpu, field)),         \
+                          "r" ((PERCPU_TYPE(field))(val)) : "memory")
+
+#define this_cpu_add(field, val)                                        \
+    __asm__ volatile ("add %1, %%gs:%c0"                                \
+                      : : "i" (offsetof(struct PerCpu, field)),         \
+                          "r" ((PERCPU_TYPE(field))(val)) : "memory")
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+#define this_cpu_dec(field) this_cpu_add(field, -1)
+
+/**
+ * The calling CPU's PerCpu.
+ */
+static inline struct PerCpu *this_cpu(void) {
+    return this_cpu_read(self);
+}
+
+#endif  // _PERCPU_H_
@@ -0,0 +1,249 @@
+#include "profile.h"
+#include "apic.h"
+#include "percpu.h"
+#include "sched.h"
+#include "smp.h"
+#include "time.h"
+#include "timer.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/log.h"
+#include "../lib/print.h"
+#include "../lib/serial.h"
+
+// ----------------------------------------------------------------------------
+//  profile.c
+// ----------------------------------------------------------------------------
+//  Sampling profiler driven by periodic timers, one per CPU.
+//
+//  Timers fire on the CPU that added them, so profile_start() arms the
+//  calling CPU's and sends the others an IPI to arm theirs. Every
+//  `period_us` microseconds each CPU's timer fires and
+//  profile_tick() stores the interrupted rip and, if asked for, the call
+//  chain found by following saved frame pointers from the interrupted rbp.
+//  Samples go to this CPU's buffer without taking a lock. Nothing is
+//  symbolized in the kernel: profile_dump() writes raw addresses to COM1
+//  and tools/profile turns them into flat and folded-stack profiles using
+//  build/kernel.elf.
+//
+//  The call chain relies on rbp frames. The kernel is built without
+//  optimization, where gcc always keeps them; code that doesn't (the
+//  assembly files, or a function interrupted inside its prologue) loses or
+//  skips frames. The walk only reads inside the interrupted thread's own
+//  stack (KERNEL_STACK_SIZE, bounded by guard pages), so a bad rbp ends it
+//  rather than faulting; a sample taken on any other stack gets no chain.
+// ----------------------------------------------------------------------------
+
+static struct ProfileBuffer profile_buffers[MAX_CPUS];
+
+static struct Timer profile_timers[MAX_CPUS];
+
+static int profile_ready;
+static int profile_enabled;
+static int profile_callchain;
+static uint32_t profile_period;
+
+/**
+ * @brief Finds the end of the stack the interrupted code was running on:
+ * the current thread's stack, or this CPU's idle stack for the idle
+ * thread.
+ *
+ * @return Top of that stack, or 0 if `rsp` is not inside it (an IST
+ *         stack, or the middle of a context switch).
+ */
+static uint64_t stack_top_of(uint64_t rsp) {
+    struct Thread *thread = this_cpu_read(current);
+    uint64_t top;
+
+    if (thread != NULL && thread->stack != NULL) {
+        top = (uint64_t)thread->stack + KERNEL_STACK_SIZE;
+    } else {
+        top = this_cpu_read(stack_top);
+    }
+
+    if (rsp >= top || rsp < top - KERNEL_STACK_SIZE) {
+        return 0;
+    }
+    return top;
+}
+
+/**
+ * @brief Follows saved frame pointers up the interrupted stack.
+ *
+ * Each frame must lie above the previous one and inside the interrupted
+ * stack, so a corrupt or missing frame pointer ends the walk instead of
+ * touching a guard page.
+ *
+ * @return Number of return addresses stored in `pc`.
+ */
+static uint64_t walk_frames(const struct TrapFrame *tf, uint64_t *pc, uint64_t max) {
+    uint64_t low = (uint64_t)tf->rsp;
+    uint64_t high = stack_top_of(low);
+    uint64_t fp = (uint64_t)tf->rbp;
+    uint64_t n = 0;
+
+    while (n < max && fp >= low && fp + 16 <= high && (fp & 7) == 0) {
+        const uint64_t *frame = (const uint64_t *)fp;
+
+        if (frame[1] == 0) {
+            break;
+        }
+        pc[n++] = frame[1];         // Return address
+
+        low = fp + 16;
+        fp = frame[0];              // Caller's rbp
+    }
+
+    return n;
+}
+
+/**
+ * @brief Sampling timer: samples the interrupted context and re-arms.
+ */
+static void profile_timer_fn(void *ctx) {
+    struct Timer *timer = ctx;
+
+    const struct TrapFrame *tf = irq_frame();
+    if (tf != NULL) {
+        profile_tick(tf);
+    }
+
+    if (profile_enabled) {
+        timer_add(timer, timer->expires + profile_period);
+    }
+}
+
+/**
+ * @brief Arms the calling CPU's sampling timer. Interrupts off.
+ */
+static void profile_arm(void) {
+    timer_add(&profile_timers[cpu_id() % MAX_CPUS], clock_us() + profile_period);
+}
+
+/**
+ * @brief Profiling IPI: start sampling this CPU.
+ */
+static void profile_ipi(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    eoi();
+    if (profile_enabled) {
+        profile_arm();
+    }
+}
+
+/**
+ * @brief Clears the buffers and starts sampling on every CPU.
+ */
+void profile_start(uint32_t period_us, int callchain) {
+    // The timers are set up once: one may still be pending from an
+    // earlier run, and timer_init() would lose it from its wheel
+    if (!profile_ready) {
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            timer_init(&profile_timers[cpu], profile_timer_fn, &profile_timers[cpu]);
+        }
+        register_irq_handler(PROFILE_IPI_VECTOR, profile_ipi, NULL);
+        profile_ready = 1;
+    }
+
+    profile_stop();
+
+    memset(profile_buffers, 0, sizeof(profile_buffers));
+    profile_period = period_us ? period_us : 1;
+    profile_callchain = callchain;
+
+    __atomic_store_n(&profile_enabled, 1, __ATOMIC_RELEASE);
+
+    uint64_t flags = irq_save();
+    uint32_t self = cpu_id();
+
+    profile_arm();
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (cpu != self && per_cpu[cpu].online) {
+            lapic_send_ipi(per_cpu[cpu].apic_id, PROFILE_IPI_VECTOR);
+        }
+    }
+    irq_restore(flags);
+}
+
+/**
+ * @brief Stops sampling.
+ */
+void profile_stop(void) {
+    __atomic_store_n(&profile_enabled, 0, __ATOMIC_RELEASE);
+
+    // A callback already past its check may re-add its timer once more;
+    // it then fires with sampling off and stops there
+    if (profile_ready) {
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            timer_cancel(&profile_timers[cpu]);
+        }
+    }
+}
+
+/**
+ * @brief Records one sample of the interrupted context when one is due.
+ */
+void profile_tick(const struct TrapFrame *tf) {
+    if (!profile_enabled) {
+        return;
+    }
+
+    struct ProfileBuffer *pb = &profile_buffers[cpu_id() % MAX_CPUS];
+
+    if (pb->count == PROFILE_SAMPLES) {
+        pb->dropped++;
+        return;
+    }
+
+    struct ProfileSample *s = &pb->samples[pb->count];
+
+    s->pc[0] = (uint64_t)tf->rip;
+    s->depth = 1;
+    if (profile_callchain) {
+        s->depth += walk_frames(tf, &s->pc[1], PROFILE_MAX_DEPTH - 1);
+    }
+
+    pb->count++;
+}
+
+/**
+ * @brief Stops sampling and writes every sample to COM1.
+ *
+ * The output bypasses the kernel log, so thousands of samples neither
+ * overrun the log ring nor scroll the VGA console. Format:
+ *
+ *   # profile begin period_us=<us>
+ *   S <cpu> <pc0> <pc1> ...      (hex, innermost first)
+ *   # profile dropped cpu=<cpu> count=<n>
+ *   # profile end
+ */
+void profile_dump(void) {
+    profile_stop();
+
+    // Anything already in the log goes out first, so the block stays whole
+    log_flush();
+
+    serial_printk("# profile begin period_us=%u\n", profile_period);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        const struct ProfileBuffer *pb = &profile_buffers[cpu];
+
+        for (uint64_t i = 0; i < pb->count; i++) {
+            const struct ProfileSample *s = &pb->samples[i];
+            char line[LOG_LINE_MAX];
+            int length = snprintk(line, sizeof(line), "S %u", cpu);
+
+            for (uint64_t d = 0; d < s->depth; d++) {
+                length += snprintk(line + length, sizeof(line) - (size_t)length, " %lx", s->pc[d]);
+            }
+            serial_printk("%s\n", line);
+        }
+
+        if (pb->dropped != 0) {
+            serial_printk("# profile dropped cpu=%u count=%lu\n", cpu, pb->dropped);
+        }
+    }
+
+    serial_printk("# profile end\n");
+}
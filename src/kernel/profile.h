@@ -0,0 +1,82 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "trap.h"
+
+/**
+ * PROFILE_MAX_DEPTH: Program counters stored per sample: the interrupted
+ *                    rip plus up to PROFILE_MAX_DEPTH - 1 return addresses.
+ * PROFILE_SAMPLES: Samples kept per CPU. Sampling stops on a CPU when its
+ *                  buffer is full; further samples are only counted.
+ */
+#define PROFILE_MAX_DEPTH   15
+#define PROFILE_SAMPLES     2048
+
+/**
+ * PROFILE_IPI_VECTOR: Sent by profile_start() so every other CPU arms its
+ *                     own sampling timer.
+ * PROFILE_PERIOD_US: Sampling period of a profiling boot (bnr.sh
+ *                    --profile).
+ * PROFILE_RUN_US: How long such a boot samples when no benchmark is
+ *                 built in to sample instead.
+ */
+#define PROFILE_IPI_VECTOR  0xF4
+#define PROFILE_PERIOD_US   1000
+#define PROFILE_RUN_US      2000000
+
+/**
+ * ProfileSample: One timer sample (one 128-byte pair of cache lines).
+ *
+ * @field depth Number of valid entries in pc.
+ * @field pc pc[0] is the interrupted rip, pc[1..] the return addresses
+ *           of its callers, innermost first.
+ */
+struct ProfileSample {
+    uint64_t depth;
+    uint64_t pc[PROFILE_MAX_DEPTH];
+};
+
+/**
+ * ProfileBuffer: Per-CPU sample buffer. Only its own CPU writes to it.
+ *
+ * @field count Samples stored in samples[].
+ * @field dropped Samples lost because the buffer was full.
+ * @field samples The samples.
+ */
+struct ProfileBuffer {
+    uint64_t count;
+    uint64_t dropped;
+    uint64_t reserved[6];
+    struct ProfileSample samples[PROFILE_SAMPLES];
+} __attribute__((aligned(64)));
+
+/**
+ * profile_start: Clears the buffers and starts sampling every online CPU,
+ * each with its own timer.
+ *
+ * @param period_us Microseconds between samples.
+ * @param callchain Non-zero to also record the frame-pointer call chain.
+ */
+void profile_start(uint32_t period_us, int callchain);
+
+/**
+ * profile_stop: Stops sampling on every CPU. The samples stay until the
+ * next start.
+ */
+void profile_stop(void);
+
+/**
+ * profile_tick: Records a sample of the interrupted context `tf` if
+ * sampling is on. Called by the sampling timer.
+ */
+void profile_tick(const struct TrapFrame *tf);
+
+/**
+ * profile_dump: Stops sampling and writes all samples to the serial port
+ * as text, for tools/profile to symbolize against kernel.elf.
+ */
+void profile_dump(void);
+
+#endif  // _PROFILE_H_
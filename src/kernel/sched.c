@@ -0,0 +1,492 @@
+#include "sched.h"
+#include "apic.h"
+#include "fpu.h"
+#include "percpu.h"
+#include "slab.h"
+#include "smp.h"
+#include "time.h"
+#include "vm.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/log.h"
+#include "../lib/print.h"
+#include "../lib/spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  sched.c
+// ----------------------------------------------------------------------------
+//  Preemptive kernel threads.
+//
+//  Every CPU has a run queue and an idle thread, the context it booted
+//  into (KMain() on the boot CPU, ap_main() on the others). schedule()
+//  takes the oldest thread from the CPU's own queue; an idle CPU (or one
+//  whose thread just exited) also steals from the other queues. With
+//  nothing to run a thread simply keeps its CPU, and an idle CPU halts
+//  until an interrupt or a reschedule IPI.
+//
+//  A switch saves the outgoing thread as a TrapFrame and leaves through
+//  the interrupt return path, so a thread preempted by an interrupt and
+//  one that yielded are resumed the same way. The outgoing thread is put
+//  back in a queue (or recycled, if it exited) only by finish_switch(),
+//  once its registers are saved: another CPU can steal it from then on.
+//
+//  Preemption: each CPU arms a timer for the running thread's slice. The
+//  timer only sets need_resched; handler() switches on the way out of the
+//  outermost interrupt, never inside a handler.
+//
+//  Exited threads keep their stack (and FPU save area) and are reused by
+//  the next thread_create(), so threads cost no unmapping (and no TLB
+//  shootdown). FPU state is switched lazily, see fpu.c.
+// ----------------------------------------------------------------------------
+
+static struct RunQueue runqueues[MAX_CPUS];
+static struct Thread idle_threads[MAX_CPUS];
+
+static struct Thread *free_threads;         // Exited, stacks kept
+static uint32_t thread_count;               // Alive, idle threads excluded
+static uint32_t next_thread_id;
+static struct Spinlock thread_lock;
+
+// CPUs halted in sched_idle(), one bit each
+static uint32_t idle_cpus;
+
+_Static_assert(THREAD_MAX <= SCHED_RUNQ_SIZE, "a run queue must hold every thread");
+_Static_assert(MAX_CPUS <= 32, "idle_cpus is a 32-bit mask");
+_Static_assert(FPU_STATE_ALIGN <= CACHE_LINE, "kmalloc() aligns FPU save areas");
+
+/**
+ * Queue a thread on the calling CPU's run queue. Interrupts must be off.
+ */
+static void rq_push(struct RunQueue *rq, struct Thread *thread) {
+    uint64_t bottom = rq->bottom;
+
+    thread->state = THREAD_RUNNABLE;
+    rq->slots[bottom % SCHED_RUNQ_SIZE] = thread;
+    __atomic_store_n(&rq->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check whether `rq` has a thread to take. A thief (another CPU) can't
+ * take a pinned thread, and waits until the owner has taken it.
+ */
+static int rq_has_work(const struct RunQueue *rq, int thief) {
+    uint64_t top = __atomic_load_n(&rq->top, __ATOMIC_ACQUIRE);
+
+    if (top >= __atomic_load_n(&rq->bottom, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return !thief || !(rq->slots[top % SCHED_RUNQ_SIZE]->flags & THREAD_PINNED);
+}
+
+/**
+ * Take the oldest thread of `rq`, racing other takers with a CAS on top.
+ * @return The thread, or NULL if there is none the caller may take.
+ */
+static struct Thread *rq_take(struct RunQueue *rq, int thief) {
+    for (;;) {
+        uint64_t top = __atomic_load_n(&rq->top, __ATOMIC_ACQUIRE);
+
+        if (top >= __atomic_load_n(&rq->bottom, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        struct Thread *thread = rq->slots[top % SCHED_RUNQ_SIZE];
+        if (thief && (thread->flags & THREAD_PINNED)) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&rq->top, &top, top + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return thread;
+        }
+        __asm__ volatile ("pause");
+    }
+}
+
+/**
+ * Whether CPU `cpu` has anything to run, its own or stolen.
+ */
+static int has_work(uint32_t cpu) {
+    uint32_t cpus = smp_cpu_count();
+
+    for (uint32_t i = 0; i < cpus; i++) {
+        if (rq_has_work(&runqueues[(cpu + i) % cpus], i != 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Wake one halted CPU, if any, so it steals from `cpu`'s queue.
+ */
+static void kick_idle_cpu(uint32_t cpu) {
+    // Orders the queue update before reading the mask; pairs with the
+    // atomic OR in sched_idle() before it looks for work a last time
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint32_t idle = __atomic_load_n(&idle_cpus, __ATOMIC_RELAXED) & ~(1u << cpu);
+    if (idle == 0 || !rq_has_work(&runqueues[cpu], 1)) {
+        return;
+    }
+    while (idle != 0) {
+        uint32_t target = (uint32_t)__builtin_ctz(idle);
+        uint32_t bit = 1u << target;
+
+        // Whoever clears the bit sends the IPI: one per halt
+        if (__atomic_fetch_and(&idle_cpus, ~bit, __ATOMIC_ACQ_REL) & bit) {
+            lapic_send_ipi(per_cpu[target].apic_id, SCHED_IPI_VECTOR);
+            return;
+        }
+        idle &= ~bit;
+    }
+}
+
+/**
+ * Put an exited thread on the free list.
+ */
+static void free_thread(struct Thread *thread) {
+    uint64_t flags = spin_lock_irqsave(&thread_lock);
+
+    thread->next_free = free_threads;
+    free_threads = thread;
+    thread_count--;
+    spin_unlock_irqrestore(&thread_lock, flags);
+}
+
+/**
+ * Second half of a switch, run by the incoming thread: requeue or
+ * recycle the thread switched away from. Interrupts must be off.
+ */
+static void finish_switch(void) {
+    uint32_t cpu = cpu_id();
+    struct RunQueue *rq = &runqueues[cpu];
+    struct Thread *prev = rq->prev;
+
+    rq->prev = NULL;
+    if (prev == NULL || prev == rq->idle) {
+        return;
+    }
+    if (prev->state == THREAD_DEAD) {
+        free_thread(prev);
+    } else {
+        rq_push(rq, prev);
+        kick_idle_cpu(cpu);
+    }
+}
+
+/**
+ * Time slice expired: switch on interrupt exit.
+ */
+static void slice_expired(void *ctx) {
+    (void)ctx;
+    this_cpu_write(need_resched, 1);
+}
+
+/**
+ * Switch from `prev` to `next` on this CPU. Returns when `prev` runs
+ * again, possibly on another CPU.
+ */
+static void switch_to(struct RunQueue *rq, struct Thread *prev, struct Thread *next) {
+    uint64_t now = rdtsc();
+
+    prev->runtime += now - rq->switch_tsc;
+    rq->switch_tsc = now;
+    rq->switches++;
+
+    next->state = THREAD_RUNNING;
+    next->cpu = this_cpu_read(cpu);
+    next->switches++;
+    rq->prev = prev;
+    this_cpu_write(current, next);
+    fpu_switch(prev, next);
+
+    if (next != rq->idle) {
+        timer_add(&rq->slice, clock_us() + SCHED_SLICE_US);
+    } else {
+        timer_cancel(&rq->slice);
+    }
+
+    context_switch(&prev->frame, next->frame);
+    finish_switch();
+}
+
+/**
+ * Pick the next thread for this CPU and switch to it.
+ */
+static void schedule(void) {
+    uint64_t flags = irq_save();
+    uint32_t cpu = cpu_id();
+    struct RunQueue *rq = &runqueues[cpu];
+    struct Thread *prev = this_cpu_read(current);
+    int looking = prev == rq->idle || prev->state == THREAD_DEAD;
+
+    this_cpu_write(need_resched, 0);
+
+    struct Thread *next = rq_take(rq, 0);
+    if (next == NULL && looking) {
+        // Nothing here: a CPU with nothing else to run takes work
+        // queued elsewhere
+        uint32_t cpus = smp_cpu_count();
+
+        for (uint32_t i = 1; i < cpus && next == NULL; i++) {
+            next = rq_take(&runqueues[(cpu + i) % cpus], 1);
+        }
+        if (next != NULL) {
+            rq->steals++;
+        }
+    }
+
+    if (next == NULL) {
+        if (prev->state != THREAD_DEAD) {
+            // Keep running; a thread preempted with nothing else queued
+            // gets a new slice
+            if (prev != rq->idle && !timer_pending(&rq->slice)) {
+                timer_add(&rq->slice, clock_us() + SCHED_SLICE_US);
+            }
+            irq_restore(flags);
+            return;
+        }
+        next = rq->idle;
+    }
+
+    switch_to(rq, prev, next);
+    irq_restore(flags);
+}
+
+/**
+ * First code of every thread, entered from TrapReturn with interrupts
+ * off and the thread in rdi.
+ */
+static void thread_start(struct Thread *thread) {
+    finish_switch();
+    irq_enable();
+
+    thread->fn(thread->arg);
+    thread_exit();
+}
+
+/**
+ * Reschedule IPI: another CPU queued work this CPU may steal.
+ */
+static void resched_ipi(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    eoi();
+    this_cpu_write(need_resched, 1);
+}
+
+/**
+ * Set up the scheduler on the boot CPU.
+ */
+void init_sched(void) {
+    memset(runqueues, 0, sizeof(runqueues));
+    memset(idle_threads, 0, sizeof(idle_threads));
+    free_threads = NULL;
+    thread_count = 0;
+    next_thread_id = 0;
+    spin_lock_init(&thread_lock, "threads");
+    idle_cpus = 0;
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        timer_init(&runqueues[cpu].slice, slice_expired, NULL);
+    }
+    register_irq_handler(SCHED_IPI_VECTOR, resched_ipi, NULL);
+
+    sched_init_cpu();
+}
+
+/**
+ * Make the calling context this CPU's idle thread.
+ */
+void sched_init_cpu(void) {
+    uint32_t cpu = cpu_id();
+    struct RunQueue *rq = &runqueues[cpu];
+    struct Thread *idle = &idle_threads[cpu];
+
+    idle->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    idle->state = THREAD_RUNNING;
+    idle->flags = THREAD_PINNED;
+    idle->cpu = cpu;
+    snprintk(idle->name, sizeof(idle->name), "idle/%u", cpu);
+
+    // The boot context's FPU state becomes the idle thread's
+    idle->fpu = fpu_alloc_state();
+    if (idle->fpu == NULL) {
+        // Switching away would save the registers through NULL
+        log_message(LOG_PANIC, "sched: no memory for CPU %u's FPU state\n", cpu);
+        log_flush();
+        __asm__ volatile ("cli");
+        while (1) {
+            __asm__ volatile ("hlt");
+        }
+    }
+
+    rq->idle = idle;
+    rq->switch_tsc = rdtsc();
+    this_cpu_write(current, idle);
+    fpu_adopt(idle);
+}
+
+/**
+ * Idle loop.
+ */
+void sched_idle(void) {
+    uint32_t cpu = cpu_id();
+    uint32_t bit = 1u << cpu;
+
+    irq_disable();
+    for (;;) {
+        schedule();
+
+        // A thread queued between schedule() and setting the bit found
+        // no CPU to kick: look once more before halting
+        __atomic_fetch_or(&idle_cpus, bit, __ATOMIC_SEQ_CST);
+        if (has_work(cpu)) {
+            __atomic_fetch_and(&idle_cpus, ~bit, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        __asm__ volatile ("sti; hlt; cli" : : : "memory");
+        __atomic_fetch_and(&idle_cpus, ~bit, __ATOMIC_RELAXED);
+        this_cpu_inc(idle_wakeups);
+    }
+}
+
+/**
+ * Create a thread and queue it on the calling CPU.
+ */
+struct Thread *thread_create(const char *name, void (*fn)(void *arg), void *arg, uint32_t flags) {
+    struct Thread *thread;
+    uint64_t lock_flags = spin_lock_irqsave(&thread_lock);
+
+    if (thread_count >= THREAD_MAX) {
+        spin_unlock_irqrestore(&thread_lock, lock_flags);
+        log_message(LOG_WARN, "sched: no more than %u threads\n", THREAD_MAX);
+        return NULL;
+    }
+    thread = free_threads;
+    if (thread != NULL) {
+        free_threads = thread->next_free;
+    }
+    thread_count++;
+    spin_unlock_irqrestore(&thread_lock, lock_flags);
+
+    if (thread == NULL) {
+        // Populated: a fault on the stack it is taken on can't be handled
+        thread = kmalloc(sizeof(*thread));
+        void *stack = vm_reserve(KERNEL_STACK_SIZE, VM_WRITE | VM_POPULATE);
+        void *fpu = fpu_alloc_state();
+        if (thread == NULL || stack == NULL || fpu == NULL) {
+            kfree(thread);
+            kfree(fpu);
+            if (stack != NULL) {
+                vm_release(stack);
+            }
+            lock_flags = spin_lock_irqsave(&thread_lock);
+            thread_count--;
+            spin_unlock_irqrestore(&thread_lock, lock_flags);
+            log_message(LOG_ERROR, "sched: no memory for a thread\n");
+            return NULL;
+        }
+        thread->stack = stack;
+        thread->fpu = fpu;
+    }
+
+    size_t len = strnlen(name, THREAD_NAME_LEN - 1);
+    memcpy(thread->name, name, len);
+    thread->name[len] = '\0';
+    thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->flags = flags;
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->runtime = 0;
+    thread->switches = 0;
+    thread->fpu_cpu = FPU_NO_CPU;
+    thread->fpu_valid = 0;
+    thread->next_free = NULL;
+
+    // The frame an interrupt would have left, returning into
+    // thread_start(thread) on an empty stack
+    uint64_t top = (uint64_t)thread->stack + KERNEL_STACK_SIZE;
+    struct TrapFrame *tf = (struct TrapFrame *)(top - sizeof(*tf));
+
+    memset(tf, 0, sizeof(*tf));
+    tf->rip = (int64_t)thread_start;
+    tf->cs = KERNEL_CS;
+    tf->rflags = RFLAGS_RESERVED;
+    tf->rsp = (int64_t)(top - 8);       // As if thread_start() had been called
+    tf->ss = KERNEL_DS;
+    tf->rdi = (int64_t)thread;
+    thread->frame = tf;
+
+    uint64_t irq_flags = irq_save();
+    uint32_t cpu = cpu_id();
+
+    thread->cpu = cpu;
+    rq_push(&runqueues[cpu], thread);
+    kick_idle_cpu(cpu);
+    irq_restore(irq_flags);
+    return thread;
+}
+
+/**
+ * Let another thread run.
+ */
+void thread_yield(void) {
+    schedule();
+}
+
+/**
+ * End the calling thread.
+ */
+void thread_exit(void) {
+    irq_disable();
+    this_cpu_read(current)->state = THREAD_DEAD;
+    schedule();
+
+    // A dead thread is never switched back to
+    for (;;) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+/**
+ * The thread running on this CPU.
+ */
+struct Thread *thread_current(void) {
+    return this_cpu_read(current);
+}
+
+/**
+ * Switch if an interrupt asked for it.
+ */
+void sched_preempt(void) {
+    if (this_cpu_read(need_resched)) {
+        schedule();
+    }
+}
+
+/**
+ * Sum the per-CPU counters.
+ */
+void sched_get_stats(struct SchedStats *stats) {
+    stats->switches = 0;
+    stats->steals = 0;
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        stats->switches += runqueues[cpu].switches;
+        stats->steals += runqueues[cpu].steals;
+    }
+}
+
+/**
+ * Print scheduler statistics.
+ */
+void sched_dump_stats(void) {
+    printk("Sched: %u thread(s), %u us slices\n", __atomic_load_n(&thread_count, __ATOMIC_RELAXED),
+           SCHED_SLICE_US);
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        const struct RunQueue *rq = &runqueues[cpu];
+
+        printk("  CPU %u: %lu switches, %lu steals, %lu queued, %lu idle wakeups\n", cpu, rq->switches,
+               rq->steals, rq->bottom - rq->top, per_cpu[cpu].idle_wakeups);
+    }
+}
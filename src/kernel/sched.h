@@ -0,0 +1,160 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "timer.h"
+#include "trap.h"
+
+/**
+ * Scheduler tuning.
+ * SCHED_SLICE_US: How long a thread runs before it is preempted, when
+ *                 another thread is waiting on its CPU.
+ * SCHED_RUNQ_SIZE: Slots in each CPU's run queue (a power of two).
+ * THREAD_MAX: Threads alive at once. Not above SCHED_RUNQ_SIZE, so a run
+ *             queue never fills up.
+ * SCHED_IPI_VECTOR: Reschedule IPI, sent to wake an idle CPU so it
+ *                   steals work.
+ */
+#define SCHED_SLICE_US      10000
+#define SCHED_RUNQ_SIZE     256
+#define THREAD_MAX          256
+#define THREAD_NAME_LEN     16
+#define SCHED_IPI_VECTOR    0xF2
+
+/**
+ * thread_create() flags.
+ * THREAD_PINNED: Stay on the creating CPU; idle CPUs don't steal it.
+ */
+#define THREAD_PINNED       (1 << 0)
+
+/**
+ * Thread states.
+ */
+enum ThreadState {
+    THREAD_RUNNABLE,                    // In a run queue
+    THREAD_RUNNING,                     // Current on some CPU
+    THREAD_DEAD,                        // Exited; recycled by the next switch
+};
+
+/**
+ * Thread: a kernel thread.
+ *
+ * While a thread isn't running, its registers are a TrapFrame at the top
+ * of what it has on its stack, and `frame` points at it. A preempted
+ * thread's frame is the one its interrupt pushed; a thread that gave up
+ * the CPU itself gets one pushed by context_switch() (trap.asm). Either
+ * way it is resumed through the same interrupt return path.
+ */
+struct Thread {
+    struct TrapFrame *frame;            // Saved context while not running
+    uint32_t id;
+    volatile uint32_t state;            // enum ThreadState
+    uint32_t flags;                     // THREAD_PINNED
+    uint32_t cpu;                       // CPU it last ran on
+    void (*fn)(void *arg);
+    void *arg;
+    void *stack;                        // KERNEL_STACK_SIZE, from vm_reserve()
+    uint64_t runtime;                   // TSC cycles spent running
+    uint64_t switches;                  // Times it was switched to
+    void *fpu;                          // FPU save area (fpu_state_size bytes)
+    uint32_t fpu_cpu;                   // CPU whose registers hold its state
+    uint32_t fpu_valid;                 // `fpu` holds its state (else initial)
+    struct Thread *next_free;
+    char name[THREAD_NAME_LEN];
+};
+
+/**
+ * Per-CPU run queue: a bounded work-stealing queue.
+ *
+ * Only the owning CPU adds threads (at `bottom`, with interrupts off).
+ * Threads are taken at `top` with a compare-and-swap, by the owner
+ * (oldest first, so the queue is round robin) and by idle CPUs stealing
+ * work, so no lock is ever taken to schedule.
+ */
+struct RunQueue {
+    uint64_t top __attribute__((aligned(64)));   // Next slot to take
+    uint64_t bottom __attribute__((aligned(64))); // Next slot to fill
+    struct Thread *slots[SCHED_RUNQ_SIZE];
+    struct Thread *idle;                // This CPU's idle thread
+    struct Thread *prev;                // Switched away from, not yet requeued
+    struct Timer slice;                 // Ends the running thread's time slice
+    uint64_t switch_tsc;                // When the running thread was switched to
+    uint64_t switches;
+    uint64_t steals;                    // Threads taken from other CPUs
+} __attribute__((aligned(64)));
+
+/**
+ * Scheduler counters, summed over all CPUs by sched_get_stats().
+ */
+struct SchedStats {
+    uint64_t switches;
+    uint64_t steals;
+};
+
+/**
+ * Turn the boot CPU's current context (KMain) into its idle thread and
+ * install the reschedule IPI. Needs init_timers() and init_vm().
+ */
+void init_sched(void);
+
+/**
+ * Same for another CPU, from its start-up code.
+ */
+void sched_init_cpu(void);
+
+/**
+ * Run threads on the calling CPU; halt while there are none. Never
+ * returns: the end of KMain() and of CPU start-up.
+ */
+void sched_idle(void) __attribute__((noreturn));
+
+/**
+ * Create a thread running fn(arg) and queue it on the calling CPU. An
+ * idle CPU is woken to take it if there is one.
+ * @param name Shown by sched_dump_stats(), truncated to 15 characters.
+ * @param flags 0 or THREAD_PINNED.
+ * @return The thread, or NULL when THREAD_MAX threads exist or memory
+ *         runs out.
+ */
+struct Thread *thread_create(const char *name, void (*fn)(void *arg), void *arg, uint32_t flags);
+
+/**
+ * Give up the CPU to the next queued thread, if any.
+ */
+void thread_yield(void);
+
+/**
+ * End the calling thread. Returning from a thread's function does the
+ * same.
+ */
+void thread_exit(void) __attribute__((noreturn));
+
+/**
+ * The thread running on this CPU.
+ */
+struct Thread *thread_current(void);
+
+/**
+ * Switch threads if a preemption was requested on this CPU. Called by
+ * handler() when leaving the outermost interrupt.
+ */
+void sched_preempt(void);
+
+/**
+ * Save the calling context as a TrapFrame in *save and resume `next`
+ * (trap.asm). Returns when something resumes the saved frame.
+ */
+void context_switch(struct TrapFrame **save, struct TrapFrame *next);
+
+/**
+ * Sum the switch and steal counts of all CPUs.
+ */
+void sched_get_stats(struct SchedStats *stats);
+
+/**
+ * Print per-CPU switch and steal counts.
+ */
+void sched_dump_stats(void);
+
+#endif  // _SCHED_H_
@@ -0,0 +1,148 @@
+#include "schedbench.h"
+#include "bench.h"
+#include "cpu.h"
+#include "sched.h"
+#include "smp.h"
+#include "time.h"
+#include "../lib/serial.h"
+
+// ----------------------------------------------------------------------------
+//  schedbench.c
+// ----------------------------------------------------------------------------
+//  Thread switch latency and throughput benchmark.
+//
+//  KMain() is the boot CPU's idle thread, so it only gets the CPU back
+//  once no benchmark thread is runnable there: every phase creates its
+//  threads, then yields until they have all finished.
+//
+//  The ping-pong latency covers the whole of thread_yield(): picking the
+//  next thread, arming its time slice, context_switch(), the interrupt
+//  return path and finish_switch(). Interrupts arriving meanwhile (the
+//  slice timer, other devices) show up in the tail.
+// ----------------------------------------------------------------------------
+
+static struct Histogram pingpong_hist;
+static uint32_t bench_iterations;
+
+// Written by the benchmark threads
+static volatile uint64_t pingpong_stamp;
+static volatile uint64_t pingpong_owner;
+static uint32_t bench_done;
+static uint64_t preempt_end_us;
+static volatile uint64_t preempt_spins[2];
+
+/**
+ * Ping-pong thread: stamp the TSC, yield to the other thread, and record
+ * how long the other thread took to get back here after its own stamp.
+ */
+static void pingpong_fn(void *arg) {
+    uint64_t self = (uint64_t)arg;
+
+    for (uint32_t i = 0; i < bench_iterations + SCHEDBENCH_WARMUP; i++) {
+        pingpong_owner = self;
+        pingpong_stamp = rdtsc();
+        thread_yield();
+
+        // Once the other thread is done, yield returns without a switch
+        uint64_t back = rdtsc();
+        if (i >= SCHEDBENCH_WARMUP && pingpong_owner != self) {
+            hist_record(&pingpong_hist, back - pingpong_stamp);
+        }
+    }
+    __atomic_fetch_add(&bench_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Throughput thread: nothing but yields.
+ */
+static void yield_fn(void *arg) {
+    (void)arg;
+
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        thread_yield();
+    }
+    __atomic_fetch_add(&bench_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Preemption thread: spin until the deadline without ever yielding.
+ */
+static void spin_fn(void *arg) {
+    uint32_t index = (uint32_t)(uint64_t)arg;
+
+    while (clock_us() < preempt_end_us) {
+        preempt_spins[index]++;
+    }
+    __atomic_fetch_add(&bench_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create `count` threads running fn and yield until all have returned.
+ * @return The number created.
+ */
+static uint32_t run_threads(const char *name, void (*fn)(void *arg), uint32_t count, uint32_t flags) {
+    uint32_t created = 0;
+
+    bench_done = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (thread_create(name, fn, (void *)(uint64_t)i, flags) == NULL) {
+            break;
+        }
+        created++;
+    }
+    while (__atomic_load_n(&bench_done, __ATOMIC_ACQUIRE) < created) {
+        thread_yield();
+        __asm__ volatile ("pause");
+    }
+    return created;
+}
+
+/**
+ * Measure thread switching and report it on COM1.
+ */
+void schedbench_run(uint32_t samples) {
+    struct SchedStats before;
+    struct SchedStats after;
+
+    if (samples == 0) {
+        samples = SCHEDBENCH_SAMPLES;
+    }
+    bench_iterations = samples;
+
+    bench_begin();
+
+    serial_printk("# schedbench begin samples=%u cpus=%u tsc_khz=%lu slice_us=%u\n",
+                  samples, smp_cpu_count(), tsc_khz, SCHED_SLICE_US);
+
+    // Latency: two threads that only run on this CPU
+    hist_reset(&pingpong_hist);
+    run_threads("pingpong", pingpong_fn, 2, THREAD_PINNED);
+
+    bench_report_hist("pingpong switch", &pingpong_hist);
+
+    // Throughput: every thread starts here, the other CPUs steal theirs
+    sched_get_stats(&before);
+    uint64_t start = clock_us();
+    uint32_t threads = run_threads("yield", yield_fn, SCHEDBENCH_THREADS_PER_CPU * smp_cpu_count(), 0);
+    uint64_t elapsed = clock_us() - start;
+    sched_get_stats(&after);
+
+    uint64_t switches = after.switches - before.switches;
+    serial_printk("L throughput threads=%u elapsed_us=%lu switches=%lu steals=%lu switches_per_sec=%lu\n",
+                  threads, elapsed, switches, after.steals - before.steals,
+                  elapsed != 0 ? switches * 1000000 / elapsed : 0);
+
+    // Preemption: spinners that never yield, both on this CPU
+    preempt_spins[0] = 0;
+    preempt_spins[1] = 0;
+    sched_get_stats(&before);
+    start = clock_us();
+    preempt_end_us = start + SCHEDBENCH_PREEMPT_SLICES * SCHED_SLICE_US;
+    run_threads("spin", spin_fn, 2, THREAD_PINNED);
+    elapsed = clock_us() - start;
+    sched_get_stats(&after);
+
+    serial_printk("L preempt threads=2 elapsed_us=%lu switches=%lu spins=%lu,%lu\n",
+                  elapsed, after.switches - before.switches, preempt_spins[0], preempt_spins[1]);
+    serial_printk("# schedbench end\n");
+}
@@ -0,0 +1,44 @@
+#ifndef _SCHEDBENCH_H_
+#define _SCHEDBENCH_H_
+
+#include <stdint.h>
+
+/**
+ * SCHEDBENCH_SAMPLES: Default number of measured switches (ping-pong)
+ *                     and yields per thread (throughput).
+ * SCHEDBENCH_WARMUP: Switches taken and discarded before measuring.
+ * SCHEDBENCH_THREADS_PER_CPU: Throughput threads per online CPU.
+ * SCHEDBENCH_PREEMPT_SLICES: How many time slices the preemption test
+ *                            spins for.
+ */
+#define SCHEDBENCH_SAMPLES          10000
+#define SCHEDBENCH_WARMUP           100
+#define SCHEDBENCH_THREADS_PER_CPU  2
+#define SCHEDBENCH_PREEMPT_SLICES   10
+
+/**
+ * Measure thread switching and report it on COM1. Runs from KMain(), the
+ * boot CPU's idle thread, after init_sched() and init_smp():
+ *   - pingpong: two threads pinned to the boot CPU yield to each other;
+ *               the time from one thread's thread_yield() call until the
+ *               other runs goes into a histogram;
+ *   - throughput: SCHEDBENCH_THREADS_PER_CPU threads per CPU, all
+ *               created on the boot CPU, yield `samples` times each;
+ *               idle CPUs steal them, and the switches (and steals) per
+ *               second over all CPUs are reported;
+ *   - preempt:  two pinned threads spin without yielding; both making
+ *               progress shows the time slice preempting them.
+ *
+ * Output, in nanoseconds:
+ *
+ *   # schedbench begin samples=<n> cpus=<n> tsc_khz=<khz> slice_us=<us>
+ *   L pingpong switch count=<n> min=<ns> p50=<ns> p99=<ns> p999=<ns>
+ *     max=<ns> mean=<ns>                            (one line)
+ *   L throughput threads=<n> elapsed_us=<us> switches=<n> steals=<n>
+ *     switches_per_sec=<n>                          (one line)
+ *   L preempt threads=2 elapsed_us=<us> switches=<n> spins=<n>,<n>
+ *   # schedbench end
+ */
+void schedbench_run(uint32_t samples);
+
+#endif  // _SCHEDBENCH_H_
@@ -0,0 +1,467 @@
+#include "slab.h"
+#include "vm.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  slab.c
+// ----------------------------------------------------------------------------
+//  Object allocator: slabs with a per-CPU magazine layer (Bonwick).
+//
+//  Slab layer: a slab is a 16 KB buddy block with a struct Slab header in
+//  its first cache line and equal-sized objects after it. Free objects of
+//  a slab are chained through their first word. The cache keeps its slabs
+//  on partial / full / empty lists under the cache lock.
+//
+//  Magazine layer: every CPU holds a `loaded` and a `previous` magazine of
+//  up to MAGAZINE_SIZE objects. Allocation pops from loaded, freeing
+//  pushes to it, and when loaded can't serve the call it is swapped with
+//  previous. Only when both are exhausted (or both full) does the CPU
+//  trade a magazine with the cache's depot, and only when the depot can't
+//  help does it fall through to the slab layer. The fast path is thus
+//  irq_save, an array access and irq_restore.
+//
+//  kmalloc() maps sizes to cache-line multiple size classes. Bigger
+//  requests get a whole buddy block of at least SLAB_SIZE with a header
+//  in its first cache line, so kfree() can always find the header by
+//  masking the pointer with SLAB_SIZE - 1. The biggest are reserved in
+//  the kernel virtual area (vm.c), which kfree() recognizes by address.
+// ----------------------------------------------------------------------------
+
+#define SLAB_MAGIC      0x42414C53          // "SLAB"
+#define LARGE_MAGIC     0x4752414C          // "LARG"
+
+/**
+ * Header in the first cache line of every slab.
+ */
+struct Slab {
+    uint32_t magic;                         // SLAB_MAGIC
+    uint32_t inuse;                         // Objects handed out
+    struct KmemCache *cache;
+    struct Slab *next;                      // List the slab is on
+    struct Slab *prev;
+    void *free;                             // Free objects, chained
+};
+
+/**
+ * Header in the first cache line of a large kmalloc() block.
+ */
+struct LargeAlloc {
+    uint32_t magic;                         // LARGE_MAGIC
+    uint32_t order;                         // Buddy order of the block
+};
+
+static const uint32_t kmalloc_sizes[] = {
+    64, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+#define KMALLOC_CLASSES  (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+
+static struct KmemCache cache_cache;        // Holds every other KmemCache
+static struct KmemCache magazine_cache;     // Holds the magazines
+static struct KmemCache *kmalloc_caches[KMALLOC_CLASSES];
+static struct KmemCache *all_caches;
+
+// ----------------------------------------------------------------------------
+//  Slab layer (cache lock held)
+// ----------------------------------------------------------------------------
+
+static void slab_list_add(struct Slab **head, struct Slab *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_del(struct Slab **head, struct Slab *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * Get a slab from the page allocator and chain its objects.
+ */
+static struct Slab *slab_create(struct KmemCache *cache) {
+    struct Slab *slab = (struct Slab *)alloc_pages(SLAB_ORDER);
+
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->free = NULL;
+
+    // Chain back to front so objects are handed out in address order
+    char *base = (char *)slab + cache->offset;
+    for (uint32_t i = cache->per_slab; i-- > 0;) {
+        void **obj = (void **)(base + (size_t)i * cache->size);
+        *obj = slab->free;
+        slab->free = obj;
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+/**
+ * Take one object from the slabs.
+ */
+static void *slab_alloc(struct KmemCache *cache) {
+    struct Slab *slab = cache->partial;
+
+    if (slab == NULL) {
+        slab = cache->empty;
+        if (slab != NULL) {
+            cache->empty = NULL;
+        } else {
+            slab = slab_create(cache);
+            if (slab == NULL) {
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void **obj = slab->free;
+    slab->free = *obj;
+    slab->inuse++;
+    cache->inuse++;
+
+    if (slab->inuse == cache->per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    return obj;
+}
+
+/**
+ * Return one object to its slab.
+ */
+static void slab_free(struct KmemCache *cache, void *obj) {
+    struct Slab *slab = (struct Slab *)((uint64_t)obj & ~(SLAB_SIZE - 1));
+
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    cache->inuse--;
+
+    if (slab->inuse-- == cache->per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    // Keep one empty slab for the next burst; the rest go back to the pages
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        } else {
+            slab->magic = 0;
+            cache->slabs--;
+            free_pages((uint64_t)slab, SLAB_ORDER);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  Magazine layer
+// ----------------------------------------------------------------------------
+
+static struct Magazine *depot_pop(struct Magazine **list, uint64_t *count) {
+    struct Magazine *mag = *list;
+
+    if (mag != NULL) {
+        *list = mag->next;
+        (*count)--;
+    }
+    return mag;
+}
+
+static void depot_push(struct Magazine **list, uint64_t *count, struct Magazine *mag) {
+    mag->next = *list;
+    *list = mag;
+    (*count)++;
+}
+
+/**
+ * Allocate one object.
+ */
+void *kmem_cache_alloc(struct KmemCache *cache) {
+    uint64_t flags = irq_save();
+    struct KmemCpuCache *cc = &cache->cpu[cpu_id() % MAX_CPUS];
+    void *obj;
+
+    cc->allocs++;
+
+    while (!(cache->flags & KMEM_NO_MAGAZINE)) {
+        if (cc->loaded != NULL && cc->loaded->rounds != 0) {
+            obj = cc->loaded->objs[--cc->loaded->rounds];
+            cc->hits++;
+            irq_restore(flags);
+            return obj;
+        }
+
+        if (cc->previous != NULL && cc->previous->rounds != 0) {
+            struct Magazine *mag = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = mag;
+            continue;
+        }
+
+        // Both empty: trade previous for a full magazine from the depot
+        uint64_t lock_flags = spin_lock_irqsave(&cache->lock);
+        struct Magazine *full = depot_pop(&cache->depot_full, &cache->depot_full_count);
+        if (full != NULL && cc->previous != NULL) {
+            depot_push(&cache->depot_empty, &cache->depot_empty_count, cc->previous);
+        }
+        spin_unlock_irqrestore(&cache->lock, lock_flags);
+
+        if (full == NULL) {
+            break;
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = full;
+    }
+
+    uint64_t lock_flags = spin_lock_irqsave(&cache->lock);
+    obj = slab_alloc(cache);
+    spin_unlock_irqrestore(&cache->lock, lock_flags);
+
+    irq_restore(flags);
+    return obj;
+}
+
+/**
+ * Free one object.
+ */
+void kmem_cache_free(struct KmemCache *cache, void *obj) {
+    uint64_t flags = irq_save();
+    struct KmemCpuCache *cc = &cache->cpu[cpu_id() % MAX_CPUS];
+
+    cc->frees++;
+
+    while (!(cache->flags & KMEM_NO_MAGAZINE)) {
+        if (cc->loaded != NULL && cc->loaded->rounds < MAGAZINE_SIZE) {
+            cc->loaded->objs[cc->loaded->rounds++] = obj;
+            irq_restore(flags);
+            return;
+        }
+
+        if (cc->previous != NULL && cc->previous->rounds == 0) {
+            struct Magazine *mag = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = mag;
+            continue;
+        }
+
+        // Both full (or missing): trade previous for an empty magazine
+        uint64_t lock_flags = spin_lock_irqsave(&cache->lock);
+        struct Magazine *empty = depot_pop(&cache->depot_empty, &cache->depot_empty_count);
+        spin_unlock_irqrestore(&cache->lock, lock_flags);
+
+        if (empty == NULL) {
+            empty = kmem_cache_alloc(&magazine_cache);
+            if (empty == NULL) {
+                break;
+            }
+            empty->rounds = 0;
+        }
+
+        if (cc->previous != NULL) {
+            lock_flags = spin_lock_irqsave(&cache->lock);
+            depot_push(&cache->depot_full, &cache->depot_full_count, cc->previous);
+            spin_unlock_irqrestore(&cache->lock, lock_flags);
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = empty;
+    }
+
+    uint64_t lock_flags = spin_lock_irqsave(&cache->lock);
+    slab_free(cache, obj);
+    spin_unlock_irqrestore(&cache->lock, lock_flags);
+
+    irq_restore(flags);
+}
+
+// ----------------------------------------------------------------------------
+//  Caches
+// ----------------------------------------------------------------------------
+
+/**
+ * Fill in a cache's geometry and link it into the list.
+ */
+static int cache_setup(struct KmemCache *cache, const char *name, uint32_t size,
+                       uint32_t align, uint32_t flags) {
+    if (align < 8) {
+        align = 8;
+    }
+    if (size == 0 || size > SLAB_MAX_OBJECT || (align & (align - 1)) != 0 || align > PAGE_SIZE) {
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->align = align;
+    cache->size = (size + align - 1) & ~(align - 1);
+    cache->offset = (sizeof(struct Slab) + align - 1) & ~(align - 1);
+    cache->per_slab = (uint32_t)((SLAB_SIZE - cache->offset) / cache->size);
+    cache->flags = flags;
+    spin_lock_init(&cache->lock, name);
+
+    cache->next = all_caches;
+    all_caches = cache;
+    return 0;
+}
+
+/**
+ * Create a cache.
+ */
+struct KmemCache *kmem_cache_create(const char *name, uint32_t size, uint32_t align, uint32_t flags) {
+    struct KmemCache *cache = kmem_cache_alloc(&cache_cache);
+
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (cache_setup(cache, name, size, align, flags) != 0) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/**
+ * Set up the internal caches and the kmalloc size classes.
+ */
+void init_kmem(void) {
+    all_caches = NULL;
+
+    // The caches the allocator itself depends on can't use magazines
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct KmemCache), CACHE_LINE, KMEM_NO_MAGAZINE);
+    cache_setup(&magazine_cache, "magazine", sizeof(struct Magazine), CACHE_LINE, KMEM_NO_MAGAZINE);
+
+    static const char *names[KMALLOC_CLASSES] = {
+        "kmalloc-64", "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512",
+        "kmalloc-768", "kmalloc-1k", "kmalloc-1.5k", "kmalloc-2k", "kmalloc-3k", "kmalloc-4k",
+    };
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(names[i], kmalloc_sizes[i], CACHE_LINE, 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  kmalloc
+// ----------------------------------------------------------------------------
+
+/**
+ * Allocate `size` bytes.
+ */
+void *kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++) {
+        if (size <= kmalloc_sizes[i]) {
+            return kmalloc_caches[i] ? kmem_cache_alloc(kmalloc_caches[i]) : NULL;
+        }
+    }
+
+    if (size >= KMALLOC_LAZY_MIN) {
+        return vm_reserve(size, VM_WRITE);
+    }
+
+    // Large: a block of at least SLAB_SIZE with the header in front
+    uint32_t order = SLAB_ORDER;
+    while (order <= PAGE_MAX_ORDER && (PAGE_SIZE << order) < size + CACHE_LINE) {
+        order++;
+    }
+    if (order > PAGE_MAX_ORDER) {
+        return NULL;
+    }
+
+    struct LargeAlloc *large = (struct LargeAlloc *)alloc_pages(order);
+    if (large == NULL) {
+        return NULL;
+    }
+    large->magic = LARGE_MAGIC;
+    large->order = order;
+    return (char *)large + CACHE_LINE;
+}
+
+/**
+ * Free memory from kmalloc().
+ */
+void kfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (vm_is_lazy(ptr)) {
+        vm_release(ptr);
+        return;
+    }
+
+    uint64_t base = (uint64_t)ptr & ~(SLAB_SIZE - 1);
+    uint32_t magic = *(const uint32_t *)base;
+
+    if (magic == SLAB_MAGIC) {
+        kmem_cache_free(((struct Slab *)base)->cache, ptr);
+    } else if (magic == LARGE_MAGIC && (uint64_t)ptr == base + CACHE_LINE) {
+        struct LargeAlloc *large = (struct LargeAlloc *)base;
+        large->magic = 0;
+        free_pages(base, large->order);
+    } else {
+        log_message(LOG_ERROR, "kfree: %p is not a kmalloc pointer\n", ptr);
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  Statistics
+// ----------------------------------------------------------------------------
+
+/**
+ * Print per-cache counters.
+ *
+ * inuse counts objects held by callers (not those parked in magazines);
+ * util is their share of the slab memory; waste is the per-slab header
+ * and tail that can never hold an object; hit is the share of
+ * allocations the magazines served without the cache lock.
+ */
+void kmem_dump_stats(void) {
+    printk("cache          size  inuse/total  slabs  util%% waste%%  allocs  frees  hit%%\n");
+
+    for (struct KmemCache *cache = all_caches; cache != NULL; cache = cache->next) {
+        uint64_t flags = spin_lock_irqsave(&cache->lock);
+        uint64_t allocs = 0, frees = 0, hits = 0;
+        uint64_t cached = cache->depot_full_count * MAGAZINE_SIZE;
+
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            const struct KmemCpuCache *cc = &cache->cpu[cpu];
+            allocs += cc->allocs;
+            frees += cc->frees;
+            hits += cc->hits;
+            cached += (cc->loaded ? cc->loaded->rounds : 0) + (cc->previous ? cc->previous->rounds : 0);
+        }
+
+        uint64_t active = cache->inuse - cached;
+        uint64_t total = cache->slabs * cache->per_slab;
+        uint64_t bytes = cache->slabs * SLAB_SIZE;
+        uint64_t waste = SLAB_SIZE - (uint64_t)cache->per_slab * cache->size;
+        spin_unlock_irqrestore(&cache->lock, flags);
+
+        printk("%-13s %5u %6lu/%-6lu %5lu  %4lu   %4lu %7lu %6lu  %3lu\n",
+               cache->name, cache->size, active, total, cache->slabs,
+               bytes ? active * cache->size * 100 / bytes : 0,
+               (uint64_t)(waste * 100 / SLAB_SIZE), allocs, frees,
+               allocs ? hits * 100 / allocs : 0);
+    }
+}
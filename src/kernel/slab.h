@@ -0,0 +1,131 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "page_alloc.h"
+#include "../lib/spinlock.h"
+
+/**
+ * Slab geometry.
+ * SLAB_ORDER: Every slab is one 2^SLAB_ORDER-page buddy block (16 KB),
+ *             aligned to its size, so the slab header of any object is
+ *             found by masking its address.
+ * CACHE_LINE: Object alignment of the kmalloc size classes.
+ * SLAB_MAX_OBJECT: Largest object a slab cache holds (three per slab);
+ *                  bigger kmalloc requests get whole pages.
+ * MAGAZINE_SIZE: Objects per magazine (a magazine is two cache lines).
+ * KMALLOC_LAZY_MIN: kmalloc() requests at least this large come from
+ *                   vm_reserve() and are backed page by page on first use.
+ */
+#define SLAB_ORDER          2
+#define SLAB_SIZE           (PAGE_SIZE << SLAB_ORDER)
+#define CACHE_LINE          64
+#define SLAB_MAX_OBJECT     4096
+#define MAGAZINE_SIZE       14
+#define KMALLOC_LAZY_MIN    (64 * 1024)
+
+/**
+ * Cache flags.
+ * KMEM_NO_MAGAZINE: Skip the per-CPU layer; every call takes the cache
+ *                   lock. Used by the caches the magazine layer itself
+ *                   allocates from.
+ */
+#define KMEM_NO_MAGAZINE    0x01
+
+/**
+ * Magazine: a stack of free objects owned by one CPU, or parked in its
+ * cache's depot.
+ */
+struct Magazine {
+    struct Magazine *next;              // Depot list link
+    uint64_t rounds;                    // Objects in objs[]
+    void *objs[MAGAZINE_SIZE];
+};
+
+/**
+ * Per-CPU part of a cache. Only touched by its own CPU with interrupts
+ * disabled, so it needs no lock.
+ */
+struct KmemCpuCache {
+    struct Magazine *loaded;            // Allocate from / free to this one
+    struct Magazine *previous;          // Full or empty; swapped with loaded
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;                      // Allocations served by a magazine
+} __attribute__((aligned(64)));
+
+struct Slab;
+
+/**
+ * KmemCache: allocator for objects of one size.
+ *
+ * Objects come from slabs; the cache lock covers the slab lists and the
+ * depot. In front of that, each CPU keeps two magazines, so allocation
+ * and freeing normally never leave the CPU.
+ */
+struct KmemCache {
+    const char *name;
+    uint32_t size;                      // Object size, rounded up to align
+    uint32_t align;
+    uint32_t offset;                    // First object within a slab
+    uint32_t per_slab;                  // Objects per slab
+    uint32_t flags;                     // KMEM_* flags
+    struct Spinlock lock;
+
+    struct Slab *partial;               // Some objects free
+    struct Slab *full;                  // No objects free
+    struct Slab *empty;                 // At most one kept for reuse
+    uint64_t slabs;                     // Slabs owned
+    uint64_t inuse;                     // Objects out of the slabs (magazines included)
+
+    struct Magazine *depot_full;        // Full magazines not loaded on any CPU
+    struct Magazine *depot_empty;
+    uint64_t depot_full_count;
+    uint64_t depot_empty_count;
+
+    struct KmemCache *next;             // All caches, for kmem_dump_stats()
+    struct KmemCpuCache cpu[MAX_CPUS];
+};
+
+/**
+ * Set up the internal caches and the kmalloc size classes. Needs
+ * init_page_alloc().
+ */
+void init_kmem(void);
+
+/**
+ * Create a cache for objects of `size` bytes aligned to `align` (a power
+ * of two; 0 means 8). `name` must stay valid.
+ * @return The cache, or NULL if size is 0 or above SLAB_MAX_OBJECT.
+ */
+struct KmemCache *kmem_cache_create(const char *name, uint32_t size, uint32_t align, uint32_t flags);
+
+/**
+ * Allocate / free one object of a cache. The contents are undefined.
+ */
+void *kmem_cache_alloc(struct KmemCache *cache);
+void kmem_cache_free(struct KmemCache *cache, void *obj);
+
+/**
+ * Allocate `size` bytes, aligned to CACHE_LINE. Up to SLAB_MAX_OBJECT
+ * the request is served by the matching size class; larger ones get a
+ * buddy block of their own, and from KMALLOC_LAZY_MIN on a demand-zero
+ * region that is neither contiguous nor backed until touched.
+ * @return NULL if size is 0 or memory is exhausted.
+ */
+void *kmalloc(size_t size);
+
+/**
+ * Free memory from kmalloc(). NULL is ignored.
+ */
+void kfree(void *ptr);
+
+/**
+ * Print per-cache counters: objects in use and allocated, slabs,
+ * utilization, slab overhead, and how often the magazines served a call.
+ */
+void kmem_dump_stats(void);
+
+#endif  // _SLAB_H_
@@ -0,0 +1,112 @@
+; ----------------------------------------------------------------------------
+;  SMP.ASM - application processor trampoline
+; ----------------------------------------------------------------------------
+;  A CPU woken by a start-up IPI begins in real mode at vector * 0x1000.
+;  smp.c copies this code to SMP_TRAMPOLINE (0x7000, vector 7) and fills
+;  in TrampolineArgs at its end before every start-up, then the code:
+;   1) loads its own small GDT and enters protected mode,
+;   2) enables PAE, loads the kernel page tables, sets EFER.LME (and NXE)
+;      and turns on paging,
+;   3) jumps into 64-bit code, takes the stack it was given and calls the
+;      C entry point with the CPU index in edi.
+;
+;  Everything runs from the copy, so every address is computed with
+;  TRAMP() rather than taken from the kernel image.
+; ----------------------------------------------------------------------------
+
+%define SMP_TRAMPOLINE      0x7000      ; Must match smp.h
+%define TRAMP(label)        (SMP_TRAMPOLINE + (label) - smp_trampoline_start)
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_args
+global smp_trampoline_end
+
+align 16
+
+[BITS 16]
+
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax                  ; CS is 0x0700; address everything from 0
+    mov ds, ax
+
+    lgdt [TRAMP(TrampGdtPtr)]
+
+    mov eax, cr0
+    or eax, 1                   ; PE
+    mov cr0, eax
+
+    jmp dword 0x08:TRAMP(TrampProtected)
+
+[BITS 32]
+
+TrampProtected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; PAE and global pages, plus the SSE enables kernel.asm sets on the
+    ; boot CPU
+    mov eax, cr4
+    or eax, (1 << 5) | (1 << 7) | (1 << 9) | (1 << 10)
+    mov cr4, eax
+
+    mov eax, [TRAMP(ArgCr3)]    ; The kernel's PML4 lies below 4 GB
+    mov cr3, eax
+
+    mov ecx, 0xC0000080         ; EFER
+    rdmsr
+    or eax, [TRAMP(ArgEfer)]    ; LME, and NXE when the tables use NX
+    wrmsr
+
+    mov eax, cr0
+    and eax, ~(1 << 2)          ; EM = 0
+    or eax, (1 << 31) | (1 << 1) ; PG, MP
+    mov cr0, eax
+
+    jmp 0x18:TRAMP(TrampLong)
+
+[BITS 64]
+
+TrampLong:
+    mov rsp, [TRAMP(ArgStack)]
+    mov edi, [TRAMP(ArgCpu)]
+    mov rax, [TRAMP(ArgEntry)]
+    call rax                    ; Does not return
+
+TrampHalt:
+    hlt
+    jmp TrampHalt
+
+; ----------------------------------------------------------------------------
+;  Temporary GDT: only until the CPU loads its own (smp.c)
+; ----------------------------------------------------------------------------
+align 8
+
+TrampGdt:
+    dq 0                        ; NULL descriptor
+    dq 0x00CF9A000000FFFF       ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF       ; 0x10: data
+    dq 0x00209A0000000000       ; 0x18: 64-bit code
+TrampGdtLen: equ $ - TrampGdt
+TrampGdtPtr:
+    dw TrampGdtLen - 1
+    dd TRAMP(TrampGdt)
+
+; ----------------------------------------------------------------------------
+;  TrampolineArgs (smp.h), written by smp.c into the copy
+; ----------------------------------------------------------------------------
+align 8
+
+smp_trampoline_args:
+ArgCr3:     dq 0                ; Kernel PML4
+ArgEfer:    dq 0                ; EFER bits to set
+ArgStack:   dq 0                ; Initial rsp
+ArgEntry:   dq 0                ; void entry(uint32_t cpu)
+ArgCpu:     dq 0                ; CPU index
+
+smp_trampoline_end:
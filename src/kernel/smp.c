@@ -0,0 +1,255 @@
+#include "smp.h"
+#include "apic.h"
+#include "fpu.h"
+#include "paging.h"
+#include "sched.h"
+#include "time.h"
+#include "timer.h"
+#include "trace.h"
+#include "trap.h"
+#include "vm.h"
+#include "../lib/debug.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  smp.c
+// ----------------------------------------------------------------------------
+//  Per-CPU state and application processor start-up.
+//
+//  Every CPU has a PerCpu in per_cpu[], with its own GDT and TSS inside,
+//  and GS_BASE pointing at it. The boot CPU sets its own up before
+//  anything else runs; it keeps the boot stack and uses static IST stacks.
+//
+//  The other CPUs are started one at a time: their stacks are reserved
+//  and populated (with guard pages) from the kernel virtual area, the
+//  trampoline's argument block is filled in, and INIT followed by two
+//  start-up IPIs is sent. A CPU entering ap_main() from the trampoline
+//  enables its FPU state, loads its tables, enables its local APIC and
+//  timer wheel, reports itself online and becomes the idle thread of its
+//  run queue (sched.c).
+// ----------------------------------------------------------------------------
+
+/**
+ * GDT descriptors (see percpu.h for the selectors).
+ */
+#define GDT_KERNEL_CODE     0x00209A0000000000ULL   // Present, DPL 0, 64-bit code
+#define GDT_KERNEL_DATA     0x0000920000000000ULL   // Present, DPL 0, writable
+#define GDT_USER_DATA       0x0000F20000000000ULL   // Present, DPL 3, writable
+#define GDT_TSS_AVAILABLE   0x89ULL                 // Present, 64-bit TSS, not busy
+
+_Static_assert(offsetof(struct PerCpu, cpu) == PERCPU_CPU_OFFSET, "cpu_id() reads PerCpu.cpu");
+_Static_assert(offsetof(struct PerCpu, trap_depth) == PERCPU_TRAP_DEPTH_OFFSET,
+               "lib.asm reads PerCpu.trap_depth");
+
+/**
+ * Trampoline code and its TrampolineArgs (smp.asm).
+ */
+extern char smp_trampoline_start[];
+extern char smp_trampoline_args[];
+extern char smp_trampoline_end[];
+
+struct PerCpu per_cpu[MAX_CPUS];
+
+static uint32_t cpus_online;
+
+// The boot CPU's IST stacks, needed before there is a page allocator
+static uint8_t boot_ist_stacks[IST_COUNT][IST_STACK_SIZE] __attribute__((aligned(16)));
+
+/**
+ * Fill in a CPU's TSS for its stacks and its GDT around the TSS.
+ */
+static void build_cpu_tables(struct PerCpu *pc, uint64_t stack_top, const uint64_t ist_tops[IST_COUNT]) {
+    memset(&pc->tss, 0, sizeof(pc->tss));
+    pc->tss.rsp[0] = stack_top;
+    for (int i = 0; i < IST_COUNT; i++) {
+        pc->tss.ist[i] = ist_tops[i];
+    }
+    pc->tss.iomap_base = sizeof(pc->tss);
+    pc->stack_top = stack_top;
+
+    uint64_t base = (uint64_t)&pc->tss;
+    uint64_t limit = sizeof(pc->tss) - 1;
+
+    pc->gdt[0] = 0;
+    pc->gdt[KERNEL_CS >> 3] = GDT_KERNEL_CODE;
+    pc->gdt[KERNEL_DS >> 3] = GDT_KERNEL_DATA;
+    pc->gdt[3] = GDT_USER_DATA;
+    pc->gdt[TSS_SELECTOR >> 3] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (GDT_TSS_AVAILABLE << 40) |
+                                 (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    pc->gdt[(TSS_SELECTOR >> 3) + 1] = base >> 32;
+}
+
+/**
+ * Switch the calling CPU to its own GDT and TSS and point GS_BASE at its
+ * PerCpu. Loading GS clears the base, so GS_BASE is written last.
+ */
+static void load_cpu_tables(struct PerCpu *pc) {
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) gdtr = { sizeof(pc->gdt) - 1, (uint64_t)pc->gdt };
+
+    __asm__ volatile ("lgdt %0\n\t"
+                      "pushq %1\n\t"
+                      "leaq 1f(%%rip), %%rax\n\t"
+                      "pushq %%rax\n\t"
+                      "lretq\n"
+                      "1:\n\t"
+                      "mov %2, %%eax\n\t"
+                      "mov %%eax, %%ds\n\t"
+                      "mov %%eax, %%es\n\t"
+                      "mov %%eax, %%ss\n\t"
+                      "xor %%eax, %%eax\n\t"
+                      "mov %%eax, %%fs\n\t"
+                      "mov %%eax, %%gs\n\t"
+                      "ltr %w3"
+                      : : "m" (gdtr), "i" (KERNEL_CS), "i" (KERNEL_DS), "r" ((uint32_t)TSS_SELECTOR)
+                      : "rax", "memory");
+
+    wrmsr(MSR_GS_BASE, (uint64_t)pc);
+}
+
+/**
+ * Set up the boot CPU's per-CPU area.
+ */
+void init_percpu(void) {
+    uint64_t ist[IST_COUNT];
+
+    memset(per_cpu, 0, sizeof(per_cpu));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        per_cpu[cpu].self = &per_cpu[cpu];
+        per_cpu[cpu].cpu = cpu;
+    }
+
+    for (int i = 0; i < IST_COUNT; i++) {
+        ist[i] = (uint64_t)boot_ist_stacks[i] + IST_STACK_SIZE;
+    }
+    build_cpu_tables(&per_cpu[0], KERNEL_BASE, ist);
+    load_cpu_tables(&per_cpu[0]);
+
+    per_cpu[0].online = 1;
+    cpus_online = 1;
+}
+
+/**
+ * First C code on an application processor, on its idle stack.
+ */
+static void ap_main(uint32_t cpu) {
+    struct PerCpu *pc = &per_cpu[cpu];
+
+    fpu_init_cpu();
+    load_cpu_tables(pc);
+    paging_init_cpu();
+    idt_init_cpu();
+    trace_set_cpu(cpu);
+    lapic_init_cpu();
+    clockevent_init_cpu();
+    init_timers();
+
+    sched_init_cpu();
+
+    __atomic_store_n(&pc->online, 1, __ATOMIC_RELEASE);
+    sched_idle();
+}
+
+/**
+ * Give CPU `cpu` its stacks and tables and wake it.
+ * @return 0 once it is online, -1 if it can't be started.
+ */
+static int start_cpu(uint32_t cpu, uint32_t apic_id) {
+    struct PerCpu *pc = &per_cpu[cpu];
+    struct TrampolineArgs *args =
+        (struct TrampolineArgs *)(SMP_TRAMPOLINE + (smp_trampoline_args - smp_trampoline_start));
+    void *stacks[1 + IST_COUNT];
+    uint64_t ist[IST_COUNT];
+
+    // Populated up front: the CPU can't take a fault before its IDT is in
+    for (int i = 0; i <= IST_COUNT; i++) {
+        stacks[i] = vm_reserve(i == 0 ? KERNEL_STACK_SIZE : IST_STACK_SIZE, VM_WRITE | VM_POPULATE);
+        if (stacks[i] == NULL) {
+            while (i-- > 0) {
+                vm_release(stacks[i]);
+            }
+            log_message(LOG_ERROR, "smp: no memory for the stacks of CPU %u\n", cpu);
+            return -1;
+        }
+    }
+    for (int i = 0; i < IST_COUNT; i++) {
+        ist[i] = (uint64_t)stacks[i + 1] + IST_STACK_SIZE;
+    }
+    build_cpu_tables(pc, (uint64_t)stacks[0] + KERNEL_STACK_SIZE, ist);
+    pc->apic_id = apic_id;
+
+    args->cr3 = (uint64_t)kernel_space.pml4;
+    args->efer = EFER_LME | (cpu_has(X86_FEATURE_NX) ? EFER_NXE : 0);
+    args->stack = pc->stack_top;
+    args->entry = (uint64_t)ap_main;
+    args->cpu = cpu;
+
+    // INIT, then a start-up IPI, and a second one if the CPU missed it.
+    // A CPU already past wait-for-SIPI ignores the second.
+    lapic_send_ipi(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    udelay(SMP_INIT_DELAY_US);
+    for (int sipi = 0; sipi < 2 && !pc->online; sipi++) {
+        lapic_send_ipi(apic_id, ICR_STARTUP | ICR_ASSERT | (SMP_TRAMPOLINE >> 12));
+        udelay(SMP_SIPI_DELAY_US);
+    }
+
+    uint64_t deadline = clock_us() + SMP_START_TIMEOUT_US;
+    while (!pc->online && clock_us() < deadline) {
+        __asm__ volatile ("pause");
+    }
+    if (!pc->online) {
+        // Its stacks stay reserved: it may still turn up and use them
+        log_message(LOG_WARN, "smp: CPU %u (APIC id %u) did not start\n", cpu, apic_id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Start the application processors.
+ */
+void init_smp(void) {
+    if (apic_info.mode == APIC_MODE_PIC) {
+        return;
+    }
+    per_cpu[0].apic_id = lapic_id();
+
+    memcpy((void *)SMP_TRAMPOLINE, smp_trampoline_start, (uint64_t)(smp_trampoline_end - smp_trampoline_start));
+
+    for (uint32_t i = 0; i < apic_info.cpu_count && cpus_online < MAX_CPUS; i++) {
+        uint32_t apic_id = apic_info.cpu_apic_ids[i];
+
+        if (apic_id == per_cpu[0].apic_id) {
+            continue;
+        }
+        // A CPU that timed out may still read the trampoline arguments
+        // later, so they can't be reused for another
+        if (start_cpu(cpus_online, apic_id) != 0) {
+            break;
+        }
+        cpus_online++;
+    }
+}
+
+/**
+ * Number of CPUs running.
+ */
+uint32_t smp_cpu_count(void) {
+    return cpus_online;
+}
+
+/**
+ * Print the CPUs that came up.
+ */
+void print_smp_info(void) {
+    printk("SMP: %u CPU(s) online\n", cpus_online);
+    for (uint32_t cpu = 0; cpu < cpus_online; cpu++) {
+        const struct PerCpu *pc = &per_cpu[cpu];
+
+        printk("  CPU %u: APIC id %u, stack %#lx, %lu idle wakeups\n", cpu, pc->apic_id,
+               pc->stack_top, pc->idle_wakeups);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef _SMP_H_
+#define _SMP_H_
+
+#include <stdint.h>
+#include "percpu.h"
+
+/**
+ * SMP_TRAMPOLINE: Page the AP trampoline (smp.asm) is copied to; its
+ *                 start-up IPI vector is the page number. Must match
+ *                 smp.asm and lie in free low memory (memmap.h).
+ * SMP_INIT_DELAY_US: Wait after INIT before the first start-up IPI.
+ * SMP_SIPI_DELAY_US: Wait after each start-up IPI.
+ * SMP_START_TIMEOUT_US: How long a CPU gets to come online.
+ */
+#define SMP_TRAMPOLINE          0x7000
+#define SMP_INIT_DELAY_US       10000
+#define SMP_SIPI_DELAY_US       200
+#define SMP_START_TIMEOUT_US    100000
+
+/**
+ * Parameters at the end of the trampoline copy. Must match the layout
+ * after smp_trampoline_args in smp.asm.
+ */
+struct TrampolineArgs {
+    uint64_t cr3;                       // Kernel PML4 (below 4 GB)
+    uint64_t efer;                      // EFER bits to set: LME, NXE
+    uint64_t stack;                     // Initial rsp
+    uint64_t entry;                     // void entry(uint32_t cpu)
+    uint64_t cpu;
+};
+
+/**
+ * Set up the boot CPU's per-CPU area, GDT and TSS (with its IST stacks)
+ * and point GS_BASE at it, which makes cpu_id() and this_cpu_*() usable.
+ * Call first thing in KMain(): it needs nothing else.
+ */
+void init_percpu(void);
+
+/**
+ * Start every other CPU listed in the MADT with INIT-SIPI-SIPI. Each
+ * gets its own stacks, GDT, TSS and per-CPU area, loads the kernel page
+ * tables and IDT, enables its local APIC and timer wheel, and then runs
+ * threads from sched_idle(). Needs init_apic(), init_time(), init_timers(),
+ * init_vm() and init_sched(); returns once all CPUs are up or have timed
+ * out.
+ */
+void init_smp(void);
+
+/**
+ * Number of CPUs running, the boot CPU included.
+ */
+uint32_t smp_cpu_count(void);
+
+/**
+ * Print the CPUs that came up.
+ */
+void print_smp_info(void);
+
+#endif  // _SMP_H_
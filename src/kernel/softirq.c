@@ -0,0 +1,218 @@
+#include "softirq.h"
+#include "sched.h"
+#include "smp.h"
+#include "time.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  softirq.c
+// ----------------------------------------------------------------------------
+//  Bottom halves: work interrupt handlers defer so they only acknowledge
+//  the device and return.
+//
+//  A handler schedules a tasklet on its CPU's queue. handler() then runs
+//  the queue on the way out of the outermost interrupt, after the device
+//  is acknowledged, with interrupts enabled: other devices get in while
+//  the work runs. Interrupts nested in a pass don't start another pass,
+//  and don't switch threads either (the pass would move to another CPU
+//  with the thread); the switch waits for the end of the pass.
+//
+//  A pass stops at SOFTIRQ_BUDGET tasklets or SOFTIRQ_BUDGET_US. What is
+//  left goes to a worker thread, pinned to the CPU, which runs a budget
+//  per time slice and yields in between. While it exists, interrupt exits
+//  leave the queue to it, so a flood of interrupts can't keep the CPU in
+//  bottom halves. The worker exits when the queue is empty; the next
+//  overflow creates another (thread_create() recycles the old one).
+// ----------------------------------------------------------------------------
+
+static struct SoftirqQueue queues[MAX_CPUS];
+
+static inline struct SoftirqQueue *this_queue(void) {
+    return &queues[cpu_id() % MAX_CPUS];
+}
+
+/**
+ * Take every tasklet pushed so far, oldest first.
+ */
+static struct Tasklet *take_all(struct SoftirqQueue *q) {
+    struct Tasklet *list = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+    struct Tasklet *oldest = NULL;
+
+    while (list != NULL) {
+        struct Tasklet *next = list->next;
+        list->next = oldest;
+        oldest = list;
+        list = next;
+    }
+    return oldest;
+}
+
+/**
+ * Push a tasklet onto a queue. Safe against interrupts and other CPUs.
+ */
+static void push(struct SoftirqQueue *q, struct Tasklet *tasklet) {
+    tasklet->next = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&q->head, &tasklet->next, tasklet, 0, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Run one tasklet, unless another CPU is running it: then it goes back on
+ * the queue, still pending.
+ */
+static void run_tasklet(struct SoftirqQueue *q, struct Tasklet *tasklet) {
+    if (__atomic_fetch_or(&tasklet->state, TASKLET_RUNNING, __ATOMIC_ACQUIRE) & TASKLET_RUNNING) {
+        push(q, tasklet);
+        return;
+    }
+
+    // Not pending from here on: the function may schedule it again
+    __atomic_fetch_and(&tasklet->state, ~TASKLET_PENDING, __ATOMIC_ACQ_REL);
+    tasklet->fn(tasklet->ctx);
+    __atomic_fetch_and(&tasklet->state, ~TASKLET_RUNNING, __ATOMIC_RELEASE);
+    q->ran++;
+}
+
+/**
+ * One budgeted pass over this CPU's queue. Interrupts enabled, q->running
+ * set by the caller.
+ * @return 1 if tasklets are left, 0 if the queue is empty.
+ */
+static int drain(struct SoftirqQueue *q) {
+    uint64_t deadline = clock_us() + SOFTIRQ_BUDGET_US;
+
+    for (uint32_t done = 0;; done++) {
+        if (q->backlog == NULL) {
+            q->backlog = take_all(q);
+            if (q->backlog == NULL) {
+                return 0;
+            }
+        }
+        if (done >= SOFTIRQ_BUDGET || clock_us() >= deadline) {
+            q->exhausted++;
+            return 1;
+        }
+
+        struct Tasklet *tasklet = q->backlog;
+        q->backlog = tasklet->next;
+        run_tasklet(q, tasklet);
+    }
+}
+
+static int has_work(const struct SoftirqQueue *q) {
+    return q->backlog != NULL || __atomic_load_n(&q->head, __ATOMIC_RELAXED) != NULL;
+}
+
+/**
+ * Worker thread: a pass per time slice until the queue is empty.
+ */
+static void softirq_worker(void *arg) {
+    struct SoftirqQueue *q = arg;       // Pinned: always this CPU's queue
+
+    for (;;) {
+        irq_disable();
+        if (!has_work(q)) {
+            q->worker = 0;
+            irq_enable();
+            return;
+        }
+        q->running = 1;
+        irq_enable();
+
+        drain(q);
+
+        irq_disable();
+        q->running = 0;
+        irq_enable();
+        thread_yield();
+    }
+}
+
+/**
+ * Clear every CPU's queue.
+ */
+void init_softirq(void) {
+    memset(queues, 0, sizeof(queues));
+}
+
+/**
+ * Prepare a tasklet.
+ */
+void tasklet_init(struct Tasklet *tasklet, void (*fn)(void *ctx), void *ctx) {
+    tasklet->next = NULL;
+    tasklet->state = 0;
+    tasklet->fn = fn;
+    tasklet->ctx = ctx;
+}
+
+/**
+ * Queue a tasklet on the calling CPU.
+ */
+void tasklet_schedule(struct Tasklet *tasklet) {
+    if (__atomic_fetch_or(&tasklet->state, TASKLET_PENDING, __ATOMIC_ACQ_REL) & TASKLET_PENDING) {
+        return;
+    }
+
+    // Outside interrupt handlers nothing else would run it soon
+    if (irqs_enabled()) {
+        uint64_t flags = irq_save();
+        push(this_queue(), tasklet);
+        irq_restore(flags);
+        softirq_run();
+    } else {
+        push(this_queue(), tasklet);
+    }
+}
+
+/**
+ * Run this CPU's pending tasklets within the budget.
+ */
+void softirq_run(void) {
+    uint64_t flags = irq_save();
+    struct SoftirqQueue *q = this_queue();
+
+    if (q->running || q->worker || !has_work(q)) {
+        irq_restore(flags);
+        return;
+    }
+
+    q->running = 1;
+    irq_enable();
+    int left = drain(q);
+    irq_disable();
+    q->running = 0;
+
+    // Queued on this CPU as interrupts are off
+    if (left) {
+        q->worker = 1;
+        if (thread_create("softirq", softirq_worker, q, THREAD_PINNED) != NULL) {
+            q->worker_starts++;
+        } else {
+            q->worker = 0;              // The next interrupt exit goes on
+        }
+    }
+    irq_restore(flags);
+}
+
+/**
+ * Check whether a pass is running on this CPU.
+ */
+int softirq_active(void) {
+    return this_queue()->running;
+}
+
+/**
+ * Print the per-CPU bottom half counters.
+ */
+void softirq_dump_stats(void) {
+    printk("Softirq: %u tasklets / %u us per pass\n", SOFTIRQ_BUDGET, SOFTIRQ_BUDGET_US);
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        const struct SoftirqQueue *q = &queues[cpu];
+
+        printk("  CPU %u: %lu run, %lu over budget, %lu worker starts\n", cpu, q->ran, q->exhausted,
+               q->worker_starts);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef _SOFTIRQ_H_
+#define _SOFTIRQ_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+/**
+ * Bottom half budget.
+ * SOFTIRQ_BUDGET: Tasklets run per pass, on interrupt exit or per time
+ *                 slice of the worker thread.
+ * SOFTIRQ_BUDGET_US: Longest a pass keeps going, in microseconds.
+ *
+ * Work left over after a pass goes to the CPU's worker thread, which
+ * takes turns with the other threads instead of delaying them.
+ */
+#define SOFTIRQ_BUDGET      64
+#define SOFTIRQ_BUDGET_US   2000
+
+/**
+ * Tasklet state bits.
+ * TASKLET_PENDING: Queued and not started yet.
+ * TASKLET_RUNNING: Its function is running (on some CPU).
+ */
+#define TASKLET_PENDING     (1u << 0)
+#define TASKLET_RUNNING     (1u << 1)
+
+/**
+ * Tasklet: work an interrupt handler defers to the bottom half.
+ *
+ * The function runs with interrupts enabled, outside any interrupt
+ * handler, on the CPU that scheduled it. A tasklet is queued at most once
+ * however often it is scheduled before it runs, and never runs on two
+ * CPUs at once. It may schedule itself again.
+ */
+struct Tasklet {
+    struct Tasklet *next;               // Next in a queue
+    uint32_t state;                     // TASKLET_PENDING, TASKLET_RUNNING
+    void (*fn)(void *ctx);
+    void *ctx;
+};
+
+/**
+ * Per-CPU bottom half queue.
+ *
+ * Tasklets are pushed onto `head` with a compare-and-swap, so interrupt
+ * handlers (and any CPU) can add work without a lock. Only the owning CPU
+ * takes from it: it swaps the whole list out, and keeps what a pass had
+ * no budget for in `backlog`, oldest first.
+ */
+struct SoftirqQueue {
+    struct Tasklet *head __attribute__((aligned(64)));  // Newest first
+    struct Tasklet *backlog;            // Taken from head, not run yet
+    uint32_t running;                   // A pass is in progress here
+    uint32_t worker;                    // The worker thread exists
+    uint64_t ran;                       // Tasklets run
+    uint64_t exhausted;                 // Passes that ran out of budget
+    uint64_t worker_starts;
+};
+
+/**
+ * Clear every CPU's queue. Call on the boot CPU before interrupts are
+ * enabled.
+ */
+void init_softirq(void);
+
+/**
+ * Prepare a tasklet. It does nothing until scheduled.
+ */
+void tasklet_init(struct Tasklet *tasklet, void (*fn)(void *ctx), void *ctx);
+
+/**
+ * Queue a tasklet on the calling CPU, unless it is already pending.
+ * From an interrupt handler it runs once the outermost handler returns;
+ * called with interrupts enabled, it runs before this returns (or in the
+ * worker thread).
+ */
+void tasklet_schedule(struct Tasklet *tasklet);
+
+/**
+ * Run this CPU's pending tasklets, with interrupts enabled, within the
+ * budget; leftovers wake the worker thread. Does nothing while a pass or
+ * the worker is already active here. Called by handler() on the way out
+ * of the outermost interrupt.
+ */
+void softirq_run(void);
+
+/**
+ * Check whether a pass is running on this CPU. Interrupts taken meanwhile
+ * must not switch threads, the pass belongs to this CPU.
+ */
+int softirq_active(void);
+
+/**
+ * Print the per-CPU bottom half counters.
+ */
+void softirq_dump_stats(void);
+
+#endif  // _SOFTIRQ_H_
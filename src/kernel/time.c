@@ -0,0 +1,293 @@
+#include "time.h"
+#include "apic.h"
+#include "cpu.h"
+#include "timer.h"
+#include "trap.h"
+#include "../lib/io.h"
+#include "../lib/print.h"
+
+// ----------------------------------------------------------------------------
+//  time.c
+// ----------------------------------------------------------------------------
+//  Clocksource and clock event devices.
+//
+//  Time is read from the TSC, calibrated once at boot (CPUID leaf 0x15 when
+//  it reports the crystal clock, otherwise against PIT channel 2). TSC
+//  deltas are turned into nanoseconds with a 32.32 fixed-point multiplier,
+//  so reading the clock costs one RDTSC and one multiply.
+//
+//  There is no periodic tick. The timer wheel (timer.c) arms one interrupt
+//  for its next expiry through clockevent_program(), using the best
+//  device available:
+//    - LAPIC timer in TSC-deadline mode: the deadline is written as an
+//      absolute TSC value, with no conversion and no drift.
+//    - LAPIC timer in one-shot mode, calibrated against the TSC.
+//    - PIT channel 0 in one-shot mode (without a local APIC). It counts at
+//      most 65535 ticks (~55 ms), so longer waits take a few wakeups.
+// ----------------------------------------------------------------------------
+
+#define MSR_TSC_DEADLINE        0x6E0
+
+#define PIT_CHANNEL0            0x40
+#define PIT_CHANNEL2            0x42
+#define PIT_COMMAND             0x43
+#define PIT_GATE                0x61     // Bit 0: channel 2 gate, bit 5: its output
+#define PIT_ONESHOT_CH0         0x30     // Channel 0, lo/hi byte, mode 0
+#define PIT_ONESHOT_CH2         0xB0     // Channel 2, lo/hi byte, mode 0
+#define PIT_MAX_COUNT           0xFFFF
+
+#define CALIBRATE_MS            20
+#define CALIBRATE_RUNS          3
+
+uint64_t tsc_khz;
+uint64_t boot_tsc;
+
+static uint64_t ns_mult;                 // ns = (tsc delta * ns_mult) >> 32
+static uint64_t lapic_timer_khz;         // LAPIC timer rate with divide-by-1
+static enum ClockEventMode clockevent_mode;
+
+// ----------------------------------------------------------------------------
+//  Clocksource
+// ----------------------------------------------------------------------------
+
+/**
+ * Measure the TSC over CALIBRATE_MS of PIT channel 2 countdown.
+ * @return TSC frequency in kHz.
+ */
+static uint64_t calibrate_tsc_pit(void) {
+    uint16_t count = PIT_HZ / (1000 / CALIBRATE_MS);
+    uint8_t gate = inb(PIT_GATE);
+
+    // Gate on, speaker off
+    outb(PIT_GATE, (gate & ~0x02) | 0x01);
+
+    outb(PIT_COMMAND, PIT_ONESHOT_CH2);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    // The output goes high when the count reaches zero
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20)) {
+        __asm__ volatile ("pause");
+    }
+    uint64_t end = rdtsc();
+
+    outb(PIT_GATE, gate);
+    return (end - start) * PIT_HZ / count / 1000;
+}
+
+/**
+ * Determine the TSC frequency.
+ */
+static uint64_t calibrate_tsc(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    // Leaf 0x15: TSC = crystal * EBX / EAX, when the crystal is reported
+    if (cpu_info.max_leaf >= 0x15) {
+        cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+        if (eax != 0 && ebx != 0 && ecx != 0) {
+            return (uint64_t)ecx * ebx / eax / 1000;
+        }
+    }
+
+    // An SMI or a host preemption only makes a run longer, so keep the
+    // shortest one
+    uint64_t khz = 0;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t run = calibrate_tsc_pit();
+        if (khz == 0 || run < khz) {
+            khz = run;
+        }
+    }
+    return khz;
+}
+
+/**
+ * Nanoseconds since init_time().
+ */
+uint64_t clock_ns(void) {
+    return (uint64_t)(((unsigned __int128)(rdtsc() - boot_tsc) * ns_mult) >> 32);
+}
+
+/**
+ * Microseconds since init_time().
+ */
+uint64_t clock_us(void) {
+    return clock_ns() / 1000;
+}
+
+/**
+ * Convert a TSC cycle count to nanoseconds.
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    // Split like us_to_tsc() so cycles * 1000000 can't overflow
+    return cycles / tsc_khz * 1000000 + cycles % tsc_khz * 1000000 / tsc_khz;
+}
+
+/**
+ * Convert a clock_us() time to a TSC value.
+ */
+uint64_t us_to_tsc(uint64_t us) {
+    // Split so neither product overflows (and no 128-bit divide is needed)
+    return boot_tsc + us / 1000 * tsc_khz + us % 1000 * tsc_khz / 1000;
+}
+
+/**
+ * Busy-wait for at least `us` microseconds.
+ */
+void udelay(uint64_t us) {
+    uint64_t end = rdtsc() + us * tsc_khz / 1000;
+
+    while (rdtsc() < end) {
+        __asm__ volatile ("pause");
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  Clock events
+// ----------------------------------------------------------------------------
+
+/**
+ * Clock event interrupt: run the expired timers, which re-arms the device.
+ */
+static void clockevent_interrupt(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    eoi();
+    timer_run();
+}
+
+/**
+ * Arm the clock event device for a clock_us() time.
+ */
+void clockevent_program(uint64_t deadline_us) {
+    uint64_t now, target, delta;
+
+    if (clockevent_mode == CLOCKEVENT_TSC_DEADLINE) {
+        // A deadline in the past fires at once; 0 disarms
+        wrmsr(MSR_TSC_DEADLINE, deadline_us == UINT64_MAX ? 0 : us_to_tsc(deadline_us));
+        return;
+    }
+
+    if (deadline_us == UINT64_MAX) {
+        if (clockevent_mode == CLOCKEVENT_LAPIC_ONESHOT) {
+            lapic_write(LAPIC_TIMER_INITIAL, 0);
+        } else {
+            outb(PIT_COMMAND, PIT_ONESHOT_CH0);     // Waits for a count that never comes
+        }
+        return;
+    }
+
+    now = rdtsc();
+    target = us_to_tsc(deadline_us);
+    delta = target > now ? target - now : 0;
+
+    if (clockevent_mode == CLOCKEVENT_LAPIC_ONESHOT) {
+        uint64_t count = delta * lapic_timer_khz / tsc_khz;
+        if (count == 0) {
+            count = 1;
+        } else if (count > 0xFFFFFFFF) {
+            count = 0xFFFFFFFF;
+        }
+        lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+        return;
+    }
+
+    // PIT: a deadline beyond the counter's range fires early; timer_run()
+    // then finds nothing due and programs the rest
+    uint64_t max_delta = (uint64_t)PIT_MAX_COUNT * tsc_khz * 1000 / PIT_HZ;
+    uint64_t count = delta >= max_delta ? PIT_MAX_COUNT : delta * PIT_HZ / (tsc_khz * 1000);
+    if (count == 0) {
+        count = 1;
+    }
+    outb(PIT_COMMAND, PIT_ONESHOT_CH0);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+/**
+ * Measure the LAPIC timer (divide by 1) against the TSC.
+ */
+static uint64_t calibrate_lapic_timer(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, 0xB);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+
+    udelay(CALIBRATE_MS * 1000);
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    return elapsed / CALIBRATE_MS;
+}
+
+/**
+ * Calibrate the TSC and set up the clock event device.
+ */
+void init_time(void) {
+    tsc_khz = calibrate_tsc();
+    ns_mult = (1000000ULL << 32) / tsc_khz;
+    boot_tsc = rdtsc();
+
+    // Stop the PIT's periodic tick; from here on it only counts when
+    // armed as the one-shot fallback
+    outb(PIT_COMMAND, PIT_ONESHOT_CH0);
+
+    if (apic_info.mode == APIC_MODE_PIC) {
+        clockevent_mode = CLOCKEVENT_PIT;
+        register_irq_handler(IRQ_BASE_VECTOR, clockevent_interrupt, NULL);
+        return;
+    }
+
+    // IRQ0 isn't needed with the LAPIC timer
+    ioapic_route_irq(0, IRQ_BASE_VECTOR, 0);
+    register_irq_handler(LAPIC_TIMER_VECTOR, clockevent_interrupt, NULL);
+
+    if (cpu_has(X86_FEATURE_TSC_DEADLINE)) {
+        clockevent_mode = CLOCKEVENT_TSC_DEADLINE;
+    } else {
+        clockevent_mode = CLOCKEVENT_LAPIC_ONESHOT;
+        lapic_timer_khz = calibrate_lapic_timer();
+    }
+    clockevent_init_cpu();
+}
+
+/**
+ * Point this CPU's LAPIC timer at the timer vector.
+ */
+void clockevent_init_cpu(void) {
+    switch (clockevent_mode) {
+        case CLOCKEVENT_TSC_DEADLINE:
+            lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+
+            // Order the LVT write before the first deadline write (SDM 10.5.4.1)
+            __asm__ volatile ("mfence" : : : "memory");
+            break;
+
+        case CLOCKEVENT_LAPIC_ONESHOT:
+            // Same divider as calibrate_lapic_timer() measured with
+            lapic_write(LAPIC_TIMER_DIVIDE, 0xB);
+            lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+            break;
+
+        case CLOCKEVENT_PIT:
+            break;
+    }
+}
+
+/**
+ * Name of the clock event device in use.
+ */
+const char *clockevent_name(void) {
+    static const char *modes[] = { "LAPIC TSC-deadline", "LAPIC one-shot", "PIT one-shot" };
+
+    return modes[clockevent_mode];
+}
+
+/**
+ * Print the clocksource and clock event setup.
+ */
+void print_time_info(void) {
+    printk("Clock: TSC %lu.%03lu MHz%s, events: %s\n", tsc_khz / 1000, tsc_khz % 1000,
+           cpu_has(X86_FEATURE_INVARIANT_TSC) ? "" : " (not invariant)",
+           clockevent_name());
+}
@@ -0,0 +1,89 @@
+#ifndef _TIME_H_
+#define _TIME_H_
+
+#include <stdint.h>
+
+/**
+ * Vector of the local APIC timer. The PIT keeps IRQ 0 (vector 32).
+ */
+#define LAPIC_TIMER_VECTOR  0xF0
+
+/**
+ * PIT input clock in Hz.
+ */
+#define PIT_HZ              1193182
+
+/**
+ * Hardware used for timer interrupts, chosen by init_time().
+ */
+enum ClockEventMode {
+    CLOCKEVENT_TSC_DEADLINE,     // LAPIC timer in TSC-deadline mode
+    CLOCKEVENT_LAPIC_ONESHOT,    // LAPIC timer counting down once
+    CLOCKEVENT_PIT,              // PIT channel 0 in one-shot mode
+};
+
+/**
+ * Clocksource state.
+ *
+ * tsc_khz: Calibrated TSC frequency.
+ * boot_tsc: TSC value at time 0 (when init_time() calibrated).
+ */
+extern uint64_t tsc_khz;
+extern uint64_t boot_tsc;
+
+/**
+ * Calibrate the TSC, pick the clock event device and stop the periodic
+ * PIT tick. Needs init_apic(); call before the first timer is added.
+ */
+void init_time(void);
+
+/**
+ * Set up the calling CPU's clock event device the way init_time() chose.
+ * init_time() does this for the boot CPU; other CPUs call it as they
+ * start, after lapic_init_cpu().
+ */
+void clockevent_init_cpu(void);
+
+/**
+ * Nanoseconds since init_time().
+ */
+uint64_t clock_ns(void);
+
+/**
+ * Microseconds since init_time(); the timer wheel's time base.
+ */
+uint64_t clock_us(void);
+
+/**
+ * Convert a TSC cycle count (a difference, not a timestamp) to nanoseconds.
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/**
+ * Convert a clock_us() time to the TSC value at which it is reached.
+ */
+uint64_t us_to_tsc(uint64_t us);
+
+/**
+ * Busy-wait for at least `us` microseconds.
+ */
+void udelay(uint64_t us);
+
+/**
+ * Arm this CPU's clock event device to interrupt at a clock_us() time.
+ * Times in the past interrupt as soon as possible. UINT64_MAX disarms it.
+ * Called by the timer wheel; the interrupt runs timer_run().
+ */
+void clockevent_program(uint64_t deadline_us);
+
+/**
+ * Name of the clock event device init_time() picked.
+ */
+const char *clockevent_name(void);
+
+/**
+ * Print the clocksource and clock event setup.
+ */
+void print_time_info(void);
+
+#endif  // _TIME_H_
@@ -0,0 +1,378 @@
+#include "timer.h"
+#include "time.h"
+#include "softirq.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/log.h"
+
+// ----------------------------------------------------------------------------
+//  timer.c
+// ----------------------------------------------------------------------------
+//  Hierarchical timer wheel, one per CPU, in microseconds.
+//
+//  Level L has 64 slots of 64^L us each. A timer due `delta` us from the
+//  wheel's clock goes to the level whose range holds delta, in the slot
+//  of its expiry time, so adding and cancelling are a list insert and
+//  unlink plus a bit in the level's occupancy word.
+//
+//  When the clock reaches the start of a higher-level slot, its timers are
+//  re-added ("cascaded") and so drop to lower levels. Timers always fire
+//  from level 0 at their exact microsecond.
+//
+//  There is no tick. The occupancy words give the next point where
+//  something happens (an expiry or a cascade) with one bit scan per level.
+//  The clock jumps straight there, and the clock event device is armed for
+//  it. A CPU with no timers takes no interrupts.
+//
+//  Each wheel has a lock, because a timer can be cancelled or moved from
+//  any CPU. timer_run() drops it for each callback, taking the timer off
+//  its slot first, so a callback can re-add timers and another CPU can
+//  cancel those still waiting without touching a list being walked.
+// ----------------------------------------------------------------------------
+
+#define LEVEL_SHIFT(level)  ((level) * TIMER_LEVEL_BITS)
+#define SLOT_MASK           (TIMER_SLOTS - 1)
+
+// Deferred log flushing: first record after a flush -> flush this much later
+#define LOG_FLUSH_DELAY_US  10000
+
+static struct TimerBase timer_bases[MAX_CPUS];
+static struct Timer log_flush_timer;
+static struct Tasklet log_flush_tasklet;
+
+static inline struct TimerBase *this_base(void) {
+    return &timer_bases[cpu_id() % MAX_CPUS];
+}
+
+/**
+ * Put a timer in the slot matching its expiry.
+ */
+static void enqueue(struct TimerBase *base, struct Timer *timer) {
+    uint64_t expires = timer->expires < base->clk ? base->clk : timer->expires;
+    uint64_t delta = expires - base->clk;
+
+    if (delta > TIMER_MAX_DELTA) {
+        delta = TIMER_MAX_DELTA;
+        expires = base->clk + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+
+    uint32_t index = (uint32_t)(expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    uint32_t slot = (uint32_t)level * TIMER_SLOTS + index;
+    struct Timer **head = &base->slots[slot];
+
+    timer->slot = (uint16_t)slot;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+
+    base->pending[level] |= 1ULL << index;
+}
+
+/**
+ * Unlink a pending timer.
+ */
+static void dequeue(struct TimerBase *base, struct Timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->pprev = NULL;
+
+    if (base->slots[timer->slot] == NULL) {
+        base->pending[timer->slot / TIMER_SLOTS] &= ~(1ULL << (timer->slot & SLOT_MASK));
+    }
+}
+
+/**
+ * Detach a whole slot and return its list.
+ */
+static struct Timer *take_slot(struct TimerBase *base, int level, uint32_t index) {
+    struct Timer *list = base->slots[level * TIMER_SLOTS + index];
+
+    base->slots[level * TIMER_SLOTS + index] = NULL;
+    base->pending[level] &= ~(1ULL << index);
+    return list;
+}
+
+/**
+ * First clock value >= base->clk at which a level-0 slot expires or a
+ * higher-level slot cascades; UINT64_MAX if the wheel is empty.
+ */
+static uint64_t next_event(const struct TimerBase *base) {
+    uint64_t best = UINT64_MAX;
+
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        if (base->pending[level] == 0) {
+            continue;
+        }
+
+        uint32_t shift = LEVEL_SHIFT(level);
+        uint64_t unit = base->clk >> shift;
+        uint32_t index = (uint32_t)unit & SLOT_MASK;
+        uint64_t rotated = (base->pending[level] >> index) |
+                           (index ? base->pending[level] << (TIMER_SLOTS - index) : 0);
+        uint64_t distance;
+
+        // The current slot is due now only if the clock sits exactly on its
+        // start; otherwise it was handled on entry and comes round again
+        if ((base->clk & ((1ULL << shift) - 1)) == 0) {
+            distance = (uint64_t)__builtin_ctzll(rotated);
+        } else {
+            distance = (rotated >> 1) ? (uint64_t)__builtin_ctzll(rotated >> 1) + 1 : TIMER_SLOTS;
+        }
+
+        uint64_t when = (unit + distance) << shift;
+        if (when < best) {
+            best = when;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Re-add the timers of every higher-level slot that starts at base->clk.
+ */
+static void cascade(struct TimerBase *base) {
+    uint64_t clk = base->clk;
+
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if (clk & ((1ULL << LEVEL_SHIFT(level)) - 1)) {
+            break;
+        }
+
+        struct Timer *timer = take_slot(base, level, (uint32_t)(clk >> LEVEL_SHIFT(level)) & SLOT_MASK);
+        while (timer != NULL) {
+            struct Timer *next = timer->next;
+            enqueue(base, timer);
+            timer = next;
+        }
+    }
+}
+
+/**
+ * Run the timers due at base->clk (its level-0 slot), including those
+ * their callbacks add there. Called locked; the lock is dropped around
+ * each callback.
+ */
+static void expire(struct TimerBase *base) {
+    struct Timer *timer;
+
+    while ((timer = base->slots[base->clk & SLOT_MASK]) != NULL) {
+        // Idle before the callback runs, so it can re-add the timer
+        dequeue(base, timer);
+
+        spin_unlock(&base->lock);
+        timer->fn(timer->ctx);
+        spin_lock(&base->lock);
+    }
+}
+
+static void unlock_bases(struct TimerBase *old, struct TimerBase *base) {
+    if (base != NULL && base != old) {
+        spin_unlock(&base->lock);
+    }
+    spin_unlock(&old->lock);
+}
+
+/**
+ * Lock the wheel `timer` is on (timer->cpu) together with `base`, the
+ * lower-numbered wheel first.
+ * @return The timer's wheel, stable until unlock_bases().
+ */
+static struct TimerBase *lock_bases(struct Timer *timer, struct TimerBase *base) {
+    for (;;) {
+        struct TimerBase *old = &timer_bases[__atomic_load_n(&timer->cpu, __ATOMIC_RELAXED) % MAX_CPUS];
+
+        if (old == base || base == NULL) {
+            spin_lock(&old->lock);
+        } else {
+            spin_lock(old < base ? &old->lock : &base->lock);
+            spin_lock(old < base ? &base->lock : &old->lock);
+        }
+
+        // timer->cpu only changes with its wheel locked
+        if (old == &timer_bases[timer->cpu % MAX_CPUS]) {
+            return old;
+        }
+        unlock_bases(old, base);
+    }
+}
+
+/**
+ * Arm the hardware for the wheel's next event if that changed.
+ */
+static void program_next(struct TimerBase *base) {
+    uint64_t next = next_event(base);
+
+    if (next != base->programmed) {
+        base->programmed = next;
+        clockevent_program(next);
+    }
+}
+
+/**
+ * Move an idle wheel's clock up to `now`. Only valid when nothing is due
+ * before then, which keeps every timer's slot correct.
+ */
+static void catch_up(struct TimerBase *base, uint64_t now) {
+    if (now > base->clk && next_event(base) > now) {
+        base->clk = now;
+    }
+}
+
+/**
+ * Schedule a log flush LOG_FLUSH_DELAY_US from now (log flush hook).
+ */
+static void request_log_flush(void) {
+    if (!timer_pending(&log_flush_timer)) {
+        timer_add(&log_flush_timer, clock_us() + LOG_FLUSH_DELAY_US);
+    }
+}
+
+/**
+ * Formatting and writing out the log is too slow for the timer interrupt:
+ * the timer only schedules it.
+ */
+static void log_flush_timer_fn(void *ctx) {
+    (void)ctx;
+    tasklet_schedule(&log_flush_tasklet);
+}
+
+static void log_flush_tasklet_fn(void *ctx) {
+    (void)ctx;
+    log_flush();
+}
+
+/**
+ * Clear this CPU's wheel.
+ */
+void init_timers(void) {
+    struct TimerBase *base = this_base();
+
+    memset(base, 0, sizeof(*base));
+    spin_lock_init(&base->lock, "timer base");
+    base->clk = clock_us();
+    base->programmed = UINT64_MAX;
+    clockevent_program(UINT64_MAX);
+
+    // The boot CPU also owns the deferred log flush
+    if (base == &timer_bases[0]) {
+        timer_init(&log_flush_timer, log_flush_timer_fn, NULL);
+        tasklet_init(&log_flush_tasklet, log_flush_tasklet_fn, NULL);
+        log_set_flush_hook(request_log_flush);
+    }
+}
+
+/**
+ * Prepare a timer.
+ */
+void timer_init(struct Timer *timer, void (*fn)(void *ctx), void *ctx) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->ctx = ctx;
+    timer->slot = 0;
+    timer->cpu = 0;
+}
+
+/**
+ * Queue a timer on this CPU.
+ */
+void timer_add(struct Timer *timer, uint64_t expires_us) {
+    uint64_t flags = irq_save();
+    struct TimerBase *base = this_base();
+    struct TimerBase *old = lock_bases(timer, base);
+
+    if (timer->pprev != NULL) {
+        dequeue(old, timer);
+    }
+
+    if (!base->running) {
+        catch_up(base, clock_us());
+    }
+
+    timer->expires = expires_us;
+    timer->cpu = (uint16_t)(base - timer_bases);
+    enqueue(base, timer);
+
+    // timer_run() programs the hardware when it finishes
+    if (!base->running) {
+        program_next(base);
+    }
+
+    unlock_bases(old, base);
+    irq_restore(flags);
+}
+
+/**
+ * Remove a pending timer, from whichever wheel it is on.
+ */
+int timer_cancel(struct Timer *timer) {
+    uint64_t flags = irq_save();
+    struct TimerBase *base = lock_bases(timer, NULL);
+    int pending = timer->pprev != NULL;
+
+    // The hardware stays armed; an early interrupt just finds nothing due
+    if (pending) {
+        dequeue(base, timer);
+    }
+
+    unlock_bases(base, NULL);
+    irq_restore(flags);
+    return pending;
+}
+
+/**
+ * Check whether a timer is queued.
+ */
+int timer_pending(struct Timer *timer) {
+    uint64_t flags = irq_save();
+    struct TimerBase *base = lock_bases(timer, NULL);
+    int pending = timer->pprev != NULL;
+
+    unlock_bases(base, NULL);
+    irq_restore(flags);
+    return pending;
+}
+
+/**
+ * Run the due timers and arm the hardware for the next one.
+ */
+void timer_run(void) {
+    struct TimerBase *base = this_base();
+    uint64_t now = clock_us();
+
+    spin_lock(&base->lock);
+    base->running = 1;
+    base->programmed = UINT64_MAX;      // The interrupt consumed it
+
+    for (;;) {
+        uint64_t next = next_event(base);
+        if (next > now) {
+            break;
+        }
+
+        base->clk = next;
+        cascade(base);
+
+        // Callbacks may queue timers that are already due; they land in
+        // the same slot and run before the clock moves on
+        expire(base);
+        base->clk++;
+    }
+
+    catch_up(base, now);
+    base->running = 0;
+    program_next(base);
+    spin_unlock(&base->lock);
+}
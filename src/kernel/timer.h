@@ -0,0 +1,89 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "../lib/spinlock.h"
+
+/**
+ * Hierarchical timer wheel geometry.
+ * TIMER_LEVEL_BITS: Slots per level = 1 << TIMER_LEVEL_BITS (one 64-bit
+ *                   occupancy word per level).
+ * TIMER_LEVELS: Level L holds timers due in [64^L, 64^(L+1)) microseconds;
+ *               seven levels reach about 50 days.
+ */
+#define TIMER_LEVEL_BITS    6
+#define TIMER_SLOTS         (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS        7
+#define TIMER_MAX_DELTA     ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+/**
+ * Timer
+ * A one-shot timer. Callbacks run in interrupt context, with interrupts
+ * disabled, on the CPU the timer was added on. A callback may re-add its
+ * own timer to make it periodic. Anything slow belongs in a tasklet
+ * (softirq.h).
+ *
+ * Any CPU may cancel or re-add a timer, whichever wheel it is on; the
+ * wheels' locks keep that safe. Cancelling doesn't wait for a callback
+ * already running on another CPU.
+ */
+struct Timer {
+    struct Timer *next;          // Next timer in the same slot
+    struct Timer **pprev;        // Link pointing at this timer; NULL when idle
+    uint64_t expires;            // clock_us() time to fire at
+    void (*fn)(void *ctx);       // Callback
+    void *ctx;                   // Argument for fn
+    uint16_t slot;               // level * TIMER_SLOTS + index while pending
+    uint16_t cpu;                // Wheel the timer is queued on
+};
+
+/**
+ * Per-CPU timer wheel. Only its CPU adds timers to it and runs it, but
+ * other CPUs take timers off it, all under `lock`. Callbacks run without
+ * the lock.
+ */
+struct TimerBase {
+    struct Spinlock lock;
+    uint64_t clk;                                      // Next microsecond to process
+    uint64_t programmed;                               // Deadline given to the hardware
+    uint64_t pending[TIMER_LEVELS];                    // Occupied-slot bitmaps
+    struct Timer *slots[TIMER_LEVELS * TIMER_SLOTS];
+    int running;                                       // Inside timer_run()
+};
+
+/**
+ * Clear the calling CPU's wheel and set its time to clock_us().
+ */
+void init_timers(void);
+
+/**
+ * Prepare a timer. It does nothing until added.
+ */
+void timer_init(struct Timer *timer, void (*fn)(void *ctx), void *ctx);
+
+/**
+ * Queue a timer on the calling CPU to fire at `expires_us` (clock_us()
+ * time). A pending timer is moved. O(1).
+ */
+void timer_add(struct Timer *timer, uint64_t expires_us);
+
+/**
+ * Remove a pending timer. O(1).
+ * @return 1 if the timer was pending, 0 if it had fired or was never added.
+ */
+int timer_cancel(struct Timer *timer);
+
+/**
+ * Check whether a timer is queued.
+ */
+int timer_pending(struct Timer *timer);
+
+/**
+ * Run every timer on this CPU's wheel that is due and program the clock
+ * event device for the next one. Called from the timer interrupt.
+ */
+void timer_run(void);
+
+#endif  // _TIMER_H_
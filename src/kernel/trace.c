@@ -0,0 +1,169 @@
+#include "trace.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/log.h"
+
+// ----------------------------------------------------------------------------
+//  trace.c
+// ----------------------------------------------------------------------------
+//  Deferred binary tracing.
+//
+//  trace_record() is meant for interrupt handlers and other hot paths. It
+//  stores the format pointer and the raw arguments in a 64-byte slot of
+//  this CPU's ring. Nothing is formatted and no lock is taken, so an event
+//  costs one RDTSCP, a cache line of stores and keeping interrupts off
+//  meanwhile. That keeps the caller on the CPU whose ring it writes (a
+//  preempted thread could otherwise resume elsewhere between reading the
+//  CPU id and filling the slot) and stops interrupt handlers from tracing
+//  into the same slot.
+//
+//  Text is produced only when someone reads the trace: trace_dump() in the
+//  kernel, or tools/tracedump on the host from a memory dump of
+//  trace_buffers plus kernel.elf.
+// ----------------------------------------------------------------------------
+
+struct TraceBuffer trace_buffers[MAX_CPUS];
+int trace_enabled;
+
+static int use_rdtscp;
+
+/**
+ * @brief Reads the TSC and, with RDTSCP, this CPU's id in the same step.
+ * Without RDTSCP the id comes from the per-CPU area.
+ */
+static inline uint64_t trace_clock(uint32_t *cpu) {
+    uint32_t lo, hi, aux = 0;
+
+    if (use_rdtscp) {
+        __asm__ volatile ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    } else {
+        __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+        aux = cpu_id();
+    }
+
+    *cpu = aux;
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief Records `cpu` as this CPU's RDTSCP id.
+ */
+void trace_set_cpu(uint32_t cpu) {
+    if (use_rdtscp) {
+        wrmsr(MSR_TSC_AUX, cpu);
+    }
+}
+
+/**
+ * @brief Clears the rings and starts recording.
+ */
+void init_trace(void) {
+    memset(trace_buffers, 0, sizeof(trace_buffers));
+
+    use_rdtscp = cpu_has(X86_FEATURE_RDTSCP);
+    trace_set_cpu(0);
+
+    trace_enabled = 1;
+}
+
+/**
+ * @brief Stores one event in this CPU's ring.
+ */
+void trace_record(const char *format, uint32_t nargs, const uint64_t *args) {
+    uint64_t flags = irq_save();
+    uint32_t cpu;
+    uint64_t tsc = trace_clock(&cpu);
+    struct TraceBuffer *tb = &trace_buffers[cpu % MAX_CPUS];
+
+    // Claim a slot: only this CPU writes its ring, and nothing can run on
+    // it until the slot is filled
+    uint64_t slot = tb->head++;
+
+    struct TraceEntry *e = &tb->entries[slot % TRACE_ENTRIES];
+
+    // Hide the slot from readers while it is rewritten
+    __atomic_store_n(&e->format, NULL, __ATOMIC_RELAXED);
+    __asm__ volatile ("" : : : "memory");
+
+    e->tsc = tsc;
+    e->cpu = cpu;
+    e->nargs = nargs;
+    for (uint32_t i = 0; i < nargs; i++) {
+        e->args[i] = args[i];
+    }
+
+    __atomic_store_n(&e->format, format, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+/**
+ * @brief Prints one event as "[tsc] cpuN: text".
+ */
+static void dump_entry(const struct TraceEntry *e, uint64_t base_tsc) {
+    char text[LOG_LINE_MAX - 32];
+    const uint64_t *a = e->args;
+
+    // Every argument was widened to 64 bits, and on x86-64 every integer or
+    // pointer vararg takes one 8-byte slot, so passing all five is safe for
+    // any format trace_printk accepted.
+    int length = snprintk(text, sizeof(text), e->format, a[0], a[1], a[2], a[3], a[4]);
+    if (length > (int)sizeof(text) - 1) {
+        length = (int)sizeof(text) - 1;
+    }
+    if (length > 0 && text[length - 1] == '\n') {
+        text[--length] = '\0';
+    }
+
+    printk("[%12lu] cpu%u: %s\n", e->tsc - base_tsc, e->cpu, text);
+}
+
+/**
+ * @brief Formats all recorded events, oldest first, into the kernel log.
+ */
+void trace_dump(void) {
+    uint64_t next[MAX_CPUS], end[MAX_CPUS];
+    uint64_t base_tsc = 0;
+    int first = 1;
+    int was_enabled = trace_enabled;
+
+    trace_enabled = 0;
+
+    // Each ring holds at most its last TRACE_ENTRIES events
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        end[cpu] = trace_buffers[cpu].head;
+        next[cpu] = end[cpu] > TRACE_ENTRIES ? end[cpu] - TRACE_ENTRIES : 0;
+    }
+
+    // Merge the rings by timestamp
+    for (;;) {
+        const struct TraceEntry *oldest = NULL;
+        int oldest_cpu = -1;
+
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            while (next[cpu] < end[cpu]) {
+                const struct TraceEntry *e = &trace_buffers[cpu].entries[next[cpu] % TRACE_ENTRIES];
+                if (__atomic_load_n(&e->format, __ATOMIC_ACQUIRE) != NULL) {
+                    if (oldest == NULL || e->tsc < oldest->tsc) {
+                        oldest = e;
+                        oldest_cpu = cpu;
+                    }
+                    break;
+                }
+                next[cpu]++;    // Empty or half-written slot
+            }
+        }
+
+        if (oldest == NULL) {
+            break;
+        }
+        if (first) {
+            base_tsc = oldest->tsc;
+            first = 0;
+        }
+
+        dump_entry(oldest, base_tsc);
+        next[oldest_cpu]++;
+    }
+
+    trace_enabled = was_enabled;
+}
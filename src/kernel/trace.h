@@ -0,0 +1,116 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "../lib/print.h"
+
+/**
+ * TRACE_MAX_ARGS: Arguments stored per event; more is a compile error.
+ * TRACE_ENTRIES: Events kept per CPU (power of two). The ring overwrites
+ *                the oldest events, so it always holds the latest ones.
+ */
+#define TRACE_MAX_ARGS    5
+#define TRACE_ENTRIES     2048
+
+/**
+ * TraceEntry: One binary trace event (one 64-byte cache line).
+ *
+ * @field tsc Time stamp counter when the event was recorded.
+ * @field format Format string in the kernel image; written last, so an
+ *               entry with a null format is empty or still being written.
+ * @field cpu CPU that recorded the event.
+ * @field nargs Number of valid entries in args.
+ * @field args Raw arguments, each widened to 64 bits.
+ */
+struct TraceEntry {
+    uint64_t tsc;
+    const char *format;
+    uint32_t cpu;
+    uint32_t nargs;
+    uint64_t args[TRACE_MAX_ARGS];
+};
+
+/**
+ * TraceBuffer: Per-CPU event ring. Only its own CPU writes to it.
+ *
+ * @field head Number of events ever recorded; the next slot is
+ *             head % TRACE_ENTRIES.
+ * @field entries The ring.
+ */
+struct TraceBuffer {
+    uint64_t head;
+    uint64_t reserved[7];
+    struct TraceEntry entries[TRACE_ENTRIES];
+} __attribute__((aligned(64)));
+
+/**
+ * The per-CPU rings. tools/tracedump finds this symbol in kernel.elf to
+ * decode a memory dump of it.
+ */
+extern struct TraceBuffer trace_buffers[MAX_CPUS];
+
+/**
+ * Non-zero while events are being recorded.
+ */
+extern int trace_enabled;
+
+/**
+ * trace_printk: Records an event without formatting it.
+ *
+ * Only the format pointer, the TSC, the CPU id and the arguments are
+ * stored; the text is produced later by trace_dump() or on the host by
+ * tools/tracedump. The format is type-checked like printk's. Arguments
+ * must be integers or pointers, and %s arguments must point at strings
+ * that stay valid (string literals).
+ */
+#define trace_printk(...) do {                                                \
+    if (0) {                                                                  \
+        printk(__VA_ARGS__);  /* Format checking only */                      \
+    }                                                                         \
+    if (trace_enabled) {                                                      \
+        const uint64_t trace_args_[] = { 0 TRACE_ARGS(__VA_ARGS__) };         \
+        trace_record(TRACE_FORMAT(__VA_ARGS__, 0), TRACE_NARGS(__VA_ARGS__),  \
+                     trace_args_ + 1);                                        \
+    }                                                                         \
+} while (0)
+
+// Argument counting and widening for trace_printk. The format string is
+// counted too, so a call without arguments still passes one macro argument.
+#define TRACE_FORMAT(fmt, ...) fmt
+#define TRACE_NARGS(...)  TRACE_NARGS_(__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TRACE_NARGS_(_f, _1, _2, _3, _4, _5, _6, _7, n, ...) n
+#define TRACE_ARGS(...)   TRACE_CAT(TRACE_ARGS_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define TRACE_CAT(a, b)   TRACE_CAT_(a, b)
+#define TRACE_CAT_(a, b)  a##b
+#define TRACE_ARGS_0(f)
+#define TRACE_ARGS_1(f, a)              , (uint64_t)(a)
+#define TRACE_ARGS_2(f, a, b)           , (uint64_t)(a), (uint64_t)(b)
+#define TRACE_ARGS_3(f, a, b, c)        , (uint64_t)(a), (uint64_t)(b), (uint64_t)(c)
+#define TRACE_ARGS_4(f, a, b, c, d)     , (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), (uint64_t)(d)
+#define TRACE_ARGS_5(f, a, b, c, d, e)  , (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), (uint64_t)(d), (uint64_t)(e)
+
+/**
+ * init_trace: Clears the rings, sets up RDTSCP's CPU id for the boot CPU
+ * and starts recording.
+ */
+void init_trace(void);
+
+/**
+ * trace_set_cpu: Records `cpu` as this CPU's id (IA32_TSC_AUX), so RDTSCP
+ * returns it with the timestamp. Called on each CPU as it comes up.
+ */
+void trace_set_cpu(uint32_t cpu);
+
+/**
+ * trace_record: Stores one event in this CPU's ring. Use trace_printk.
+ */
+void trace_record(const char *format, uint32_t nargs, const uint64_t *args);
+
+/**
+ * trace_dump: Formats all recorded events, oldest first across CPUs, into
+ * the kernel log.
+ */
+void trace_dump(void);
+
+#endif  // _TRACE_H_
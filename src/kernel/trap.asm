@@ -1,7 +1,10 @@
+%include "src/kernel/cpu.inc"
+
 section .text
 
 ; External and global symbols
 extern handler                ; External handler function
+extern lapic_eoi_register     ; xAPIC EOI register address (apic.c)
 
 ; Global vectors and functions
 global vector0
@@ -23,22 +26,46 @@ global vector17
 global vector18
 global vector19
 global vector32
+global vector36
 global vector39
+global vector240
+global vector241
+global vector242
+global vector243
+global vector244
+global vector255
 global eoi
 global read_isr
 global load_idt
+global context_switch
 
-; Macro to define interrupt vectors to reduce repetitive code
+; Exception without a CPU error code: push a 0 so every frame has the
+; same layout
 %macro DEFINE_VECTOR 2
 %1:
-    push 0             ; Error code placeholder (0 if no error code)
+    push 0             ; Error code placeholder
     push %2            ; Interrupt vector number
     jmp Trap           ; Jump to common Trap handler
 %endmacro
 
-; Trap handler
+; Exception for which the CPU has already pushed an error code
+%macro DEFINE_VECTOR_ERR 2
+%1:
+    push %2            ; Interrupt vector number
+    jmp Trap
+%endmacro
+
+; Hardware interrupt: takes the slim Irq path
+%macro DEFINE_IRQ 2
+%1:
+    push 0             ; No error code
+    push %2            ; Interrupt vector number
+    jmp Irq
+%endmacro
+
+; Exception entry: saves every general-purpose register so the handler
+; (and a panic dump) sees the complete state
 Trap:
-    ; Save all general-purpose registers
     push rax
     push rbx
     push rcx
@@ -55,16 +82,11 @@ Trap:
     push r14
     push r15
 
-    ; Increment memory value
-    inc byte [0xb8010]
-    mov byte [0xb8011], 0xe
-
-    ; Pass stack pointer (rsp) to the handler
-    mov rdi, rsp
+    cld                  ; The C ABI expects DF clear
+    mov rdi, rsp         ; struct TrapFrame *
     call handler
 
 TrapReturn:
-    ; Restore all general-purpose registers
     pop r15
     pop r14
     pop r13
@@ -81,11 +103,85 @@ TrapReturn:
     pop rbx
     pop rax
 
-    ; Adjust stack pointer and return from interrupt
-    add rsp, 16          ; Adjust stack in case of alignment issues
-    iretq                ; Return from interrupt
+    add rsp, 16          ; Drop the vector number and error code
+    iretq
+
+; Interrupt entry: the C handler preserves rbx and r12-r15 itself, so only
+; the caller-saved registers and rbp (for profiler stack walks) are
+; stored. The frame keeps the TrapFrame layout; the rbx and r12-r15 slots
+; are left unwritten.
+Irq:
+    sub rsp, 15 * 8
+    mov [rsp + 4 * 8], r11
+    mov [rsp + 5 * 8], r10
+    mov [rsp + 6 * 8], r9
+    mov [rsp + 7 * 8], r8
+    mov [rsp + 8 * 8], rbp
+    mov [rsp + 9 * 8], rdi
+    mov [rsp + 10 * 8], rsi
+    mov [rsp + 11 * 8], rdx
+    mov [rsp + 12 * 8], rcx
+    mov [rsp + 14 * 8], rax
+
+    cld
+    mov rdi, rsp         ; struct TrapFrame *
+    call handler
+
+    mov r11, [rsp + 4 * 8]
+    mov r10, [rsp + 5 * 8]
+    mov r9, [rsp + 6 * 8]
+    mov r8, [rsp + 7 * 8]
+    mov rbp, [rsp + 8 * 8]
+    mov rdi, [rsp + 9 * 8]
+    mov rsi, [rsp + 10 * 8]
+    mov rdx, [rsp + 11 * 8]
+    mov rcx, [rsp + 12 * 8]
+    mov rax, [rsp + 14 * 8]
+
+    add rsp, 15 * 8 + 16 ; Registers, vector number and error code
+    iretq
+
+; Thread switch: void context_switch(struct TrapFrame **save, struct TrapFrame *next)
+; Pushes the frame an interrupt taken at the return address would have
+; pushed (with every register, like Trap), stores it in *save and
+; resumes `next` through TrapReturn. The saved thread continues after the
+; call once something switches back to it. Called with interrupts off;
+; the saved rflags keep them off until the caller restores its own.
+context_switch:
+    pop r8               ; Return address: the resume rip
+    mov r9, rsp          ; rsp after the return
+    xor eax, eax
+    mov ax, ss
+    push rax             ; ss
+    push r9              ; rsp
+    pushfq               ; rflags
+    mov ax, cs
+    push rax             ; cs
+    push r8              ; rip
+    push 0               ; Error code
+    push 0               ; Vector number
+
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov [rdi], rsp       ; *save
+    mov rsp, rsi         ; next
+    jmp TrapReturn
 
-; Define interrupt vectors using the macro
+; Define interrupt vectors using the macros
 DEFINE_VECTOR vector0, 0
 DEFINE_VECTOR vector1, 1
 DEFINE_VECTOR vector2, 2
@@ -94,25 +190,51 @@ DEFINE_VECTOR vector4, 4
 DEFINE_VECTOR vector5, 5
 DEFINE_VECTOR vector6, 6
 DEFINE_VECTOR vector7, 7
-DEFINE_VECTOR vector8, 8
-DEFINE_VECTOR vector10, 10
-DEFINE_VECTOR vector11, 11
-DEFINE_VECTOR vector12, 12
-DEFINE_VECTOR vector13, 13
-DEFINE_VECTOR vector14, 14
+DEFINE_VECTOR_ERR vector8, 8        ; #DF
+DEFINE_VECTOR_ERR vector10, 10      ; #TS
+DEFINE_VECTOR_ERR vector11, 11      ; #NP
+DEFINE_VECTOR_ERR vector12, 12      ; #SS
+DEFINE_VECTOR_ERR vector13, 13      ; #GP
+DEFINE_VECTOR_ERR vector14, 14      ; #PF
 DEFINE_VECTOR vector16, 16
-DEFINE_VECTOR vector17, 17
+DEFINE_VECTOR_ERR vector17, 17      ; #AC
 DEFINE_VECTOR vector18, 18
 DEFINE_VECTOR vector19, 19
-DEFINE_VECTOR vector32, 32
-DEFINE_VECTOR vector39, 39
+DEFINE_IRQ vector32, 32
+DEFINE_IRQ vector36, 36
+DEFINE_IRQ vector39, 39
+DEFINE_IRQ vector240, 240            ; Local APIC timer
+DEFINE_IRQ vector241, 241            ; Interrupt latency benchmark (self-IPI)
+DEFINE_IRQ vector242, 242            ; Reschedule IPI (sched.c)
+DEFINE_IRQ vector243, 243            ; TLB shootdown IPI (paging.c)
+DEFINE_IRQ vector244, 244            ; Profiler start IPI (profile.c)
+DEFINE_IRQ vector255, 255            ; Local APIC spurious
 
 ; End of Interrupt (EOI)
+; Patchable site, retargeted to the local APIC when the CPU has one. The
+; order must match the mode init_apic() (apic.c) picks.
 eoi:
+    jmp near pic_eoi
+ALTERNATIVE eoi, X86_FEATURE_X2APIC, x2apic_eoi
+ALTERNATIVE eoi, X86_FEATURE_APIC, xapic_eoi
+
+pic_eoi:
     mov al, 0x20           ; Send End-of-Interrupt signal
     out 0x20, al
     ret
 
+x2apic_eoi:
+    mov ecx, 0x80B         ; x2APIC EOI MSR
+    xor eax, eax
+    xor edx, edx
+    wrmsr
+    ret
+
+xapic_eoi:
+    mov rax, [lapic_eoi_register]
+    mov dword [rax], 0
+    ret
+
 ; Read ISR (In-Service Register)
 read_isr:
     mov al, 0x0B           ; Command to read ISR
@@ -1,4 +1,20 @@
 #include "trap.h"
+#include "trace.h"
+#include "percpu.h"
+#include "sched.h"
+#include "softirq.h"
+#include "../lib/debug.h"
+#include "../lib/lib.h"
+#include "../lib/log.h"
+#include "../lib/serial.h"
+
+/**
+ * Registered handler for one vector.
+ */
+struct IrqAction {
+    irq_handler_t fn;
+    void *ctx;
+};
 
 /**
  * IDT (Interrupt Descriptor Table) Pointer
@@ -12,6 +28,22 @@ static struct IdtPtr idt_pointer;
  */
 static struct IdtEntry vectors[256];
 
+/**
+ * Dispatch table and per-CPU statistics, indexed by vector.
+ */
+static struct IrqAction irq_actions[256];
+static struct IrqStats irq_stats[MAX_CPUS][256];
+
+/**
+ * Frame of the interrupt each CPU is handling (NULL when none).
+ */
+static struct TrapFrame *irq_frames[MAX_CPUS];
+
+/**
+ * TSC value at handler() entry of each CPU's current interrupt.
+ */
+static uint64_t irq_entry[MAX_CPUS];
+
 /**
  * Initialize a single IDT entry.
  *
@@ -21,10 +53,68 @@ static struct IdtEntry vectors[256];
  */
 static void init_idt_entry(struct IdtEntry *entry, uint64_t addr, uint8_t attribute) {
     entry->low = (uint16_t)addr;            // Lower 16 bits of the handler address
-    entry->selector = 8;                    // Code segment selector (offset in GDT)
+    entry->selector = KERNEL_CS;            // Code segment selector (offset in GDT)
+    entry->ist = 0;                         // Stay on the current stack
     entry->attr = attribute;                // Entry attributes
     entry->mid = (uint16_t)(addr >> 16);    // Middle 16 bits of the handler address
     entry->high = (uint32_t)(addr >> 32);   // Upper 32 bits of the handler address
+    entry->res1 = 0;
+}
+
+/**
+ * COM1 interrupt (IRQ4): transmit FIFO empty
+ */
+static void serial_irq(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    serial_interrupt();
+    eoi();
+}
+
+/**
+ * Spurious interrupt (IRQ7)
+ * Only a real IRQ7 sets its in-service bit and needs an EOI.
+ */
+static void spurious_interrupt(struct TrapFrame *tf, void *ctx) {
+    (void)tf;
+    (void)ctx;
+    if ((read_isr() & (1 << 7)) != 0) {
+        eoi();
+    }
+}
+
+/**
+ * Log a fatal exception's frame and halt the CPU.
+ */
+void trap_panic(struct TrapFrame *tf) {
+    log_message(LOG_PANIC, "Unhandled exception %ld, error code %#lx\n", tf->trapno, tf->errorcode);
+    log_message(LOG_PANIC, "RIP: 0x%016lx  CS: %#lx  RFLAGS: 0x%016lx\n", tf->rip, tf->cs, tf->rflags);
+    log_message(LOG_PANIC, "RSP: 0x%016lx  SS: %#lx\n", tf->rsp, tf->ss);
+    log_message(LOG_PANIC, "RAX: 0x%016lx  RBX: 0x%016lx  RCX: 0x%016lx\n", tf->rax, tf->rbx, tf->rcx);
+    log_message(LOG_PANIC, "RDX: 0x%016lx  RSI: 0x%016lx  RDI: 0x%016lx\n", tf->rdx, tf->rsi, tf->rdi);
+    log_message(LOG_PANIC, "RBP: 0x%016lx  R8:  0x%016lx  R9:  0x%016lx\n", tf->rbp, tf->r8, tf->r9);
+    log_message(LOG_PANIC, "R10: 0x%016lx  R11: 0x%016lx  R12: 0x%016lx\n", tf->r10, tf->r11, tf->r12);
+    log_message(LOG_PANIC, "R13: 0x%016lx  R14: 0x%016lx  R15: 0x%016lx\n", tf->r13, tf->r14, tf->r15);
+    log_flush();
+
+    __asm__ volatile ("cli");
+    while (1) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+/**
+ * Report a trap nobody registered for.
+ * Exceptions are fatal. A stray hardware interrupt is logged and
+ * acknowledged.
+ */
+static void unhandled_trap(struct TrapFrame *tf) {
+    if (tf->trapno >= 32) {
+        log_message(LOG_WARN, "Unhandled interrupt %ld\n", tf->trapno);
+        eoi();
+        return;
+    }
+    trap_panic(tf);
 }
 
 /**
@@ -52,7 +142,28 @@ void init_idt(void) {
     init_idt_entry(&vectors[18], (uint64_t)vector18, 0x8E);
     init_idt_entry(&vectors[19], (uint64_t)vector19, 0x8E);
     init_idt_entry(&vectors[32], (uint64_t)vector32, 0x8E);
+    init_idt_entry(&vectors[36], (uint64_t)vector36, 0x8E);
     init_idt_entry(&vectors[39], (uint64_t)vector39, 0x8E);
+    init_idt_entry(&vectors[240], (uint64_t)vector240, 0x8E);
+    init_idt_entry(&vectors[241], (uint64_t)vector241, 0x8E);
+    init_idt_entry(&vectors[242], (uint64_t)vector242, 0x8E);
+    init_idt_entry(&vectors[243], (uint64_t)vector243, 0x8E);
+    init_idt_entry(&vectors[244], (uint64_t)vector244, 0x8E);
+    init_idt_entry(&vectors[255], (uint64_t)vector255, 0x8E);
+
+    // Exceptions that can arrive on a broken stack get their own
+    vectors[2].ist = IST_NMI;
+    vectors[8].ist = IST_DOUBLE_FAULT;
+    vectors[18].ist = IST_MACHINE_CHECK;
+
+    // Clear the dispatch table and counters, then install the handlers for
+    // the legacy PIC devices (the timer belongs to init_time())
+    memset(irq_actions, 0, sizeof(irq_actions));
+    memset(irq_stats, 0, sizeof(irq_stats));
+    memset(irq_frames, 0, sizeof(irq_frames));
+    memset(irq_entry, 0, sizeof(irq_entry));
+    register_irq_handler(36, serial_irq, NULL);
+    register_irq_handler(39, spurious_interrupt, NULL);
 
     // Set up the IDT pointer
     idt_pointer.limit = sizeof(vectors) - 1; // Size of the IDT (in bytes - 1)
@@ -62,31 +173,122 @@ void init_idt(void) {
     load_idt(&idt_pointer);
 }
 
+/**
+ * Load the shared IDT on another CPU.
+ */
+void idt_init_cpu(void) {
+    load_idt(&idt_pointer);
+}
+
+/**
+ * Register an interrupt handler for a vector.
+ */
+int register_irq_handler(int vector, irq_handler_t fn, void *ctx) {
+    if (vector < 0 || vector > 255) {
+        return -1;
+    }
+
+    // Clear the function first so the handler never sees a stale context
+    irq_actions[vector].fn = NULL;
+    __asm__ volatile ("" : : : "memory");
+    irq_actions[vector].ctx = ctx;
+    __asm__ volatile ("" : : : "memory");
+    irq_actions[vector].fn = fn;
+    return 0;
+}
+
+/**
+ * Return the frame of the interrupt being handled on this CPU.
+ */
+struct TrapFrame *irq_frame(void) {
+    return irq_frames[cpu_id() % MAX_CPUS];
+}
+
+/**
+ * Return the handler() entry time of this CPU's current interrupt.
+ */
+uint64_t irq_entry_tsc(void) {
+    return irq_entry[cpu_id() % MAX_CPUS];
+}
+
+/**
+ * Sum one vector's counters over all CPUs.
+ */
+void irq_get_stats(int vector, struct IrqStats *stats) {
+    stats->count = 0;
+    stats->cycles = 0;
+
+    if (vector < 0 || vector > 255) {
+        return;
+    }
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->count += irq_stats[cpu][vector].count;
+        stats->cycles += irq_stats[cpu][vector].cycles;
+    }
+}
+
+/**
+ * Log the counters of every vector that has been taken.
+ */
+void irq_dump_stats(void) {
+    struct IrqStats stats;
+
+    printk("vector      count         cycles    avg\n");
+    for (int vector = 0; vector < 256; vector++) {
+        irq_get_stats(vector, &stats);
+        if (stats.count != 0) {
+            printk("%6d %10lu %14lu %6lu\n", vector, stats.count, stats.cycles,
+                   stats.cycles / stats.count);
+        }
+    }
+}
+
 /**
  * Trap handler function.
- * Handles interrupts and exceptions by processing the trap frame.
+ * Dispatches interrupts and exceptions to their registered handlers and
+ * accounts the time spent in each vector.
  *
  * @param tf Pointer to the TrapFrame containing CPU state at the time of the interrupt.
  */
 void handler(struct TrapFrame *tf) {
-    unsigned char isr_value;
-
-    switch (tf->trapno) {
-        case 32:
-            // Timer interrupt (IRQ0)
-            eoi();
-            break;
-
-        case 39:
-            // Spurious interrupt (IRQ7)
-            isr_value = read_isr();
-            if ((isr_value & (1 << 7)) != 0) {
-                eoi();
-            }
-            break;
-
-        default:
-            // Unhandled interrupt: enter infinite loop
-            while (1) { }
+    uint64_t start = rdtsc();
+    uint32_t cpu = cpu_id() % MAX_CPUS;
+    uint8_t vector = (uint8_t)tf->trapno;
+    const struct IrqAction *action = &irq_actions[vector];
+    struct TrapFrame *outer = irq_frames[cpu];
+    uint64_t outer_entry = irq_entry[cpu];
+
+    trace_printk("trap %ld rip %#lx\n", tf->trapno, tf->rip);
+
+    // The vector registers belong to the interrupted thread until the
+    // matching decrement (fpu.h)
+    this_cpu_inc(trap_depth);
+    irq_frames[cpu] = tf;
+    irq_entry[cpu] = start;
+    if (action->fn != NULL) {
+        action->fn(tf, action->ctx);
+    } else {
+        unhandled_trap(tf);
+    }
+    irq_frames[cpu] = outer;
+    irq_entry[cpu] = outer_entry;
+
+    struct IrqStats *stats = &irq_stats[cpu][vector];
+    stats->count++;
+    stats->cycles += rdtsc() - start;
+
+    // Leaving the outermost interrupt: deferred work runs here, with
+    // interrupts enabled (but still on the interrupted thread's vector
+    // registers), then a thread switch it asked for (end of a time slice,
+    // reschedule IPI) happens. Not while this interrupted a pass of
+    // deferred work, which must finish first. Nothing below may use `cpu`,
+    // the thread can resume on another CPU.
+    int leaving = outer == NULL && vector >= 32 && !softirq_active();
+    if (leaving) {
+        softirq_run();
+    }
+    this_cpu_dec(trap_depth);
+    if (leaving) {
+        sched_preempt();
     }
 }
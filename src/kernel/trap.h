@@ -10,7 +10,7 @@
 struct IdtEntry {
     uint16_t low;        // Lower 16 bits of the handler address
     uint16_t selector;   // Code segment selector in GDT or LDT
-    uint8_t res0;        // Reserved, set to 0
+    uint8_t ist;         // Interrupt stack table slot (0: current stack)
     uint8_t attr;        // Attributes (e.g., type, DPL, present)
     uint16_t mid;        // Middle 16 bits of the handler address
     uint32_t high;       // Upper 32 bits of the handler address (if 64-bit)
@@ -29,6 +29,8 @@ struct IdtPtr {
 /**
  * Trap Frame
  * Captures the CPU state during an interrupt or exception.
+ * Hardware interrupts (vector 32 and up) take a slim entry path that does
+ * not store rbx and r12-r15; those fields are undefined for them.
  */
 struct TrapFrame {
     int64_t r15;         // General-purpose registers
@@ -78,7 +80,30 @@ void vector17(void);
 void vector18(void);
 void vector19(void);
 void vector32(void);
+void vector36(void);
 void vector39(void);
+void vector240(void);
+void vector241(void);
+void vector242(void);
+void vector243(void);
+void vector244(void);
+void vector255(void);
+
+/**
+ * Interrupt handler
+ * Called with the trap frame and the context pointer given at registration.
+ * Interrupt handlers send their own EOI.
+ */
+typedef void (*irq_handler_t)(struct TrapFrame *tf, void *ctx);
+
+/**
+ * Per-vector statistics
+ * Kept per CPU and summed by irq_get_stats().
+ */
+struct IrqStats {
+    uint64_t count;      // Times the vector was taken
+    uint64_t cycles;     // TSC cycles spent in handler(), entry to return
+};
 
 /**
  * IDT Initialization
@@ -86,6 +111,60 @@ void vector39(void);
  */
 void init_idt(void);
 
+/**
+ * Load the IDT built by init_idt() on the calling CPU.
+ * For the CPUs started after the boot CPU.
+ */
+void idt_init_cpu(void);
+
+/**
+ * Register an interrupt handler
+ * Installs `fn` as the handler for `vector`, replacing any previous one.
+ * Must be called after init_idt(). Passing NULL removes the handler.
+ * @param vector Interrupt vector (0-255).
+ * @param fn Handler function.
+ * @param ctx Pointer passed back to the handler.
+ * @return 0 on success, -1 if the vector is out of range.
+ */
+int register_irq_handler(int vector, irq_handler_t fn, void *ctx);
+
+/**
+ * Fatal exception
+ * Logs the trap frame and halts this CPU. For exception handlers that
+ * find they can't recover.
+ */
+void trap_panic(struct TrapFrame *tf) __attribute__((noreturn));
+
+/**
+ * Interrupted context
+ * Returns the trap frame of the interrupt being handled on this CPU, or
+ * NULL outside interrupt context. Lets timer callbacks (e.g. the
+ * profiler) see where the CPU was.
+ */
+struct TrapFrame *irq_frame(void);
+
+/**
+ * Interrupt entry time
+ * Returns the TSC value read on entry to handler() for the interrupt
+ * being handled on this CPU. Lets the latency benchmark measure the delay
+ * from a known deadline to the C dispatcher.
+ */
+uint64_t irq_entry_tsc(void);
+
+/**
+ * Query interrupt statistics
+ * Sums the counters of all CPUs for one vector.
+ * @param vector Interrupt vector (0-255).
+ * @param stats Receives the totals.
+ */
+void irq_get_stats(int vector, struct IrqStats *stats);
+
+/**
+ * Print interrupt statistics
+ * Logs count, total and average cycles for every vector taken so far.
+ */
+void irq_dump_stats(void);
+
 /**
  * End of Interrupt (EOI)
  * Signals the end of processing for an interrupt.
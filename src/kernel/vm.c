@@ -0,0 +1,342 @@
+#include "vm.h"
+#include "page_alloc.h"
+#include "slab.h"
+#include "time.h"
+#include "trap.h"
+#include "../lib/debug.h"
+#include "../lib/irqflags.h"
+#include "../lib/lib.h"
+#include "../lib/print.h"
+#include "../lib/spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  vm.c
+// ----------------------------------------------------------------------------
+//  Demand-zero kernel memory.
+//
+//  vm_reserve() only takes a range of the kernel virtual area (PML4 slot
+//  1, shared by every address space) and records it as a region. The
+//  first access to each page faults; the handler finds the region, maps a
+//  zeroed page there and returns, and the access is retried. Memory that
+//  is reserved but never used (most of a large buffer, the deep end of a
+//  stack) thus costs nothing.
+//
+//  Clearing a page is most of the cost of such a fault, so each CPU keeps
+//  a small pool of pages zeroed ahead of time by a timer callback, a
+//  batch at a time. The pool is refilled only after faults drew it down.
+//
+//  A fault anywhere else, on a guard page between regions or a write to a
+//  read-only region, is a kernel bug and is reported as such.
+// ----------------------------------------------------------------------------
+
+// Page fault error code bits
+#define PF_PRESENT          (1 << 0)        // Protection violation, not a missing page
+#define PF_WRITE            (1 << 1)
+#define PF_USER             (1 << 2)
+#define PF_RESERVED         (1 << 3)        // Reserved bit set in an entry
+#define PF_INSTR            (1 << 4)        // Instruction fetch
+
+#define PAGE_FAULT_VECTOR   14
+
+// Internal region flag: vm_release() is taking it down
+#define VM_RELEASING        0x80000000
+
+static struct VmRegion *regions;            // Sorted by start
+static uint64_t reserved_bytes;
+static struct Spinlock vm_lock;
+static struct ZeroPool zero_pools[MAX_CPUS];
+
+/**
+ * Find the region holding `addr`, unless it is being released. Called
+ * locked.
+ */
+static struct VmRegion *find_region(uint64_t addr) {
+    for (struct VmRegion *r = regions; r != NULL && r->start <= addr; r = r->next) {
+        if (addr < r->end) {
+            return (r->flags & VM_RELEASING) ? NULL : r;
+        }
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+//  Zeroed pages
+// ----------------------------------------------------------------------------
+
+/**
+ * Refill timer: zero one batch of pages into this CPU's pool and come
+ * back later if it is still short.
+ */
+static void zero_pool_refill(void *ctx) {
+    struct ZeroPool *pool = ctx;
+
+    for (int i = 0; i < ZERO_POOL_BATCH && pool->count < ZERO_POOL_HIGH; i++) {
+        uint64_t page = alloc_page();
+        if (page == 0) {
+            return;
+        }
+        memset((void *)page, 0, PAGE_SIZE);
+        pool->pages[pool->count++] = page;
+        pool->zeroed++;
+    }
+
+    if (pool->count < ZERO_POOL_HIGH) {
+        timer_add(&pool->refill, clock_us() + ZERO_POOL_DELAY_US);
+    }
+}
+
+/**
+ * Get a zeroed page, from the pool when it has one.
+ * @return Physical address, or 0 if out of memory.
+ */
+static uint64_t get_zero_page(void) {
+    uint64_t flags = irq_save();
+    struct ZeroPool *pool = &zero_pools[cpu_id() % MAX_CPUS];
+    uint64_t page = 0;
+
+    pool->faults++;
+    if (pool->count != 0) {
+        page = pool->pages[--pool->count];
+        pool->hits++;
+    }
+    if (pool->count < ZERO_POOL_LOW && !timer_pending(&pool->refill)) {
+        timer_add(&pool->refill, clock_us() + ZERO_POOL_DELAY_US);
+    }
+    irq_restore(flags);
+
+    if (page == 0) {
+        page = alloc_page();
+        if (page != 0) {
+            memset((void *)page, 0, PAGE_SIZE);
+        }
+    }
+    return page;
+}
+
+/**
+ * Back one page of a region. Called locked.
+ * @return 0 if the page is mapped (now or already), -1 if out of memory.
+ */
+static int fault_in(struct VmRegion *region, uint64_t virt) {
+    virt &= ~(PAGE_SIZE - 1);
+
+    if (virt_to_phys(&kernel_space, virt) != 0) {
+        return 0;                           // Another CPU got here first
+    }
+
+    uint64_t page = get_zero_page();
+    if (page == 0) {
+        return -1;
+    }
+
+    uint64_t prot = (region->flags & VM_WRITE) ? PAGE_KERNEL : PAGE_KERNEL_RO;
+    if (map_pages(&kernel_space, virt, page, PAGE_SIZE, prot) != 0) {
+        free_page(page);
+        return -1;
+    }
+    region->resident++;
+    return 0;
+}
+
+/**
+ * Vector 14: back demand-zero pages, report anything else.
+ */
+static void page_fault(struct TrapFrame *tf, void *ctx) {
+    (void)ctx;
+    uint64_t addr = read_cr2();
+    uint64_t error = (uint64_t)tf->errorcode;
+
+    if ((error & (PF_PRESENT | PF_USER | PF_RESERVED | PF_INSTR)) == 0) {
+        uint64_t flags = spin_lock_irqsave(&vm_lock);
+        struct VmRegion *region = find_region(addr);
+        int done = region != NULL && (!(error & PF_WRITE) || (region->flags & VM_WRITE)) &&
+                   fault_in(region, addr) == 0;
+        spin_unlock_irqrestore(&vm_lock, flags);
+
+        if (done) {
+            return;
+        }
+    }
+
+    log_message(LOG_PANIC, "Page fault at %#lx: %s %s%s%s\n", addr,
+                (error & PF_INSTR) ? "fetch" : (error & PF_WRITE) ? "write" : "read",
+                (error & PF_PRESENT) ? "protection violation" : "not present",
+                (error & PF_RESERVED) ? ", reserved bit" : "",
+                vm_is_lazy((void *)addr) ? ", kernel virtual area" : "");
+    trap_panic(tf);
+}
+
+// ----------------------------------------------------------------------------
+//  Regions
+// ----------------------------------------------------------------------------
+
+/**
+ * Set up the region list, the zero pools and the fault handler.
+ */
+void init_vm(void) {
+    regions = NULL;
+    reserved_bytes = 0;
+    spin_lock_init(&vm_lock, "vm");
+
+    memset(zero_pools, 0, sizeof(zero_pools));
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        timer_init(&zero_pools[cpu].refill, zero_pool_refill, &zero_pools[cpu]);
+    }
+
+    register_irq_handler(PAGE_FAULT_VECTOR, page_fault, NULL);
+}
+
+/**
+ * Reserve a range of the kernel virtual area (first fit).
+ */
+void *vm_reserve(uint64_t size, uint32_t flags) {
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size == 0 || size > KERNEL_VIRT_END - KERNEL_VIRT_BASE) {
+        return NULL;
+    }
+
+    struct VmRegion *region = kmalloc(sizeof(*region));
+    if (region == NULL) {
+        return NULL;
+    }
+
+    uint64_t lock_flags = spin_lock_irqsave(&vm_lock);
+
+    // A guard page before the first region and after every region
+    uint64_t start = KERNEL_VIRT_BASE + PAGE_SIZE;
+    struct VmRegion **link = &regions;
+    while (*link != NULL && (*link)->start < start + size + PAGE_SIZE) {
+        start = (*link)->end + PAGE_SIZE;
+        link = &(*link)->next;
+    }
+
+    if (start + size > KERNEL_VIRT_END - PAGE_SIZE) {
+        spin_unlock_irqrestore(&vm_lock, lock_flags);
+        kfree(region);
+        log_message(LOG_WARN, "vm: no room for %lu KB\n", size >> 10);
+        return NULL;
+    }
+
+    region->start = start;
+    region->end = start + size;
+    region->flags = flags;
+    region->resident = 0;
+    region->next = *link;
+    *link = region;
+    reserved_bytes += size;
+
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+
+    if ((flags & VM_POPULATE) && vm_populate((void *)start, size) != 0) {
+        vm_release((void *)start);
+        return NULL;
+    }
+    return (void *)start;
+}
+
+/**
+ * Unmap what a region backed, have every CPU drop it from its TLB, then
+ * free the pages and the region.
+ *
+ * The region stays on the list, marked VM_RELEASING, until the
+ * shootdown is over: its range can't be handed out again while some CPU
+ * may still map it to the old pages, and a fault in it is reported.
+ */
+void vm_release(void *addr) {
+    uint64_t lock_flags = spin_lock_irqsave(&vm_lock);
+    struct VmRegion *region = regions;
+
+    while (region != NULL && region->start != (uint64_t)addr) {
+        region = region->next;
+    }
+    if (region == NULL || (region->flags & VM_RELEASING)) {
+        spin_unlock_irqrestore(&vm_lock, lock_flags);
+        log_message(LOG_ERROR, "vm: release of unknown region %p\n", addr);
+        return;
+    }
+    region->flags |= VM_RELEASING;
+
+    // The pages are chained through their first word (direct map) until
+    // no TLB points at them any more. Stop as soon as every backed page
+    // has been found
+    uint64_t freed = 0;
+    for (uint64_t virt = region->start; virt < region->end && region->resident != 0; virt += PAGE_SIZE) {
+        uint64_t page = virt_to_phys(&kernel_space, virt);
+        if (page != 0) {
+            unmap_pages(&kernel_space, virt, PAGE_SIZE);
+            *(uint64_t *)page = freed;
+            freed = page;
+            region->resident--;
+        }
+    }
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+
+    // Not under vm_lock: CPUs faulting meanwhile spin on it with
+    // interrupts off and couldn't answer
+    flush_tlb_kernel_range(region->start, region->end);
+    while (freed != 0) {
+        uint64_t next = *(uint64_t *)freed;
+        free_page(freed);
+        freed = next;
+    }
+
+    lock_flags = spin_lock_irqsave(&vm_lock);
+    struct VmRegion **link = &regions;
+    while (*link != region) {
+        link = &(*link)->next;
+    }
+    *link = region->next;
+    reserved_bytes -= region->end - region->start;
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+
+    kfree(region);
+}
+
+/**
+ * Fault in part of a region ahead of use.
+ */
+int vm_populate(void *addr, uint64_t size) {
+    uint64_t start = (uint64_t)addr & ~(PAGE_SIZE - 1);
+    uint64_t end = ((uint64_t)addr + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t lock_flags = spin_lock_irqsave(&vm_lock);
+    struct VmRegion *region = find_region(start);
+    int ret = 0;
+
+    if (region == NULL || end > region->end) {
+        ret = -1;
+    }
+    for (uint64_t virt = start; ret == 0 && virt < end; virt += PAGE_SIZE) {
+        ret = fault_in(region, virt);
+    }
+
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+    return ret;
+}
+
+/**
+ * Print reserved versus resident memory and the fault counters.
+ */
+void vm_dump_stats(void) {
+    uint64_t lock_flags = spin_lock_irqsave(&vm_lock);
+    uint64_t count = 0, resident = 0;
+
+    for (struct VmRegion *r = regions; r != NULL; r = r->next) {
+        count++;
+        resident += r->resident;
+    }
+    uint64_t reserved = reserved_bytes;
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+
+    uint64_t faults = 0, hits = 0, zeroed = 0, pooled = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        faults += zero_pools[cpu].faults;
+        hits += zero_pools[cpu].hits;
+        zeroed += zero_pools[cpu].zeroed;
+        pooled += zero_pools[cpu].count;
+    }
+
+    printk("VM: %lu regions, %lu KB reserved, %lu KB resident\n", count, reserved >> 10,
+           resident << (PAGE_SHIFT - 10));
+    printk("  %lu demand-zero faults, %lu from the zero pool (%lu%%), %lu pages pre-zeroed, %lu pooled\n",
+           faults, hits, faults ? hits * 100 / faults : 0, zeroed, pooled);
+}
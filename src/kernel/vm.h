@@ -0,0 +1,103 @@
+#ifndef _VM_H_
+#define _VM_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "paging.h"
+#include "timer.h"
+
+/**
+ * Region flags.
+ * VM_WRITE: Pages are mapped writable; without it they read as zero.
+ * VM_POPULATE: Back every page at vm_reserve() time instead of on first
+ *              touch, for memory that must never fault (IST stacks,
+ *              buffers used with interrupts off in a hurry).
+ */
+#define VM_WRITE            0x01
+#define VM_POPULATE         0x02
+
+/**
+ * Pre-zeroed page pool, per CPU.
+ * ZERO_POOL_HIGH: Pages a pool is refilled up to.
+ * ZERO_POOL_LOW: A fault that leaves fewer pages arms the refill timer.
+ * ZERO_POOL_BATCH: Pages zeroed per refill timer callback, so one
+ *                  callback stays short.
+ * ZERO_POOL_DELAY_US: Delay between refill callbacks.
+ */
+#define ZERO_POOL_HIGH      32
+#define ZERO_POOL_LOW       8
+#define ZERO_POOL_BATCH     8
+#define ZERO_POOL_DELAY_US  1000
+
+/**
+ * VmRegion: a reserved range of the kernel virtual area. Its pages are
+ * mapped one at a time, zeroed, when they are first touched. At least one
+ * unmapped page separates neighbouring regions, so running off either
+ * end (a stack overflowing) faults instead of corrupting a neighbour.
+ */
+struct VmRegion {
+    uint64_t start;
+    uint64_t end;
+    uint32_t flags;                     // VM_* flags
+    uint64_t resident;                  // Pages backed so far
+    struct VmRegion *next;              // Sorted by start
+};
+
+/**
+ * Per-CPU pool of zeroed pages. The page fault handler takes from it;
+ * a timer callback zeroes more pages in small batches, so the common
+ * fault does no clearing itself.
+ */
+struct ZeroPool {
+    uint32_t count;
+    uint64_t pages[ZERO_POOL_HIGH];
+    struct Timer refill;
+    uint64_t faults;                    // Demand-zero faults served
+    uint64_t hits;                      // ... with a page from the pool
+    uint64_t zeroed;                    // Pages cleared by the refill timer
+} __attribute__((aligned(64)));
+
+/**
+ * Install the page fault handler and set up the kernel virtual area
+ * (KERNEL_VIRT_BASE to KERNEL_VIRT_END). Needs init_idt(), init_kmem()
+ * and init_timers().
+ */
+void init_vm(void);
+
+/**
+ * Reserve `size` bytes (rounded up to pages) of kernel virtual memory.
+ * Nothing is allocated until a page is touched, unless VM_POPULATE is
+ * given.
+ * @return Page-aligned start, or NULL if the area or memory is exhausted.
+ */
+void *vm_reserve(uint64_t size, uint32_t flags);
+
+/**
+ * Unmap a region from vm_reserve() and free its pages. `addr` must be
+ * the address vm_reserve() returned. The pages are only freed once no
+ * CPU's TLB maps them (flush_tlb_kernel_range()), so the same rule
+ * applies: don't call it, or kfree() a lazy allocation, holding a lock
+ * other CPUs take with interrupts off.
+ */
+void vm_release(void *addr);
+
+/**
+ * Back [addr, addr + size) of a region now.
+ * @return 0 on success, -1 if the range isn't inside one region or
+ *         memory ran out.
+ */
+int vm_populate(void *addr, uint64_t size);
+
+/**
+ * Check whether an address lies in the kernel virtual area.
+ */
+static inline int vm_is_lazy(const void *addr) {
+    return (uint64_t)addr >= KERNEL_VIRT_BASE && (uint64_t)addr < KERNEL_VIRT_END;
+}
+
+/**
+ * Print the regions' footprint and the demand-zero counters.
+ */
+void vm_dump_stats(void);
+
+#endif  // _VM_H_
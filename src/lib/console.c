@@ -0,0 +1,226 @@
+#include "console.h"
+#include "lib.h"
+#include "log.h"
+#include "io.h"
+#include "spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  console.c
+// ----------------------------------------------------------------------------
+//  VGA text console.
+//
+//  Video memory is uncached and slow to read back, so the console never
+//  reads it. Text goes into a shadow buffer in RAM; each line that changes
+//  is marked dirty and copied to video memory once by console_sync().
+//
+//  Scrolling doesn't move any text. Each new line is written one row
+//  further down the 32 KB text window, and the CRTC start address is moved
+//  so the screen shows the last 25 rows. Only when the window's last row is
+//  used are the visible rows rewritten at the top of the window, which
+//  happens once every WINDOW_LINES - CONSOLE_ROWS lines.
+//
+//  console_lock covers the console state, the shadow buffer and the CRTC
+//  registers (an index write followed by a data write).
+// ----------------------------------------------------------------------------
+
+#define VGA_TEXT_BASE     0xB8000
+#define LINE_BYTES        (CONSOLE_COLS * 2)
+
+// CRTC registers (color adapter)
+#define CRTC_INDEX        0x3D4
+#define CRTC_DATA         0x3D5
+#define CRTC_START_HIGH   0x0C    // Followed by START_LOW (0x0D)
+#define CRTC_CURSOR_HIGH  0x0E    // Followed by CURSOR_LOW (0x0F)
+
+static struct Console console;
+static struct Spinlock console_lock;
+
+// Scrollback history, indexed by logical line modulo HISTORY_LINES
+static uint16_t shadow[HISTORY_LINES][CONSOLE_COLS];
+
+/**
+ * @brief Returns the shadow copy of a logical line.
+ */
+static uint16_t *shadow_line(uint64_t line) {
+    return shadow[line % HISTORY_LINES];
+}
+
+/**
+ * @brief Returns the oldest logical line still in the history.
+ */
+static uint64_t oldest_line(void) {
+    return console.line >= HISTORY_LINES ? console.line - (HISTORY_LINES - 1) : 0;
+}
+
+/**
+ * @brief Returns the top line of the screen when it follows the output.
+ */
+static uint64_t bottom_view(void) {
+    return console.line >= CONSOLE_ROWS ? console.line - (CONSOLE_ROWS - 1) : 0;
+}
+
+/**
+ * @brief Adds logical lines lo..hi to the dirty range.
+ */
+static void mark_dirty(uint64_t lo, uint64_t hi) {
+    if (console.dirty_lo > console.dirty_hi) {
+        console.dirty_lo = lo;
+        console.dirty_hi = hi;
+        return;
+    }
+    if (lo < console.dirty_lo) {
+        console.dirty_lo = lo;
+    }
+    if (hi > console.dirty_hi) {
+        console.dirty_hi = hi;
+    }
+}
+
+/**
+ * @brief Writes a 16-bit value to a pair of CRTC registers (high byte first).
+ */
+static void crtc_write16(uint8_t reg_high, uint16_t value) {
+    outb(CRTC_INDEX, reg_high);
+    outb(CRTC_DATA, (uint8_t)(value >> 8));
+    outb(CRTC_INDEX, reg_high + 1);
+    outb(CRTC_DATA, (uint8_t)value);
+}
+
+/**
+ * @brief Moves the cursor to the start of a new, blank line.
+ */
+static void new_line(void) {
+    console.line++;
+    console.column = 0;
+    memset(shadow_line(console.line), 0, LINE_BYTES);
+    mark_dirty(console.line, console.line);
+
+    // Out of rows in the window: start over at its top with the visible rows
+    if (console.line - console.window_base >= WINDOW_LINES) {
+        console.window_base = console.line - (CONSOLE_ROWS - 1);
+        mark_dirty(console.window_base, console.line);
+    }
+}
+
+/**
+ * @brief Copies dirty lines to video memory and updates the CRTC.
+ */
+static void console_sync(void) {
+    if (console.dirty_lo <= console.dirty_hi) {
+        uint64_t lo = console.dirty_lo;
+
+        // Lines that left the history or the window don't need copying
+        if (lo < console.window_base) {
+            lo = console.window_base;
+        }
+        if (lo < oldest_line()) {
+            lo = oldest_line();
+        }
+
+        for (uint64_t l = lo; l <= console.dirty_hi; l++) {
+            memcpy(console.vram + (l - console.window_base) * CONSOLE_COLS, shadow_line(l), LINE_BYTES);
+        }
+        console.dirty_lo = 1;
+        console.dirty_hi = 0;
+    }
+
+    uint16_t start = (uint16_t)((console.view_top - console.window_base) * CONSOLE_COLS);
+    if (start != console.start) {
+        crtc_write16(CRTC_START_HIGH, start);
+        console.start = start;
+    }
+
+    uint16_t cursor = (uint16_t)((console.line - console.window_base) * CONSOLE_COLS + console.column);
+    if (cursor != console.cursor) {
+        crtc_write16(CRTC_CURSOR_HIGH, cursor);
+        console.cursor = cursor;
+    }
+}
+
+/**
+ * @brief Draws text at the cursor and updates the screen.
+ */
+void console_write(const char *text, size_t length) {
+    uint64_t flags = spin_lock_irqsave(&console_lock);
+    uint16_t attr = (uint16_t)console.color << 8;
+    uint16_t *cells = shadow_line(console.line);
+
+    mark_dirty(console.line, console.line);
+
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            new_line();
+            cells = shadow_line(console.line);
+        } else {
+            cells[console.column++] = attr | (uint8_t)text[i];
+
+            if (console.column >= CONSOLE_COLS) {
+                new_line();
+                cells = shadow_line(console.line);
+            }
+        }
+    }
+
+    // New output always brings the view back to the bottom
+    console.view_top = bottom_view();
+    console_sync();
+
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/**
+ * @brief Moves the view through the scrollback history.
+ */
+void console_scroll(int lines) {
+    uint64_t flags = spin_lock_irqsave(&console_lock);
+    uint64_t bottom = bottom_view();
+    int64_t top = (int64_t)console.view_top + lines;
+
+    if (top < (int64_t)oldest_line()) {
+        top = (int64_t)oldest_line();
+    }
+    if (top > (int64_t)bottom) {
+        top = (int64_t)bottom;
+    }
+
+    console.view_top = (uint64_t)top;
+
+    // History above the window: rebuild the window from the shadow buffer.
+    // All of history fits (HISTORY_LINES < WINDOW_LINES).
+    if (console.view_top < console.window_base) {
+        console.window_base = console.view_top;
+        mark_dirty(console.view_top, console.line);
+    }
+
+    console_sync();
+
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Flushed log text is drawn straight onto the console
+static struct LogSink vga_sink = { "vga", console_write, NULL };
+
+/**
+ * @brief Resets the console and registers it as a kernel log sink.
+ */
+void init_vga_console(void) {
+    spin_lock_init(&console_lock, "console");
+    memset(shadow, 0, sizeof(shadow));
+
+    console.vram = (uint16_t *)VGA_TEXT_BASE;
+    console.line = 0;
+    console.column = 0;
+    console.color = 0x0F;          // White on black
+    console.window_base = 0;
+    console.view_top = 0;
+    console.dirty_lo = 1;
+    console.dirty_hi = 0;
+
+    // Start at the top of the window like the BIOS left it
+    console.start = 0;
+    console.cursor = 0;
+    crtc_write16(CRTC_START_HIGH, 0);
+    crtc_write16(CRTC_CURSOR_HIGH, 0);
+
+    log_register_sink(&vga_sink);
+}
@@ -0,0 +1,72 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * CONSOLE_COLS / CONSOLE_ROWS: Size of the visible VGA text screen.
+ * WINDOW_LINES: Lines that fit in the 32 KB text window at 0xB8000; the
+ *               CRTC start address can point the screen at any of them.
+ * HISTORY_LINES: Lines kept in the shadow buffer for scrollback. Must be
+ *                smaller than WINDOW_LINES so all of history fits in the
+ *                window at once.
+ */
+#define CONSOLE_COLS    80
+#define CONSOLE_ROWS    25
+#define WINDOW_LINES    204
+#define HISTORY_LINES   200
+
+/**
+ * Console: State of the VGA text console.
+ *
+ * Text is written to a shadow copy in normal RAM and only changed lines
+ * are copied to video memory. Lines are numbered from boot onwards
+ * ("logical" lines); video memory row r holds logical line window_base + r.
+ *
+ * @field vram Pointer to the 32 KB text window.
+ * @field line Logical line holding the cursor.
+ * @field column Cursor column.
+ * @field color Attribute byte for new characters.
+ * @field window_base Logical line stored in the first row of the window.
+ * @field view_top Logical line shown in the first row of the screen.
+ * @field dirty_lo First logical line not yet copied to video memory.
+ * @field dirty_hi Last logical line not yet copied (dirty_lo > dirty_hi: clean).
+ * @field start Last value written to the CRTC start address.
+ * @field cursor Last value written to the CRTC cursor location.
+ */
+struct Console {
+    uint16_t *vram;
+    uint64_t line;
+    int column;
+    uint8_t color;
+    uint64_t window_base;
+    uint64_t view_top;
+    uint64_t dirty_lo;
+    uint64_t dirty_hi;
+    uint16_t start;
+    uint16_t cursor;
+};
+
+/**
+ * init_vga_console: Resets the console and registers it as a kernel log sink.
+ */
+void init_vga_console(void);
+
+/**
+ * console_write: Draws text at the cursor and updates the screen.
+ *
+ * @param text Characters to draw; '\n' starts a new line.
+ * @param length Number of characters.
+ */
+void console_write(const char *text, size_t length);
+
+/**
+ * console_scroll: Moves the view through the scrollback history.
+ *
+ * @param lines Lines to move; negative scrolls back, positive forward.
+ *              The view snaps back to the bottom on new output.
+ */
+void console_scroll(int lines);
+
+#endif  // _CONSOLE_H_
@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "print.h"  // Ensure this header provides declarations for `printk` and `vprintk`
+#include "log.h"
 #include <stdarg.h>
 
 // ----------------------------------------------------------------------------
@@ -12,9 +13,9 @@
 /**
  * @brief Logs a formatted message with a specified log level.
  *
- * This function prints a formatted message to the screen with a prefix indicating
- * the severity level. It can be extended to log to additional interfaces like
- * serial ports.
+ * The message is stored in the kernel log ring tagged with its level; the
+ * severity prefix is added when the ring is flushed to the sinks (VGA,
+ * serial, ...). Error and panic messages are flushed immediately.
  *
  * @param level The severity level of the log message.
  * @param format The format string (printf-style).
@@ -24,27 +25,7 @@ void log_message(log_level_t level, const char *format, ...) {
     va_list args;
     va_start(args, format);
 
-    // Print log level prefix
-    switch (level) {
-        case LOG_INFO:
-            printk("[INFO] ");
-            break;
-        case LOG_WARN:
-            printk("[WARN] ");
-            break;
-        case LOG_ERROR:
-            printk("[ERROR] ");
-            break;
-        case LOG_PANIC:
-            printk("[PANIC] ");
-            break;
-        default:
-            printk("[UNKNOWN] ");
-            break;
-    }
-
-    // Print the formatted message using vprintk
-    vprintk(format, args);
+    vprintk_level(level, format, args);
 
     va_end(args);
 }
@@ -66,12 +47,15 @@ void error_check(const char *file, uint64_t line) {
     log_message(LOG_PANIC, "------------------------------------------\n");
 
     // Print assertion failure details
-    log_message(LOG_PANIC, "Assertion Failed: %s:%u\n", file, line);
+    log_message(LOG_PANIC, "Assertion Failed: %s:%lu\n", file, line);
 
     // Dump CPU registers and memory for debugging
     dump_registers();
     // dump_memory(0x200000, 256); // Example: dump 256 bytes starting at 0x200000
 
+    // Register dump is INFO level; push it out before halting
+    log_flush();
+
     // Disable interrupts to prevent any further operations
     __asm__ volatile ("cli");
 
@@ -115,64 +99,125 @@ void dump_registers(void) {
         : "memory"
     );
 
-    // Print register values using %llu for 64-bit
     log_message(LOG_INFO, "Register Dump:\n");
-    log_message(LOG_INFO, "RAX: 0x%u\n", rax);
-    log_message(LOG_INFO, "RBX: 0x%u\n", rbx);
-    log_message(LOG_INFO, "RCX: 0x%u\n", rcx);
-    log_message(LOG_INFO, "RDX: 0x%u\n", rdx);
-    log_message(LOG_INFO, "RSI: 0x%u\n", rsi);
-    log_message(LOG_INFO, "RDI: 0x%u\n", rdi);
-    log_message(LOG_INFO, "RBP: 0x%u\n", rbp);
-    log_message(LOG_INFO, "RSP: 0x%u\n", rsp);
-    log_message(LOG_INFO, "R8 : 0x%u\n", r8);
-    log_message(LOG_INFO, "R9 : 0x%u\n", r9);
-    log_message(LOG_INFO, "R10: 0x%u\n", r10);
-    log_message(LOG_INFO, "R11: 0x%u\n", r11);
-    log_message(LOG_INFO, "R12: 0x%u\n", r12);
-    log_message(LOG_INFO, "R13: 0x%u\n", r13);
-    log_message(LOG_INFO, "R14: 0x%u\n", r14);
-    log_message(LOG_INFO, "R15: 0x%u\n", r15);
+    log_message(LOG_INFO, "RAX: 0x%016lx\n", rax);
+    log_message(LOG_INFO, "RBX: 0x%016lx\n", rbx);
+    log_message(LOG_INFO, "RCX: 0x%016lx\n", rcx);
+    log_message(LOG_INFO, "RDX: 0x%016lx\n", rdx);
+    log_message(LOG_INFO, "RSI: 0x%016lx\n", rsi);
+    log_message(LOG_INFO, "RDI: 0x%016lx\n", rdi);
+    log_message(LOG_INFO, "RBP: 0x%016lx\n", rbp);
+    log_message(LOG_INFO, "RSP: 0x%016lx\n", rsp);
+    log_message(LOG_INFO, "R8 : 0x%016lx\n", r8);
+    log_message(LOG_INFO, "R9 : 0x%016lx\n", r9);
+    log_message(LOG_INFO, "R10: 0x%016lx\n", r10);
+    log_message(LOG_INFO, "R11: 0x%016lx\n", r11);
+    log_message(LOG_INFO, "R12: 0x%016lx\n", r12);
+    log_message(LOG_INFO, "R13: 0x%016lx\n", r13);
+    log_message(LOG_INFO, "R14: 0x%016lx\n", r14);
+    log_message(LOG_INFO, "R15: 0x%016lx\n", r15);
 }
 
+// Hexdump row layout:
+// "0000000000009000: 00 01 02 03 04 05 06 07  08 09 0a 0b 0c 0d 0e 0f  |................|\n"
+#define HEXDUMP_ROW_BYTES  16
+#define HEXDUMP_ROW_MAX    96      // Longest formatted row, with slack
+
 /**
- * @brief Formats a single byte as two hexadecimal characters.
+ * @brief Formats one hexdump row (address, hex bytes, ASCII).
  *
- * @param byte The byte to format.
- * @param buffer The buffer to append the formatted characters.
- * @param position The current position in the buffer.
- * @return The new position in the buffer after appending.
+ * @param out Output buffer with room for HEXDUMP_ROW_MAX characters.
+ * @param address Address printed at the start of the row.
+ * @param bytes Bytes to show.
+ * @param count Number of bytes (up to HEXDUMP_ROW_BYTES); a short last row
+ *              is padded so the ASCII column stays aligned.
+ * @return The number of characters written.
  */
-static int format_byte_hex(uint8_t byte, char *buffer, int position) {
-    const char hex_map[16] = "0123456789ABCDEF";
-    buffer[position++] = hex_map[(byte >> 4) & 0x0F];
-    buffer[position++] = hex_map[byte & 0x0F];
-    buffer[position++] = ' '; // Add space after each byte
-    return position;
+static int format_hexdump_row(char *out, uint64_t address, const uint8_t *bytes, size_t count) {
+    static const char hex_map[16] = "0123456789abcdef";
+    char *p = out;
+
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        *p++ = hex_map[(address >> shift) & 0xF];
+    }
+    *p++ = ':';
+
+    for (size_t i = 0; i < HEXDUMP_ROW_BYTES; i++) {
+        if (i == HEXDUMP_ROW_BYTES / 2) {
+            *p++ = ' ';
+        }
+        *p++ = ' ';
+        if (i < count) {
+            *p++ = hex_map[bytes[i] >> 4];
+            *p++ = hex_map[bytes[i] & 0xF];
+        } else {
+            *p++ = ' ';
+            *p++ = ' ';
+        }
+    }
+
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = '|';
+    for (size_t i = 0; i < count; i++) {
+        *p++ = (bytes[i] >= 0x20 && bytes[i] < 0x7F) ? (char)bytes[i] : '.';
+    }
+    *p++ = '|';
+    *p++ = '\n';
+
+    return (int)(p - out);
 }
 
 /**
  * @brief Dumps a section of memory for debugging purposes.
  *
- * This function prints a hexadecimal dump of memory starting at the specified
- * address for the given size. Useful for inspecting memory contents during
- * debugging.
+ * Rows of 16 bytes (address, hex and ASCII) are formatted straight into a
+ * buffer and handed to the kernel log a log line's worth at a time, so a
+ * 4 KB page costs a few dozen log records instead of thousands of printk
+ * calls. Runs of identical rows are shown once, followed by "*", which
+ * keeps dumps of mostly empty page tables or large ranges short. Long
+ * dumps stream out as the ring fills up.
  *
  * @param address The starting memory address to dump.
  * @param size The number of bytes to dump.
  */
 void dump_memory(uint64_t address, uint64_t size) {
-    volatile char *ptr = (volatile char *)address;
-    log_message(LOG_INFO, "Memory Dump at 0x%llu (Size: %llu bytes):\n", address, size);
-    for (uint64_t i = 0; i < size; i++) {
-        char byte_buffer[4]; // Two hex digits + space + null terminator
-        int pos = 0;
-        pos = format_byte_hex((unsigned char)ptr[i], byte_buffer, pos);
-        byte_buffer[pos] = '\0'; // Null-terminate
-        log_message(LOG_INFO, "%s", byte_buffer); // Print the formatted byte
-        if ((i + 1) % 16 == 0) {
-            log_message(LOG_INFO, "\n");
+    const uint8_t *ptr = (const uint8_t *)address;
+    char chunk[LOG_LINE_MAX];
+    size_t used = 0;
+    uint8_t row[HEXDUMP_ROW_BYTES];
+    uint8_t prev[HEXDUMP_ROW_BYTES];
+    int repeating = 0;
+
+    log_message(LOG_INFO, "Memory Dump at 0x%016lx (Size: %lu bytes):\n", address, size);
+
+    for (uint64_t offset = 0; offset < size; offset += HEXDUMP_ROW_BYTES) {
+        size_t count = size - offset < HEXDUMP_ROW_BYTES ? (size_t)(size - offset) : HEXDUMP_ROW_BYTES;
+        int last = offset + count >= size;
+
+        memcpy(row, ptr + offset, count);
+
+        if (used + HEXDUMP_ROW_MAX > sizeof(chunk)) {
+            log_store(LOG_LEVEL_RAW, chunk, used, 0);
+            used = 0;
         }
+
+        // Same as the row before: print "*" once; the last row always shows
+        if (offset > 0 && !last && memcmp(row, prev, HEXDUMP_ROW_BYTES) == 0) {
+            if (!repeating) {
+                chunk[used++] = '*';
+                chunk[used++] = '\n';
+                repeating = 1;
+            }
+            continue;
+        }
+        repeating = 0;
+
+        used += format_hexdump_row(chunk + used, address + offset, row, count);
+        memcpy(prev, row, HEXDUMP_ROW_BYTES);
+    }
+
+    if (used > 0) {
+        log_store(LOG_LEVEL_RAW, chunk, used, 0);
     }
-    log_message(LOG_INFO, "\n");
 }
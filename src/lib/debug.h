@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdarg.h>
+#include "print.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,7 +30,7 @@ typedef enum {
  * @param format The format string (printf-style).
  * @param ... Variable arguments corresponding to the format string.
  */
-void log_message(log_level_t level, const char *format, ...);
+void log_message(log_level_t level, const char *format, ...) PRINTF_FORMAT(2, 3);
 
 /**
  * @brief Handles failed assertions by displaying an error message and halting.
@@ -69,8 +70,9 @@ void dump_registers(void);
  * @brief Dumps a section of memory for debugging purposes.
  *
  * This function prints a hexadecimal dump of memory starting at the specified
- * address for the given size. Useful for inspecting memory contents during
- * debugging.
+ * address for the given size, 16 bytes per row with an ASCII column. Rows are
+ * written to the kernel log in bulk, so large ranges (page tables, the E820
+ * area) can be dumped and streamed to the serial console.
  *
  * @param address The starting memory address to dump.
  * @param size The number of bytes to dump.
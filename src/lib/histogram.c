@@ -0,0 +1,91 @@
+#include "histogram.h"
+#include "lib.h"
+
+// ----------------------------------------------------------------------------
+//  histogram.c
+// ----------------------------------------------------------------------------
+//  Log-linear histogram in the style of HdrHistogram.
+//
+//  Values below HIST_SUB_COUNT get one bucket each. Above that, a value
+//  whose top bit is bit `msb` goes to group msb - HIST_SUB_BITS + 1, and
+//  within the group to the bucket given by its HIST_SUB_BITS bits below
+//  the top one. Every bucket is thus 1/32 of its power of two wide, and
+//  the relative error is the same from a few cycles to seconds.
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Maps a value to its bucket.
+ */
+static uint32_t bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (uint32_t)value;
+    }
+
+    uint32_t shift = 63 - (uint32_t)__builtin_clzll(value) - HIST_SUB_BITS;
+    uint32_t sub = (uint32_t)(value >> shift) - HIST_SUB_COUNT;
+
+    return (shift + 1) * HIST_SUB_COUNT + sub;
+}
+
+/**
+ * @brief Returns the highest value that maps to a bucket.
+ */
+static uint64_t bucket_highest(uint32_t index) {
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+
+    uint32_t shift = index / HIST_SUB_COUNT - 1;
+    uint64_t top = HIST_SUB_COUNT + index % HIST_SUB_COUNT;
+
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * @brief Empties a histogram.
+ */
+void hist_reset(struct Histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/**
+ * @brief Adds one value.
+ */
+void hist_record(struct Histogram *h, uint64_t value) {
+    h->buckets[bucket_index(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * @brief Returns the value at a percentile.
+ */
+uint64_t hist_percentile(const struct Histogram *h, uint32_t per_10k) {
+    if (h->count == 0) {
+        return 0;
+    }
+
+    // Rank of the wanted value, 1-based and rounded up
+    uint64_t rank = (h->count * per_10k + 9999) / 10000;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_highest(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
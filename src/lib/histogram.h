@@ -0,0 +1,54 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+/**
+ * Log-linear (HDR-style) histogram geometry.
+ * HIST_SUB_BITS: Each power of two is split into 1 << HIST_SUB_BITS
+ *                buckets, so a recorded value is known to within 1/32
+ *                (~3%). Values below 1 << HIST_SUB_BITS are exact.
+ * HIST_BUCKETS: Buckets needed to cover every uint64_t value.
+ */
+#define HIST_SUB_BITS   5
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/**
+ * Histogram: Counts of values in log-linear buckets.
+ *
+ * @field count Values recorded.
+ * @field min Smallest value recorded (exact).
+ * @field max Largest value recorded (exact).
+ * @field sum Sum of all values, for the mean.
+ * @field buckets Per-bucket counts.
+ */
+struct Histogram {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+/**
+ * @brief Empties a histogram.
+ */
+void hist_reset(struct Histogram *h);
+
+/**
+ * @brief Adds one value. O(1): a bit scan and an increment.
+ */
+void hist_record(struct Histogram *h, uint64_t value);
+
+/**
+ * @brief Returns the value below which `per_10k` ten-thousandths of the
+ * recorded values fall (5000 = median, 9990 = p99.9).
+ *
+ * The result is the highest value of the bucket holding that rank, so it
+ * overstates the true value by at most one bucket width, and never exceeds
+ * the recorded maximum. Returns 0 for an empty histogram.
+ */
+uint64_t hist_percentile(const struct Histogram *h, uint32_t per_10k);
+
+#endif  // _HISTOGRAM_H_
@@ -0,0 +1,28 @@
+#ifndef _IO_H_
+#define _IO_H_
+
+#include <stdint.h>
+
+/**
+ * outb: Writes a byte to an I/O port.
+ *
+ * @param port The I/O port number.
+ * @param value The byte to write.
+ */
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a" (value), "Nd" (port));
+}
+
+/**
+ * inb: Reads a byte from an I/O port.
+ *
+ * @param port The I/O port number.
+ * @return The byte read.
+ */
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile ("inb %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+#endif  // _IO_H_
@@ -0,0 +1,55 @@
+#ifndef _IRQFLAGS_H_
+#define _IRQFLAGS_H_
+
+#include <stdint.h>
+
+/**
+ * RFLAGS.IF: Set while maskable interrupts are enabled.
+ * RFLAGS_RESERVED: Bit 1, always set.
+ */
+#define RFLAGS_IF  (1 << 9)
+#define RFLAGS_RESERVED  (1 << 1)
+
+/**
+ * irq_enable / irq_disable: Set or clear RFLAGS.IF on this CPU.
+ */
+static inline void irq_enable(void) {
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline void irq_disable(void) {
+    __asm__ volatile ("cli" : : : "memory");
+}
+
+/**
+ * irqs_enabled: Returns non-zero if RFLAGS.IF is set on this CPU.
+ */
+static inline int irqs_enabled(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0" : "=r" (flags));
+    return (flags & RFLAGS_IF) != 0;
+}
+
+/**
+ * irq_save: Disables interrupts on this CPU.
+ *
+ * @return The previous RFLAGS, for irq_restore.
+ */
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+/**
+ * irq_restore: Re-enables interrupts if they were enabled in `flags`.
+ *
+ * @param flags Value returned by the matching irq_save.
+ */
+static inline void irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+#endif  // _IRQFLAGS_H_
@@ -1,3 +1,35 @@
+; ----------------------------------------------------------------------------
+;  LIB.ASM (64-bit)
+; ----------------------------------------------------------------------------
+;  Memory routines for the kernel (System V calling convention).
+;
+;  memset/memcpy are single patchable jumps (see ALTERNATIVE in cpu.inc)
+;  that apply_alternatives() points at the best variant at boot:
+;
+;    *_fsrm  : plain rep movsb (fast short rep mov, no setup needed)
+;    *_erms  : rep movsb/stosb with a scalar path for short lengths
+;    *_sse2  : 16-byte unaligned loads, aligned stores, 64 bytes/iteration
+;    *_avx2  : 32-byte unaligned loads, aligned stores, 128 bytes/iteration
+;
+;  The SSE2 and AVX2 variants switch to non-temporal stores once a copy
+;  reaches NT_THRESHOLD bytes, so huge buffers don't evict the whole cache.
+;
+;  All copy variants load the head and tail of the buffer before storing
+;  anything, which keeps a forward copy correct when dst < src overlaps.
+;  memmove only needs its own loop for the dst > src overlapping case.
+;
+;  The vector variants clobber xmm0-xmm5 / ymm0-ymm5 (caller-saved).
+;  Under handler() those registers hold the interrupted thread's state
+;  (FPU state is switched lazily, see fpu.c), so there they fall back to
+;  rep movsb/stosb and scalar compares instead.
+; ----------------------------------------------------------------------------
+
+default rel
+
+%include "src/kernel/cpu.inc"
+
+NT_THRESHOLD equ 0x100000          ; 1 MB: use streaming stores above this
+
 section .text
 
 ; Exporting the symbols for external use
@@ -6,53 +38,595 @@ global memcpy
 global memmove
 global memcmp
 
-;------------------------------------------------------------------------------
-; memset: Fills a block of memory with a specified value
-;------------------------------------------------------------------------------
+global memset_erms
+global memset_sse2
+global memset_avx2
+global memcpy_fsrm
+global memcpy_erms
+global memcpy_sse2
+global memcpy_avx2
+
+; ----------------------------------------------------------------------------
+;  SCALAR_IN_TRAP: jump to the given label when called under handler()
+;  (PerCpu.trap_depth non-zero). Host builds (scripts/libtest.sh) have no
+;  per-CPU area and define HOSTED.
+; ----------------------------------------------------------------------------
+%macro SCALAR_IN_TRAP 1
+%ifndef HOSTED
+    cmp dword [gs:PERCPU_TRAP_DEPTH], 0
+    jne %1
+%endif
+%endmacro
+
+; ----------------------------------------------------------------------------
+;  COPY_SMALL: copy rdx (< 16) bytes from rsi to rdi, then ret.
+;  Every load happens before any store, so overlap in either direction is
+;  fine. Uses rcx/r8.
+; ----------------------------------------------------------------------------
+%macro COPY_SMALL 0
+    cmp edx, 8
+    jb %%lt8
+    mov rcx, [rsi]
+    mov r8, [rsi + rdx - 8]
+    mov [rdi], rcx
+    mov [rdi + rdx - 8], r8
+    ret
+%%lt8:
+    cmp edx, 4
+    jb %%lt4
+    mov ecx, [rsi]
+    mov r8d, [rsi + rdx - 4]
+    mov [rdi], ecx
+    mov [rdi + rdx - 4], r8d
+    ret
+%%lt4:
+    test edx, edx
+    jz %%done
+    movzx ecx, byte [rsi]
+    cmp edx, 2
+    jb %%one
+    movzx r8d, word [rsi + rdx - 2]
+    mov [rdi + rdx - 2], r8w
+%%one:
+    mov [rdi], cl
+%%done:
+    ret
+%endmacro
+
+; ----------------------------------------------------------------------------
+;  SET_SMALL: store rdx (< 16) copies of the byte pattern in r8 (already
+;  broadcast to all 8 bytes) at rdi, then ret.
+; ----------------------------------------------------------------------------
+%macro SET_SMALL 0
+    cmp edx, 8
+    jb %%lt8
+    mov [rdi], r8
+    mov [rdi + rdx - 8], r8
+    ret
+%%lt8:
+    cmp edx, 4
+    jb %%lt4
+    mov [rdi], r8d
+    mov [rdi + rdx - 4], r8d
+    ret
+%%lt4:
+    test edx, edx
+    jz %%done
+    mov [rdi], r8b
+    cmp edx, 2
+    jb %%done
+    mov [rdi + rdx - 2], r8w
+%%done:
+    ret
+%endmacro
+
+; ----------------------------------------------------------------------------
+;  BROADCAST_BYTE: r8 = low byte of esi repeated 8 times, rax = rdi.
+; ----------------------------------------------------------------------------
+%macro BROADCAST_BYTE 0
+    movzx r8d, sil
+    mov rax, 0x0101010101010101
+    imul r8, rax
+    mov rax, rdi
+%endmacro
+
+; ----------------------------------------------------------------------------
+;  memset: Fills a block of memory with a specified value
+;    rdi = buffer, esi = value (low byte used), rdx = size
+;    returns rax = buffer
+; ----------------------------------------------------------------------------
+; The unpatched default only uses rep stosb, which is correct on every
+; x86-64 CPU; alternatives are listed best first.
 memset:
+    jmp near memset_erms
+ALTERNATIVE memset, X86_FEATURE_AVX2, memset_avx2
+ALTERNATIVE memset, X86_FEATURE_ERMS, memset_erms
+ALTERNATIVE memset, X86_FEATURE_SSE2, memset_sse2
+
+memset_erms:
     cld                          ; Clear the direction flag to increment addresses
-    mov ecx, edx                 ; Copy the size (edx) to ecx (counter for rep stosb)
-    mov al, sil                  ; Load the fill value (sil) into al
-    rep stosb                    ; Fill ecx bytes of memory at rdi with the value in al
-    ret                          ; Return
-
-;------------------------------------------------------------------------------
-; memcmp: Compares two blocks of memory byte by byte
-;------------------------------------------------------------------------------
+    mov r9, rdi                  ; Keep the buffer pointer for the return value
+    movzx eax, sil               ; Load the fill value into al
+    mov rcx, rdx                 ; Full 64-bit count
+    rep stosb                    ; Fill rcx bytes at rdi with al
+    mov rax, r9
+    ret
+
+memset_sse2:
+    SCALAR_IN_TRAP memset_erms
+    BROADCAST_BYTE
+    cmp rdx, 16
+    jb .small
+
+    movq xmm0, r8
+    punpcklqdq xmm0, xmm0        ; Broadcast to all 16 lanes of xmm0
+    movdqu [rdi], xmm0           ; Unaligned head
+    movdqu [rdi + rdx - 16], xmm0 ; Unaligned tail
+
+    ; Align the destination up; the head store already covered the gap
+    lea rcx, [rdi + rdx]         ; rcx = end
+    add rdi, 16
+    and rdi, -16
+    sub rcx, rdi                 ; rcx = bytes left from aligned start
+    cmp rcx, NT_THRESHOLD
+    jae .stream
+
+.loop64:
+    cmp rcx, 64
+    jb .loop16
+    movdqa [rdi], xmm0
+    movdqa [rdi + 16], xmm0
+    movdqa [rdi + 32], xmm0
+    movdqa [rdi + 48], xmm0
+    add rdi, 64
+    sub rcx, 64
+    jmp .loop64
+
+.loop16:
+    cmp rcx, 16
+    jb .done                     ; The tail store covers what is left
+    movdqa [rdi], xmm0
+    add rdi, 16
+    sub rcx, 16
+    jmp .loop16
+
+.stream:
+    movntdq [rdi], xmm0
+    movntdq [rdi + 16], xmm0
+    movntdq [rdi + 32], xmm0
+    movntdq [rdi + 48], xmm0
+    add rdi, 64
+    sub rcx, 64
+    cmp rcx, 64
+    jae .stream
+    sfence
+    jmp .loop16
+
+.done:
+    ret
+
+.small:
+    SET_SMALL
+
+memset_avx2:
+    SCALAR_IN_TRAP memset_erms
+    BROADCAST_BYTE
+    cmp rdx, 32
+    jb .small
+
+    vmovq xmm0, r8
+    vpbroadcastq ymm0, xmm0
+    vmovdqu [rdi], ymm0          ; Unaligned head
+    vmovdqu [rdi + rdx - 32], ymm0 ; Unaligned tail
+
+    lea rcx, [rdi + rdx]
+    add rdi, 32
+    and rdi, -32
+    sub rcx, rdi
+    cmp rcx, NT_THRESHOLD
+    jae .stream
+
+.loop128:
+    cmp rcx, 128
+    jb .loop32
+    vmovdqa [rdi], ymm0
+    vmovdqa [rdi + 32], ymm0
+    vmovdqa [rdi + 64], ymm0
+    vmovdqa [rdi + 96], ymm0
+    add rdi, 128
+    sub rcx, 128
+    jmp .loop128
+
+.loop32:
+    cmp rcx, 32
+    jb .done
+    vmovdqa [rdi], ymm0
+    add rdi, 32
+    sub rcx, 32
+    jmp .loop32
+
+.stream:
+    vmovntdq [rdi], ymm0
+    vmovntdq [rdi + 32], ymm0
+    vmovntdq [rdi + 64], ymm0
+    vmovntdq [rdi + 96], ymm0
+    add rdi, 128
+    sub rcx, 128
+    cmp rcx, 128
+    jae .stream
+    sfence
+    jmp .loop32
+
+.done:
+    vzeroupper
+    ret
+
+.small:
+    cmp edx, 16
+    jb .tiny
+    movq xmm0, r8
+    punpcklqdq xmm0, xmm0
+    movdqu [rdi], xmm0
+    movdqu [rdi + rdx - 16], xmm0
+    ret
+.tiny:
+    SET_SMALL
+
+; ----------------------------------------------------------------------------
+;  memcmp: Compares two blocks of memory, 16 bytes per step with SSE2
+;    rdi = src1, rsi = src2, rdx = size
+;    returns eax < 0, 0 or > 0 ordering the first differing byte (unsigned)
+; ----------------------------------------------------------------------------
 memcmp:
-    cld                          ; Clear the direction flag to increment addresses
-    xor eax, eax                 ; Zero out eax (return value)
-    mov ecx, edx                 ; Set the comparison size (edx) in ecx
-    repe cmpsb                   ; Compare ecx bytes of memory at rsi and rdi
-    setnz al                     ; Set al to 1 if a mismatch is found, 0 otherwise
-    ret                          ; Return
-
-;------------------------------------------------------------------------------
-; memcpy: Copies a block of memory from source to destination
-; memmove: Same as memcpy but handles overlapping memory regions
-;------------------------------------------------------------------------------
+    cmp rdx, 16
+    jb .small
+    SCALAR_IN_TRAP .scalar
+
+.loop16:
+    movdqu xmm0, [rdi]
+    movdqu xmm1, [rsi]
+    pcmpeqb xmm0, xmm1           ; 0xFF in every lane that matches
+    pmovmskb eax, xmm0
+    cmp eax, 0xFFFF
+    jne .diff
+    add rdi, 16
+    add rsi, 16
+    sub rdx, 16
+    cmp rdx, 16
+    jae .loop16
+
+    ; Fewer than 16 bytes left: compare the last 16 bytes of the range.
+    ; The overlap was already equal, so the first mismatch is still first.
+    test rdx, rdx
+    jz .equal
+    lea rdi, [rdi + rdx - 16]
+    lea rsi, [rsi + rdx - 16]
+    movdqu xmm0, [rdi]
+    movdqu xmm1, [rsi]
+    pcmpeqb xmm0, xmm1
+    pmovmskb eax, xmm0
+    cmp eax, 0xFFFF
+    jne .diff
+
+.equal:
+    xor eax, eax
+    ret
+
+.diff:
+    xor eax, 0xFFFF              ; Set bits now mark mismatching lanes
+    bsf ecx, eax                 ; Index of the first mismatch
+    movzx eax, byte [rdi + rcx]
+    movzx edx, byte [rsi + rcx]
+    sub eax, edx
+    ret
+
+.small:
+    cmp edx, 8
+    jb .bytes
+    ; 8..15 bytes: two overlapping big-endian qword compares
+    mov rax, [rdi]
+    mov rcx, [rsi]
+    cmp rax, rcx
+    jne .qdiff
+    mov rax, [rdi + rdx - 8]
+    mov rcx, [rsi + rdx - 8]
+    cmp rax, rcx
+    jne .qdiff
+    xor eax, eax
+    ret
+
+.scalar:
+    ; Under handler(): 8 bytes per step, then the byte loop for the rest
+    mov rax, [rdi]
+    mov rcx, [rsi]
+    cmp rax, rcx
+    jne .qdiff
+    add rdi, 8
+    add rsi, 8
+    sub rdx, 8
+    cmp rdx, 8
+    jae .scalar
+    jmp .bytes
+
+.qdiff:
+    bswap rax                    ; First byte in memory becomes most significant
+    bswap rcx
+    cmp rax, rcx
+    sbb eax, eax                 ; -1 if below, 0 otherwise
+    or eax, 1                    ; -1 or 1
+    ret
+
+.bytes:
+    xor eax, eax
+    test edx, edx
+    jz .done
+.byte_loop:
+    movzx eax, byte [rdi]
+    movzx ecx, byte [rsi]
+    sub eax, ecx
+    jnz .done
+    inc rdi
+    inc rsi
+    dec edx
+    jnz .byte_loop
+.done:
+    ret
+
+; ----------------------------------------------------------------------------
+;  memcpy: Copies a block of memory from source to destination
+;    rdi = dst, rsi = src, rdx = size; returns rax = dst
+; ----------------------------------------------------------------------------
+; AVX2 wins below 1 KB and ties rep movsb above that. FSRM rep movsb
+; skips the short-copy setup that plain ERMS pays.
 memcpy:
+    jmp near memcpy_erms
+ALTERNATIVE memcpy, X86_FEATURE_AVX2, memcpy_avx2
+ALTERNATIVE memcpy, X86_FEATURE_FSRM, memcpy_fsrm
+ALTERNATIVE memcpy, X86_FEATURE_ERMS, memcpy_erms
+ALTERNATIVE memcpy, X86_FEATURE_SSE2, memcpy_sse2
+
+memcpy_fsrm:
+    cld
+    mov rax, rdi
+    mov rcx, rdx
+    rep movsb
+    ret
+
+memcpy_erms:
+    mov rax, rdi
+    cmp rdx, 16
+    jb .small
+    cld
+    mov rcx, rdx
+    rep movsb
+    ret
+.small:
+    COPY_SMALL
+
+memcpy_sse2:
+    SCALAR_IN_TRAP memcpy_erms
+    mov rax, rdi
+    cmp rdx, 16
+    jb .small
+
+    ; Load head and tail first; they are stored last (see file header)
+    movdqu xmm4, [rsi]
+    movdqu xmm5, [rsi + rdx - 16]
+    mov r10, rdi                 ; Head destination
+    lea r9, [rdi + rdx - 16]     ; Tail destination
+
+    ; Advance to the first 16-byte aligned destination
+    mov rcx, rdi
+    neg rcx
+    and ecx, 15
+    add rdi, rcx
+    add rsi, rcx
+    sub rdx, rcx
+    cmp rdx, NT_THRESHOLD
+    jae .stream
+
+.loop64:
+    cmp rdx, 64
+    jb .loop16
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + 16]
+    movdqu xmm2, [rsi + 32]
+    movdqu xmm3, [rsi + 48]
+    movdqa [rdi], xmm0
+    movdqa [rdi + 16], xmm1
+    movdqa [rdi + 32], xmm2
+    movdqa [rdi + 48], xmm3
+    add rsi, 64
+    add rdi, 64
+    sub rdx, 64
+    jmp .loop64
+
+.loop16:
+    cmp rdx, 16
+    jb .finish
+    movdqu xmm0, [rsi]
+    movdqa [rdi], xmm0
+    add rsi, 16
+    add rdi, 16
+    sub rdx, 16
+    jmp .loop16
+
+.stream:
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + 16]
+    movdqu xmm2, [rsi + 32]
+    movdqu xmm3, [rsi + 48]
+    movntdq [rdi], xmm0
+    movntdq [rdi + 16], xmm1
+    movntdq [rdi + 32], xmm2
+    movntdq [rdi + 48], xmm3
+    add rsi, 64
+    add rdi, 64
+    sub rdx, 64
+    cmp rdx, 64
+    jae .stream
+    sfence
+    jmp .loop16
+
+.finish:
+    movdqu [r10], xmm4
+    movdqu [r9], xmm5
+    ret
+
+.small:
+    COPY_SMALL
+
+memcpy_avx2:
+    SCALAR_IN_TRAP memcpy_erms
+    mov rax, rdi
+    cmp rdx, 32
+    jb .small
+
+    vmovdqu ymm4, [rsi]
+    vmovdqu ymm5, [rsi + rdx - 32]
+    mov r10, rdi
+    lea r9, [rdi + rdx - 32]
+
+    mov rcx, rdi
+    neg rcx
+    and ecx, 31
+    add rdi, rcx
+    add rsi, rcx
+    sub rdx, rcx
+    cmp rdx, NT_THRESHOLD
+    jae .stream
+
+.loop128:
+    cmp rdx, 128
+    jb .loop32
+    vmovdqu ymm0, [rsi]
+    vmovdqu ymm1, [rsi + 32]
+    vmovdqu ymm2, [rsi + 64]
+    vmovdqu ymm3, [rsi + 96]
+    vmovdqa [rdi], ymm0
+    vmovdqa [rdi + 32], ymm1
+    vmovdqa [rdi + 64], ymm2
+    vmovdqa [rdi + 96], ymm3
+    add rsi, 128
+    add rdi, 128
+    sub rdx, 128
+    jmp .loop128
+
+.loop32:
+    cmp rdx, 32
+    jb .finish
+    vmovdqu ymm0, [rsi]
+    vmovdqa [rdi], ymm0
+    add rsi, 32
+    add rdi, 32
+    sub rdx, 32
+    jmp .loop32
+
+.stream:
+    vmovdqu ymm0, [rsi]
+    vmovdqu ymm1, [rsi + 32]
+    vmovdqu ymm2, [rsi + 64]
+    vmovdqu ymm3, [rsi + 96]
+    vmovntdq [rdi], ymm0
+    vmovntdq [rdi + 32], ymm1
+    vmovntdq [rdi + 64], ymm2
+    vmovntdq [rdi + 96], ymm3
+    add rsi, 128
+    add rdi, 128
+    sub rdx, 128
+    cmp rdx, 128
+    jae .stream
+    sfence
+    jmp .loop32
+
+.finish:
+    vmovdqu [r10], ymm4
+    vmovdqu [r9], ymm5
+    vzeroupper
+    ret
+
+.small:
+    cmp edx, 16
+    jb .tiny
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + rdx - 16]
+    movdqu [rdi], xmm0
+    movdqu [rdi + rdx - 16], xmm1
+    ret
+.tiny:
+    COPY_SMALL
+
+; ----------------------------------------------------------------------------
+;  memmove: Same as memcpy but handles overlapping memory regions
+; ----------------------------------------------------------------------------
 memmove:
-    cld                          ; Clear the direction flag to increment addresses
+    ; (dst - src) >= size as unsigned means dst is below src or past the
+    ; end of it; the forward copy is safe in both cases.
+    mov rax, rdi
+    sub rax, rsi
+    cmp rax, rdx
+    jae memcpy
+
+    mov rax, rdi
+    cmp rdx, 16
+    jb .small
+    SCALAR_IN_TRAP .scalar
+
+    ; Backward copy: load head and tail, then walk down from the end with
+    ; aligned stores, finishing with the head and tail stores.
+    movdqu xmm4, [rsi]
+    movdqu xmm5, [rsi + rdx - 16]
+    mov r10, rdi
+    lea r9, [rdi + rdx - 16]
+
+    lea rdi, [rdi + rdx]         ; rdi = dst end
+    lea rsi, [rsi + rdx]         ; rsi = src end
+    mov rcx, rdi
+    and ecx, 15                  ; Bytes past the last aligned boundary
+    sub rdi, rcx
+    sub rsi, rcx
+    sub rdx, rcx
+
+.loop64:
+    cmp rdx, 64
+    jb .loop16
+    movdqu xmm0, [rsi - 16]
+    movdqu xmm1, [rsi - 32]
+    movdqu xmm2, [rsi - 48]
+    movdqu xmm3, [rsi - 64]
+    movdqa [rdi - 16], xmm0
+    movdqa [rdi - 32], xmm1
+    movdqa [rdi - 48], xmm2
+    movdqa [rdi - 64], xmm3
+    sub rsi, 64
+    sub rdi, 64
+    sub rdx, 64
+    jmp .loop64
+
+.loop16:
+    cmp rdx, 16
+    jb .finish
+    movdqu xmm0, [rsi - 16]
+    movdqa [rdi - 16], xmm0
+    sub rsi, 16
+    sub rdi, 16
+    sub rdx, 16
+    jmp .loop16
+
+.finish:
+    movdqu [r10], xmm4
+    movdqu [r9], xmm5
+    ret
+
+.scalar:
+    ; Under handler(): byte copy from the end down
+    lea rsi, [rsi + rdx - 1]
+    lea rdi, [rdi + rdx - 1]
+    mov rcx, rdx
+    std
+    rep movsb
+    cld
+    ret
 
-    ; Check for memory overlap (source < destination < source + size)
-    cmp rsi, rdi                 ; Compare source (rsi) with destination (rdi)
-    jae .copy                    ; If source >= destination, no overlap, go to .copy
-
-    mov r8, rsi                  ; Temporary register r8 = source (rsi)
-    add r8, rdx                  ; r8 = source + size
-    cmp r8, rdi                  ; Check if destination (rdi) is within the source range
-    jbe .copy                    ; If destination >= source + size, no overlap, go to .copy
-
-.overlap:
-    std                          ; Set the direction flag to decrement addresses
-    add rdi, rdx                 ; Adjust destination pointer to the end
-    add rsi, rdx                 ; Adjust source pointer to the end
-    sub rdi, 1                   ; Move destination pointer one step back
-    sub rsi, 1                   ; Move source pointer one step back
-
-.copy:
-    mov ecx, edx                 ; Set the size (edx) in ecx (counter for rep movsb)
-    rep movsb                    ; Copy ecx bytes from source (rsi) to destination (rdi)
-    cld                          ; Clear the direction flag to ensure default behavior
-    ret                          ; Return
+.small:
+    COPY_SMALL
@@ -1,5 +1,22 @@
 #include "lib.h"
 
+// ----------------------------------------------------------------------------
+//  String routines work a word (8 bytes) at a time. Word loads are always
+//  8-byte aligned on the string being scanned, so they never cross into a
+//  page the string doesn't touch. A zero byte in a word is found with
+//  HAS_ZERO, which is exact for the lowest zero byte.
+// ----------------------------------------------------------------------------
+
+typedef uint64_t __attribute__((__may_alias__)) word_t;
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) uword_t;
+
+#define WORD_SIZE    8
+#define PAGE_SIZE    4096
+#define ONES         0x0101010101010101ULL
+#define HIGHS        0x8080808080808080ULL
+#define HAS_ZERO(w)  (((w) - ONES) & ~(w) & HIGHS)
+#define FIRST_BYTE(m) (__builtin_ctzll(m) >> 3)
+
 /**
  * @brief Calculates the length of a null-terminated string.
  *
@@ -7,8 +24,46 @@
  * @return The number of characters in the string, excluding the null terminator.
  */
 size_t strlen(const char *str) {
+    uintptr_t offset = (uintptr_t)str & (WORD_SIZE - 1);
+    const word_t *p = (const word_t *)(str - offset);
+
+    // Force the bytes before str in the first word to be non-zero
+    uint64_t w = *p | ((1ULL << (offset * 8)) - 1);
+    uint64_t mask;
+
+    while ((mask = HAS_ZERO(w)) == 0) {
+        w = *++p;
+    }
+
+    return (const char *)p + FIRST_BYTE(mask) - str;
+}
+
+/**
+ * @brief Calculates the length of a string, looking at no more than max bytes.
+ *
+ * @param str Pointer to the string.
+ * @param max The maximum number of bytes to examine.
+ * @return The string length, or max if no terminator was found in range.
+ */
+size_t strnlen(const char *str, size_t max) {
     size_t len = 0;
-    while (str[len] != '\0') {
+
+    while (len < max && ((uintptr_t)(str + len) & (WORD_SIZE - 1)) != 0) {
+        if (str[len] == '\0') {
+            return len;
+        }
+        len++;
+    }
+
+    while (max - len >= WORD_SIZE) {
+        uint64_t mask = HAS_ZERO(*(const word_t *)(str + len));
+        if (mask != 0) {
+            return len + FIRST_BYTE(mask);
+        }
+        len += WORD_SIZE;
+    }
+
+    while (len < max && str[len] != '\0') {
         len++;
     }
     return len;
@@ -22,11 +77,138 @@ size_t strlen(const char *str) {
  * @return Pointer to the destination string.
  */
 char* strcpy(char *dest, const char *src) {
-    size_t i = 0;
-    while (src[i] != '\0') {
-        dest[i] = src[i];
-        i++;
+    char *d = dest;
+
+    // Byte copy until the source is word aligned
+    while (((uintptr_t)src & (WORD_SIZE - 1)) != 0) {
+        if ((*d++ = *src++) == '\0') {
+            return dest;
+        }
+    }
+
+    // Whole words while they contain no terminator
+    for (;;) {
+        uint64_t w = *(const word_t *)src;
+        if (HAS_ZERO(w) != 0) {
+            break;
+        }
+        *(uword_t *)d = w;
+        src += WORD_SIZE;
+        d += WORD_SIZE;
     }
-    dest[i] = '\0';
+
+    while ((*d++ = *src++) != '\0') { }
     return dest;
 }
+
+/**
+ * @brief Compares two null-terminated strings.
+ *
+ * @param s1 Pointer to the first string.
+ * @param s2 Pointer to the second string.
+ * @return An integer less than, equal to, or greater than zero if s1 orders
+ *         before, the same as, or after s2 (bytes compared as unsigned).
+ */
+int strcmp(const char *s1, const char *s2) {
+    const unsigned char *a = (const unsigned char *)s1;
+    const unsigned char *b = (const unsigned char *)s2;
+
+    while (((uintptr_t)a & (WORD_SIZE - 1)) != 0) {
+        if (*a != *b || *a == '\0') {
+            return *a - *b;
+        }
+        a++;
+        b++;
+    }
+
+    // a is aligned; b may not be, so its load is only taken when it cannot
+    // run into the next page. Otherwise fall through to one byte step.
+    for (;;) {
+        if (((uintptr_t)b & (PAGE_SIZE - 1)) <= PAGE_SIZE - WORD_SIZE) {
+            uint64_t wa = *(const word_t *)a;
+            uint64_t wb = *(const uword_t *)b;
+            if (wa == wb && HAS_ZERO(wa) == 0) {
+                a += WORD_SIZE;
+                b += WORD_SIZE;
+                continue;
+            }
+        }
+
+        // Either a difference or a terminator lies in the next 8 bytes
+        for (int i = 0; i < WORD_SIZE; i++) {
+            if (a[i] != b[i] || a[i] == '\0') {
+                return a[i] - b[i];
+            }
+        }
+        a += WORD_SIZE;
+        b += WORD_SIZE;
+    }
+}
+
+/**
+ * @brief Finds the first occurrence of a byte in a block of memory.
+ *
+ * @param buffer Pointer to the memory block.
+ * @param value The byte to look for (converted to unsigned char).
+ * @param size The number of bytes to search.
+ * @return Pointer to the matching byte, or NULL if it does not occur.
+ */
+void* memchr(const void *buffer, int value, size_t size) {
+    const unsigned char *p = (const unsigned char *)buffer;
+    unsigned char c = (unsigned char)value;
+    uint64_t pattern = c * ONES;
+
+    while (size > 0 && ((uintptr_t)p & (WORD_SIZE - 1)) != 0) {
+        if (*p == c) {
+            return (void *)p;
+        }
+        p++;
+        size--;
+    }
+
+    while (size >= WORD_SIZE) {
+        uint64_t mask = HAS_ZERO(*(const word_t *)p ^ pattern);
+        if (mask != 0) {
+            return (void *)(p + FIRST_BYTE(mask));
+        }
+        p += WORD_SIZE;
+        size -= WORD_SIZE;
+    }
+
+    for (; size > 0; p++, size--) {
+        if (*p == c) {
+            return (void *)p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the first occurrence of a character in a string.
+ *
+ * @param str Pointer to the null-terminated string.
+ * @param value The character to look for; '\0' finds the terminator.
+ * @return Pointer to the character, or NULL if it does not occur.
+ */
+char* strchr(const char *str, int value) {
+    char c = (char)value;
+    uintptr_t offset = (uintptr_t)str & (WORD_SIZE - 1);
+    const word_t *p = (const word_t *)(str - offset);
+    uint64_t pattern = (unsigned char)c * ONES;
+    uint64_t w = *p;
+    uint64_t mask;
+
+    // Force the bytes before str to be neither a terminator nor a match.
+    // (Masking the result instead would not work: a zero byte there can
+    // produce a false positive in a higher byte.)
+    uint64_t low = (1ULL << (offset * 8)) - 1;
+    mask = HAS_ZERO(w | low) | HAS_ZERO((w ^ pattern) | low);
+
+    while (mask == 0) {
+        w = *++p;
+        mask = HAS_ZERO(w) | HAS_ZERO(w ^ pattern);
+    }
+
+    const char *hit = (const char *)p + FIRST_BYTE(mask);
+    return (*hit == c) ? (char *)hit : NULL;
+}
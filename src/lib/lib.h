@@ -10,8 +10,9 @@
  * @param buffer Pointer to the memory block to fill.
  * @param value The value to set in each byte of the memory block.
  * @param size The number of bytes to fill.
+ * @return The buffer pointer.
  */
-void memset(void* buffer, char value, int size);
+void* memset(void* buffer, int value, size_t size);
 
 /**
  * memmove: Copies a block of memory from source to destination, handling overlap.
@@ -19,8 +20,9 @@ void memset(void* buffer, char value, int size);
  * @param dst Pointer to the destination memory block.
  * @param src Pointer to the source memory block.
  * @param size The number of bytes to copy.
+ * @return The destination pointer.
  */
-void memmove(void* dst, void* src, int size);
+void* memmove(void* dst, const void* src, size_t size);
 
 /**
  * memcpy: Copies a block of memory from source to destination.
@@ -28,8 +30,9 @@ void memmove(void* dst, void* src, int size);
  * @param dst Pointer to the destination memory block.
  * @param src Pointer to the source memory block.
  * @param size The number of bytes to copy.
+ * @return The destination pointer.
  */
-void memcpy(void* dst, void* src, int size);
+void* memcpy(void* dst, const void* src, size_t size);
 
 /**
  * memcmp: Compares two blocks of memory byte by byte.
@@ -40,7 +43,26 @@ void memcpy(void* dst, void* src, int size);
  * @return An integer less than, equal to, or greater than zero if the first block
  *         is found to be less than, equal to, or greater than the second block.
  */
-int memcmp(void* src1, void* src2, int size);
+int memcmp(const void* src1, const void* src2, size_t size);
+
+/**
+ * Individual memset/memcpy variants (lib.asm). memset/memcpy are patched
+ * at boot by apply_alternatives() to jump straight to the best variant for
+ * the running CPU. They are exported so benchmarks can call each one
+ * directly.
+ *
+ *  _fsrm : rep movsb only (Fast Short REP MOV)
+ *  _erms : rep movsb/stosb (Enhanced REP MOVSB/STOSB), scalar under 16 bytes
+ *  _sse2 : 16-byte vector loop, non-temporal stores from 1 MB
+ *  _avx2 : 32-byte vector loop, non-temporal stores from 1 MB
+ */
+void* memset_erms(void* buffer, int value, size_t size);
+void* memset_sse2(void* buffer, int value, size_t size);
+void* memset_avx2(void* buffer, int value, size_t size);
+void* memcpy_fsrm(void* dst, const void* src, size_t size);
+void* memcpy_erms(void* dst, const void* src, size_t size);
+void* memcpy_sse2(void* dst, const void* src, size_t size);
+void* memcpy_avx2(void* dst, const void* src, size_t size);
 
 /**
  * @brief Calculates the length of a null-terminated string.
@@ -59,4 +81,42 @@ size_t strlen(const char *str);
  */
 char* strcpy(char *dest, const char *src);
 
+/**
+ * @brief Calculates the length of a string, looking at no more than max bytes.
+ *
+ * @param str Pointer to the string.
+ * @param max The maximum number of bytes to examine.
+ * @return The string length, or max if no terminator was found in range.
+ */
+size_t strnlen(const char *str, size_t max);
+
+/**
+ * @brief Compares two null-terminated strings.
+ *
+ * @param s1 Pointer to the first string.
+ * @param s2 Pointer to the second string.
+ * @return An integer less than, equal to, or greater than zero if s1 orders
+ *         before, the same as, or after s2 (bytes compared as unsigned).
+ */
+int strcmp(const char *s1, const char *s2);
+
+/**
+ * @brief Finds the first occurrence of a byte in a block of memory.
+ *
+ * @param buffer Pointer to the memory block.
+ * @param value The byte to look for (converted to unsigned char).
+ * @param size The number of bytes to search.
+ * @return Pointer to the matching byte, or NULL if it does not occur.
+ */
+void* memchr(const void *buffer, int value, size_t size);
+
+/**
+ * @brief Finds the first occurrence of a character in a string.
+ *
+ * @param str Pointer to the null-terminated string.
+ * @param value The character to look for; '\0' finds the terminator.
+ * @return Pointer to the character, or NULL if it does not occur.
+ */
+char* strchr(const char *str, int value);
+
 #endif  // _LIB_H_
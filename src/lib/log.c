@@ -0,0 +1,276 @@
+#include "log.h"
+#include "lib.h"
+#include "debug.h"
+
+// ----------------------------------------------------------------------------
+//  log.c
+// ----------------------------------------------------------------------------
+//  Kernel log ring (dmesg-style).
+//
+//  Writers reserve space by advancing `head` with a compare-and-swap, copy
+//  their header and text in, then set LOG_REC_COMMITTED. No lock is taken,
+//  so a writer can be interrupted by another writer at any point.
+//
+//  The flusher walks from `tail` to `head`, hands each committed record to
+//  the sinks, zeroes the consumed bytes and advances `tail`. It stops at
+//  the first record that isn't committed yet. Zeroing matters: a fresh
+//  header can land where old text was, and must read as uncommitted until
+//  its writer finishes.
+//
+//  If a record doesn't fit, the writer flushes once itself; if there is
+//  still no room the message is dropped and counted.
+// ----------------------------------------------------------------------------
+
+#define RECORD_ALIGN  16
+#define RING_MASK     (LOG_BUF_SIZE - 1)
+#define BATCH_SIZE    4096     // Text handed to the sinks per write call
+#define LINE_SLACK    32       // Room for a level prefix and "...\n"
+
+static char ring[LOG_BUF_SIZE] __attribute__((aligned(RECORD_ALIGN)));
+
+static uint64_t head;          // Next byte to reserve (monotonic)
+static uint64_t tail;          // Next byte to flush (monotonic)
+static uint32_t next_seq;
+static uint64_t dropped;
+static uint64_t dropped_reported;
+static int flushing;           // Flush in progress (try-lock)
+static int flush_requested;    // flush_hook called since the last flush
+static void (*flush_hook)(void);
+
+static struct LogSink *sinks;
+
+// Level prefixes, indexed by log_level_t
+static const char *level_prefix[] = { "[INFO] ", "[WARN] ", "[ERROR] ", "[PANIC] " };
+
+static inline uint64_t read_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief Copies bytes into the ring starting at a ring offset, wrapping.
+ */
+static void ring_write(uint64_t pos, const void *data, size_t length) {
+    size_t offset = pos & RING_MASK;
+    size_t first = LOG_BUF_SIZE - offset;
+
+    if (length <= first) {
+        memcpy(&ring[offset], data, length);
+    } else {
+        memcpy(&ring[offset], data, first);
+        memcpy(&ring[0], (const char *)data + first, length - first);
+    }
+}
+
+/**
+ * @brief Copies bytes out of the ring starting at a ring offset, wrapping.
+ */
+static void ring_read(uint64_t pos, void *data, size_t length) {
+    size_t offset = pos & RING_MASK;
+    size_t first = LOG_BUF_SIZE - offset;
+
+    if (length <= first) {
+        memcpy(data, &ring[offset], length);
+    } else {
+        memcpy(data, &ring[offset], first);
+        memcpy((char *)data + first, &ring[0], length - first);
+    }
+}
+
+/**
+ * @brief Zeroes bytes in the ring starting at a ring offset, wrapping.
+ */
+static void ring_clear(uint64_t pos, size_t length) {
+    size_t offset = pos & RING_MASK;
+    size_t first = LOG_BUF_SIZE - offset;
+
+    if (length <= first) {
+        memset(&ring[offset], 0, length);
+    } else {
+        memset(&ring[offset], 0, first);
+        memset(&ring[0], 0, length - first);
+    }
+}
+
+/**
+ * @brief Clears the ring and its positions.
+ */
+void init_log(void) {
+    memset(ring, 0, sizeof(ring));
+    head = 0;
+    tail = 0;
+    next_seq = 0;
+    dropped = 0;
+    dropped_reported = 0;
+    flushing = 0;
+    flush_requested = 0;
+    flush_hook = NULL;
+    sinks = NULL;
+}
+
+/**
+ * @brief Sets the function that schedules a deferred flush.
+ */
+void log_set_flush_hook(void (*hook)(void)) {
+    __atomic_store_n(&flush_requested, 0, __ATOMIC_RELAXED);
+    flush_hook = hook;
+}
+
+/**
+ * @brief Adds a sink to the list of flush targets.
+ */
+void log_register_sink(struct LogSink *sink) {
+    sink->next = sinks;
+    sinks = sink;
+}
+
+/**
+ * @brief Reserves `size` bytes of ring space.
+ *
+ * @return 1 with *pos set on success, 0 if the ring is full.
+ */
+static int reserve(size_t size, uint64_t *pos) {
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+    do {
+        uint64_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        if (h + size - t > LOG_BUF_SIZE) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &h, h + size, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    *pos = h;
+    return 1;
+}
+
+/**
+ * @brief Appends a message to the ring.
+ */
+void log_store(int level, const char *text, size_t length, int truncated) {
+    struct LogRecord rec;
+    uint64_t pos;
+
+    if (length > LOG_LINE_MAX) {
+        length = LOG_LINE_MAX;
+        truncated = 1;
+    }
+
+    size_t size = (sizeof(rec) + length + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+
+    if (!reserve(size, &pos)) {
+        // Full: make room synchronously once, then give up
+        log_flush();
+        if (!reserve(size, &pos)) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    rec.length = (uint16_t)length;
+    rec.level = (uint8_t)level;
+    rec.flags = truncated ? LOG_REC_TRUNCATED : 0;
+    rec.seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    rec.tsc = read_tsc();
+
+    ring_write(pos + sizeof(rec), text, length);
+    ring_write(pos, &rec, sizeof(rec));
+
+    // Publish: the flusher may read the record once this flag is visible
+    struct LogRecord *hdr = (struct LogRecord *)&ring[pos & RING_MASK];
+    __atomic_store_n(&hdr->flags, (uint8_t)(rec.flags | LOG_REC_COMMITTED), __ATOMIC_RELEASE);
+
+    // Errors go out immediately; everything else waits for the deferred
+    // flush unless the ring is getting full. Only the first record after
+    // a flush asks for one.
+    if ((level != LOG_LEVEL_RAW && level >= LOG_ERROR) ||
+        pos + size - __atomic_load_n(&tail, __ATOMIC_RELAXED) >= LOG_FLUSH_MARK) {
+        log_flush();
+    } else if (flush_hook != NULL &&
+               !__atomic_exchange_n(&flush_requested, 1, __ATOMIC_ACQ_REL)) {
+        flush_hook();
+    }
+}
+
+/**
+ * @brief Sends a batch of text to every sink.
+ */
+static void emit(const char *text, size_t length) {
+    for (struct LogSink *s = sinks; s != NULL; s = s->next) {
+        s->write(text, length);
+    }
+}
+
+/**
+ * @brief Writes all committed records to the sinks.
+ */
+void log_flush(void) {
+    static char batch[BATCH_SIZE];
+    size_t used = 0;
+
+    if (__atomic_exchange_n(&flushing, 1, __ATOMIC_ACQUIRE) != 0) {
+        return;
+    }
+
+    // Records stored from here on need a new request
+    __atomic_store_n(&flush_requested, 0, __ATOMIC_RELEASE);
+
+    uint64_t t = tail;
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+    while (t < h) {
+        struct LogRecord *hdr = (struct LogRecord *)&ring[t & RING_MASK];
+        if (!(__atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE) & LOG_REC_COMMITTED)) {
+            break;    // Writer still copying; pick it up next time
+        }
+
+        struct LogRecord rec = *hdr;
+        size_t size = (sizeof(rec) + rec.length + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+
+        if (used + rec.length + LINE_SLACK > BATCH_SIZE) {
+            emit(batch, used);
+            used = 0;
+        }
+
+        if (rec.level != LOG_LEVEL_RAW) {
+            const char *prefix = "[UNKNOWN] ";
+            if (rec.level < sizeof(level_prefix) / sizeof(level_prefix[0])) {
+                prefix = level_prefix[rec.level];
+            }
+            size_t plen = strlen(prefix);
+            memcpy(batch + used, prefix, plen);
+            used += plen;
+        }
+        ring_read(t + sizeof(rec), batch + used, rec.length);
+        used += rec.length;
+        if (rec.flags & LOG_REC_TRUNCATED) {
+            memcpy(batch + used, "...\n", 4);
+            used += 4;
+        }
+
+        ring_clear(t, size);
+        t += size;
+        __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+    }
+
+    if (used > 0) {
+        emit(batch, used);
+    }
+
+    uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != dropped_reported) {
+        static const char msg[] = "[log: messages dropped, ring full]\n";
+        dropped_reported = lost;
+        emit(msg, sizeof(msg) - 1);
+    }
+
+    __atomic_store_n(&flushing, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns the number of dropped messages.
+ */
+uint64_t log_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,106 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * LOG_BUF_SIZE: Size of the kernel log ring in bytes (power of two).
+ * LOG_LINE_MAX: Longest text a single record can hold; longer messages are
+ *               truncated and flagged.
+ * LOG_FLUSH_MARK: Fill level at which a writer flushes the ring itself
+ *                 instead of waiting for the deferred flush.
+ */
+#define LOG_BUF_SIZE    (64 * 1024)
+#define LOG_LINE_MAX    512
+#define LOG_FLUSH_MARK  (LOG_BUF_SIZE / 2)
+
+/**
+ * Level used for plain printk output, which is written without a prefix.
+ * Other records use the log_level_t values from debug.h.
+ */
+#define LOG_LEVEL_RAW   0xFF
+
+/**
+ * Record flags.
+ */
+#define LOG_REC_COMMITTED  0x01  // Text is complete; the flusher may read it
+#define LOG_REC_TRUNCATED  0x02  // Message was cut at LOG_LINE_MAX
+
+/**
+ * LogRecord: Header in front of every message in the ring.
+ * Records are padded to 16 bytes so a header never wraps around the end.
+ *
+ * @field length Number of text bytes that follow the header.
+ * @field level log_level_t value or LOG_LEVEL_RAW.
+ * @field flags LOG_REC_* bits; COMMITTED is set last by the writer.
+ * @field seq Sequence number of the record.
+ * @field tsc Time stamp counter when the message was stored.
+ */
+struct LogRecord {
+    uint16_t length;
+    uint8_t level;
+    uint8_t flags;
+    uint32_t seq;
+    uint64_t tsc;
+};
+
+/**
+ * LogSink: An output device that flushed records are written to.
+ *
+ * @field name Short name for diagnostics.
+ * @field write Called with batches of text (level prefix already added).
+ * @field next Next sink in the list (set by log_register_sink).
+ */
+struct LogSink {
+    const char *name;
+    void (*write)(const char *text, size_t length);
+    struct LogSink *next;
+};
+
+/**
+ * init_log: Clears the ring. Must run before the first message is stored.
+ */
+void init_log(void);
+
+/**
+ * log_register_sink: Adds a sink that receives all records flushed from
+ * now on.
+ *
+ * @param sink Sink to add; must stay valid forever.
+ */
+void log_register_sink(struct LogSink *sink);
+
+/**
+ * log_set_flush_hook: Sets the function that schedules a deferred flush.
+ * It is called, from any context, for the first record stored after a
+ * flush, and should arrange for log_flush() to run soon (e.g. by arming a
+ * timer). Without a hook, records wait for an explicit flush.
+ *
+ * @param hook Scheduling function, or NULL.
+ */
+void log_set_flush_hook(void (*hook)(void));
+
+/**
+ * log_store: Appends one message to the ring without taking a lock.
+ *
+ * @param level log_level_t value or LOG_LEVEL_RAW.
+ * @param text Message text (not null-terminated).
+ * @param length Number of bytes in text; clamped to LOG_LINE_MAX.
+ * @param truncated Non-zero if the caller already had to cut the message.
+ */
+void log_store(int level, const char *text, size_t length, int truncated);
+
+/**
+ * log_flush: Writes every committed record to all sinks. Called through
+ * the flush hook, by writers once the ring passes LOG_FLUSH_MARK, and for
+ * error/panic messages. Does nothing if another flush is in progress.
+ */
+void log_flush(void);
+
+/**
+ * log_dropped: Number of messages discarded because the ring was full.
+ */
+uint64_t log_dropped(void);
+
+#endif  // _LOG_H_
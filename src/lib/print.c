@@ -1,398 +1,463 @@
 #include "print.h"
 #include "lib.h"
+#include "log.h"
 #include <stdint.h>
 #include <stdarg.h>
 
-// Screen buffer initialized to VGA text mode address
-static struct ScreenBuffer screen_buffer = {(char*)0xb8000, 0, 0};
+// ----------------------------------------------------------------------------
+//  print.c
+// ----------------------------------------------------------------------------
+//  Kernel formatted output. vsnprintk() is the only format loop; printk,
+//  vprintk, vprintk_level and snprintk are thin wrappers around it.
+//
+//  Supported: flags "-+ #0", width and precision (also '*'), length
+//  modifiers hh h l ll z j t, and conversions d i u o x X c s p %.
+// ----------------------------------------------------------------------------
+
+// Conversion flags
+#define FLAG_LEFT     0x01    // '-': pad on the right
+#define FLAG_PLUS     0x02    // '+': always print a sign
+#define FLAG_SPACE    0x04    // ' ': space in place of a '+' sign
+#define FLAG_ALT      0x08    // '#': 0x prefix / leading octal 0
+#define FLAG_ZERO     0x10    // '0': pad numbers with zeros
+#define FLAG_UPPER    0x20    // Upper-case hex digits
+
+// Length modifiers
+enum { LEN_INT, LEN_CHAR, LEN_SHORT, LEN_LONG, LEN_LLONG, LEN_SIZE };
+
+// "00".."99": decimal conversion emits two digits per division
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_lower[16] = "0123456789abcdef";
+static const char hex_upper[16] = "0123456789ABCDEF";
 
 /**
- * Converts an unsigned integer to a decimal string representation.
- *
- * @param buffer Pointer to the output buffer.
- * @param position Starting position in the buffer.
- * @param digits The unsigned integer to convert.
- * @return The number of characters written to the buffer.
+ * Output state for one vsnprintk call.
+ * `length` counts every character produced, including those that did not
+ * fit, so the caller gets the snprintf return value.
  */
-static int udecimal_to_string(char *buffer, int position, uint64_t digits) {
-    char digits_map[10] = "0123456789";
-    char digits_buffer[25];
-    int size = 0;
-
-    // Extract digits in reverse order
-    do {
-        digits_buffer[size++] = digits_map[digits % 10];
-        digits /= 10;
-    } while (digits != 0);
+struct FormatOutput {
+    char *buffer;
+    size_t size;       // Usable bytes, excluding the terminator
+    size_t length;
+};
 
-    // Write digits in correct order to the buffer
-    for (int i = size - 1; i >= 0; i--) {
-        buffer[position++] = digits_buffer[i];
+/**
+ * Appends characters, keeping whatever fits in the buffer.
+ */
+static void put_chars(struct FormatOutput *out, const char *text, size_t count) {
+    if (out->length < out->size) {
+        size_t room = out->size - out->length;
+        memcpy(out->buffer + out->length, text, count < room ? count : room);
     }
+    out->length += count;
+}
 
-    return size;
+/**
+ * Appends `count` copies of a character.
+ */
+static void put_repeat(struct FormatOutput *out, char c, int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (out->length < out->size) {
+        size_t room = out->size - out->length;
+        memset(out->buffer + out->length, c, (size_t)count < room ? (size_t)count : room);
+    }
+    out->length += (size_t)count;
 }
 
 /**
- * Converts a signed integer to a decimal string representation.
+ * Converts an unsigned integer to decimal, writing backwards from `end`.
+ * Divisions by the constant 100 compile to a multiply by its reciprocal;
+ * values below 2^32 use the cheaper 32-bit multiply.
  *
- * @param buffer Pointer to the output buffer.
- * @param position Starting position in the buffer.
- * @param digits The signed integer to convert.
- * @return The number of characters written to the buffer.
+ * @return Pointer to the first digit.
  */
-static int decimal_to_string(char *buffer, int position, int64_t digits) {
-    int size = 0;
-
-    // Handle negative numbers
-    if (digits < 0) {
-        digits = -digits;
-        buffer[position++] = '-';
-        size = 1;
+static char *format_decimal(char *end, uint64_t value) {
+    while (value > 0xFFFFFFFFu) {
+        uint64_t q = value / 100;
+        end -= 2;
+        memcpy(end, &digit_pairs[(value - q * 100) * 2], 2);
+        value = q;
     }
 
-    size += udecimal_to_string(buffer, position, (uint64_t)digits);
-    return size;
+    uint32_t v = (uint32_t)value;
+    while (v >= 100) {
+        uint32_t q = v / 100;
+        end -= 2;
+        memcpy(end, &digit_pairs[(v - q * 100) * 2], 2);
+        v = q;
+    }
+
+    if (v >= 10) {
+        end -= 2;
+        memcpy(end, &digit_pairs[v * 2], 2);
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
 }
 
 /**
- * Converts an unsigned integer to a hexadecimal string representation.
+ * Converts an unsigned integer to hexadecimal, one byte (two digits) per
+ * step, writing backwards from `end`.
  *
- * @param buffer Pointer to the output buffer.
- * @param position Starting position in the buffer.
- * @param digits The unsigned integer to convert.
- * @return The number of characters written to the buffer.
+ * @return Pointer to the first digit.
  */
-static int hex_to_string(char *buffer, int position, uint64_t digits) {
-    char digits_buffer[25];
-    char digits_map[16] = "0123456789ABCDEF";
-    int size = 0;
-
-    // Extract digits in reverse order
+static char *format_hex(char *end, uint64_t value, const char *digits) {
     do {
-        digits_buffer[size++] = digits_map[digits % 16];
-        digits /= 16;
-    } while (digits != 0);
-
-    // Write digits in correct order to the buffer
-    for (int i = size - 1; i >= 0; i--) {
-        buffer[position++] = digits_buffer[i];
+        uint8_t byte = (uint8_t)value;
+        end -= 2;
+        end[0] = digits[byte >> 4];
+        end[1] = digits[byte & 0xF];
+        value >>= 8;
+    } while (value != 0);
+
+    // Drop a leading zero from the last byte
+    if (*end == '0') {
+        end++;
     }
-
-    buffer[position++] = 'H'; // Append 'H' for hexadecimal notation
-    return size + 1;
+    return end;
 }
 
 /**
- * Converts an unsigned 64-bit integer to a hexadecimal string representation with leading zeros.
+ * Converts an unsigned integer to octal, writing backwards from `end`.
  *
- * @param buffer Pointer to the output buffer.
- * @param position Starting position in the buffer.
- * @param digits The unsigned 64-bit integer to convert.
- * @return The number of characters written to the buffer.
+ * @return Pointer to the first digit.
  */
-static int hex64_to_string(char *buffer, int position, uint64_t digits) {
-    char digits_buffer[17];
-    char digits_map[16] = "0123456789ABCDEF";
-    int size = 0;
-
-    // Extract digits in reverse order
+static char *format_octal(char *end, uint64_t value) {
     do {
-        digits_buffer[size++] = digits_map[digits % 16];
-        digits /= 16;
-    } while (digits != 0);
+        *--end = (char)('0' + (value & 7));
+        value >>= 3;
+    } while (value != 0);
+    return end;
+}
+
+/**
+ * Formats one integer conversion with sign, prefix, precision and padding.
+ */
+static void put_number(struct FormatOutput *out, uint64_t value, int negative, char conv,
+                       int flags, int width, int precision) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start;
+    char prefix[2];
+    int prefix_len = 0;
+
+    if (conv == 'x' || conv == 'X' || conv == 'p') {
+        start = format_hex(end, value, (flags & FLAG_UPPER) ? hex_upper : hex_lower);
+    } else if (conv == 'o') {
+        start = format_octal(end, value);
+    } else {
+        start = format_decimal(end, value);
+    }
 
-    // Ensure we have leading zeros for 16 hex digits
-    while (size < 16) {
-        digits_buffer[size++] = '0';
+    // An explicit precision of 0 prints nothing for 0
+    if (precision == 0 && value == 0) {
+        start = end;
+    }
+    int ndigits = (int)(end - start);
+
+    if (negative) {
+        prefix[prefix_len++] = '-';
+    } else if (flags & FLAG_PLUS) {
+        prefix[prefix_len++] = '+';
+    } else if (flags & FLAG_SPACE) {
+        prefix[prefix_len++] = ' ';
     }
 
-    // Write digits in correct order to the buffer
-    for (int i = size - 1; i >= 0; i--) {
-        buffer[position++] = digits_buffer[i];
+    // '#' adds 0x to non-zero hex; %p always has it
+    if ((flags & FLAG_ALT) && (((conv == 'x' || conv == 'X') && value != 0) || conv == 'p')) {
+        prefix[prefix_len++] = '0';
+        prefix[prefix_len++] = (flags & FLAG_UPPER) ? 'X' : 'x';
     }
 
-    buffer[position++] = 'H'; // Append 'H' for hexadecimal notation
-    return size + 1;
+    int zeros = precision > ndigits ? precision - ndigits : 0;
+
+    // '#' with octal makes sure the first digit is a 0
+    if ((flags & FLAG_ALT) && conv == 'o' && zeros == 0 && (ndigits == 0 || *start != '0')) {
+        zeros = 1;
+    }
+
+    int pad = width - prefix_len - zeros - ndigits;
+
+    // '0' only pads when no precision is given and we aren't left-aligned
+    if ((flags & (FLAG_ZERO | FLAG_LEFT)) == FLAG_ZERO && precision < 0 && pad > 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(flags & FLAG_LEFT)) {
+        put_repeat(out, ' ', pad);
+    }
+    put_chars(out, prefix, (size_t)prefix_len);
+    put_repeat(out, '0', zeros);
+    put_chars(out, start, (size_t)ndigits);
+    if (flags & FLAG_LEFT) {
+        put_repeat(out, ' ', pad);
+    }
 }
 
 /**
- * Copies a string into a buffer.
- *
- * @param buffer Pointer to the output buffer.
- * @param position Starting position in the buffer.
- * @param string Pointer to the input string.
- * @return The number of characters written to the buffer.
+ * Formats text padded to a field width.
  */
-static int read_string(char *buffer, int position, const char *string) {
-    int index = 0;
+static void put_field(struct FormatOutput *out, const char *text, size_t length, int flags, int width) {
+    int pad = width - (int)length;
 
-    while (string[index] != '\0') {
-        buffer[position++] = string[index++];
+    if (!(flags & FLAG_LEFT)) {
+        put_repeat(out, ' ', pad);
+    }
+    put_chars(out, text, length);
+    if (flags & FLAG_LEFT) {
+        put_repeat(out, ' ', pad);
     }
-
-    return index;
 }
 
 /**
- * Writes a buffer to the screen with text wrapping and scrolling.
+ * vsnprintk: Formats a string into a caller buffer.
  *
- * @param buffer Pointer to the text buffer.
- * @param size Number of characters to write.
- * @param sb Pointer to the screen buffer structure.
- * @param color Text color to apply.
+ * @param buffer Destination; always null-terminated if size > 0.
+ * @param size Size of the destination in bytes.
+ * @param format Format string (see the top of this file).
+ * @param args Variable argument list.
+ * @return The length the full output would have, like vsnprintf.
  */
-static void write_screen(const char *buffer, int size, struct ScreenBuffer *sb, char color) {
-    int column = sb->column;
-    int row = sb->row;
-
-    for (int i = 0; i < size; i++) {
-        // Scroll screen if row exceeds 24
-        if (row >= 25) {
-            memcpy(sb->buffer, sb->buffer + LINE_SIZE, LINE_SIZE * 24);
-            memset(sb->buffer + LINE_SIZE * 24, 0, LINE_SIZE);
-            row--;
+int vsnprintk(char *buffer, size_t size, const char *format, va_list args) {
+    struct FormatOutput out = { buffer, size > 0 ? size - 1 : 0, 0 };
+    const char *p = format;
+
+    while (*p != '\0') {
+        // Copy the literal run up to the next conversion in one go
+        const char *percent = strchr(p, '%');
+        if (percent == NULL) {
+            put_chars(&out, p, strlen(p));
+            break;
+        }
+        put_chars(&out, p, (size_t)(percent - p));
+        const char *spec = percent;
+        p = percent + 1;
+
+        // Flags
+        int flags = 0;
+        for (;; p++) {
+            if (*p == '-') {
+                flags |= FLAG_LEFT;
+            } else if (*p == '+') {
+                flags |= FLAG_PLUS;
+            } else if (*p == ' ') {
+                flags |= FLAG_SPACE;
+            } else if (*p == '#') {
+                flags |= FLAG_ALT;
+            } else if (*p == '0') {
+                flags |= FLAG_ZERO;
+            } else {
+                break;
+            }
         }
 
-        if (buffer[i] == '\n') {
-            column = 0;
-            row++;
+        // Width
+        int width = 0;
+        if (*p == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            p++;
         } else {
-            sb->buffer[column * 2 + row * LINE_SIZE] = buffer[i];
-            sb->buffer[column * 2 + row * LINE_SIZE + 1] = color;
-            column++;
+            while (*p >= '0' && *p <= '9') {
+                width = width * 10 + (*p++ - '0');
+            }
+        }
+
+        // Precision (-1: none)
+        int precision = -1;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                precision = va_arg(args, int);
+                if (precision < 0) {
+                    precision = -1;
+                }
+                p++;
+            } else {
+                precision = 0;
+                while (*p >= '0' && *p <= '9') {
+                    precision = precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+
+        // Length modifier
+        int length = LEN_INT;
+        if (*p == 'h') {
+            length = (*++p == 'h') ? (p++, LEN_CHAR) : LEN_SHORT;
+        } else if (*p == 'l') {
+            length = (*++p == 'l') ? (p++, LEN_LLONG) : LEN_LONG;
+        } else if (*p == 'z' || *p == 'j' || *p == 't') {
+            length = LEN_SIZE;
+            p++;
+        }
+
+        char conv = *p;
+        if (conv == '\0') {
+            // Lone '%' at the end: print what we saw
+            put_chars(&out, spec, (size_t)(p - spec));
+            break;
+        }
+        p++;
+
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                switch (length) {
+                    case LEN_CHAR:  value = (signed char)va_arg(args, int); break;
+                    case LEN_SHORT: value = (short)va_arg(args, int); break;
+                    case LEN_LONG:  value = va_arg(args, long); break;
+                    case LEN_LLONG: value = va_arg(args, long long); break;
+                    case LEN_SIZE:  value = va_arg(args, int64_t); break;
+                    default:        value = va_arg(args, int); break;
+                }
+                uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+                put_number(&out, magnitude, value < 0, conv, flags, width, precision);
+                break;
+            }
+
+            case 'X':
+                flags |= FLAG_UPPER;
+                // Fall through
+            case 'u':
+            case 'o':
+            case 'x': {
+                uint64_t value;
+                switch (length) {
+                    case LEN_CHAR:  value = (unsigned char)va_arg(args, unsigned int); break;
+                    case LEN_SHORT: value = (unsigned short)va_arg(args, unsigned int); break;
+                    case LEN_LONG:  value = va_arg(args, unsigned long); break;
+                    case LEN_LLONG: value = va_arg(args, unsigned long long); break;
+                    case LEN_SIZE:  value = va_arg(args, uint64_t); break;
+                    default:        value = va_arg(args, unsigned int); break;
+                }
+                put_number(&out, value, 0, conv, flags & ~(FLAG_PLUS | FLAG_SPACE), width, precision);
+                break;
+            }
+
+            case 'p': {
+                uint64_t value = (uint64_t)(uintptr_t)va_arg(args, void *);
+                put_number(&out, value, 0, conv, flags | FLAG_ALT, width, precision);
+                break;
+            }
 
-            if (column >= 80) {
-                column = 0;
-                row++;
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                put_field(&out, &c, 1, flags, width);
+                break;
             }
+
+            case 's': {
+                const char *string = va_arg(args, const char *);
+                if (string == NULL) {
+                    string = "(null)";
+                }
+                size_t len = precision >= 0 ? strnlen(string, (size_t)precision) : strlen(string);
+                put_field(&out, string, len, flags, width);
+                break;
+            }
+
+            case '%':
+                put_chars(&out, "%", 1);
+                break;
+
+            default:
+                // Unknown conversion: print it literally
+                put_chars(&out, spec, (size_t)(p - spec));
+                break;
         }
     }
 
-    sb->column = column;
-    sb->row = row;
+    if (size > 0) {
+        buffer[out.length < out.size ? out.length : out.size] = '\0';
+    }
+    return (int)out.length;
 }
 
 /**
- * printk: Formats and prints a string to the screen.
+ * snprintk: Formats a string into a caller buffer.
  *
- * @param format Format string with optional specifiers (e.g., %d, %x, %s, %llu).
- * @param ... Additional arguments matching the format specifiers.
- * @return The number of characters written to the screen.
+ * @param buffer Destination; always null-terminated if size > 0.
+ * @param size Size of the destination in bytes.
+ * @param format Format string.
+ * @param ... Arguments matching the format specifiers.
+ * @return The length the full output would have, like snprintf.
  */
-int printk(const char *format, ...) {
-    char buffer[1024];
-    int buffer_size = 0;
-    int64_t integer = 0;
-    char *string = 0;
-    uint64_t ull_integer = 0;
+int snprintk(char *buffer, size_t size, const char *format, ...) {
     va_list args;
 
     va_start(args, format);
-
-    for (int i = 0; format[i] != '\0'; i++) {
-        if (format[i] != '%') {
-            buffer[buffer_size++] = format[i];
-        } else {
-            switch (format[++i]) {
-                case 'x':
-                    integer = va_arg(args, int64_t);
-                    buffer_size += hex_to_string(buffer, buffer_size, (uint64_t)integer);
-                    break;
-
-                case 'u':
-                    integer = va_arg(args, int64_t);
-                    buffer_size += udecimal_to_string(buffer, buffer_size, (uint64_t)integer);
-                    break;
-
-                case 'd':
-                    integer = va_arg(args, int64_t);
-                    buffer_size += decimal_to_string(buffer, buffer_size, integer);
-                    break;
-
-                case 's':
-                    string = va_arg(args, char*);
-                    buffer_size += read_string(buffer, buffer_size, string);
-                    break;
-
-                case 'c':
-                    buffer[buffer_size++] = (char)va_arg(args, int);
-                    break;
-
-                case 'l':
-                    if (format[++i] == 'l') { // Handle '%llu'
-                        ull_integer = va_arg(args, uint64_t);
-                        buffer_size += hex64_to_string(buffer, buffer_size, ull_integer);
-                    } else {
-                        // Handle unknown specifier after 'l'
-                        buffer[buffer_size++] = '%';
-                        buffer[buffer_size++] = 'l';
-                        i--; // Re-evaluate current character
-                    }
-                    break;
-
-                default:
-                    buffer[buffer_size++] = '%';
-                    i--;
-            }
-        }
-    }
-
-    write_screen(buffer, buffer_size, &screen_buffer, 0xf); // Write to screen in white color
+    int length = vsnprintk(buffer, size, format, args);
     va_end(args);
 
-    return buffer_size;
+    return length;
 }
 
 /**
- * vprintk: Formats and prints a string to the screen using a va_list.
+ * vprintk_level: Formats a message and stores it in the kernel log.
+ * Output longer than LOG_LINE_MAX is cut and marked as truncated.
  *
- * @param format Format string with optional specifiers (e.g., %d, %x, %s, %llu).
+ * @param level log_level_t value, or LOG_LEVEL_RAW for no prefix.
+ * @param format Format string.
  * @param args Variable argument list.
- * @return The number of characters written to the screen.
+ * @return The number of characters stored.
  */
-int vprintk(const char *format, va_list args) {
-    char buffer[1024];
-    int buffer_size = 0;
-    int64_t integer = 0;
-    char *string = 0;
-    uint64_t ull_integer = 0;
-
-    // Create a copy of args to traverse
-    va_list args_copy;
-    va_copy(args_copy, args);
-
-    for (int i = 0; format[i] != '\0'; i++) {
-        if (format[i] != '%') {
-            buffer[buffer_size++] = format[i];
-        } else {
-            i++; // Move past '%'
-            // Parse flags
-            int zero_pad = 0;
-            if (format[i] == '0') {
-                zero_pad = 1;
-                i++;
-            }
-
-            // Parse width specifier
-            int width = 0;
-            while (format[i] >= '0' && format[i] <= '9') {
-                width = width * 10 + (format[i] - '0');
-                i++;
-            }
+int vprintk_level(int level, const char *format, va_list args) {
+    char buffer[LOG_LINE_MAX + 1];
+    int length = vsnprintk(buffer, sizeof(buffer), format, args);
+    int truncated = length > LOG_LINE_MAX;
 
-            // Parse specifier
-            switch (format[i]) {
-                case 'x':
-                case 'X': {
-                    integer = va_arg(args_copy, int64_t);
-                    char hex_buffer[25];
-                    hex_to_string(hex_buffer, 0, (uint64_t)integer);
-
-                    // Convert to uppercase if needed
-                    if (format[i] == 'X') {
-                        for (int j = 0; j < strlen(hex_buffer); j++) {
-                            if (hex_buffer[j] >= 'a' && hex_buffer[j] <= 'f') {
-                                hex_buffer[j] -= 32;
-                            }
-                        }
-                    }
-
-                    // Apply zero-padding if specified
-                    int len = strlen(hex_buffer);
-                    if (zero_pad && len < width) {
-                        for (int p = 0; p < width - len; p++) {
-                            buffer[buffer_size++] = '0';
-                        }
-                    }
-
-                    // Append to main buffer
-                    for (int j = 0; hex_buffer[j] != '\0'; j++) {
-                        buffer[buffer_size++] = hex_buffer[j];
-                    }
-                    break;
-                }
-
-                // Handle other specifiers (u, d, s, c, etc.) similarly
-                case 'u':
-                    integer = va_arg(args_copy, int64_t);
-                    char dec_buffer[25];
-                    udecimal_to_string(dec_buffer, 0, (uint64_t)integer);
-                    // Apply zero-padding if needed
-                    {
-                        int len = strlen(dec_buffer);
-                        if (zero_pad && len < width) {
-                            for (int p = 0; p < width - len; p++) {
-                                buffer[buffer_size++] = '0';
-                            }
-                        }
-                        for (int j = 0; dec_buffer[j] != '\0'; j++) {
-                            buffer[buffer_size++] = dec_buffer[j];
-                        }
-                    }
-                    break;
-
-                case 'd': {
-                    integer = va_arg(args_copy, int64_t);
-                    char dec_buffer[25];
-                    decimal_to_string(dec_buffer, 0, integer);
-                    // Apply zero-padding if needed (excluding negative sign)
-                    int start = 0;
-                    if (dec_buffer[0] == '-') {
-                        buffer[buffer_size++] = '-';
-                        start = 1;
-                    }
-                    int len = strlen(&dec_buffer[start]);
-                    if (zero_pad && len < width) {
-                        for (int p = 0; p < width - len; p++) {
-                            buffer[buffer_size++] = '0';
-                        }
-                    }
-                    for (int j = start; dec_buffer[j] != '\0'; j++) {
-                        buffer[buffer_size++] = dec_buffer[j];
-                    }
-                    break;
-                }
+    if (truncated) {
+        length = LOG_LINE_MAX;
+    }
+    log_store(level, buffer, (size_t)length, truncated);
 
-                case 's': {
-                    string = va_arg(args_copy, char*);
-                    // No padding for strings
-                    buffer_size += read_string(buffer, buffer_size, string);
-                    break;
-                }
+    return length;
+}
 
-                case 'c': {
-                    buffer[buffer_size++] = (char)va_arg(args_copy, int);
-                    break;
-                }
+/**
+ * vprintk: Formats and prints a string using a va_list.
+ *
+ * @param format Format string.
+ * @param args Variable argument list.
+ * @return The number of characters printed.
+ */
+int vprintk(const char *format, va_list args) {
+    return vprintk_level(LOG_LEVEL_RAW, format, args);
+}
 
-                default:
-                    // Handle unknown specifiers by printing them literally
-                    buffer[buffer_size++] = '%';
-                    if (zero_pad) buffer[buffer_size++] = '0';
-                    if (width > 0) {
-                        // Convert width back to characters
-                        char width_str[10];
-                        int w = width;
-                        int w_size = 0;
-                        while (w > 0) {
-                            width_str[w_size++] = '0' + (w % 10);
-                            w /= 10;
-                        }
-                        // Reverse and append
-                        for (int j = w_size - 1; j >= 0; j--) {
-                            buffer[buffer_size++] = width_str[j];
-                        }
-                    }
-                    buffer[buffer_size++] = format[i];
-                    break;
-            }
-        }
-    }
+/**
+ * printk: Formats and prints a string.
+ *
+ * @param format Format string.
+ * @param ... Arguments matching the format specifiers.
+ * @return The number of characters printed.
+ */
+int printk(const char *format, ...) {
+    va_list args;
 
-    write_screen(buffer, buffer_size, &screen_buffer, 0xf); // Write to screen in white color
-    va_end(args_copy);
+    va_start(args, format);
+    int length = vprintk_level(LOG_LEVEL_RAW, format, args);
+    va_end(args);
 
-    return buffer_size;
+    return length;
 }
-
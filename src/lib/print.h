@@ -2,45 +2,66 @@
 #define _PRINT_H_
 
 #include <stdarg.h>
+#include <stddef.h>
 #include "lib.h"
 
 /**
- * LINE_SIZE: Defines the number of characters in a single line of the screen buffer.
- * Typically used for managing text rendering in a fixed-width screen layout.
+ * PRINTF_FORMAT: Lets the compiler check format strings against their
+ * arguments (-Wformat). `fmt` is the index of the format parameter, `args`
+ * the index of the first variadic argument (0 for va_list functions).
  */
-#define LINE_SIZE 160
+#define PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
 
 /**
- * ScreenBuffer: Represents a simple text-based screen buffer for managing output.
+ * printk: Formats a string and writes it to the kernel log.
+ * Uses the standard printf conversions (see print.c).
  *
- * @field buffer Pointer to the memory holding the screen content.
- * @field column Current column position in the buffer.
- * @field row Current row position in the buffer.
+ * @param format A format string specifying how to format the output.
+ * @param ... Additional arguments corresponding to the format specifiers.
+ * @return The number of characters printed.
+ */
+int printk(const char *format, ...) PRINTF_FORMAT(1, 2);
+
+/**
+ * vprintk: Formats a string and writes it to the kernel log using a va_list.
+ *
+ * @param format A format string specifying how to format the output.
+ * @param args A va_list containing the arguments corresponding to the format specifiers.
+ * @return The number of characters printed.
+ */
+int vprintk(const char *format, va_list args) PRINTF_FORMAT(1, 0);
+
+/**
+ * vprintk_level: Like vprintk, but tags the message with a log level so the
+ * flusher can add the matching prefix.
+ *
+ * @param level A log_level_t value, or LOG_LEVEL_RAW for plain output.
+ * @param format A format string specifying how to format the output.
+ * @param args A va_list containing the arguments corresponding to the format specifiers.
+ * @return The number of characters stored in the log.
  */
-struct ScreenBuffer {
-    char* buffer;  ///< Pointer to the screen buffer memory.
-    int column;    ///< Current column position for text rendering.
-    int row;       ///< Current row position for text rendering.
-};
+int vprintk_level(int level, const char *format, va_list args) PRINTF_FORMAT(2, 0);
 
 /**
- * printk: Formats and prints a string to the screen.
- * Similar to printf but optimized for kernel or low-level output.
+ * snprintk: Formats a string into a buffer, like snprintf.
  *
+ * @param buffer Destination buffer; null-terminated whenever size > 0.
+ * @param size Size of the destination buffer in bytes.
  * @param format A format string specifying how to format the output.
  * @param ... Additional arguments corresponding to the format specifiers.
- * @return The number of characters printed, or a negative value if an error occurs.
+ * @return The length of the complete output; a value >= size means it was cut.
  */
-int printk(const char *format, ...);
+int snprintk(char *buffer, size_t size, const char *format, ...) PRINTF_FORMAT(3, 4);
 
 /**
- * vprintk: Formats and prints a string to the screen using a va_list.
- * Similar to vprintf but optimized for kernel or low-level output.
+ * vsnprintk: Formats a string into a buffer using a va_list, like vsnprintf.
  *
+ * @param buffer Destination buffer; null-terminated whenever size > 0.
+ * @param size Size of the destination buffer in bytes.
  * @param format A format string specifying how to format the output.
  * @param args A va_list containing the arguments corresponding to the format specifiers.
- * @return The number of characters printed, or a negative value if an error occurs.
+ * @return The length of the complete output; a value >= size means it was cut.
  */
-int vprintk(const char *format, va_list args);
+int vsnprintk(char *buffer, size_t size, const char *format, va_list args) PRINTF_FORMAT(3, 0);
 
 #endif  // _PRINT_H_
@@ -0,0 +1,257 @@
+#include "serial.h"
+#include "log.h"
+#include "io.h"
+#include "irqflags.h"
+#include "print.h"
+#include "spinlock.h"
+
+// ----------------------------------------------------------------------------
+//  serial.c
+// ----------------------------------------------------------------------------
+//  16550 UART driver for COM1, used as a kernel log sink.
+//
+//  Text is copied into a transmit queue. The UART is fed 16 bytes at a
+//  time, which fills its FIFO. When the FIFO runs empty it raises a THRE
+//  interrupt (IRQ4), and the handler sends the next 16 bytes. Nobody waits
+//  on the UART byte by byte.
+//
+//  Interrupts are still off early in boot. Until the first THRE interrupt
+//  has been seen, and whenever the caller has interrupts disabled,
+//  serial_write() drains the queue itself: it waits for the FIFO to empty,
+//  then sends the next 16 bytes. Otherwise it only waits when the queue is
+//  full.
+//
+//  Any CPU may write, and the THRE interrupt may arrive on another CPU
+//  than the writer's. writer_lock keeps writers' text from interleaving;
+//  it is an MCS lock because a writer can hold it for as long as the
+//  UART takes to make room. tx_lock covers feeding the UART (txq_tail).
+// ----------------------------------------------------------------------------
+
+// Register offsets from the base port
+#define UART_DATA       0    // RBR/THR (DLL when DLAB=1)
+#define UART_IER        1    // Interrupt enable (DLM when DLAB=1)
+#define UART_IIR        2    // Interrupt identification (read)
+#define UART_FCR        2    // FIFO control (write)
+#define UART_LCR        3    // Line control
+#define UART_MCR        4    // Modem control
+#define UART_LSR        5    // Line status
+#define UART_MSR        6    // Modem status
+#define UART_SCRATCH    7
+
+#define IER_THRE        0x02 // Interrupt when the transmit FIFO is empty
+#define LCR_8N1         0x03
+#define LCR_DLAB        0x80
+#define FCR_ENABLE      0xC7 // Enable and clear FIFOs, 14-byte RX trigger
+#define MCR_OUT2        0x0B // DTR | RTS | OUT2 (OUT2 gates the IRQ line)
+#define LSR_THRE        0x20 // Transmit FIFO empty
+#define LSR_TEMT        0x40 // Transmit FIFO and shift register empty
+
+#define IIR_NONE        0x01 // No interrupt pending
+#define IIR_ID_MASK     0x0E
+#define IIR_MODEM       0x00
+#define IIR_THRE        0x02
+#define IIR_RX_DATA     0x04
+#define IIR_LINE        0x06
+#define IIR_RX_TIMEOUT  0x0C
+
+#define PIC1_DATA       0x21
+
+#define TXQ_MASK        (SERIAL_TXQ_SIZE - 1)
+
+static const uint16_t port = SERIAL_COM1_PORT;
+
+static char txq[SERIAL_TXQ_SIZE];
+static uint32_t txq_head;        // Next byte to queue (written by serial_write)
+static uint32_t txq_tail;        // Next byte to send (written by tx_fill)
+static int irq_driven;           // Set once a THRE interrupt has arrived
+static int present;              // Set once a UART has been found
+static struct McsLock writer_lock;
+static struct Spinlock tx_lock;
+
+static struct LogSink serial_sink = { "serial", serial_write, NULL };
+
+/**
+ * @brief Moves up to one FIFO's worth of queued bytes to the UART.
+ *
+ * Only call when the FIFO is empty (LSR.THRE set or a THRE interrupt),
+ * with tx_lock held and interrupts disabled.
+ */
+static void tx_fill(void) {
+    uint32_t tail = txq_tail;
+    uint32_t head = __atomic_load_n(&txq_head, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < SERIAL_FIFO_SIZE && tail != head; i++) {
+        outb(port + UART_DATA, (uint8_t)txq[tail & TXQ_MASK]);
+        tail++;
+    }
+
+    __atomic_store_n(&txq_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Sends the next burst if the FIFO is empty.
+ */
+static void tx_kick(void) {
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+
+    if (inb(port + UART_LSR) & LSR_THRE) {
+        tx_fill();
+    }
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+/**
+ * @brief Waits for the FIFO to empty and sends the next burst.
+ */
+static void tx_poll_burst(void) {
+    while (!(inb(port + UART_LSR) & LSR_THRE)) {
+        __asm__ volatile ("pause");
+    }
+    tx_kick();
+}
+
+/**
+ * @brief Appends one byte to the transmit queue, making room if needed.
+ */
+static void txq_put(char c) {
+    while (txq_head - __atomic_load_n(&txq_tail, __ATOMIC_ACQUIRE) >= SERIAL_TXQ_SIZE) {
+        tx_poll_burst();
+    }
+
+    txq[txq_head & TXQ_MASK] = c;
+    __atomic_store_n(&txq_head, txq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Queues text for transmission on COM1.
+ */
+void serial_write(const char *text, size_t length) {
+    struct McsNode node;
+
+    if (!present) {
+        return;
+    }
+
+    // No interrupt has come in yet, or none can arrive now, so nothing
+    // else will send the rest
+    int drain = !irq_driven || !irqs_enabled();
+    uint64_t flags = mcs_lock_irqsave(&writer_lock, &node);
+
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            txq_put('\r');
+        }
+        txq_put(text[i]);
+    }
+
+    mcs_unlock_irqrestore(&writer_lock, &node, flags);
+    tx_kick();
+
+    if (drain) {
+        while (txq_tail != txq_head) {
+            tx_poll_burst();
+        }
+    }
+}
+
+/**
+ * @brief Sends everything queued and waits until the UART is idle.
+ */
+void serial_drain(void) {
+    if (!present) {
+        return;
+    }
+
+    while (txq_tail != txq_head) {
+        tx_poll_burst();
+    }
+    while (!(inb(port + UART_LSR) & LSR_TEMT)) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/**
+ * @brief Formats one line and queues it on COM1, bypassing the log.
+ */
+int serial_printk(const char *format, ...) {
+    char line[LOG_LINE_MAX];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintk(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length > (int)sizeof(line) - 1) {
+        length = (int)sizeof(line) - 1;
+    }
+    serial_write(line, (size_t)length);
+    return length;
+}
+
+/**
+ * @brief IRQ4 handler body: refills the transmit FIFO.
+ */
+void serial_interrupt(void) {
+    uint8_t iir;
+
+    // Reading IIR acknowledges a THRE interrupt; loop until none is pending
+    while (!((iir = inb(port + UART_IIR)) & IIR_NONE)) {
+        switch (iir & IIR_ID_MASK) {
+            case IIR_THRE:
+                irq_driven = 1;
+                spin_lock(&tx_lock);
+                tx_fill();
+                spin_unlock(&tx_lock);
+                break;
+
+            case IIR_RX_DATA:
+            case IIR_RX_TIMEOUT:
+                inb(port + UART_DATA);      // No input handling yet
+                break;
+
+            case IIR_LINE:
+                inb(port + UART_LSR);
+                break;
+
+            default:
+                inb(port + UART_MSR);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Programs COM1 and registers it as a log sink.
+ */
+void init_serial_console(void) {
+    present = 0;
+
+    // No UART here if the scratch register doesn't hold a value
+    outb(port + UART_SCRATCH, 0xA5);
+    if (inb(port + UART_SCRATCH) != 0xA5) {
+        return;
+    }
+
+    outb(port + UART_IER, 0);
+    outb(port + UART_LCR, LCR_DLAB);
+    outb(port + UART_DATA, 1);               // Divisor 1 => 115200 baud
+    outb(port + UART_IER, 0);
+    outb(port + UART_LCR, LCR_8N1);
+    outb(port + UART_FCR, FCR_ENABLE);
+    outb(port + UART_MCR, MCR_OUT2);
+
+    mcs_lock_init(&writer_lock, "serial writer");
+    spin_lock_init(&tx_lock, "serial tx");
+    txq_head = 0;
+    txq_tail = 0;
+    irq_driven = 0;
+    present = 1;
+
+    outb(port + UART_IER, IER_THRE);
+
+    // Unmask IRQ4 on the master PIC
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << SERIAL_COM1_IRQ));
+
+    log_register_sink(&serial_sink);
+}
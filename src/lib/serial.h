@@ -0,0 +1,59 @@
+#ifndef _SERIAL_H_
+#define _SERIAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "print.h"
+
+/**
+ * COM1 resources.
+ */
+#define SERIAL_COM1_PORT   0x3F8
+#define SERIAL_COM1_IRQ    4
+
+/**
+ * SERIAL_FIFO_SIZE: Depth of the 16550 transmit FIFO.
+ * SERIAL_TXQ_SIZE: Size of the software transmit queue (power of two).
+ */
+#define SERIAL_FIFO_SIZE   16
+#define SERIAL_TXQ_SIZE    (16 * 1024)
+
+/**
+ * init_serial_console: Programs COM1 for 115200 8N1 with FIFOs, enables
+ * its transmit interrupt and registers it as a kernel log sink. Does
+ * nothing if no UART answers at COM1.
+ */
+void init_serial_console(void);
+
+/**
+ * serial_write: Queues text for transmission on COM1.
+ *
+ * Does nothing if init_serial_console() found no UART.
+ *
+ * @param text Bytes to send; '\n' is sent as "\r\n".
+ * @param length Number of bytes.
+ */
+void serial_write(const char *text, size_t length);
+
+/**
+ * serial_drain: Sends everything queued by polling and waits until the
+ * last bit has left the UART. For use before the machine is stopped.
+ */
+void serial_drain(void);
+
+/**
+ * serial_printk: Formats text (at most LOG_LINE_MAX - 1 bytes) and queues
+ * it on COM1 directly, bypassing the kernel log. For bulk machine-readable
+ * dumps that would overrun the log ring or scroll the VGA console.
+ *
+ * @return Number of bytes queued.
+ */
+int serial_printk(const char *format, ...) PRINTF_FORMAT(1, 2);
+
+/**
+ * serial_interrupt: IRQ4 handler body. Refills the transmit FIFO from the
+ * queue. The caller sends the EOI.
+ */
+void serial_interrupt(void);
+
+#endif  // _SERIAL_H_
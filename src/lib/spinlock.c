@@ -0,0 +1,255 @@
+#include "spinlock.h"
+#include "print.h"
+
+// ----------------------------------------------------------------------------
+//  spinlock.c
+// ----------------------------------------------------------------------------
+//  Slow paths of the spinning locks, and lock statistics.
+//
+//  Ticket lock: spin_lock() takes a ticket with one atomic add and only
+//  calls in here when it isn't served at once. Every waiter polls the
+//  same `owner` word, so each release is seen by all of them; that is
+//  cheap with a few CPUs and the reason for the MCS lock.
+//
+//  MCS lock: a waiter swaps its node into `tail` and links itself behind
+//  the previous tail, then spins on its own node's `locked` flag. The
+//  holder hands over by clearing its successor's flag. A holder with no
+//  successor yet resets `tail` with a CAS, or waits for the successor
+//  that is in the middle of linking itself.
+//
+//  Lock statistics (LOCK_STATS) are updated by the holder, inside the
+//  critical section, except for readers, which share the lock and use
+//  atomic adds.
+// ----------------------------------------------------------------------------
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+/**
+ * @brief Waits for a ticket.
+ */
+void spin_lock_wait(struct Spinlock *lock, uint16_t ticket) {
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        cpu_relax();
+    }
+}
+
+/**
+ * @brief Takes an MCS lock, queueing behind the current tail.
+ */
+void mcs_lock(struct McsLock *lock, struct McsNode *node) {
+    node->next = NULL;
+    node->locked = 1;
+
+    struct McsNode *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), prev != NULL, 1);
+}
+
+/**
+ * @brief Takes an MCS lock if the queue is empty.
+ */
+int mcs_trylock(struct McsLock *lock, struct McsNode *node) {
+    struct McsNode *expected = NULL;
+
+    node->next = NULL;
+    node->locked = 0;
+    if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), 0, 1);
+    return 1;
+}
+
+/**
+ * @brief Releases an MCS lock to the next waiter.
+ */
+void mcs_unlock(struct McsLock *lock, struct McsNode *node) {
+    struct McsNode *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    lock_stats_released(LOCK_STATS_OF(lock));
+    if (next == NULL) {
+        struct McsNode *expected = node;
+
+        // Nobody queued: the lock is free again
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // A waiter swapped itself in but hasn't linked to us yet
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Adds a reader unless a writer holds or waits for the lock.
+ */
+int read_trylock(struct RwLock *lock) {
+    uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+    if (value & (RWLOCK_WRITER | RWLOCK_WAITING)) {
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&lock->value, &value, value + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), 0, 0);
+    return 1;
+}
+
+/**
+ * @brief Adds a reader, waiting while a writer holds or waits.
+ */
+void read_lock(struct RwLock *lock) {
+    int contended = 0;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+        if (!(value & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+            if (__atomic_compare_exchange_n(&lock->value, &value, value + 1, 0, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+        contended = 1;
+        cpu_relax();
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), contended, 0);
+}
+
+/**
+ * @brief Takes the lock for writing if it is free.
+ */
+int write_trylock(struct RwLock *lock) {
+    uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+    if ((value & ~RWLOCK_WAITING) != 0) {
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), 0, 1);
+    return 1;
+}
+
+/**
+ * @brief Takes the lock for writing. While waiting, RWLOCK_WAITING keeps
+ * new readers out so the current ones drain.
+ */
+void write_lock(struct RwLock *lock) {
+    int contended = 0;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+        // Free (perhaps with other writers waiting): taking it clears
+        // WAITING, and those writers set it again as they keep spinning
+        if ((value & ~RWLOCK_WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+        if (!(value & RWLOCK_WAITING)) {
+            __atomic_fetch_or(&lock->value, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        }
+        contended = 1;
+        cpu_relax();
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), contended, 1);
+}
+
+// ----------------------------------------------------------------------------
+//  Statistics
+// ----------------------------------------------------------------------------
+
+#ifdef LOCK_STATS
+
+// Locks register from the first init functions on; .bss is cleared by the
+// loader, so this starts out empty without an init call
+static struct LockStats *registered;
+
+static inline uint64_t read_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief Clears a lock's counters and adds it to the dump list.
+ */
+void lock_stats_register(struct LockStats *stats, const char *name) {
+    stats->name = name;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->hold_cycles = 0;
+    stats->max_hold_cycles = 0;
+    stats->acquired_tsc = 0;
+
+    stats->next = __atomic_load_n(&registered, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&registered, &stats->next, stats, 0, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Counts an acquisition; exclusive holders also start the clock.
+ */
+void lock_stats_acquired(struct LockStats *stats, int contended, int exclusive) {
+    if (!exclusive) {
+        __atomic_fetch_add(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+        if (contended) {
+            __atomic_fetch_add(&stats->contended, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    stats->acquisitions++;
+    stats->contended += contended != 0;
+    stats->acquired_tsc = read_tsc();
+}
+
+/**
+ * @brief Adds the hold time of an exclusive holder about to release.
+ */
+void lock_stats_released(struct LockStats *stats) {
+    uint64_t held = read_tsc() - stats->acquired_tsc;
+
+    stats->hold_cycles += held;
+    if (held > stats->max_hold_cycles) {
+        stats->max_hold_cycles = held;
+    }
+}
+
+/**
+ * @brief Prints every registered lock that has been taken.
+ */
+void lock_stats_dump(void) {
+    printk("Locks: acquisitions, contended, average / max hold (TSC cycles)\n");
+    for (struct LockStats *s = __atomic_load_n(&registered, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+        if (s->acquisitions == 0) {
+            continue;
+        }
+        printk("  %-16s %10lu %8lu %8lu %10lu\n", s->name, s->acquisitions, s->contended,
+               s->hold_cycles / s->acquisitions, s->max_hold_cycles);
+    }
+}
+
+#else
+
+void lock_stats_dump(void) {
+}
+
+#endif  // LOCK_STATS
@@ -0,0 +1,295 @@
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "irqflags.h"
+
+/**
+ * Spinning locks for kernel data shared between CPUs and interrupt
+ * handlers. None of them sleep, and none may be taken recursively.
+ *
+ * - Spinlock: ticket lock. Waiters are served in arrival order. Fine
+ *   for short, lightly contended sections.
+ * - McsLock: queue lock. Each waiter spins on its own McsNode (usually
+ *   on the caller's stack), so a release only touches the next waiter's
+ *   cache line. Use it where many CPUs wait at once.
+ * - RwLock: readers share the lock, writers have it alone. A waiting
+ *   writer holds off new readers, so writers aren't starved.
+ *
+ * Data also used by interrupt handlers must be locked with the _irqsave
+ * variants, which disable interrupts on this CPU for the critical
+ * section and return the previous RFLAGS for the matching _irqrestore.
+ *
+ * Every lock has an init function, to be called once before first use.
+ */
+
+/**
+ * LockStats: Per-lock counters, kept when the kernel is built with
+ * LOCK_STATS (scripts/bnr.sh --debug) and printed by lock_stats_dump().
+ *
+ * @field name Name given to the init function.
+ * @field acquisitions Times the lock was taken.
+ * @field contended Acquisitions that had to wait.
+ * @field hold_cycles TSC cycles the lock was held in total (exclusive
+ *        holders only; readers are counted but not timed).
+ * @field max_hold_cycles Longest single hold.
+ * @field acquired_tsc When the current exclusive holder took the lock.
+ * @field next Next registered lock.
+ */
+struct LockStats {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+    uint64_t acquired_tsc;
+    struct LockStats *next;
+};
+
+/**
+ * Spinlock: ticket lock.
+ *
+ * @field next Next ticket to hand out.
+ * @field owner Ticket being served; the lock is free when owner == next.
+ */
+struct Spinlock {
+    uint16_t next;
+    uint16_t owner;
+#ifdef LOCK_STATS
+    struct LockStats stats;
+#endif
+};
+
+/**
+ * McsNode: One waiter's place in an McsLock queue. It must stay valid
+ * until the matching unlock.
+ */
+struct McsNode {
+    struct McsNode *next;
+    uint32_t locked;
+};
+
+/**
+ * McsLock: queue lock.
+ *
+ * @field tail Last waiter (or the holder); NULL when free.
+ */
+struct McsLock {
+    struct McsNode *tail;
+#ifdef LOCK_STATS
+    struct LockStats stats;
+#endif
+};
+
+/**
+ * RwLock: reader-writer lock.
+ *
+ * @field value Reader count, plus RWLOCK_WRITER while a writer holds it
+ *        and RWLOCK_WAITING while a writer waits.
+ */
+#define RWLOCK_WRITER   (1u << 31)
+#define RWLOCK_WAITING  (1u << 30)
+
+struct RwLock {
+    uint32_t value;
+#ifdef LOCK_STATS
+    struct LockStats stats;
+#endif
+};
+
+// ----------------------------------------------------------------------------
+//  Statistics hooks (nothing without LOCK_STATS)
+// ----------------------------------------------------------------------------
+
+#ifdef LOCK_STATS
+void lock_stats_register(struct LockStats *stats, const char *name);
+void lock_stats_acquired(struct LockStats *stats, int contended, int exclusive);
+void lock_stats_released(struct LockStats *stats);
+#define LOCK_STATS_OF(lock) (&(lock)->stats)
+#else
+#define lock_stats_register(stats, name)                ((void)(name))
+#define lock_stats_acquired(stats, contended, exclusive) ((void)(contended))
+#define lock_stats_released(stats)                      ((void)0)
+#define LOCK_STATS_OF(lock) ((struct LockStats *)0)
+#endif
+
+/**
+ * @brief Prints the counters of every registered lock (LOCK_STATS
+ * builds; prints nothing otherwise).
+ */
+void lock_stats_dump(void);
+
+// ----------------------------------------------------------------------------
+//  Ticket lock
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Slow path of spin_lock(): waits for `ticket` to be served.
+ */
+void spin_lock_wait(struct Spinlock *lock, uint16_t ticket);
+
+/**
+ * @brief Prepares a free lock. `name` is shown by lock_stats_dump().
+ */
+static inline void spin_lock_init(struct Spinlock *lock, const char *name) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock_stats_register(LOCK_STATS_OF(lock), name);
+}
+
+/**
+ * @brief Takes a ticket and waits for it to come up.
+ */
+static inline void spin_lock(struct Spinlock *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    int contended = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket;
+
+    if (contended) {
+        spin_lock_wait(lock, ticket);
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), contended, 1);
+}
+
+/**
+ * @brief Takes the lock only if it is free.
+ * @return 1 if taken, 0 otherwise.
+ */
+static inline int spin_trylock(struct Spinlock *lock) {
+    uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    uint16_t expected = owner;
+
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, (uint16_t)(owner + 1), 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stats_acquired(LOCK_STATS_OF(lock), 0, 1);
+    return 1;
+}
+
+/**
+ * @brief Serves the next ticket.
+ */
+static inline void spin_unlock(struct Spinlock *lock) {
+    lock_stats_released(LOCK_STATS_OF(lock));
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief spin_lock() with interrupts disabled until the matching
+ * spin_unlock_irqrestore(). Returns the previous RFLAGS.
+ */
+static inline uint64_t spin_lock_irqsave(struct Spinlock *lock) {
+    uint64_t flags = irq_save();
+
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct Spinlock *lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+// ----------------------------------------------------------------------------
+//  MCS lock
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Prepares a free lock. `name` is shown by lock_stats_dump().
+ */
+static inline void mcs_lock_init(struct McsLock *lock, const char *name) {
+    lock->tail = NULL;
+    lock_stats_register(LOCK_STATS_OF(lock), name);
+}
+
+/**
+ * @brief Queues `node` and waits for the lock.
+ */
+void mcs_lock(struct McsLock *lock, struct McsNode *node);
+
+/**
+ * @brief Takes the lock only if nobody holds or waits for it.
+ * @return 1 if taken, 0 otherwise.
+ */
+int mcs_trylock(struct McsLock *lock, struct McsNode *node);
+
+/**
+ * @brief Releases the lock taken with `node`, handing it to the next
+ * waiter if there is one.
+ */
+void mcs_unlock(struct McsLock *lock, struct McsNode *node);
+
+static inline uint64_t mcs_lock_irqsave(struct McsLock *lock, struct McsNode *node) {
+    uint64_t flags = irq_save();
+
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(struct McsLock *lock, struct McsNode *node, uint64_t flags) {
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+}
+
+// ----------------------------------------------------------------------------
+//  Reader-writer lock
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Prepares a free lock. `name` is shown by lock_stats_dump().
+ */
+static inline void rwlock_init(struct RwLock *lock, const char *name) {
+    lock->value = 0;
+    lock_stats_register(LOCK_STATS_OF(lock), name);
+}
+
+/**
+ * @brief Take the lock shared (read) or alone (write), waiting as long
+ * as needed.
+ */
+void read_lock(struct RwLock *lock);
+void write_lock(struct RwLock *lock);
+
+/**
+ * @brief Take the lock only if that needs no waiting.
+ * @return 1 if taken, 0 otherwise.
+ */
+int read_trylock(struct RwLock *lock);
+int write_trylock(struct RwLock *lock);
+
+static inline void read_unlock(struct RwLock *lock) {
+    __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+}
+
+static inline void write_unlock(struct RwLock *lock) {
+    lock_stats_released(LOCK_STATS_OF(lock));
+    // Keeps RWLOCK_WAITING: another writer may be waiting
+    __atomic_fetch_and(&lock->value, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t read_lock_irqsave(struct RwLock *lock) {
+    uint64_t flags = irq_save();
+
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(struct RwLock *lock, uint64_t flags) {
+    read_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline uint64_t write_lock_irqsave(struct RwLock *lock) {
+    uint64_t flags = irq_save();
+
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(struct RwLock *lock, uint64_t flags) {
+    write_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif  // _SPINLOCK_H_
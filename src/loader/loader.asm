@@ -48,54 +48,41 @@ start:
     test edx, 0x04000000
     jz  NoSSE2Support
 
-LoadKernelExtended:
-    ; ------------------------------------------------------------------------
-    ; 3) Read kernel from disk (INT 0x13 AH=0x42 - Extended Read)
-    ; ------------------------------------------------------------------------
-    mov si, ReadPacket
-    mov word [si], 0x10         ; Number of sectors to read (0x10 = 16)
-    mov word [si + 2], 100      ; Size of packet (some BIOSes ignore)
-    mov word [si + 4], 0        ; Reserved
-    mov word [si + 6], 0x1000   ; Destination offset in memory (within DS)
-    mov dword [si + 8], 6       ; LBA (low 32 bits)
-    mov dword [si + 0xC], 0     ; LBA (high 32 bits)
-    mov dl, [BootDrive]         ; Restore the saved drive ID
-    mov ah, 0x42                ; Extended read
-    int 0x13
-    jc  DiskReadError           ; Jump if read failed (carry set)
-
 GetE820MemoryMap:
     ; ------------------------------------------------------------------------
-    ; 4) E820 memory detection
+    ; 3) E820 memory detection
+    ;    Entries are stored at 0x9000 and counted in BootInfo for the kernel.
     ; ------------------------------------------------------------------------
-    mov eax, 0xE820
-    mov edx, 0x534D4150         ; 'SMAP' signature
-    mov ecx, 20                 ; Size of the E820 buffer
-    mov edi, 0x9000             ; Store the map at 0x9000
+    xor ax, ax
+    mov es, ax                  ; ES:DI = 0:0x9000
+    mov edi, E820_MAP
     xor ebx, ebx                ; Continuation value
-    int 0x15
-    jc  NoMemoryInfoSupport     ; If CF=1, E820 not supported
 
-ContinueE820:
-    add edi, 20                 ; Move pointer to next memory map entry
+NextE820:
     mov eax, 0xE820
-    mov edx, 0x534D4150
-    mov ecx, 20
+    mov edx, 0x534D4150         ; 'SMAP' signature
+    mov ecx, E820_ENTRY_SIZE    ; Size of the E820 buffer
     int 0x15
-    jc  E820Done
+    jc  E820Done                ; CF=1: no more entries (or no E820)
+    cmp eax, 0x534D4150
+    jne E820Done
 
-    test ebx, ebx
-    jnz ContinueE820
+    add edi, E820_ENTRY_SIZE    ; Keep the entry
+    inc dword [BootInfoE820Count]
+    cmp dword [BootInfoE820Count], E820_MAX
+    jae E820Done
+
+    test ebx, ebx               ; EBX=0: that was the last entry
+    jnz NextE820
 
 E820Done:
-    ; Print message that kernel loaded & memory fetch done
-    mov si, SuccessMessage
-    call PrintMessage
-    call NextLine
+    cmp dword [BootInfoE820Count], 0
+    je  NoMemoryInfoSupport
 
 CheckA20Line:
     ; ------------------------------------------------------------------------
-    ; 5) Quick A20 line test (simple check)
+    ; 4) Quick A20 line test (simple check). The kernel is copied above
+    ;    1 MB, so this comes before loading it.
     ; ------------------------------------------------------------------------
     mov ax, 0xFFFF
     mov es, ax
@@ -113,6 +100,68 @@ EnableA20Message:
     call PrintMessage
     call NextLine
 
+LoadKernelExtended:
+    ; ------------------------------------------------------------------------
+    ; 5) Read the kernel from disk (INT 0x13 AH=0x42 - Extended Read)
+    ;    Its first sector holds the kernel header (struct KernelHeader in
+    ;    bootinfo.h). The image is then read in chunks of up to 127
+    ;    sectors into the transfer buffer, each copied straight on to its
+    ;    link address through unreal mode.
+    ; ------------------------------------------------------------------------
+    mov dword [KernelLba], KERNEL_LBA
+    mov ax, 1
+    call ReadSectors
+
+    mov ax, KERNEL_BUFFER_SEG
+    mov fs, ax
+    cmp dword [fs:KHDR_MAGIC], KERNEL_MAGIC
+    jne BadKernelHeader
+    mov eax, [fs:KHDR_LOAD]
+    mov [KernelDest], eax
+    mov ecx, [fs:KHDR_IMAGE_END]
+    mov [KernelBssStart], ecx
+    sub ecx, eax                ; Image size in bytes
+    jbe BadKernelHeader
+    add ecx, 511
+    shr ecx, 9
+    mov [KernelSectorsLeft], ecx
+    mov eax, [fs:KHDR_BSS_END]
+    mov [KernelBssEnd], eax
+    mov eax, [fs:KHDR_ENTRY]
+    mov [KernelEntry], eax
+
+.NextChunk:
+    mov eax, [KernelSectorsLeft]
+    test eax, eax
+    jz  .Loaded
+    cmp eax, 127                ; 127 sectors is the most BIOSes take
+    jbe .Read
+    mov eax, 127
+.Read:
+    mov [ChunkSectors], ax
+    call ReadSectors
+
+    ; Copy the chunk with 32-bit offsets (DS = ES = 0, 4 GB limits)
+    call EnterUnrealMode
+    cld
+    mov esi, KERNEL_BUFFER
+    mov edi, [KernelDest]
+    movzx ecx, word [ChunkSectors]
+    shl ecx, 7                  ; 512-byte sectors in dwords
+    a32 rep movsd
+    mov [KernelDest], edi
+
+    movzx eax, word [ChunkSectors]
+    add [KernelLba], eax
+    sub [KernelSectorsLeft], eax
+    jmp .NextChunk
+
+.Loaded:
+    ; Print message that kernel loaded & memory fetch done
+    mov si, SuccessMessage
+    call PrintMessage
+    call NextLine
+
 EnterProtectedMode:
     ; ------------------------------------------------------------------------
     ; 6) Set simple text mode, then jump into protected mode
@@ -160,10 +209,53 @@ DiskReadError:
     call PrintMessage
     jmp JumpToEnd
 
+BadKernelHeader:
+    mov si, KernelHeaderMsg
+    call PrintMessage
+    jmp JumpToEnd
+
 ; ----------------------------------------------------------------------------
 ;  SUBROUTINES (16-bit)
 ; ----------------------------------------------------------------------------
 
+ReadSectors:
+    ; Read AX sectors from LBA [KernelLba] into the transfer buffer
+    mov si, ReadPacket
+    mov word [si], 0x10         ; Packet size
+    mov [si + 2], ax            ; Sectors to read
+    mov word [si + 4], 0        ; Destination offset
+    mov word [si + 6], KERNEL_BUFFER_SEG ; Destination segment
+    mov eax, [KernelLba]
+    mov [si + 8], eax           ; LBA (low 32 bits)
+    mov dword [si + 0xC], 0     ; LBA (high 32 bits)
+    mov dl, [BootDrive]         ; Restore the saved drive ID
+    mov ah, 0x42                ; Extended read
+    int 0x13
+    jc  DiskReadError           ; Jump if read failed (carry set)
+    ret
+
+EnterUnrealMode:
+    ; Load DS and ES in protected mode with 4 GB limits and go back to real
+    ; mode, which keeps the limits: 32-bit offsets then reach all memory.
+    ; BIOS calls may reset the limits, so this runs after each one
+    cli
+    lgdt [Gdt32Ptr]
+    mov eax, cr0
+    or al, 1                    ; PE
+    mov cr0, eax
+    jmp $ + 2
+    mov bx, 0x10                ; Data32: base 0, 4 GB
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    jmp $ + 2
+    xor bx, bx
+    mov ds, bx
+    mov es, bx
+    sti
+    ret
+
 NextLine:
     ; Move the cursor down one line
     mov ah, 0x03     ; BIOS: read cursor position
@@ -237,6 +329,7 @@ ProtectedModeEntry:
     ; Simple page table setup, or set up for 64-bit transition
     mov dword [0x80000], 0x81007        ; PDE/PTE example
     mov dword [0x81000], 10000111b      ; PDE bits, etc.
+    mov dword [0x81018], 0xC000009F     ; 3-4 GB: APIC MMIO, 1 GB page, uncached
 
     lgdt [Gdt64Ptr]                     ; Prepare 64-bit GDT
 
@@ -278,13 +371,17 @@ LongModeEntry:
     ; ------------------------------------------------------------------------
     mov rsp, 0x7C00
 
+    ; The image is in place; clear its .bss
     cld
-    mov rdi, 0x200000
-    mov rsi, 0x10000
-    mov rcx, 51200 / 8
-    rep movsq
+    mov edi, [KernelBssStart]
+    mov ecx, [KernelBssEnd]
+    sub ecx, edi
+    xor eax, eax
+    rep stosb
 
-    jmp 0x200000
+    mov rdi, BootInfo           ; KMain's argument (kernel.asm passes it on)
+    mov eax, [KernelEntry]
+    jmp rax
 
 LongModeEnd:
     hlt
@@ -302,6 +399,7 @@ A20LineSetMsg:          db "A20 line is set.", 0
 
 ; --- Error messages ---
 DiskReadErrorMsg:       db "Error reading disk.", 0
+KernelHeaderMsg:        db "No kernel header.", 0
 ExtFuncsNotSupported:   db "Extended functions not supported.", 0
 LongModeNotSupported:   db "Long mode not supported.", 0
 SSE2NotSupported:       db "SSE2 not supported.", 0
@@ -313,6 +411,38 @@ ReadPacket: times 16 db 0
 ; --- BIOS Drive Number ---
 BootDrive: db 0
 
+; --- Kernel image (struct KernelHeader in bootinfo.h) ---
+KERNEL_LBA:        equ 6        ; After the boot sector and the loader
+KERNEL_BUFFER:     equ 0x10000  ; Transfer buffer, 127 sectors
+KERNEL_BUFFER_SEG: equ KERNEL_BUFFER >> 4
+KERNEL_MAGIC:      equ 0x4C4E524B
+KHDR_MAGIC:        equ 0        ; Field offsets
+KHDR_LOAD:         equ 8
+KHDR_IMAGE_END:    equ 16
+KHDR_BSS_END:      equ 24
+KHDR_ENTRY:        equ 32
+
+align 4
+KernelLba:         dd 0         ; Next sector to read
+KernelSectorsLeft: dd 0
+KernelDest:        dd 0         ; Where the next chunk goes
+KernelBssStart:    dd 0
+KernelBssEnd:      dd 0
+KernelEntry:       dd 0         ; Addresses below 4 GB (the loader maps 1 GB)
+ChunkSectors:      dw 0
+
+; --- Boot information for the kernel (struct BootInfo in bootinfo.h) ---
+E820_MAP:        equ 0x9000
+E820_ENTRY_SIZE: equ 20
+E820_MAX:        equ 128
+
+align 8
+BootInfo:
+    dd 0x544F4F42               ; Magic: "BOOT"
+BootInfoE820Count:
+    dd 0                        ; Number of E820 entries
+    dq E820_MAP                 ; Physical address of the entries
+
 ; ----------------------------------------------------------------------------
 ;  GDT (32-bit) / IDT (32-bit)
 ; ----------------------------------------------------------------------------
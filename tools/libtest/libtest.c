@@ -0,0 +1,835 @@
+// ----------------------------------------------------------------------------
+//  libtest.c
+// ----------------------------------------------------------------------------
+//  Host-side correctness and performance harness for src/lib.
+//
+//  scripts/libtest.sh builds lib.asm, lib.c, print.c, log.c and histogram.c
+//  as bnr.sh does, renames every symbol in those objects with a "k_" prefix
+//  (so they don't collide with glibc) and links them into this Linux
+//  binary. The kernel's own log.h and histogram.h supply the structures
+//  passed to those objects, so their layouts can't drift apart.
+//
+//  Modes:
+//    --fuzz               Compare every routine against glibc on random
+//                         sizes, alignments and overlaps.
+//    --bench              Time every routine with the TSC across sizes
+//                         (8 B to 4 MB) and alignments.
+//    --baseline FILE      With --bench, flag results more than 10% slower
+//                         than the matching line in a previous run.
+//
+//  Output is one JSON object per line on stdout. The exit status is
+//  non-zero if any fuzz case failed or a benchmark regressed.
+// ----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+#include "../../src/lib/histogram.h"
+#include "../../src/lib/log.h"
+
+// ----------------------------------------------------------------------------
+//  Kernel library symbols (renamed by objcopy --prefix-symbols=k_)
+// ----------------------------------------------------------------------------
+typedef void *(*copy_fn)(void *, const void *, size_t);
+typedef void *(*set_fn)(void *, int, size_t);
+
+extern void *k_memcpy(void *, const void *, size_t);
+extern void *k_memmove(void *, const void *, size_t);
+extern void *k_memset(void *, int, size_t);
+extern int k_memcmp(const void *, const void *, size_t);
+extern void *k_memcpy_fsrm(void *, const void *, size_t);
+extern void *k_memcpy_erms(void *, const void *, size_t);
+extern void *k_memcpy_sse2(void *, const void *, size_t);
+extern void *k_memcpy_avx2(void *, const void *, size_t);
+extern void *k_memset_erms(void *, int, size_t);
+extern void *k_memset_sse2(void *, int, size_t);
+extern void *k_memset_avx2(void *, int, size_t);
+
+extern size_t k_strlen(const char *);
+extern size_t k_strnlen(const char *, size_t);
+extern char *k_strcpy(char *, const char *);
+extern int k_strcmp(const char *, const char *);
+extern void *k_memchr(const void *, int, size_t);
+extern char *k_strchr(const char *, int);
+
+extern int k_printk(const char *, ...);
+extern int k_snprintk(char *, size_t, const char *, ...);
+
+extern void k_init_log(void);
+extern void k_log_register_sink(struct LogSink *);
+extern void k_log_store(int, const char *, size_t, int);
+extern void k_log_flush(void);
+extern uint64_t k_log_dropped(void);
+
+extern void k_hist_reset(struct Histogram *);
+extern void k_hist_record(struct Histogram *, uint64_t);
+extern uint64_t k_hist_percentile(const struct Histogram *, uint32_t);
+
+// ----------------------------------------------------------------------------
+//  Variant tables
+// ----------------------------------------------------------------------------
+struct CopyVariant {
+    const char *name;
+    copy_fn fn;
+    int needs_avx2;
+};
+
+struct SetVariant {
+    const char *name;
+    set_fn fn;
+    int needs_avx2;
+};
+
+static const struct CopyVariant copy_variants[] = {
+    { "memcpy_fsrm", k_memcpy_fsrm, 0 },
+    { "memcpy_erms", k_memcpy_erms, 0 },
+    { "memcpy_sse2", k_memcpy_sse2, 0 },
+    { "memcpy_avx2", k_memcpy_avx2, 1 },
+};
+
+static const struct SetVariant set_variants[] = {
+    { "memset_erms", k_memset_erms, 0 },
+    { "memset_sse2", k_memset_sse2, 0 },
+    { "memset_avx2", k_memset_avx2, 1 },
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int have_avx2;
+
+// ----------------------------------------------------------------------------
+//  Helpers
+// ----------------------------------------------------------------------------
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Mostly short lengths (where the branchy code is), sometimes long ones.
+static uint32_t random_length(uint32_t max) {
+    switch (rng() % 4) {
+        case 0:  return rng() % 33;
+        case 1:  return rng() % 257;
+        case 2:  return rng() % 4097;
+        default: return rng() % (max + 1);
+    }
+}
+
+static void fill_random(unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (unsigned char)rng();
+    }
+}
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+static void report_fuzz(const char *name, long cases, long failures) {
+    printf("{\"fuzz\":\"%s\",\"cases\":%ld,\"failures\":%ld}\n", name, cases, failures);
+}
+
+// ----------------------------------------------------------------------------
+//  Fuzzing
+// ----------------------------------------------------------------------------
+#define FUZZ_MAX   (1u << 20)
+#define FUZZ_ITERS 20000
+#define SLACK      128
+
+static unsigned char *buf_a, *buf_b, *buf_c;
+
+static long fuzz_copy(const struct CopyVariant *v) {
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        size_t n = random_length(FUZZ_MAX);
+        size_t soff = rng() % 64, doff = rng() % 64;
+
+        fill_random(buf_a, n + SLACK);
+        memset(buf_b, 0xA5, n + SLACK);
+        memset(buf_c, 0xA5, n + SLACK);
+
+        void *ret = v->fn(buf_b + doff, buf_a + soff, n);
+        memcpy(buf_c + doff, buf_a + soff, n);
+
+        if (ret != buf_b + doff || memcmp(buf_b, buf_c, n + SLACK) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "%s: n=%zu src+%zu dst+%zu\n", v->name, n, soff, doff);
+            }
+        }
+    }
+    return failures;
+}
+
+static long fuzz_set(const struct SetVariant *v) {
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        size_t n = random_length(FUZZ_MAX);
+        size_t off = rng() % 64;
+        int value = (int)rng();
+
+        memset(buf_b, 0x5A, n + SLACK);
+        memset(buf_c, 0x5A, n + SLACK);
+
+        void *ret = v->fn(buf_b + off, value, n);
+        memset(buf_c + off, value, n);
+
+        if (ret != buf_b + off || memcmp(buf_b, buf_c, n + SLACK) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "%s: n=%zu dst+%zu value=%d\n", v->name, n, off, value);
+            }
+        }
+    }
+    return failures;
+}
+
+// Retarget a patchable "jmp near" site the way apply_alternatives() does
+// in the kernel (cpu.c).
+static void patch_jump(void *site, void *target) {
+    uintptr_t page = (uintptr_t)site & ~(uintptr_t)4095;
+    int32_t rel = (int32_t)((intptr_t)target - ((intptr_t)site + 5));
+
+    mprotect((void *)page, 8192, PROT_READ | PROT_WRITE | PROT_EXEC);
+    memcpy((char *)site + 1, &rel, sizeof(rel));
+    mprotect((void *)page, 8192, PROT_READ | PROT_EXEC);
+}
+
+// memmove is exercised with every copy variant behind it, since its
+// forward path tail-jumps to memcpy.
+static long fuzz_memmove(copy_fn forward) {
+    long failures = 0;
+    patch_jump((void *)k_memcpy, (void *)forward);
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        size_t n = random_length(FUZZ_MAX / 2);
+        size_t soff = rng() % 256, doff = rng() % 256;
+
+        fill_random(buf_b, n + 2 * SLACK + 256);
+        memcpy(buf_c, buf_b, n + 2 * SLACK + 256);
+
+        void *ret = k_memmove(buf_b + doff, buf_b + soff, n);
+        memmove(buf_c + doff, buf_c + soff, n);
+
+        if (ret != buf_b + doff || memcmp(buf_b, buf_c, n + 2 * SLACK + 256) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "memmove: n=%zu src+%zu dst+%zu\n", n, soff, doff);
+            }
+        }
+    }
+    return failures;
+}
+
+static long fuzz_memcmp(void) {
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        size_t n = random_length(FUZZ_MAX);
+        size_t aoff = rng() % 64, boff = rng() % 64;
+
+        fill_random(buf_a + aoff, n);
+        memcpy(buf_b + boff, buf_a + aoff, n);
+        if (n > 0 && (rng() & 1)) {
+            buf_b[boff + rng() % n] = (unsigned char)rng();
+        }
+
+        if (sign(k_memcmp(buf_a + aoff, buf_b + boff, n)) !=
+            sign(memcmp(buf_a + aoff, buf_b + boff, n))) {
+            if (failures++ == 0) {
+                fprintf(stderr, "memcmp: n=%zu a+%zu b+%zu\n", n, aoff, boff);
+            }
+        }
+    }
+    return failures;
+}
+
+// Random non-empty bytes, some with the top bit set to catch signed compares.
+static void random_string(char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char)(1 + rng() % 4 + ((rng() & 1) ? 0x80 : 0));
+    }
+    s[len] = '\0';
+}
+
+static long fuzz_strings(void) {
+    long failures = 0;
+    char *s1 = (char *)buf_a, *s2 = (char *)buf_b, *d = (char *)buf_c;
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        size_t len = random_length(8192);
+        size_t o1 = rng() % 16, o2 = rng() % 16;
+        int bad = 0;
+
+        random_string(s1 + o1, len);
+        memcpy(s2 + o2, s1 + o1, len + 1);
+        if (rng() & 1) {
+            s2[o2 + rng() % (len + 1)] = (char)(rng() % 6);
+        }
+
+        bad |= k_strlen(s1 + o1) != len;
+
+        size_t max = rng() % (len + 20);
+        bad |= k_strnlen(s1 + o1, max) != strnlen(s1 + o1, max);
+
+        bad |= sign(k_strcmp(s1 + o1, s2 + o2)) != sign(strcmp(s1 + o1, s2 + o2));
+
+        memset(d, 0x77, len + 32);
+        bad |= k_strcpy(d + o2, s1 + o1) != d + o2;
+        bad |= strcmp(d + o2, s1 + o1) != 0 || d[o2 + len + 1] != 0x77;
+
+        int c = (int)(rng() % 6);
+        if (len > 0 && (rng() & 3) == 0) {
+            c = (unsigned char)s1[o1 + rng() % len];
+        }
+        bad |= k_strchr(s1 + o1, c) != strchr(s1 + o1, c);
+        bad |= k_memchr(s1 + o1, c, len) != memchr(s1 + o1, c, len);
+
+        if (bad && failures++ == 0) {
+            fprintf(stderr, "strings: len=%zu s1+%zu s2+%zu c=%d\n", len, o1, o2, c);
+        }
+    }
+    return failures;
+}
+
+// Strings that end right before an unmapped page must not fault.
+static long fuzz_page_boundary(void) {
+    long failures = 0;
+    char *page = mmap(NULL, 8192, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        return 1;
+    }
+    mprotect(page + 4096, 4096, PROT_NONE);
+
+    for (size_t len = 0; len < 64; len++) {
+        char *s = page + 4096 - len - 1;
+        char other[128], copy[128];
+
+        memset(s, 'x', len);
+        s[len] = '\0';
+
+        failures += k_strlen(s) != len;
+        failures += k_strnlen(s, 4096) != len;
+        failures += k_strchr(s, 'y') != NULL;
+        failures += k_memchr(s, 'y', len) != NULL;
+        for (size_t off = 0; off < 16; off++) {
+            memset(other + off, 'x', len);
+            other[off + len] = '\0';
+            failures += k_strcmp(other + off, s) != 0;
+            failures += k_strcmp(s, other + off) != 0;
+        }
+        failures += strcmp(k_strcpy(copy + 3, s), s) != 0;
+    }
+
+    munmap(page, 8192);
+    return failures;
+}
+
+// ----------------------------------------------------------------------------
+//  The log ring is checked through a capturing sink: random records (some
+//  longer than a line, so they get truncated) with flushes at random points
+//  must come out complete and in order.
+// ----------------------------------------------------------------------------
+static char captured[1 << 20];
+static size_t captured_len;
+
+static void capture_write(const char *text, size_t length) {
+    if (captured_len + length <= sizeof(captured)) {
+        memcpy(captured + captured_len, text, length);
+    }
+    captured_len += length;
+}
+
+static struct LogSink capture_sink = { .name = "capture", .write = capture_write };
+
+static long fuzz_log(void) {
+    static const char *prefix[] = { "[INFO] ", "[WARN] ", "[ERROR] ", "[PANIC] " };
+    static char expect[1 << 20];
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS / 16; it++) {
+        size_t elen = 0;
+        captured_len = 0;
+
+        // Stay below the ring size so nothing is dropped
+        for (int k = 0; k < 64; k++) {
+            char text[LOG_LINE_MAX + 100];
+            size_t len = rng() % sizeof(text);
+            int level = (rng() & 1) ? LOG_LEVEL_RAW : (int)(rng() % 2);
+            for (size_t j = 0; j < len; j++) {
+                text[j] = (char)('a' + rng() % 26);
+            }
+
+            k_log_store(level, text, len, 0);
+
+            if (level != LOG_LEVEL_RAW) {
+                elen += (size_t)sprintf(expect + elen, "%s", prefix[level]);
+            }
+            memcpy(expect + elen, text, len < LOG_LINE_MAX ? len : LOG_LINE_MAX);
+            elen += len < LOG_LINE_MAX ? len : LOG_LINE_MAX;
+            if (len > LOG_LINE_MAX) {
+                memcpy(expect + elen, "...\n", 4);
+                elen += 4;
+            }
+
+            if ((rng() & 7) == 0) {
+                k_log_flush();
+            }
+        }
+        k_log_flush();
+
+        if (captured_len != elen || memcmp(captured, expect, elen) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "log: got %zu bytes, expected %zu\n", captured_len, elen);
+            }
+        }
+    }
+
+    if (k_log_dropped() != 0) {
+        fprintf(stderr, "log: %llu messages dropped\n", (unsigned long long)k_log_dropped());
+        failures++;
+    }
+
+    return failures;
+}
+
+// ----------------------------------------------------------------------------
+//  The formatter is checked against glibc's snprintf on random formats
+//  (flags, width, precision, length modifiers), both through snprintk with
+//  random buffer sizes and through printk and the log ring.
+// ----------------------------------------------------------------------------
+#define PRINTK_MAX 2048
+#define FMT_ARGS   8
+
+static int render_printk(const char *fmt, const uint64_t *a, char *out) {
+    captured_len = 0;
+
+    int n = k_printk(fmt, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    k_log_flush();
+
+    size_t len = captured_len < PRINTK_MAX ? captured_len : PRINTK_MAX;
+    memcpy(out, captured, len);
+    out[len] = '\0';
+    return n;
+}
+
+// Appends a random conversion to fmt and its arguments to args
+static void random_conversion(char *fmt, uint64_t *args, int *nargs, char *strarg) {
+    static const char *flags[] = { "", "", "-", "+", " ", "#", "0", "-0", "+0", "#0", "- ", "+ " };
+    static const char *lengths[] = { "hh", "h", "", "", "l", "ll", "z" };
+    static const char convs[] = "diuoxXxdcsp%";
+    char conv = convs[rng() % (sizeof(convs) - 1)];
+    char *f = fmt + strlen(fmt);
+
+    f += sprintf(f, "%%%s", flags[rng() % COUNT(flags)]);
+
+    // Width and precision: none, literal or '*'
+    switch (rng() % 4) {
+        case 1: f += sprintf(f, "%d", (int)(rng() % 24)); break;
+        case 2: f += sprintf(f, "*"); args[(*nargs)++] = (uint64_t)(int64_t)((int)(rng() % 48) - 24); break;
+        default: break;
+    }
+    if (conv != 'c' && conv != 'p' && conv != '%') {
+        switch (rng() % 4) {
+            case 1: f += sprintf(f, ".%d", (int)(rng() % 24)); break;
+            case 2: f += sprintf(f, ".*"); args[(*nargs)++] = (uint64_t)(int64_t)((int)(rng() % 30) - 5); break;
+            case 3: f += sprintf(f, "."); break;
+            default: break;
+        }
+    }
+
+    if (strchr("diuoxX", conv)) {
+        f += sprintf(f, "%s", lengths[rng() % COUNT(lengths)]);
+    }
+    *f++ = conv;
+    *f = '\0';
+
+    uint64_t v = rng() >> (rng() % 64);
+    if (rng() % 8 == 0) {
+        v = 0;
+    }
+    if (rng() & 1) {
+        v = (uint64_t)-(int64_t)v;
+    }
+
+    switch (conv) {
+        case 's':
+            random_string(strarg, rng() % 20);
+            for (char *p = strarg; *p; p++) {
+                *p = (char)('a' + (*p & 15));
+            }
+            args[(*nargs)++] = (uint64_t)(uintptr_t)strarg;
+            break;
+        case 'c':
+            args[(*nargs)++] = 'A' + rng() % 26;
+            break;
+        case 'p':
+            args[(*nargs)++] = v | 1;      // glibc prints "(nil)" for NULL
+            break;
+        case '%':
+            break;
+        default:
+            args[(*nargs)++] = v;
+            break;
+    }
+}
+
+static long fuzz_printk(void) {
+    static const char *words[] = { "", "a", "log: ", "value=", "0x", "  ", "%%" };
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS; it++) {
+        char fmt[256] = "", expect[PRINTK_MAX], got[PRINTK_MAX + 1];
+        char strarg[4][32];
+        uint64_t args[FMT_ARGS] = { 0 };
+        int nargs = 0;
+
+        for (int k = 0; k < 4 && nargs <= FMT_ARGS - 3; k++) {
+            strcat(fmt, words[rng() % COUNT(words)]);
+            random_conversion(fmt, args, &nargs, strarg[k]);
+        }
+
+        // The format is random on purpose
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wformat-nonliteral"
+        int elen = snprintf(expect, sizeof(expect), fmt, args[0], args[1], args[2], args[3],
+                            args[4], args[5], args[6], args[7]);
+
+        // Bounded formatting into a random-sized buffer
+        size_t size = rng() % (size_t)(elen + 4);
+        char want[PRINTK_MAX], have[PRINTK_MAX];
+        memset(have, 0x5A, sizeof(have));
+        snprintf(want, size, fmt, args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7]);
+        #pragma GCC diagnostic pop
+        int bn = k_snprintk(have, size, fmt, args[0], args[1], args[2], args[3],
+                            args[4], args[5], args[6], args[7]);
+        if (bn != elen || (size > 0 && strcmp(have, want) != 0) || have[size] != 0x5A) {
+            if (failures++ == 0) {
+                fprintf(stderr, "snprintk: fmt=\"%s\" size=%zu\n  got    %d \"%s\"\n  expect %d \"%s\"\n",
+                        fmt, size, bn, size > 0 ? have : "", elen, size > 0 ? want : "");
+            }
+            continue;
+        }
+
+        int n = render_printk(fmt, args, got);
+        if (n != elen || strcmp(got, expect) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "printk: fmt=\"%s\"\n  got    \"%s\"\n  expect \"%s\"\n",
+                        fmt, got, expect);
+            }
+        }
+    }
+    return failures;
+}
+
+// ----------------------------------------------------------------------------
+//  Histogram percentiles are checked against the exact value from a sorted
+//  copy of the samples: the answer may only be high, and by less than one
+//  bucket (1/HIST_SUB_COUNT of the value).
+// ----------------------------------------------------------------------------
+#define HIST_SAMPLES 4096
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static long fuzz_histogram(void) {
+    static const uint32_t points[] = { 0, 1, 5000, 9000, 9900, 9990, 9999, 10000 };
+    static struct Histogram h;
+    static uint64_t values[HIST_SAMPLES];
+    long failures = 0;
+
+    for (int it = 0; it < FUZZ_ITERS / 64; it++) {
+        size_t n = 1 + rng() % HIST_SAMPLES;
+        int bits = 1 + (int)(rng() % 64);
+
+        k_hist_reset(&h);
+        for (size_t i = 0; i < n; i++) {
+            values[i] = bits == 64 ? rng() : rng() & ((1ULL << bits) - 1);
+            k_hist_record(&h, values[i]);
+        }
+        qsort(values, n, sizeof(values[0]), compare_u64);
+
+        for (size_t p = 0; p < COUNT(points); p++) {
+            uint64_t rank = (n * points[p] + 9999) / 10000;
+            uint64_t exact = values[rank ? rank - 1 : 0];
+            uint64_t got = k_hist_percentile(&h, points[p]);
+
+            if (got < exact || got - exact > exact / HIST_SUB_COUNT || got > values[n - 1]) {
+                if (failures++ == 0) {
+                    fprintf(stderr, "histogram: p%u of %zu values: got %llu, expected %llu\n",
+                            points[p], n, (unsigned long long)got, (unsigned long long)exact);
+                }
+            }
+        }
+
+        if (h.count != n || h.min != values[0] || h.max != values[n - 1]) {
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+static long run_fuzz(void) {
+    long total = 0, f;
+
+    for (size_t i = 0; i < COUNT(copy_variants); i++) {
+        if (copy_variants[i].needs_avx2 && !have_avx2) {
+            continue;
+        }
+        total += f = fuzz_copy(&copy_variants[i]);
+        report_fuzz(copy_variants[i].name, FUZZ_ITERS, f);
+
+        char name[64];
+        snprintf(name, sizeof(name), "memmove+%s", copy_variants[i].name);
+        total += f = fuzz_memmove(copy_variants[i].fn);
+        report_fuzz(name, FUZZ_ITERS, f);
+    }
+
+    for (size_t i = 0; i < COUNT(set_variants); i++) {
+        if (set_variants[i].needs_avx2 && !have_avx2) {
+            continue;
+        }
+        total += f = fuzz_set(&set_variants[i]);
+        report_fuzz(set_variants[i].name, FUZZ_ITERS, f);
+    }
+
+    total += f = fuzz_memcmp();
+    report_fuzz("memcmp", FUZZ_ITERS, f);
+    total += f = fuzz_strings();
+    report_fuzz("strings", FUZZ_ITERS, f);
+    total += f = fuzz_page_boundary();
+    report_fuzz("page_boundary", 64, f);
+    total += f = fuzz_log();
+    report_fuzz("log", FUZZ_ITERS / 16, f);
+    total += f = fuzz_printk();
+    report_fuzz("printk", FUZZ_ITERS, f);
+    total += f = fuzz_histogram();
+    report_fuzz("histogram", FUZZ_ITERS / 64, f);
+
+    return total;
+}
+
+// ----------------------------------------------------------------------------
+//  Benchmarks
+// ----------------------------------------------------------------------------
+#define BENCH_MAX    (4u << 20)
+#define BENCH_BYTES  (64u << 20)     // Work per sample, spread over iterations
+#define BENCH_REPS   5               // Best of this many samples
+
+static const size_t bench_aligns[] = { 0, 1, 15, 31 };
+
+struct Baseline {
+    char key[96];
+    double cycles;
+};
+
+static struct Baseline *baseline;
+static size_t baseline_count;
+static long regressions;
+
+static inline uint64_t tsc_begin(void) {
+    _mm_lfence();
+    return __rdtsc();
+}
+
+static inline uint64_t tsc_end(void) {
+    unsigned int aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+
+static size_t bench_iters(size_t size) {
+    size_t iters = BENCH_BYTES / (size ? size : 1);
+    if (iters > 200000) {
+        iters = 200000;
+    }
+    return iters ? iters : 1;
+}
+
+static void report_bench(const char *name, size_t size, size_t align, double cycles) {
+    char key[96];
+    snprintf(key, sizeof(key), "%s/%zu/%zu", name, size, align);
+
+    printf("{\"bench\":\"%s\",\"size\":%zu,\"align\":%zu,\"cycles\":%.2f,\"bytes_per_cycle\":%.3f",
+           name, size, align, cycles, cycles > 0 ? size / cycles : 0.0);
+
+    for (size_t i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].key, key) == 0) {
+            double ratio = cycles / baseline[i].cycles;
+            printf(",\"baseline_cycles\":%.2f,\"ratio\":%.3f", baseline[i].cycles, ratio);
+            if (ratio > 1.10) {
+                printf(",\"regression\":true");
+                regressions++;
+            }
+            break;
+        }
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+// Each BENCH_* macro times `iters` calls of an expression and keeps the best
+// per-call cycle count over BENCH_REPS samples.
+#define BENCH_LOOP(result, iters, expr) do {                        \
+    double best_ = 1e30;                                            \
+    for (int rep_ = 0; rep_ < BENCH_REPS; rep_++) {                 \
+        uint64_t t0_ = tsc_begin();                                 \
+        for (size_t it_ = 0; it_ < (iters); it_++) {                \
+            expr;                                                   \
+            __asm__ volatile ("" ::: "memory");                     \
+        }                                                           \
+        double c_ = (double)(tsc_end() - t0_) / (double)(iters);    \
+        if (c_ < best_) best_ = c_;                                 \
+    }                                                               \
+    (result) = best_;                                               \
+} while (0)
+
+static void run_bench(void) {
+    double cycles;
+
+    for (size_t size = 8; size <= BENCH_MAX; size *= 2) {
+        size_t iters = bench_iters(size);
+
+        for (size_t a = 0; a < COUNT(bench_aligns); a++) {
+            size_t al = bench_aligns[a];
+            unsigned char *dst = buf_b + al, *src = buf_a + 64 + al / 2;
+
+            for (size_t i = 0; i < COUNT(copy_variants); i++) {
+                if (copy_variants[i].needs_avx2 && !have_avx2) {
+                    continue;
+                }
+                copy_fn fn = copy_variants[i].fn;
+                BENCH_LOOP(cycles, iters, fn(dst, src, size));
+                report_bench(copy_variants[i].name, size, al, cycles);
+            }
+
+            for (size_t i = 0; i < COUNT(set_variants); i++) {
+                if (set_variants[i].needs_avx2 && !have_avx2) {
+                    continue;
+                }
+                set_fn fn = set_variants[i].fn;
+                BENCH_LOOP(cycles, iters, fn(dst, 0x3C, size));
+                report_bench(set_variants[i].name, size, al, cycles);
+            }
+
+            // Overlapping backward move (dst just above src)
+            BENCH_LOOP(cycles, iters, k_memmove(buf_b + 64 + al, buf_b + 32, size));
+            report_bench("memmove_backward", size, al, cycles);
+
+            memcpy(dst, src, size);
+            BENCH_LOOP(cycles, iters, k_memcmp(dst, src, size));
+            report_bench("memcmp", size, al, cycles);
+
+            memset(src, 'x', size);
+            src[size - 1] = '\0';
+            BENCH_LOOP(cycles, iters, k_strlen((const char *)src));
+            report_bench("strlen", size, al, cycles);
+            BENCH_LOOP(cycles, iters, k_strchr((const char *)src, 'y'));
+            report_bench("strchr", size, al, cycles);
+            BENCH_LOOP(cycles, iters, k_memchr(src, 'y', size));
+            report_bench("memchr", size, al, cycles);
+            memcpy(dst, src, size);
+            BENCH_LOOP(cycles, iters, k_strcmp((const char *)dst, (const char *)src));
+            report_bench("strcmp", size, al, cycles);
+            BENCH_LOOP(cycles, iters, k_strcpy((char *)dst, (const char *)src));
+            report_bench("strcpy", size, al, cycles);
+        }
+    }
+
+    // A typical log line through the whole printk formatting path
+    char line[PRINTK_MAX + 1];
+    const uint64_t line_args[FMT_ARGS] = { 32, 0x200000, (uint64_t)(uintptr_t)"timer", 12345 };
+    BENCH_LOOP(cycles, 100000,
+               render_printk("irq %d at %#lx: %s (%u)", line_args, line));
+    report_bench("printk_line", 0, 0, cycles);
+}
+
+static void load_baseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[512];
+    size_t cap = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "libtest: cannot open baseline %s\n", path);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[64];
+        size_t size, align;
+        double cycles;
+
+        if (sscanf(line, "{\"bench\":\"%63[^\"]\",\"size\":%zu,\"align\":%zu,\"cycles\":%lf",
+                   name, &size, &align, &cycles) != 4) {
+            continue;
+        }
+        if (baseline_count == cap) {
+            cap = cap ? cap * 2 : 256;
+            baseline = realloc(baseline, cap * sizeof(*baseline));
+        }
+        snprintf(baseline[baseline_count].key, sizeof(baseline[0].key), "%s/%zu/%zu", name, size, align);
+        baseline[baseline_count].cycles = cycles;
+        baseline_count++;
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    int fuzz = 0, bench = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fuzz") == 0) {
+            fuzz = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            load_baseline(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--fuzz] [--bench [--baseline FILE]]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!fuzz && !bench) {
+        fuzz = 1;
+    }
+
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2");
+
+    size_t bytes = (BENCH_MAX > FUZZ_MAX ? BENCH_MAX : FUZZ_MAX) + 4096;
+    buf_a = aligned_alloc(4096, bytes);
+    buf_b = aligned_alloc(4096, bytes);
+    buf_c = aligned_alloc(4096, bytes);
+    memset(buf_a, 0, bytes);
+    memset(buf_b, 0, bytes);
+    memset(buf_c, 0, bytes);
+
+    // printk goes through the log ring; capture what it flushes
+    k_init_log();
+    k_log_register_sink(&capture_sink);
+
+    long failures = 0;
+    if (fuzz) {
+        failures = run_fuzz();
+    }
+
+    if (bench) {
+        run_bench();
+    }
+
+    return (failures != 0 || regressions != 0) ? 1 : 0;
+}
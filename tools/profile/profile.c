@@ -0,0 +1,367 @@
+// ----------------------------------------------------------------------------
+//  profile.c
+// ----------------------------------------------------------------------------
+//  Host-side symbolizer for the kernel's sampling profiler
+//  (src/kernel/profile.c).
+//
+//  profile_dump() writes raw sample addresses to COM1, which bnr.sh logs to
+//  build/serial.log. This tool resolves them against the symbols in
+//  kernel.elf and prints either a flat profile (samples per function, self
+//  and including callees) or folded stacks, one "outer;...;inner count"
+//  line per distinct call chain, ready for flamegraph.pl.
+//
+//    scripts/bnr.sh --profile [--schedbench]
+//    tools/profile/profile build/kernel.elf build/serial.log
+//    tools/profile/profile --folded build/kernel.elf build/serial.log > build/profile.folded
+//    flamegraph.pl build/profile.folded > build/profile.svg
+//
+//  If the log holds several dumps, the last complete one is used.
+//
+//  Build: gcc -O2 -o tools/profile/profile tools/profile/profile.c
+// ----------------------------------------------------------------------------
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/kernel/profile.h"
+
+static uint8_t *elf;
+static size_t elf_size;
+
+/**
+ * Symbol: A code symbol from kernel.elf. Size 0 (assembly labels) means
+ * it extends up to the next symbol.
+ */
+struct Symbol {
+    uint64_t value;
+    uint64_t size;
+    const char *name;
+};
+
+static struct Symbol *symbols;
+static size_t symbol_count;
+
+/**
+ * Sample: One parsed "S" line; pc[0] is the sampled rip.
+ */
+struct Sample {
+    uint32_t cpu;
+    uint32_t depth;
+    uint64_t pc[PROFILE_MAX_DEPTH];
+};
+
+static struct Sample *samples;
+static size_t sample_count;
+static uint64_t dropped;
+
+// ----------------------------------------------------------------------------
+//  ELF access
+// ----------------------------------------------------------------------------
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = malloc((size_t)length + 1);
+    if (data == NULL || fread(data, 1, (size_t)length, f) != (size_t)length) {
+        fprintf(stderr, "profile: cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    data[length] = 0;
+    *size = (size_t)length;
+    return data;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const struct Symbol *x = a, *y = b;
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+// Collects every named symbol that lives in an executable section
+static void load_symbols(void) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+
+    if (elf_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != ELFCLASS64) {
+        fprintf(stderr, "profile: not a 64-bit ELF file\n");
+        exit(1);
+    }
+
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(elf + eh->e_shoff);
+
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB) {
+            continue;
+        }
+
+        const Elf64_Sym *sym = (const Elf64_Sym *)(elf + sh[i].sh_offset);
+        const char *strtab = (const char *)(elf + sh[sh[i].sh_link].sh_offset);
+        size_t count = sh[i].sh_size / sizeof(Elf64_Sym);
+
+        symbols = calloc(count, sizeof(*symbols));
+        for (size_t j = 0; j < count; j++) {
+            int type = ELF64_ST_TYPE(sym[j].st_info);
+            uint16_t shndx = sym[j].st_shndx;
+
+            if ((type != STT_FUNC && type != STT_NOTYPE) || sym[j].st_name == 0 ||
+                shndx == SHN_UNDEF || shndx >= eh->e_shnum ||
+                !(sh[shndx].sh_flags & SHF_EXECINSTR)) {
+                continue;
+            }
+
+            symbols[symbol_count].value = sym[j].st_value;
+            symbols[symbol_count].size = sym[j].st_size;
+            symbols[symbol_count].name = strtab + sym[j].st_name;
+            symbol_count++;
+        }
+    }
+
+    if (symbol_count == 0) {
+        fprintf(stderr, "profile: no code symbols in kernel.elf\n");
+        exit(1);
+    }
+    qsort(symbols, symbol_count, sizeof(*symbols), compare_symbols);
+}
+
+// Returns the index of the symbol containing `addr`, or -1
+static long find_symbol(uint64_t addr) {
+    size_t lo = 0, hi = symbol_count;
+
+    // Last symbol starting at or below addr
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (symbols[mid].value <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    const struct Symbol *s = &symbols[lo - 1];
+    if (s->size != 0 && addr >= s->value + s->size) {
+        return -1;
+    }
+    return (long)(lo - 1);
+}
+
+// Symbol name for pc[level]; return addresses are looked up one byte back
+// so a call at the very end of a function is charged to that function
+static const char *symbolize(const struct Sample *s, uint32_t level) {
+    uint64_t addr = level == 0 ? s->pc[0] : s->pc[level] - 1;
+    long index = find_symbol(addr);
+    return index < 0 ? "[unknown]" : symbols[index].name;
+}
+
+// ----------------------------------------------------------------------------
+//  Sample parsing
+// ----------------------------------------------------------------------------
+// Reads the last complete "# profile begin" ... "# profile end" block
+static void load_samples(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    size_t capacity = 0, count = 0;
+    struct Sample *block = NULL;
+    uint64_t block_dropped = 0;
+    int in_block = 0, complete = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "# profile begin", 15) == 0) {
+            in_block = 1;
+            count = 0;
+            block_dropped = 0;
+        } else if (!in_block) {
+            continue;
+        } else if (strncmp(line, "# profile end", 13) == 0) {
+            in_block = 0;
+            complete = 1;
+            free(samples);
+            samples = block;
+            sample_count = count;
+            dropped = block_dropped;
+            block = NULL;
+            capacity = 0;
+        } else if (strncmp(line, "# profile dropped", 17) == 0) {
+            const char *n = strstr(line, "count=");
+            block_dropped += n != NULL ? strtoull(n + 6, NULL, 10) : 0;
+        } else if (line[0] == 'S' && line[1] == ' ') {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                block = realloc(block, capacity * sizeof(*block));
+            }
+
+            struct Sample *s = &block[count];
+            char *p = line + 2, *end;
+
+            s->cpu = (uint32_t)strtoul(p, &end, 10);
+            s->depth = 0;
+            for (p = end; s->depth < PROFILE_MAX_DEPTH; p = end) {
+                uint64_t pc = strtoull(p, &end, 16);
+                if (end == p) {
+                    break;
+                }
+                s->pc[s->depth++] = pc;
+            }
+            if (s->depth > 0) {
+                count++;
+            }
+        }
+    }
+    fclose(f);
+    free(block);
+
+    if (!complete) {
+        fprintf(stderr, "profile: no complete profile dump in %s\n", path);
+        exit(1);
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  Output
+// ----------------------------------------------------------------------------
+struct FlatEntry {
+    long symbol;
+    uint64_t self;
+    uint64_t total;
+};
+
+static int compare_flat(const void *a, const void *b) {
+    const struct FlatEntry *x = a, *y = b;
+    if (x->self != y->self) {
+        return x->self < y->self ? 1 : -1;
+    }
+    return (x->total < y->total) - (x->total > y->total);
+}
+
+// Samples per function: "self" where the sampled rip was, "total" where
+// the function was anywhere on the call chain (counted once per sample)
+static void print_flat(void) {
+    struct FlatEntry *flat = calloc(symbol_count + 1, sizeof(*flat));
+    uint64_t *seen = calloc(symbol_count + 1, sizeof(*seen));
+
+    for (size_t i = 0; i <= symbol_count; i++) {
+        flat[i].symbol = (long)i;
+    }
+
+    for (size_t i = 0; i < sample_count; i++) {
+        for (uint32_t level = 0; level < samples[i].depth; level++) {
+            uint64_t addr = level == 0 ? samples[i].pc[0] : samples[i].pc[level] - 1;
+            long index = find_symbol(addr);
+            size_t slot = index < 0 ? symbol_count : (size_t)index;
+
+            if (level == 0) {
+                flat[slot].self++;
+            }
+            if (seen[slot] != i + 1) {
+                seen[slot] = i + 1;
+                flat[slot].total++;
+            }
+        }
+    }
+
+    qsort(flat, symbol_count + 1, sizeof(*flat), compare_flat);
+
+    printf("%lu samples", (unsigned long)sample_count);
+    if (dropped != 0) {
+        printf(" (%lu dropped)", (unsigned long)dropped);
+    }
+    printf("\n\n%10s %7s %10s %7s  %s\n", "self", "self%", "total", "total%", "function");
+
+    for (size_t i = 0; i <= symbol_count && flat[i].total != 0; i++) {
+        const char *name = (size_t)flat[i].symbol == symbol_count ?
+                           "[unknown]" : symbols[flat[i].symbol].name;
+        printf("%10lu %6.2f%% %10lu %6.2f%%  %s\n",
+               (unsigned long)flat[i].self, 100.0 * (double)flat[i].self / (double)sample_count,
+               (unsigned long)flat[i].total, 100.0 * (double)flat[i].total / (double)sample_count,
+               name);
+    }
+
+    free(flat);
+    free(seen);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// One "outer;...;inner count" line per distinct call chain
+static void print_folded(void) {
+    char **stacks = calloc(sample_count + 1, sizeof(*stacks));
+
+    for (size_t i = 0; i < sample_count; i++) {
+        const struct Sample *s = &samples[i];
+        size_t length = 0, size = 1;
+
+        for (uint32_t level = 0; level < s->depth; level++) {
+            size += strlen(symbolize(s, level)) + 1;
+        }
+        stacks[i] = malloc(size);
+
+        for (uint32_t level = s->depth; level-- > 0; ) {
+            length += (size_t)sprintf(stacks[i] + length, "%s%s",
+                                      length ? ";" : "", symbolize(s, level));
+        }
+    }
+
+    qsort(stacks, sample_count, sizeof(*stacks), compare_strings);
+
+    for (size_t i = 0; i < sample_count; ) {
+        size_t j = i;
+        while (j < sample_count && strcmp(stacks[j], stacks[i]) == 0) {
+            j++;
+        }
+        printf("%s %lu\n", stacks[i], (unsigned long)(j - i));
+        i = j;
+    }
+
+    for (size_t i = 0; i < sample_count; i++) {
+        free(stacks[i]);
+    }
+    free(stacks);
+}
+
+// ----------------------------------------------------------------------------
+//  Main
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    int folded = argc == 4 && strcmp(argv[1], "--folded") == 0;
+
+    if (argc != 3 && !folded) {
+        fprintf(stderr, "usage: %s [--folded] kernel.elf serial.log\n", argv[0]);
+        return 2;
+    }
+
+    elf = read_file(argv[argc - 2], &elf_size);
+    load_symbols();
+    load_samples(argv[argc - 1]);
+
+    if (sample_count == 0) {
+        fprintf(stderr, "profile: the dump holds no samples\n");
+        return 1;
+    }
+
+    if (folded) {
+        print_folded();
+    } else {
+        print_flat();
+    }
+    return 0;
+}
@@ -0,0 +1,254 @@
+// ----------------------------------------------------------------------------
+//  tracedump.c
+// ----------------------------------------------------------------------------
+//  Host-side decoder for the kernel's binary trace rings (src/kernel/trace.c).
+//
+//  The kernel only stores format pointers and raw arguments. This tool
+//  reads the format strings (and %s arguments) from kernel.elf and prints
+//  the events of all CPUs merged by timestamp, in the same format as the
+//  kernel's trace_dump().
+//
+//  Getting a dump out of a running QEMU (the kernel is identity mapped, so
+//  the symbol address is also the physical address):
+//
+//    tools/tracedump/tracedump --pmemsave build/kernel.elf
+//        prints e.g. "pmemsave 0x20a000 1049088 build/trace.bin"
+//    (type that into the QEMU monitor)
+//    tools/tracedump/tracedump build/kernel.elf build/trace.bin
+//
+//  Build: gcc -O2 -o tools/tracedump/tracedump tools/tracedump/tracedump.c
+// ----------------------------------------------------------------------------
+
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/kernel/trace.h"
+
+static uint8_t *elf;
+static size_t elf_size;
+
+// ----------------------------------------------------------------------------
+//  ELF access
+// ----------------------------------------------------------------------------
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = malloc((size_t)length + 1);
+    if (data == NULL || fread(data, 1, (size_t)length, f) != (size_t)length) {
+        fprintf(stderr, "tracedump: cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    data[length] = 0;
+    *size = (size_t)length;
+    return data;
+}
+
+static const Elf64_Ehdr *elf_header(void) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+
+    if (elf_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != ELFCLASS64) {
+        fprintf(stderr, "tracedump: not a 64-bit ELF file\n");
+        exit(1);
+    }
+    return eh;
+}
+
+// Finds a symbol in .symtab; returns 0 if it isn't there
+static int find_symbol(const char *name, uint64_t *value, uint64_t *size) {
+    const Elf64_Ehdr *eh = elf_header();
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(elf + eh->e_shoff);
+
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB) {
+            continue;
+        }
+
+        const Elf64_Sym *sym = (const Elf64_Sym *)(elf + sh[i].sh_offset);
+        const char *strtab = (const char *)(elf + sh[sh[i].sh_link].sh_offset);
+        size_t count = sh[i].sh_size / sizeof(Elf64_Sym);
+
+        for (size_t j = 0; j < count; j++) {
+            if (strcmp(strtab + sym[j].st_name, name) == 0) {
+                *value = sym[j].st_value;
+                *size = sym[j].st_size;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Returns the string at a kernel virtual address, or NULL if the address
+// isn't backed by file data (e.g. a string built at run time)
+static const char *elf_string(uint64_t vaddr) {
+    const Elf64_Ehdr *eh = elf_header();
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)(elf + eh->e_phoff);
+
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && vaddr >= ph[i].p_vaddr &&
+            vaddr < ph[i].p_vaddr + ph[i].p_filesz) {
+            uint64_t offset = ph[i].p_offset + (vaddr - ph[i].p_vaddr);
+            return offset < elf_size ? (const char *)(elf + offset) : NULL;
+        }
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+//  Formatting
+// ----------------------------------------------------------------------------
+// Formats one event like vsnprintk would, one conversion at a time
+static void format_event(char *out, size_t size, const char *format, const struct TraceEntry *e) {
+    size_t len = 0;
+    uint32_t next = 0;
+
+    #define ARG() (next < e->nargs ? e->args[next++] : 0)
+
+    for (const char *p = format; *p != '\0' && len + 1 < size; ) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+
+        // Copy one conversion spec, consuming '*' arguments as we go
+        char spec[32];
+        size_t n = 0;
+        uint64_t values[3];
+        int nvalues = 0;
+
+        spec[n++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.*hlzjt", *p) && n < sizeof(spec) - 2) {
+            if (*p == '*') {
+                values[nvalues++] = ARG();
+            }
+            spec[n++] = *p++;
+        }
+        char conv = *p;
+        if (conv == '\0') {
+            break;
+        }
+        spec[n++] = *p++;
+        spec[n] = '\0';
+
+        int written;
+        if (conv == '%') {
+            written = snprintf(out + len, size - len, "%%");
+        } else if (conv == 's') {
+            uint64_t addr = ARG();
+            const char *s = elf_string(addr);
+            char unknown[32];
+            if (s == NULL) {
+                snprintf(unknown, sizeof(unknown), "<%#lx>", (unsigned long)addr);
+                s = unknown;
+            }
+            values[nvalues++] = (uint64_t)(uintptr_t)s;
+            written = snprintf(out + len, size - len, spec, values[0], values[1], values[2]);
+        } else {
+            // Integers were widened to 64 bits; every vararg is one 8-byte
+            // slot on x86-64, so the original spec reads them back correctly
+            values[nvalues++] = ARG();
+            written = snprintf(out + len, size - len, spec, values[0], values[1], values[2]);
+        }
+
+        if (written > 0) {
+            len += (size_t)written < size - len ? (size_t)written : size - len - 1;
+        }
+    }
+
+    #undef ARG
+
+    out[len] = '\0';
+    if (len > 0 && out[len - 1] == '\n') {
+        out[len - 1] = '\0';
+    }
+}
+
+// ----------------------------------------------------------------------------
+//  Main
+// ----------------------------------------------------------------------------
+static int compare_tsc(const void *a, const void *b) {
+    const struct TraceEntry *x = *(const struct TraceEntry *const *)a;
+    const struct TraceEntry *y = *(const struct TraceEntry *const *)b;
+    return (x->tsc > y->tsc) - (x->tsc < y->tsc);
+}
+
+int main(int argc, char **argv) {
+    uint64_t addr, size;
+
+    if (argc == 3 && strcmp(argv[1], "--pmemsave") == 0) {
+        elf = read_file(argv[2], &elf_size);
+        if (!find_symbol("trace_buffers", &addr, &size)) {
+            fprintf(stderr, "tracedump: trace_buffers not found in %s\n", argv[2]);
+            return 1;
+        }
+        printf("pmemsave %#lx %lu build/trace.bin\n", (unsigned long)addr, (unsigned long)size);
+        return 0;
+    }
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s kernel.elf trace.bin\n"
+                        "       %s --pmemsave kernel.elf\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    elf = read_file(argv[1], &elf_size);
+    if (!find_symbol("trace_buffers", &addr, &size)) {
+        fprintf(stderr, "tracedump: trace_buffers not found in %s\n", argv[1]);
+        return 1;
+    }
+
+    size_t dump_size;
+    struct TraceBuffer *rings = (struct TraceBuffer *)read_file(argv[2], &dump_size);
+    if (size != sizeof(struct TraceBuffer) * MAX_CPUS || dump_size < size) {
+        fprintf(stderr, "tracedump: dump is %zu bytes, kernel.elf expects %lu\n",
+                dump_size, (unsigned long)size);
+        return 1;
+    }
+
+    // Collect the valid entries of every ring and sort them by time
+    static const struct TraceEntry *events[MAX_CPUS * TRACE_ENTRIES];
+    size_t count = 0;
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t head = rings[cpu].head;
+        uint64_t first = head > TRACE_ENTRIES ? head - TRACE_ENTRIES : 0;
+
+        for (uint64_t i = first; i < head; i++) {
+            const struct TraceEntry *e = &rings[cpu].entries[i % TRACE_ENTRIES];
+            if (e->format != NULL && e->nargs <= TRACE_MAX_ARGS) {
+                events[count++] = e;
+            }
+        }
+    }
+    qsort(events, count, sizeof(events[0]), compare_tsc);
+
+    for (size_t i = 0; i < count; i++) {
+        const char *format = elf_string((uint64_t)(uintptr_t)events[i]->format);
+        char text[1024];
+
+        if (format == NULL) {
+            snprintf(text, sizeof(text), "<unknown format %p>", (const void *)events[i]->format);
+        } else {
+            format_event(text, sizeof(text), format, events[i]);
+        }
+
+        printf("[%12lu] cpu%u: %s\n", (unsigned long)(events[i]->tsc - events[0]->tsc),
+               events[i]->cpu, text);
+    }
+
+    return 0;
+}